@@ -1,6 +1,6 @@
 // -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
-/* exported collectFromDatadirs, recursivelyDeleteDir,
-            recursivelyMoveDir, loadInterfaceXML */
+/* exported collectFromDatadirs, collectFromDatadirsAsync, loadFilesAsync,
+            recursivelyDeleteDir, recursivelyMoveDir, loadInterfaceXML */
 
 const { Gio, GLib } = imports.gi;
 const Config = imports.misc.config;
@@ -29,6 +29,66 @@ function collectFromDatadirs(subdir, includeUserDir, processFile) {
     }
 }
 
+function _getTaskPool() {
+    // Imported lazily, as this module is also used outside the shell
+    return imports.gi.Shell.TaskPool.get_default();
+}
+
+function _enumerateDirectory(dir, cancellable) {
+    return new Promise((resolve, reject) => {
+        _getTaskPool().enumerate_directory(dir,
+            'standard::name,standard::type', cancellable, (pool, res) => {
+                try {
+                    resolve(pool.enumerate_directory_finish(res));
+                } catch (e) {
+                    reject(e);
+                }
+            });
+    });
+}
+
+// Like collectFromDatadirs(), but the directories are listed on worker
+// threads; resolves to an array of [file, info] pairs
+async function collectFromDatadirsAsync(subdir, includeUserDir, cancellable = null) {
+    let dataDirs = GLib.get_system_data_dirs();
+    if (includeUserDir)
+        dataDirs.unshift(GLib.get_user_data_dir());
+
+    let dirs = dataDirs.map(dataDir => {
+        let path = GLib.build_filenamev([dataDir, 'gnome-shell', subdir]);
+        return Gio.File.new_for_path(path);
+    });
+
+    let infoLists = await Promise.all(dirs.map(dir => {
+        return _enumerateDirectory(dir, cancellable).catch(e => {
+            if (e instanceof GLib.Error &&
+                e.matches(Gio.IOErrorEnum, Gio.IOErrorEnum.CANCELLED))
+                throw e;
+            return [];
+        });
+    }));
+
+    let children = [];
+    infoLists.forEach((infos, i) => {
+        infos.forEach(info => children.push([dirs[i].get_child(info.get_name()), info]));
+    });
+    return children;
+}
+
+// Reads the contents of files on worker threads; resolves to an array
+// of GLib.Bytes, with null for files that couldn't be read
+function loadFilesAsync(files, cancellable = null) {
+    return new Promise((resolve, reject) => {
+        _getTaskPool().read_files(files, cancellable, (pool, res) => {
+            try {
+                resolve(pool.read_files_finish(res));
+            } catch (e) {
+                reject(e);
+            }
+        });
+    });
+}
+
 function recursivelyDeleteDir(dir, deleteParent) {
     let children = dir.enumerate_children('standard::name,standard::type',
                                           Gio.FileQueryInfoFlags.NONE, null);
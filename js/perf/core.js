@@ -1,5 +1,5 @@
 // -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
-/* exported run, script_overviewShowStart, script_overviewShowDone,
+/* exported run, finish, script_overviewShowStart, script_overviewShowDone,
             script_applicationsShowStart, script_applicationsShowDone,
             script_afterShowHide, malloc_usedSize, glx_swapComplete,
             clutter_stagePaintDone */
@@ -60,6 +60,10 @@ var METRICS = {
       units: "us" },
 };
 
+// Per-subsystem memory use after the overview is shown once and twice;
+// the difference is reported as leakedAfterOverview:<subsystem> metrics
+let memoryAfterOverview = [];
+
 let WINDOW_CONFIGS = [
     { width: 640, height: 480, alpha: false, maximized: false, count: 1,  metric: 'overviewFpsSubsequent' },
     { width: 640, height: 480, alpha: false, maximized: false, count: 5,  metric: 'overviewFps5Windows'  },
@@ -117,6 +121,9 @@ function *run() {
         yield Scripting.sleep(1000);
         Scripting.collectStatistics();
         Scripting.scriptEvent('afterShowHide');
+
+        if (i < 2)
+            memoryAfterOverview.push(Scripting.memorySnapshot());
     }
 
     yield Scripting.destroyTestWindows();
@@ -238,3 +245,20 @@ function clutter_stagePaintDone(time) {
     if (!haveSwapComplete)
         _frameDone(time);
 }
+
+function finish() {
+    if (memoryAfterOverview.length < 2)
+        return;
+
+    let [before, after] = memoryAfterOverview;
+    let leaked = Scripting.memoryDiff(before, after);
+
+    for (let subsystem of after.keys()) {
+        let diff = leaked.find(d => d.subsystem == subsystem);
+        METRICS[`leakedAfterOverview:${subsystem}`] = {
+            description: `Additional bytes used by ${subsystem} the second time the overview is shown`,
+            units: 'B',
+            value: diff ? diff.bytes : 0,
+        };
+    }
+}
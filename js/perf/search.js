@@ -0,0 +1,374 @@
+// -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
+/* exported run, finish, search_start, search_keystroke,
+            search_providerResults, search_providerDone,
+            clutter_stagePaintDone */
+/* eslint camelcase: ["error", { properties: "never", allow: ["^search_", "^clutter"] }] */
+
+const { Gio, GLib, Shell } = imports.gi;
+
+const Main = imports.ui.main;
+const RemoteSearch = imports.ui.remoteSearch;
+const Scripting = imports.ui.scripting;
+const ViewSelector = imports.ui.viewSelector;
+
+// This performance script measures how responsive search is while
+// typing. It types scripted keystroke sequences into the overview
+// search entry - including refining a search, which the providers
+// answer with a subsearch, and deleting characters - and measures
+// for each keystroke how long it takes until the results are painted.
+//
+// Besides the application search, the searches go to stand-in remote
+// providers that are served from within the shell over D-Bus and
+// answer after a fixed delay; other remote providers are disabled
+// while the script runs. The delays can be changed by setting
+// SHELL_PERF_SEARCH_DELAYS to a comma-separated list of milliseconds,
+// one stand-in provider is created for each.
+
+var METRICS = {
+    keystrokeLatency50:
+    { description: "Time from keystroke to painting all results, median",
+      units: "us" },
+    keystrokeLatency90:
+    { description: "Time from keystroke to painting all results, 90th percentile",
+      units: "us" },
+    keystrokeLatency99:
+    { description: "Time from keystroke to painting all results, 99th percentile",
+      units: "us" },
+    keystrokeLatencyInitial:
+    { description: "Time from keystroke to painting all results, new searches, median",
+      units: "us" },
+    keystrokeLatencySubsearch:
+    { description: "Time from keystroke to painting all results, refined searches, median",
+      units: "us" },
+    keystrokeLatencyDelete:
+    { description: "Time from keystroke to painting all results, after deleting a character, median",
+      units: "us" },
+};
+
+var DEFAULT_PROVIDER_DELAYS = [0, 50, 200]; // ms
+
+// '\b' deletes the last character
+var KEYSTROKE_SEQUENCES = [
+    'settings',
+    'tex\b\berminal',
+    'aurora beacon',
+    'calx\bendar\b\b\b\b\b\bmera',
+];
+
+var ITERATIONS = 3;
+
+// Time between the results of a keystroke being painted and the next
+// keystroke; larger than the search timeout in SearchResultsView, so
+// that every keystroke starts a search of its own
+var KEYSTROKE_INTERVAL = 250; // ms
+
+// Words from which the stand-in providers make up their items
+const WORDS = [
+    'aurora', 'beacon', 'calendar', 'camera', 'delta', 'ember', 'fjord',
+    'garnet', 'harbor', 'settings', 'summit', 'terminal', 'texture',
+    'tundra', 'violet', 'willow',
+];
+
+const SERVICE_PATH = '/org/gnome/Shell/PerfSearchProvider';
+
+var StandInSearchProvider = class {
+    constructor(index, delay) {
+        this._delay = delay;
+        this._names = new Map();
+
+        let n = 0;
+        for (let first of WORDS) {
+            for (let second of WORDS) {
+                if (first != second)
+                    this._names.set(`item-${n++}`, `${first} ${second}`);
+            }
+        }
+
+        this._dbusImpl = Gio.DBusExportedObject.wrapJSObject(
+            RemoteSearch.SearchProvider2ProxyInfo, this);
+        this._dbusImpl.export(Gio.DBus.session, `${SERVICE_PATH}${index}`);
+
+        let keyfile = new GLib.KeyFile();
+        keyfile.set_string('Desktop Entry', 'Type', 'Application');
+        keyfile.set_string('Desktop Entry', 'Name', `Search ${delay} ms`);
+        keyfile.set_string('Desktop Entry', 'Exec', 'true');
+
+        this.provider = new RemoteSearch.RemoteSearchProvider2(
+            Gio.DesktopAppInfo.new_from_keyfile(keyfile),
+            Gio.DBus.session.get_unique_name(),
+            `${SERVICE_PATH}${index}`,
+            false);
+        // Apps from key files have no ID
+        this.provider.id = `perf-search-${delay}ms`;
+    }
+
+    destroy() {
+        this._dbusImpl.unexport();
+    }
+
+    _match(ids, terms) {
+        terms = terms.map(t => t.toLowerCase());
+        return ids.filter(id => {
+            let name = this._names.get(id);
+            return name && terms.every(t => name.includes(t));
+        });
+    }
+
+    _returnLater(invocation, value) {
+        let id = GLib.timeout_add(GLib.PRIORITY_DEFAULT, this._delay, () => {
+            invocation.return_value(value);
+            return GLib.SOURCE_REMOVE;
+        });
+        GLib.Source.set_name_by_id(id, '[gnome-shell] invocation.return_value');
+    }
+
+    GetInitialResultSetAsync([terms], invocation) {
+        let results = this._match([...this._names.keys()], terms);
+        this._returnLater(invocation, new GLib.Variant('(as)', [results]));
+    }
+
+    GetSubsearchResultSetAsync([previousResults, terms], invocation) {
+        let results = this._match(previousResults, terms);
+        this._returnLater(invocation, new GLib.Variant('(as)', [results]));
+    }
+
+    GetResultMetasAsync([ids], invocation) {
+        let metas = ids.map(id => {
+            return {
+                id: new GLib.Variant('s', id),
+                name: new GLib.Variant('s', this._names.get(id)),
+                description: new GLib.Variant('s', `Stand-in result ${id}`),
+            };
+        });
+        this._returnLater(invocation, new GLib.Variant('(aa{sv})', [metas]));
+    }
+
+    ActivateResult(_id, _terms, _timestamp) {
+    }
+
+    LaunchSearch(_terms, _timestamp) {
+    }
+};
+
+function _getProviderDelays() {
+    let delays = GLib.getenv('SHELL_PERF_SEARCH_DELAYS');
+    if (!delays)
+        return DEFAULT_PROVIDER_DELAYS;
+
+    return delays.split(',').map(d => parseInt(d));
+}
+
+// Records when each provider has returned results, and when its
+// results are on display
+function _instrumentProvider(provider, resultsEvent, doneEvent) {
+    let perfLog = Shell.PerfLog.get_default();
+
+    let wrapResultsCallback = method => {
+        provider[method] = (...args) => {
+            // The callback is followed by the cancellable
+            let callback = args[args.length - 2];
+            args[args.length - 2] = results => {
+                perfLog.record_s(resultsEvent, provider.id);
+                callback(results);
+            };
+            Object.getPrototypeOf(provider)[method].apply(provider, args);
+        };
+    };
+    wrapResultsCallback('getInitialResultSet');
+    wrapResultsCallback('getSubsearchResultSet');
+
+    let display = provider.display;
+    display.updateSearch = (results, terms, callback) => {
+        // Grid results update again when their allocation changes, but
+        // only the first update belongs to the keystroke
+        let done = false;
+        Object.getPrototypeOf(display).updateSearch.call(display, results, terms, () => {
+            if (!done)
+                perfLog.record_s(doneEvent, provider.id);
+            done = true;
+            callback();
+        });
+    };
+}
+
+function _uninstrumentProvider(provider) {
+    delete provider.getInitialResultSet;
+    delete provider.getSubsearchResultSet;
+    delete provider.display.updateSearch;
+}
+
+function _waitSearchDone(searchResults) {
+    return new Promise(resolve => {
+        let id = GLib.timeout_add(GLib.PRIORITY_DEFAULT, 5, () => {
+            if (searchResults.searchInProgress)
+                return GLib.SOURCE_CONTINUE;
+
+            resolve();
+            return GLib.SOURCE_REMOVE;
+        });
+        GLib.Source.set_name_by_id(id, '[gnome-shell] _waitSearchDone');
+    });
+}
+
+function *run() {
+    let perfLog = Shell.PerfLog.get_default();
+    let startEvent = perfLog.define_event('search.start',
+        'Start of search tests, with the number of providers', 'i');
+    let keystrokeEvent = perfLog.define_event('search.keystroke',
+        'Key typed into the search entry, with the kind of search', 's');
+    let resultsEvent = perfLog.define_event('search.providerResults',
+        'Search provider returned results', 's');
+    let doneEvent = perfLog.define_event('search.providerDone',
+        'Search provider results are on display', 's');
+
+    // Enable recording of timestamps for different points in the frame cycle
+    global.frame_timestamps = true;
+
+    yield Scripting.sleep(1000);
+
+    Main.overview.show();
+    yield Scripting.waitLeisure();
+
+    let searchResults = Main.overview.viewSelector._searchResults;
+    searchResults._providers.filter(p => p.isRemoteProvider).forEach(p => {
+        searchResults._unregisterProvider(p);
+    });
+
+    let standIns = _getProviderDelays().map((delay, i) => {
+        return new StandInSearchProvider(i, delay);
+    });
+    standIns.forEach(s => searchResults._registerProvider(s.provider));
+
+    let providers = searchResults._providers.slice();
+    providers.forEach(p => _instrumentProvider(p, resultsEvent, doneEvent));
+
+    perfLog.record_i(startEvent, providers.length);
+
+    let entry = Main.overview.searchEntry;
+    for (let i = 0; i < ITERATIONS; i++) {
+        for (let sequence of KEYSTROKE_SEQUENCES) {
+            let text = '';
+
+            for (let key of sequence) {
+                let oldTerms = ViewSelector.getTermsForSearchString(text);
+                text = key == '\b' ? text.slice(0, -1) : text + key;
+                let terms = ViewSelector.getTermsForSearchString(text);
+
+                let kind;
+                // No search for trailing spaces or an empty entry
+                if (terms.length == 0 || terms.join(' ') == oldTerms.join(' '))
+                    kind = null;
+                else if (oldTerms.length > 0 && terms.join(' ').startsWith(oldTerms.join(' ')))
+                    kind = 'subsearch';
+                else if (key == '\b')
+                    kind = 'delete';
+                else
+                    kind = 'initial';
+
+                if (kind)
+                    perfLog.record_s(keystrokeEvent, kind);
+
+                entry.text = text;
+
+                yield _waitSearchDone(searchResults);
+                yield Scripting.waitLeisure();
+                yield Scripting.sleep(KEYSTROKE_INTERVAL);
+            }
+
+            entry.text = '';
+            yield Scripting.waitLeisure();
+        }
+    }
+
+    providers.forEach(p => _uninstrumentProvider(p));
+    standIns.forEach(s => s.destroy());
+    searchResults._reloadRemoteProviders();
+
+    Main.overview.hide();
+    yield Scripting.waitLeisure();
+}
+
+let nProviders = 0;
+let keystroke = null;
+let latencies = {
+    all: [],
+    initial: [],
+    subsearch: [],
+    delete: [],
+};
+let providerTimes = new Map();
+
+function _percentile(values, p) {
+    if (values.length == 0)
+        return 0;
+
+    let sorted = values.slice().sort((a, b) => a - b);
+    let rank = Math.ceil(p / 100 * sorted.length) - 1;
+    return sorted[Math.max(rank, 0)];
+}
+
+function _getProviderTimes(providerId) {
+    if (!providerTimes.has(providerId))
+        providerTimes.set(providerId, { firstResult: [], complete: [] });
+    return providerTimes.get(providerId);
+}
+
+function search_start(time, n) {
+    nProviders = n;
+}
+
+function search_keystroke(time, kind) {
+    keystroke = { start: time, kind, nDone: 0, results: new Set() };
+}
+
+function search_providerResults(time, providerId) {
+    // A provider answers each search once, but the first answer
+    // is the one that counts
+    if (!keystroke || keystroke.results.has(providerId))
+        return;
+
+    keystroke.results.add(providerId);
+    _getProviderTimes(providerId).firstResult.push(time - keystroke.start);
+}
+
+function search_providerDone(time, providerId) {
+    if (!keystroke)
+        return;
+
+    keystroke.nDone++;
+    _getProviderTimes(providerId).complete.push(time - keystroke.start);
+}
+
+function clutter_stagePaintDone(time) {
+    // The first frame painted after the last provider updated its
+    // results is the one that shows the complete results
+    if (!keystroke || keystroke.nDone < nProviders)
+        return;
+
+    let latency = time - keystroke.start;
+    latencies.all.push(latency);
+    latencies[keystroke.kind].push(latency);
+    keystroke = null;
+}
+
+function finish() {
+    METRICS.keystrokeLatency50.value = _percentile(latencies.all, 50);
+    METRICS.keystrokeLatency90.value = _percentile(latencies.all, 90);
+    METRICS.keystrokeLatency99.value = _percentile(latencies.all, 99);
+    METRICS.keystrokeLatencyInitial.value = _percentile(latencies.initial, 50);
+    METRICS.keystrokeLatencySubsearch.value = _percentile(latencies.subsearch, 50);
+    METRICS.keystrokeLatencyDelete.value = _percentile(latencies.delete, 50);
+
+    for (let [providerId, times] of providerTimes) {
+        METRICS[`firstResult:${providerId}`] = {
+            description: `Time from keystroke to results from ${providerId}, median`,
+            units: "us",
+            value: _percentile(times.firstResult, 50),
+        };
+        METRICS[`complete:${providerId}`] = {
+            description: `Time from keystroke to ${providerId} displaying its results, median`,
+            units: "us",
+            value: _percentile(times.complete, 50),
+        };
+    }
+}
@@ -0,0 +1,47 @@
+// -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
+/* exported run, finish */
+
+const { Shell } = imports.gi;
+
+const Scripting = imports.ui.scripting;
+
+// This performance script reports the startup timeline: the time from
+// main() to the first frame, and the duration of each startup phase.
+// Phases vary with the installed extensions and such, so the metrics
+// are filled in when the script finishes; run it with
+// gnome-shell-perf-tool --startup to get medians over several restarts.
+
+var METRICS = {
+    firstFrame:
+    { description: "Time from main() to the first frame",
+      units: "us" },
+};
+
+function *run() {
+    // The timeline is normally finished long before we get here, since
+    // perf scripts only run once the startup animation is over
+    while (!Shell.startup_timeline_is_finished())
+        yield Scripting.sleep(100);
+}
+
+function finish() {
+    METRICS.firstFrame.value = Shell.startup_timeline_get_first_frame_time();
+
+    let phases = Shell.startup_timeline_get_phases().deep_unpack();
+    for (let [name, start, end, depth] of phases) {
+        if (end == 0)
+            continue;
+
+        let metric = `phase:${name}`;
+        if (!(metric in METRICS)) {
+            METRICS[metric] = {
+                description: `Duration of startup phase ${name} (depth ${depth})`,
+                units: "us",
+                value: 0,
+            };
+        }
+
+        // Phases with the same name are added up
+        METRICS[metric].value += end - start;
+    }
+}
@@ -0,0 +1,210 @@
+// -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
+/* exported run, finish, script_spawnStart, script_overviewStart,
+            script_destroyStart, script_churnDone, churn_stall,
+            windowTracker_addedCount, windowTracker_addedTime,
+            windowTracker_removedCount, windowTracker_removedTime */
+/* eslint camelcase: ["error", { properties: "never", allow: ["^script_", "^churn_", "^windowTracker_"] }] */
+
+const { GLib, Shell } = imports.gi;
+
+const Main = imports.ui.main;
+const Scripting = imports.ui.scripting;
+
+// This performance script stresses window tracking and the overview
+// with large numbers of windows coming and going: hundreds of windows
+// with a mix of WM_CLASS and application IDs, some with modal dialogs,
+// are created and destroyed at a steady rate, partly while the overview
+// is showing. It reports how often the main loop stalled in each of
+// those phases, and how long the window tracker takes to start and
+// stop tracking a window.
+
+var METRICS = {
+    spawnStalls:
+    { description: "Main loop stalls while spawning windows",
+      units: "stalls" },
+    spawnMaxStall:
+    { description: "Longest main loop stall while spawning windows",
+      units: "us" },
+    overviewStalls:
+    { description: "Main loop stalls while windows come and go in the overview",
+      units: "stalls" },
+    overviewMaxStall:
+    { description: "Longest main loop stall while windows come and go in the overview",
+      units: "us" },
+    destroyStalls:
+    { description: "Main loop stalls while destroying windows",
+      units: "stalls" },
+    destroyMaxStall:
+    { description: "Longest main loop stall while destroying windows",
+      units: "us" },
+    windowAddedTime:
+    { description: "Time to start tracking a window, mean",
+      units: "us" },
+    windowRemovedTime:
+    { description: "Time to stop tracking a window, mean",
+      units: "us" },
+};
+
+var SPAWN_COUNT = 200;
+var SPAWN_RATE = 20; // windows / s
+
+// Windows created and destroyed again while the overview is showing
+var CHURN_COUNT = 50;
+var CHURN_RATE = 10; // windows / s
+
+var DESTROY_RATE = 50; // windows / s
+
+var WINDOW_PARAMS = {
+    wmClasses: 20,
+    appIds: 10,
+    dialogEvery: 10,
+    modal: true,
+};
+
+// The main loop is checked on every MONITOR_INTERVAL; if it comes
+// around more than STALL_THRESHOLD late, that's a stall
+var MONITOR_INTERVAL = 10; // ms
+var STALL_THRESHOLD = 50000; // us
+
+function _startStallMonitor(stallEvent) {
+    let perfLog = Shell.PerfLog.get_default();
+    let lastTime = GLib.get_monotonic_time();
+
+    let id = GLib.timeout_add(GLib.PRIORITY_HIGH, MONITOR_INTERVAL, () => {
+        let now = GLib.get_monotonic_time();
+        let gap = now - lastTime;
+
+        if (gap - MONITOR_INTERVAL * 1000 > STALL_THRESHOLD)
+            perfLog.record_x(stallEvent, gap);
+
+        lastTime = now;
+        return GLib.SOURCE_CONTINUE;
+    });
+    GLib.Source.set_name_by_id(id, '[gnome-shell] _startStallMonitor');
+
+    return id;
+}
+
+function *run() {
+    Scripting.defineScriptEvent("spawnStart", "Starting to spawn windows");
+    Scripting.defineScriptEvent("overviewStart", "Starting window churn in the overview");
+    Scripting.defineScriptEvent("destroyStart", "Starting to destroy windows");
+    Scripting.defineScriptEvent("churnDone", "Done with window churn");
+
+    let stallEvent = Shell.PerfLog.get_default().define_event('churn.stall',
+        'Main loop stall; argument is the time between iterations in microseconds', 'x');
+
+    yield Scripting.sleep(1000);
+    yield Scripting.destroyTestWindows();
+    yield Scripting.waitLeisure();
+
+    // Baseline for the window tracker statistics
+    Scripting.collectStatistics();
+
+    let monitorId = _startStallMonitor(stallEvent);
+
+    Scripting.scriptEvent('spawnStart');
+    yield Scripting.spawnTestWindows(SPAWN_COUNT,
+                                     Object.assign({ rate: SPAWN_RATE }, WINDOW_PARAMS));
+    yield Scripting.waitTestWindows();
+    yield Scripting.waitLeisure();
+
+    Main.overview.show();
+    yield Scripting.waitLeisure();
+
+    Scripting.scriptEvent('overviewStart');
+    yield Promise.all([
+        Scripting.spawnTestWindows(CHURN_COUNT,
+                                   Object.assign({ rate: CHURN_RATE }, WINDOW_PARAMS)),
+        Scripting.destroyOldestTestWindows(CHURN_COUNT, CHURN_RATE),
+    ]);
+    yield Scripting.waitTestWindows();
+    yield Scripting.waitLeisure();
+
+    Main.overview.hide();
+    yield Scripting.waitLeisure();
+
+    Scripting.scriptEvent('destroyStart');
+    yield Scripting.destroyOldestTestWindows(SPAWN_COUNT, DESTROY_RATE);
+    yield Scripting.waitLeisure();
+    Scripting.scriptEvent('churnDone');
+
+    GLib.source_remove(monitorId);
+
+    yield Scripting.destroyTestWindows();
+    yield Scripting.sleep(1000);
+    Scripting.collectStatistics();
+}
+
+let phase = null;
+let stalls = {
+    spawn: [],
+    overview: [],
+    destroy: [],
+};
+
+// First and last values of the window tracker statistics
+let trackerStatistics = {};
+
+function _updateTrackerStatistic(name, value) {
+    if (!(name in trackerStatistics))
+        trackerStatistics[name] = { first: value, last: value };
+    trackerStatistics[name].last = value;
+}
+
+function _getTrackerStatisticDelta(name) {
+    let statistic = trackerStatistics[name];
+    return statistic ? statistic.last - statistic.first : 0;
+}
+
+function script_spawnStart(_time) {
+    phase = 'spawn';
+}
+
+function script_overviewStart(_time) {
+    phase = 'overview';
+}
+
+function script_destroyStart(_time) {
+    phase = 'destroy';
+}
+
+function script_churnDone(_time) {
+    phase = null;
+}
+
+function churn_stall(time, duration) {
+    if (phase)
+        stalls[phase].push(duration);
+}
+
+function windowTracker_addedCount(time, value) {
+    _updateTrackerStatistic('addedCount', value);
+}
+
+function windowTracker_addedTime(time, value) {
+    _updateTrackerStatistic('addedTime', value);
+}
+
+function windowTracker_removedCount(time, value) {
+    _updateTrackerStatistic('removedCount', value);
+}
+
+function windowTracker_removedTime(time, value) {
+    _updateTrackerStatistic('removedTime', value);
+}
+
+function finish() {
+    for (let p in stalls) {
+        METRICS[`${p}Stalls`].value = stalls[p].length;
+        METRICS[`${p}MaxStall`].value = Math.max(0, ...stalls[p]);
+    }
+
+    let nAdded = _getTrackerStatisticDelta('addedCount');
+    let nRemoved = _getTrackerStatisticDelta('removedCount');
+
+    METRICS.windowAddedTime.value =
+        nAdded > 0 ? _getTrackerStatisticDelta('addedTime') / nAdded : 0;
+    METRICS.windowRemovedTime.value =
+        nRemoved > 0 ? _getTrackerStatisticDelta('removedTime') / nRemoved : 0;
+}
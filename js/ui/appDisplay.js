@@ -391,9 +391,8 @@ var AllView = GObject.registerClass({
 
         this._redisplayWorkId = Main.initializeDeferredWork(this, this._redisplay.bind(this));
 
-        Shell.AppSystem.get_default().connect('installed-changed', () => {
-            Main.queueDeferredWork(this._redisplayWorkId);
-        });
+        Shell.AppSystem.get_default().connect('installed-apps-changed',
+            this._onInstalledAppsChanged.bind(this));
         this._folderSettings = new Gio.Settings({ schema_id: 'org.gnome.desktop.app-folders' });
         this._folderSettings.connect('changed::folder-children', () => {
             Main.queueDeferredWork(this._redisplayWorkId);
@@ -473,8 +472,7 @@ var AllView = GObject.registerClass({
         return this._appInfoList;
     }
 
-    _loadApps() {
-        let appIcons = [];
+    _loadAppInfos() {
         this._appInfoList = Shell.AppSystem.get_default().get_installed().filter(appInfo => {
             try {
                 appInfo.get_id(); // catch invalid file encodings
@@ -483,6 +481,53 @@ var AllView = GObject.registerClass({
             }
             return appInfo.should_show();
         });
+    }
+
+    _onInstalledAppsChanged(appSys, added, removed, changed) {
+        // Nothing to update before the view is first loaded
+        if (!this._appInfoList) {
+            Main.queueDeferredWork(this._redisplayWorkId);
+            return;
+        }
+
+        this._loadAppInfos();
+        let shownIds = new Set(this._appInfoList.map(appInfo => appInfo.get_id()));
+
+        // Changed apps get new icons, as their name or icon may be different
+        [...removed, ...changed].forEach(id => {
+            let icon = this._items.get(id);
+            if (!(icon instanceof AppIcon))
+                return;
+
+            this._orderedItems.splice(this._orderedItems.indexOf(icon), 1);
+            icon.destroy();
+            this._items.delete(id);
+        });
+
+        let favoritesWritable = global.settings.is_writable('favorite-apps');
+        [...changed, ...added].forEach(id => {
+            if (!shownIds.has(id) || this._items.has(id))
+                return;
+
+            let app = appSys.lookup_app(id);
+            if (!app)
+                return;
+
+            let icon = new AppIcon(app, {
+                isDraggable: favoritesWritable,
+            });
+            let index = Util.insertSorted(this._orderedItems, icon, this._compareItems);
+            this._grid.addItem(icon, index);
+            this._items.set(id, icon);
+        });
+
+        this._refilterApps();
+        this.emit('view-loaded');
+    }
+
+    _loadApps() {
+        let appIcons = [];
+        this._loadAppInfos();
 
         let apps = this._appInfoList.map(app => app.get_id());
 
@@ -1217,6 +1262,7 @@ var AppSearchProvider = class AppSearchProvider {
         this.id = 'applications';
         this.isRemoteProvider = false;
         this.canLaunchSearch = false;
+        this._query = '';
 
         this._systemActions = new SystemActions.getDefault();
     }
@@ -1252,19 +1298,11 @@ var AppSearchProvider = class AppSearchProvider {
         return results.slice(0, maxNumber);
     }
 
-    getInitialResultSet(terms, callback, _cancellable) {
-        let query = terms.join(' ');
-        let groups = Shell.AppSystem.search(query);
+    _finishResultSet(groups, terms, callback) {
         let usage = Shell.AppUsage.get_default();
         let results = [];
         groups.forEach(group => {
-            group = group.filter(appID => {
-                let app = Gio.DesktopAppInfo.new(appID);
-                return app && app.should_show();
-            });
-            results = results.concat(group.sort(
-                (a, b) => usage.compare(a, b)
-            ));
+            results = results.concat(usage.sort_ids(group));
         });
 
         results = results.concat(this._systemActions.getMatchingActions(terms));
@@ -1272,8 +1310,28 @@ var AppSearchProvider = class AppSearchProvider {
         callback(results);
     }
 
+    getInitialResultSet(terms, callback, _cancellable) {
+        this._query = terms.join(' ');
+        let groups = Shell.AppSystem.search(this._query);
+        this._finishResultSet(groups, terms, callback);
+    }
+
     getSubsearchResultSet(previousResults, terms, callback, cancellable) {
-        this.getInitialResultSet(terms, callback, cancellable);
+        // The terms extend those of the previous search, but not
+        // necessarily the query the previous results came from
+        let query = terms.join(' ');
+        if (!query.startsWith(this._query)) {
+            this.getInitialResultSet(terms, callback, cancellable);
+            return;
+        }
+
+        let previousQuery = this._query;
+        this._query = query;
+
+        // System actions are cheap to match again; only narrow down apps
+        let previousApps = previousResults.filter(id => id.endsWith('.desktop'));
+        let groups = Shell.AppSystem.subsearch(previousApps, previousQuery, this._query);
+        this._finishResultSet(groups, terms, callback);
     }
 
     createResultObject(resultMeta) {
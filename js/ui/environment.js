@@ -217,6 +217,46 @@ function _loggingFunc(...args) {
     GLib.log_structured(domain, GLib.LogLevelFlags.LEVEL_MESSAGE, fields);
 }
 
+// Names that are looked up on importers without importing a module
+const IMPORTER_PROPERTIES = ['searchPath', 'toString', 'valueOf'];
+
+// Records the time taken to import each shell module as a phase of
+// the startup timeline. Importers load modules lazily on first property
+// access, so wrap them in proxies that time the first access to each
+// name; the original importers are put back once startup is over.
+// Nested imports are included in the time of the importing module.
+function _traceStartupImports() {
+    if (Shell.startup_timeline_is_finished())
+        return;
+
+    for (let dir of ['misc', 'ui']) {
+        let importer = imports[dir];
+        let seen = new Set();
+
+        imports[dir] = new Proxy(importer, {
+            get(target, name) {
+                if (typeof name != 'string' || name.startsWith('_') ||
+                    IMPORTER_PROPERTIES.includes(name) || seen.has(name))
+                    return target[name];
+
+                if (Shell.startup_timeline_is_finished()) {
+                    imports[dir] = importer;
+                    return target[name];
+                }
+
+                let phase = `import:${dir}.${name}`;
+                seen.add(name);
+                Shell.startup_timeline_begin(phase);
+                try {
+                    return target[name];
+                } finally {
+                    Shell.startup_timeline_end(phase);
+                }
+            },
+        });
+    }
+}
+
 function init() {
     // Add some bindings to the global JS namespace; (gjs keeps the web
     // browser convention of having that namespace be called 'window'.)
@@ -304,6 +344,8 @@ function init() {
             St.Settings.get().slow_down_factor = factor;
     }
 
+    _traceStartupImports();
+
     // OK, now things are initialized enough that we can import shell JS
     const Format = imports.format;
     const Tweener = imports.ui.tweener;
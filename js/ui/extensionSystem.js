@@ -305,10 +305,16 @@ var ExtensionManager = class {
         } else {
             let enabled = this._enabledExtensions.includes(extension.uuid);
             if (enabled) {
-                if (!this._callExtensionInit(extension.uuid))
-                    return;
-                if (extension.state == ExtensionState.DISABLED)
-                    this._callExtensionEnable(extension.uuid);
+                let phase = `extension:${extension.uuid}`;
+                Shell.startup_timeline_begin(phase);
+                try {
+                    if (!this._callExtensionInit(extension.uuid))
+                        return;
+                    if (extension.state == ExtensionState.DISABLED)
+                        this._callExtensionEnable(extension.uuid);
+                } finally {
+                    Shell.startup_timeline_end(phase);
+                }
             } else {
                 extension.state = ExtensionState.INITIALIZED;
             }
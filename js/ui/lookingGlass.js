@@ -11,8 +11,11 @@ const ExtensionUtils = imports.misc.extensionUtils;
 const ShellEntry = imports.ui.shellEntry;
 const Main = imports.ui.main;
 const JsParse = imports.misc.jsParse;
+const PaintProfiler = imports.ui.paintProfiler;
+const Scripting = imports.ui.scripting;
 
 const { ExtensionState } = ExtensionUtils;
+const { SortKey } = PaintProfiler;
 
 const CHEVRON = '>>> ';
 
@@ -35,6 +38,9 @@ var AUTO_COMPLETE_GLOBAL_KEYWORDS = _getAutoCompleteGlobalKeywords();
 
 const LG_ANIMATION_TIME = 500;
 
+// Number of rows shown in the paint profile table
+const PAINT_PROFILE_ROWS = 25;
+
 function _getAutoCompleteGlobalKeywords() {
     const keywords = ['true', 'false', 'null', 'new'];
     // Don't add the private properties of window (i.e., ones starting with '_')
@@ -797,6 +803,207 @@ var Extensions = GObject.registerClass({
     }
 });
 
+var PaintProfile = GObject.registerClass({
+}, class PaintProfile extends St.BoxLayout {
+    _init(lookingGlass) {
+        super._init({ vertical: true, name: 'lookingGlassPaintProfile' });
+
+        this._lookingGlass = lookingGlass;
+        this._profiler = Main.paintProfiler;
+        this._sortKey = SortKey.SELF_TIME;
+
+        let controls = new St.BoxLayout({ style_class: 'lg-paint-profile-controls' });
+        this.add_child(controls);
+
+        this._startButton = this._addLink(controls, () => {
+            if (this._profiler.active)
+                this._profiler.stop();
+            else
+                this._profiler.start({ overlay: this._profiler.overlayVisible });
+        });
+        this._overlayButton = this._addLink(controls, () => {
+            if (!this._profiler.active)
+                this._profiler.start({ overlay: true });
+            else
+                this._profiler.setOverlayVisible(!this._profiler.overlayVisible);
+        });
+        this._addLink(controls, () => this._profiler.reset(), 'Reset');
+        this._addLink(controls, () => this._update(), 'Refresh');
+
+        let layout = new Clutter.GridLayout();
+        this._table = new St.Widget({ style_class: 'lg-paint-profile-table',
+                                      layout_manager: layout });
+        layout.hookup_style(this._table);
+        this.add_child(this._table);
+
+        this._profiler.connect('active-changed', this._sync.bind(this));
+        this._profiler.connect('overlay-changed', this._sync.bind(this));
+        this._profiler.connect('updated', this._update.bind(this));
+
+        this._sync();
+    }
+
+    _addLink(box, callback, label = null) {
+        let button = new St.Button({ reactive: true,
+                                     track_hover: true,
+                                     style_class: 'shell-link',
+                                     label });
+        button.connect('clicked', callback);
+        box.add_child(button);
+        return button;
+    }
+
+    _sync() {
+        this._startButton.label = this._profiler.active ? 'Stop' : 'Start';
+        this._overlayButton.label = this._profiler.overlayVisible
+            ? 'Hide Overlay' : 'Show Overlay';
+        this._update();
+    }
+
+    _addCell(text, column, row, styleClass = null) {
+        let label = new St.Label({ text, style_class: styleClass });
+        this._table.layout_manager.attach(label, column, row, 1, 1);
+        return label;
+    }
+
+    _addHeader(text, column, sortKey = null) {
+        if (!sortKey) {
+            this._addCell(text, column, 0, 'lg-paint-profile-header');
+            return;
+        }
+
+        let button = new St.Button({ reactive: true,
+                                     track_hover: true,
+                                     style_class: 'shell-link',
+                                     label: sortKey == this._sortKey ? `${text} ▾` : text });
+        button.connect('clicked', () => {
+            this._sortKey = sortKey;
+            this._update();
+        });
+        this._table.layout_manager.attach(button, column, 0, 1, 1);
+    }
+
+    _update() {
+        if (!this._lookingGlass.isOpen)
+            return;
+
+        this._table.destroy_all_children();
+
+        this._addHeader('Class', 0);
+        this._addHeader('Style Class', 1);
+        this._addHeader('Actors', 2);
+        this._addHeader('Paints', 3, SortKey.PAINTS);
+        this._addHeader('Self (ms)', 4, SortKey.SELF_TIME);
+        this._addHeader('Theme Node (ms)', 5, SortKey.NODE_TIME);
+
+        let entries = this._profiler.getTopEntries(PAINT_PROFILE_ROWS, this._sortKey);
+        entries.forEach((entry, i) => {
+            let row = i + 1;
+            this._addCell(entry.className, 0, row);
+            this._addCell(entry.styleClass, 1, row);
+            this._addCell(`${entry.actors}`, 2, row);
+            this._addCell(`${entry.paints}`, 3, row);
+            this._addCell((entry.selfTime / 1000).toFixed(2), 4, row);
+            this._addCell((entry.nodeTime / 1000).toFixed(2), 5, row);
+        });
+    }
+
+    update() {
+        this._update();
+    }
+});
+
+var MemoryUsage = GObject.registerClass({
+}, class MemoryUsage extends St.BoxLayout {
+    _init(lookingGlass) {
+        super._init({ vertical: true, name: 'lookingGlassMemoryUsage' });
+
+        this._lookingGlass = lookingGlass;
+        this._snapshot = null;
+
+        let controls = new St.BoxLayout({ style_class: 'lg-memory-controls' });
+        this.add_child(controls);
+
+        this._addLink(controls, () => this._update(), 'Refresh');
+        this._addLink(controls, () => {
+            this._snapshot = Scripting.memorySnapshot();
+            this._update();
+        }, 'Take Snapshot');
+        this._addLink(controls, () => {
+            this._snapshot = null;
+            this._update();
+        }, 'Clear Snapshot');
+
+        let layout = new Clutter.GridLayout();
+        this._table = new St.Widget({ style_class: 'lg-memory-table',
+                                      layout_manager: layout });
+        layout.hookup_style(this._table);
+        this.add_child(this._table);
+
+        this._update();
+    }
+
+    _addLink(box, callback, label) {
+        let button = new St.Button({ reactive: true,
+                                     track_hover: true,
+                                     style_class: 'shell-link',
+                                     label });
+        button.connect('clicked', callback);
+        box.add_child(button);
+    }
+
+    _addCell(text, column, row, styleClass = null) {
+        let label = new St.Label({ text, style_class: styleClass });
+        this._table.layout_manager.attach(label, column, row, 1, 1);
+    }
+
+    _formatChange(value, format = v => `${v}`) {
+        if (value == 0)
+            return '';
+        return value > 0 ? `+${format(value)}` : `-${format(-value)}`;
+    }
+
+    _update() {
+        if (!this._lookingGlass.isOpen)
+            return;
+
+        this._table.destroy_all_children();
+
+        let headers = ['Subsystem', 'Objects', 'Size'];
+        if (this._snapshot)
+            headers.push('Objects Since Snapshot', 'Size Since Snapshot');
+        headers.forEach((header, column) => {
+            this._addCell(header, column, 0, 'lg-memory-header');
+        });
+
+        let usage = Scripting.memorySnapshot();
+        let changes = new Map();
+        if (this._snapshot) {
+            for (let diff of Scripting.memoryDiff(this._snapshot, usage))
+                changes.set(diff.subsystem, diff);
+        }
+
+        let row = 1;
+        for (let [subsystem, { objects, bytes }] of usage) {
+            this._addCell(subsystem, 0, row);
+            this._addCell(`${objects}`, 1, row);
+            this._addCell(GLib.format_size(bytes), 2, row);
+
+            let change = changes.get(subsystem);
+            if (change) {
+                this._addCell(this._formatChange(change.objects), 3, row);
+                this._addCell(this._formatChange(change.bytes, GLib.format_size), 4, row);
+            }
+
+            row++;
+        }
+    }
+
+    update() {
+        this._update();
+    }
+});
+
 var LookingGlass = GObject.registerClass(
 class LookingGlass extends St.BoxLayout {
     _init() {
@@ -912,6 +1119,12 @@ class LookingGlass extends St.BoxLayout {
         this._extensions = new Extensions(this);
         notebook.appendPage('Extensions', this._extensions);
 
+        this._paintProfile = new PaintProfile(this);
+        notebook.appendPage('Paint', this._paintProfile);
+
+        this._memoryUsage = new MemoryUsage(this);
+        notebook.appendPage('Memory', this._memoryUsage);
+
         this._entry.clutter_text.connect('activate', (o, _e) => {
             // Hide any completions we are currently showing
             this._hideCompletions();
@@ -1149,6 +1362,8 @@ class LookingGlass extends St.BoxLayout {
         });
 
         this._windowList.update();
+        this._paintProfile.update();
+        this._memoryUsage.update();
     }
 
     close() {
@@ -1,9 +1,9 @@
 // -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
 /* exported componentManager, notificationDaemon, windowAttentionHandler,
-            ctrlAltTabManager, padOsdService, osdWindowManager,
+            ctrlAltTabManager, padOsdService, paintProfiler, osdWindowManager,
             osdMonitorLabeler, shellMountOpDBusService, shellDBusService,
             shellAccessDialogDBusService, shellAudioSelectionDBusService,
-            screenSaverDBus, screencastService, uiGroup, magnifier,
+            statisticsDBusService, screenSaverDBus, screencastService, uiGroup, magnifier,
             xdndHandler, keyboard, kbdA11yDialog, introspectService,
             start, pushModal, popModal, activateWindow, createLookingGlass,
             initializeDeferredWork, getThemeStylesheet, setThemeStylesheet */
@@ -26,6 +26,7 @@ const OsdWindow = imports.ui.osdWindow;
 const OsdMonitorLabeler = imports.ui.osdMonitorLabeler;
 const Overview = imports.ui.overview;
 const PadOsd = imports.ui.padOsd;
+const PaintProfiler = imports.ui.paintProfiler;
 const Panel = imports.ui.panel;
 const Params = imports.misc.params;
 const RunDialog = imports.ui.runDialog;
@@ -40,6 +41,7 @@ const Scripting = imports.ui.scripting;
 const SessionMode = imports.ui.sessionMode;
 const ShellDBus = imports.ui.shellDBus;
 const ShellMountOperation = imports.ui.shellMountOperation;
+const StatisticsDBus = imports.ui.statisticsDBus;
 const WindowManager = imports.ui.windowManager;
 const Magnifier = imports.ui.magnifier;
 const XdndHandler = imports.ui.xdndHandler;
@@ -65,6 +67,7 @@ var notificationDaemon = null;
 var windowAttentionHandler = null;
 var ctrlAltTabManager = null;
 var padOsdService = null;
+var paintProfiler = null;
 var osdWindowManager = null;
 var osdMonitorLabeler = null;
 var sessionMode = null;
@@ -72,6 +75,7 @@ var shellAccessDialogDBusService = null;
 var shellAudioSelectionDBusService = null;
 var shellDBusService = null;
 var shellMountOpDBusService = null;
+var statisticsDBusService = null;
 var screenSaverDBus = null;
 var screencastService = null;
 var modalCount = 0;
@@ -131,16 +135,24 @@ function start() {
 
     Gio.DesktopAppInfo.set_desktop_env('GNOME');
 
+    Shell.startup_timeline_begin('js.sessionMode');
     sessionMode = new SessionMode.SessionMode();
     sessionMode.connect('updated', _sessionUpdated);
+    Shell.startup_timeline_end('js.sessionMode');
 
     St.Settings.get().connect('notify::gtk-theme', _loadDefaultStylesheet);
+
+    Shell.startup_timeline_begin('js.initializeUI');
     _initializeUI();
+    Shell.startup_timeline_end('js.initializeUI');
 
+    Shell.startup_timeline_begin('js.dbusServices');
     shellAccessDialogDBusService = new AccessDialog.AccessDialogDBus();
     shellAudioSelectionDBusService = new AudioDeviceSelection.AudioDeviceSelectionDBus();
     shellDBusService = new ShellDBus.GnomeShell();
     shellMountOpDBusService = new ShellMountOperation.GnomeShellMountOpHandler();
+    statisticsDBusService = new StatisticsDBus.StatisticsService();
+    Shell.startup_timeline_end('js.dbusServices');
 
     _sessionUpdated();
 }
@@ -154,13 +166,18 @@ function _initializeUI() {
     // and recalculate application associations, so to avoid
     // races for now we initialize it here. It's better to
     // be predictable anyways.
+    Shell.startup_timeline_begin('js.loadApps');
     Shell.WindowTracker.get_default();
     Shell.AppUsage.get_default();
+    Shell.startup_timeline_end('js.loadApps');
 
+    Shell.startup_timeline_begin('js.loadTheme');
     reloadThemeResource();
     _loadOskLayouts();
     _loadDefaultStylesheet();
+    Shell.startup_timeline_end('js.loadTheme');
 
+    Shell.startup_timeline_begin('js.createUI');
     // Setup the stage hierarchy early
     layoutManager = new Layout.LayoutManager();
 
@@ -170,6 +187,7 @@ function _initializeUI() {
     uiGroup = layoutManager.uiGroup;
 
     padOsdService = new PadOsd.PadOsdService();
+    paintProfiler = new PaintProfiler.PaintProfiler();
     screencastService = new Screencast.ScreencastService();
     xdndHandler = new XdndHandler.XdndHandler();
     ctrlAltTabManager = new CtrlAltTab.CtrlAltTabManager();
@@ -198,6 +216,7 @@ function _initializeUI() {
 
     layoutManager.init();
     overview.init();
+    Shell.startup_timeline_end('js.createUI');
 
     new PointerA11yTimeout.PointerA11yTimeout();
 
@@ -237,9 +256,11 @@ function _initializeUI() {
 
     _startDate = new Date();
 
+    Shell.startup_timeline_begin('js.extensions');
     ExtensionDownloader.init();
     extensionManager = new ExtensionSystem.ExtensionManager();
     extensionManager.init();
+    Shell.startup_timeline_end('js.extensions');
 
     if (sessionMode.isGreeter && screenShield) {
         layoutManager.connect('startup-prepared', () => {
@@ -277,6 +298,11 @@ function _initializeUI() {
 
         LoginManager.registerSessionWithGDM();
 
+        // SHELL_PAINT_PROFILE=overlay also shows the heat overlay
+        let paintProfile = GLib.getenv('SHELL_PAINT_PROFILE');
+        if (paintProfile)
+            paintProfiler.start({ overlay: paintProfile == 'overlay' });
+
         let perfModuleName = GLib.getenv("SHELL_PERF_MODULE");
         if (perfModuleName) {
             let perfOutput = GLib.getenv("SHELL_PERF_OUTPUT");
@@ -0,0 +1,203 @@
+// -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
+/* exported PaintProfiler */
+
+const { Clutter, GLib, Shell, St } = imports.gi;
+const ByteArray = imports.byteArray;
+const Signals = imports.signals;
+
+var UPDATE_INTERVAL = 1000; // ms
+
+// Number of actors highlighted by the heat overlay
+var OVERLAY_MAX_ACTORS = 30;
+
+// Paint time per update interval at which an actor is drawn fully red
+const OVERLAY_HOT_TIME = 20000; // us
+
+// Most entries recorded in the perf log per update, and the most bytes
+// they take up; the perf log drops events that don't fit in one of its
+// 8 kB blocks, so the profile has to stay well below that
+const PROFILE_MAX_ENTRIES = 50;
+const PROFILE_MAX_LENGTH = 4096;
+
+// Time between recording the profile so far in the perf log, so that
+// little of it is lost if the shell goes away while profiling
+var PROFILE_RECORD_INTERVAL = 10000; // ms
+
+var SortKey = {
+    SELF_TIME: 'selfTime',
+    NODE_TIME: 'nodeTime',
+    PAINTS: 'paints',
+};
+
+// Collects the per-widget paint times measured by St, aggregates them
+// by widget class and style class, and optionally shows where the time
+// goes with an overlay that tints the most expensive actors.
+var PaintProfiler = class {
+    constructor() {
+        this._overlay = null;
+        this._updateId = 0;
+        this._recordId = 0;
+        this._lastTimes = new Map();
+
+        this._perfLog = Shell.PerfLog.get_default();
+        this._profileEvent = this._perfLog.define_event('st.paintProfile',
+            'Paint profile by widget class and style class', 's');
+    }
+
+    get active() {
+        return St.profiler_get_paint_profiling();
+    }
+
+    get overlayVisible() {
+        return this._overlay != null;
+    }
+
+    start(params = {}) {
+        let { overlay = false } = params;
+
+        if (!this.active) {
+            St.profiler_reset_paint_profile();
+            St.profiler_set_paint_profiling(true);
+
+            this._recordId = GLib.timeout_add(GLib.PRIORITY_DEFAULT,
+                                              PROFILE_RECORD_INTERVAL, () => {
+                                                  this._recordProfile();
+                                                  return GLib.SOURCE_CONTINUE;
+                                              });
+            GLib.Source.set_name_by_id(this._recordId, '[gnome-shell] this._recordProfile');
+
+            this.emit('active-changed');
+        }
+
+        this.setOverlayVisible(overlay);
+    }
+
+    stop() {
+        if (!this.active)
+            return;
+
+        this.setOverlayVisible(false);
+        St.profiler_set_paint_profiling(false);
+
+        if (this._recordId) {
+            GLib.source_remove(this._recordId);
+            this._recordId = 0;
+        }
+        this._recordProfile();
+        this.emit('active-changed');
+    }
+
+    reset() {
+        St.profiler_reset_paint_profile();
+        this._lastTimes.clear();
+        this.emit('updated');
+    }
+
+    setOverlayVisible(visible) {
+        if (visible == this.overlayVisible)
+            return;
+
+        if (visible) {
+            // A plain actor, so that the overlay isn't profiled itself
+            this._overlay = new Clutter.Actor({ reactive: false });
+            global.stage.add_child(this._overlay);
+            this._overlay.add_constraint(new Clutter.BindConstraint({
+                source: global.stage,
+                coordinate: Clutter.BindCoordinate.ALL,
+            }));
+
+            this._lastTimes.clear();
+            this._updateId = GLib.timeout_add(GLib.PRIORITY_DEFAULT,
+                                              UPDATE_INTERVAL, () => {
+                                                  this._updateOverlay();
+                                                  this.emit('updated');
+                                                  return GLib.SOURCE_CONTINUE;
+                                              });
+            GLib.Source.set_name_by_id(this._updateId, '[gnome-shell] this._updateOverlay');
+        } else {
+            GLib.source_remove(this._updateId);
+            this._updateId = 0;
+
+            this._overlay.destroy();
+            this._overlay = null;
+        }
+
+        this.emit('overlay-changed');
+    }
+
+    // Returns the @n entries with the highest @sortKey, as objects with
+    // className, styleClass, actors, paints, selfTime and nodeTime
+    // properties; times are in microseconds.
+    getTopEntries(n, sortKey = SortKey.SELF_TIME) {
+        let entries = St.profiler_get_paint_profile().deep_unpack().map(
+            ([className, styleClass, actors, paints, selfTime, nodeTime]) => {
+                return { className, styleClass, actors, paints, selfTime, nodeTime };
+            });
+
+        entries.sort((a, b) => b[sortKey] - a[sortKey]);
+
+        return entries.slice(0, n);
+    }
+
+    _updateOverlay() {
+        let deltas = [];
+        let times = new Map();
+
+        for (let actor of St.profiler_get_profiled_actors()) {
+            let time = St.profiler_get_actor_paint_time(actor);
+            let delta = time - (this._lastTimes.get(actor) || 0);
+
+            times.set(actor, time);
+            if (delta > 0 && actor.is_mapped())
+                deltas.push({ actor, delta });
+        }
+
+        this._lastTimes = times;
+
+        deltas.sort((a, b) => b.delta - a.delta);
+
+        this._overlay.destroy_all_children();
+        for (let { actor, delta } of deltas.slice(0, OVERLAY_MAX_ACTORS)) {
+            let [x, y] = actor.get_transformed_position();
+            let [width, height] = actor.get_transformed_size();
+            let heat = Math.min(delta / OVERLAY_HOT_TIME, 1);
+
+            this._overlay.add_child(new Clutter.Actor({
+                x, y, width, height,
+                background_color: new Clutter.Color({
+                    red: 255,
+                    green: Math.round(255 * (1 - heat)),
+                    blue: 0,
+                    alpha: 48 + Math.round(112 * heat),
+                }),
+            }));
+        }
+    }
+
+    // Records the totals so far; the last one recorded holds the profile
+    _recordProfile() {
+        // Space-separated, since the perf log doesn't escape strings;
+        // multiple style classes are joined CSS-selector style
+        let profile = '';
+        let length = 0;
+        for (let e of this.getTopEntries(PROFILE_MAX_ENTRIES)) {
+            let styleClass = e.styleClass.split(' ').join('.') || '-';
+            let entry = [e.className, styleClass, e.actors, e.paints,
+                         e.selfTime, e.nodeTime].join(' ');
+
+            if (profile.length > 0)
+                entry = `; ${entry}`;
+
+            // The perf log stores the string as UTF-8
+            let entryLength = ByteArray.fromString(entry).length;
+            if (length + entryLength > PROFILE_MAX_LENGTH)
+                break;
+
+            profile += entry;
+            length += entryLength;
+        }
+
+        this._perfLog.record_s(this._profileEvent, profile);
+    }
+};
+Signals.addSignalMethods(PaintProfiler.prototype);
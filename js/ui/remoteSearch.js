@@ -60,16 +60,29 @@ const SearchProvider2Iface = `
 var SearchProviderProxyInfo = Gio.DBusInterfaceInfo.new_for_xml(SearchProviderIface);
 var SearchProvider2ProxyInfo = Gio.DBusInterfaceInfo.new_for_xml(SearchProvider2Iface);
 
+// Reads the search provider key files on worker threads; resolves to
+// an array of [file, contents] pairs
+async function _loadProviderFiles() {
+    let children = await FileUtils.collectFromDatadirsAsync('search-providers', false);
+    let files = children.map(([file]) => file);
+    let contents = await FileUtils.loadFilesAsync(files);
+
+    return files.map((file, i) => [file, contents[i]]);
+}
+
 function loadRemoteSearchProviders(searchSettings, callback) {
     let objectPaths = {};
     let loadedProviders = [];
 
-    function loadRemoteSearchProvider(file) {
+    function loadRemoteSearchProvider(file, contents) {
         let keyfile = new GLib.KeyFile();
         let path = file.get_path();
 
+        if (!contents)
+            return;
+
         try {
-            keyfile.load_from_file(path, 0);
+            keyfile.load_from_bytes(contents, 0);
         } catch (e) {
             return;
         }
@@ -135,8 +148,15 @@ function loadRemoteSearchProviders(searchSettings, callback) {
         return;
     }
 
-    FileUtils.collectFromDatadirs('search-providers', false, loadRemoteSearchProvider);
+    _loadProviderFiles().then(files => {
+        files.forEach(([file, contents]) => loadRemoteSearchProvider(file, contents));
+        callback(_sortProviders(searchSettings, loadedProviders));
+    }).catch(e => {
+        logError(e, 'Failed to load search providers');
+    });
+}
 
+function _sortProviders(searchSettings, loadedProviders) {
     let sortOrder = searchSettings.get_strv('sort-order');
 
     // Special case gnome-control-center to be always active and always first
@@ -184,7 +204,7 @@ function loadRemoteSearchProviders(searchSettings, callback) {
         return idxA - idxB;
     });
 
-    callback(loadedProviders);
+    return loadedProviders;
 }
 
 var RemoteSearchProvider = class {
@@ -1,9 +1,10 @@
 // -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
 /* exported sleep, waitLeisure, createTestWindow, waitTestWindows,
-            destroyTestWindows, defineScriptEvent, scriptEvent,
-            collectStatistics, runPerfScript */
+            destroyTestWindows, spawnTestWindows, destroyOldestTestWindows,
+            defineScriptEvent, scriptEvent, collectStatistics, memorySnapshot,
+            memoryDiff, runPerfScript */
 
-const { Gio, GLib, Meta, Shell } = imports.gi;
+const { Gio, GLib, Meta, Shell, St } = imports.gi;
 
 const Config = imports.misc.config;
 const Main = imports.ui.main;
@@ -72,9 +73,22 @@ function PerfHelper() {
 }
 
 let _perfHelper = null;
+let _pendingChurns = new Map();
+let _finishedChurns = new Set();
 function _getPerfHelper() {
-    if (_perfHelper == null)
+    if (_perfHelper == null) {
         _perfHelper = new PerfHelper();
+        _perfHelper.connectSignal('ChurnFinished', (proxy, sender, [id]) => {
+            let resolve = _pendingChurns.get(id);
+            if (resolve) {
+                _pendingChurns.delete(id);
+                resolve();
+            } else {
+                // The reply carrying the ID hasn't been handled yet
+                _finishedChurns.add(id);
+            }
+        });
+    }
 
     return _perfHelper;
 }
@@ -98,6 +112,28 @@ function _callRemote(obj, method, ...args) {
     });
 }
 
+// Churn operations can take longer than the D-Bus timeout, so the helper
+// replies with an operation ID right away, and emits ChurnFinished with
+// it once the operation is done
+function _callChurn(obj, method, ...args) {
+    return new Promise((resolve, reject) => {
+        args.push((result, excp) => {
+            if (excp) {
+                reject(excp);
+                return;
+            }
+
+            let [id] = result;
+            if (_finishedChurns.delete(id))
+                resolve();
+            else
+                _pendingChurns.set(id, resolve);
+        });
+
+        method.apply(obj, args);
+    });
+}
+
 /**
  * createTestWindow:
  * @param {Object} params: options for window creation.
@@ -154,6 +190,68 @@ function destroyTestWindows() {
     return _callRemote(perfHelper, perfHelper.DestroyWindowsRemote);
 }
 
+/**
+ * spawnTestWindows:
+ * @param {number} count: number of windows to create
+ * @param {Object} params: options for window creation.
+ *   {number} [params.rate=0] - windows to create per second, or 0 to
+ *     create them as fast as possible
+ *   {number} [params.width=320] - width of the windows, in pixels
+ *   {number} [params.height=240] - height of the windows, in pixels
+ *   {number} [params.wmClasses=0] - number of different WM_CLASS values
+ *     to cycle through, or 0 to use the default of the helper
+ *   {number} [params.appIds=0] - number of different GApplication IDs
+ *     to cycle through, or 0 for windows without one
+ *   {number} [params.dialogEvery=0] - give every nth window a transient
+ *     dialog, or 0 for no dialogs
+ *   {bool} [params.modal=false] - whether the dialogs are modal
+ * @returns {Promise}
+ *
+ * Creates many windows at a controlled rate using gnome-shell-perf-helper,
+ * for stressing window tracking. The windows share the PID of the helper.
+ * The promise resolves once the last window has been created; use
+ * waitTestWindows() to wait until they are all mapped and exposed.
+ */
+function spawnTestWindows(count, params) {
+    params = Params.parse(params, { rate: 0,
+                                    width: 320,
+                                    height: 240,
+                                    wmClasses: 0,
+                                    appIds: 0,
+                                    dialogEvery: 0,
+                                    modal: false });
+
+    let options = {
+        'width': new GLib.Variant('i', params.width),
+        'height': new GLib.Variant('i', params.height),
+        'wm-classes': new GLib.Variant('u', params.wmClasses),
+        'app-ids': new GLib.Variant('u', params.appIds),
+        'dialog-every': new GLib.Variant('u', params.dialogEvery),
+        'modal': new GLib.Variant('b', params.modal),
+    };
+
+    let perfHelper = _getPerfHelper();
+    return _callChurn(perfHelper, perfHelper.SpawnWindowsRemote,
+                      count, params.rate, options);
+}
+
+/**
+ * destroyOldestTestWindows:
+ * @param {number} count: number of windows to destroy
+ * @param {number} rate: windows to destroy per second, or 0 to destroy
+ *   them as fast as possible
+ * @returns {Promise}
+ *
+ * Destroys the @count test windows that were created first, at a
+ * controlled rate. The promise resolves once the last of them has
+ * been destroyed by the helper.
+ */
+function destroyOldestTestWindows(count, rate = 0) {
+    let perfHelper = _getPerfHelper();
+    return _callChurn(perfHelper, perfHelper.DestroyOldestWindowsRemote,
+                      count, rate);
+}
+
 /**
  * defineScriptEvent
  * @param {string} name: The event will be called script.<name>
@@ -163,10 +261,14 @@ function destroyTestWindows() {
  * within the 'script' namespace that is reserved for events defined locally
  * within a performance automation script
  */
+let _scriptEvents = new Map();
+
 function defineScriptEvent(name, description) {
-    Shell.PerfLog.get_default().define_event(`script.${name}`,
-                                             description,
-                                             "");
+    let handle = Shell.PerfLog.get_default().define_event(`script.${name}`,
+                                                          description,
+                                                          "");
+    if (handle)
+        _scriptEvents.set(name, handle);
 }
 
 /**
@@ -177,7 +279,11 @@ function defineScriptEvent(name, description) {
  * previously defined with defineScriptEvent
  */
 function scriptEvent(name) {
-    Shell.PerfLog.get_default().event(`script.${name}`);
+    let handle = _scriptEvents.get(name);
+    if (handle)
+        Shell.PerfLog.get_default().record(handle);
+    else
+        Shell.PerfLog.get_default().event(`script.${name}`);
 }
 
 /**
@@ -189,6 +295,45 @@ function collectStatistics() {
     Shell.PerfLog.get_default().collect_statistics();
 }
 
+/**
+ * memorySnapshot:
+ * @returns {Map} the memory use of each subsystem, as objects with
+ *   objects and bytes properties
+ *
+ * Takes a snapshot of the per-subsystem memory accounting of St and
+ * the shell. Compare snapshots taken before and after some scripted
+ * actions with memoryDiff() to find out where memory is leaking.
+ */
+function memorySnapshot() {
+    let snapshot = new Map();
+    for (let [subsystem, objects, bytes] of St.profiler_get_memory_usage().deep_unpack())
+        snapshot.set(subsystem, { objects, bytes });
+    return snapshot;
+}
+
+/**
+ * memoryDiff:
+ * @param {Map} before: snapshot from memorySnapshot()
+ * @param {Map} after: later snapshot from memorySnapshot()
+ * @returns {Object[]} the subsystems whose memory use changed between
+ *   the snapshots, as objects with subsystem, objects and bytes
+ *   properties holding the differences, largest growth first
+ */
+function memoryDiff(before, after) {
+    let diff = [];
+    for (let [subsystem, usage] of after) {
+        let old = before.get(subsystem) || { objects: 0, bytes: 0 };
+        let objects = usage.objects - old.objects;
+        let bytes = usage.bytes - old.bytes;
+
+        if (objects != 0 || bytes != 0)
+            diff.push({ subsystem, objects, bytes });
+    }
+
+    diff.sort((a, b) => b.bytes - a.bytes);
+    return diff;
+}
+
 function _collect(scriptModule, outputFile) {
     let eventHandlers = {};
 
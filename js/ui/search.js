@@ -14,6 +14,69 @@ const SEARCH_PROVIDERS_SCHEMA = 'org.gnome.desktop.search-providers';
 var MAX_LIST_SEARCH_RESULTS_ROWS = 5;
 var MAX_GRID_SEARCH_RESULTS_ROWS = 1;
 
+// Expected time to create one result actor; the task scheduler only
+// starts a step if that much time is left before the next frame
+var RENDER_BUDGET = 1; // ms
+
+// Runs tasks that create result actors in the slack between frames,
+// so that providers returning many results, or results with expensive
+// icons, don't make typing stutter. Tasks are generators that yield
+// after each unit of work; the queued task with the lowest priority
+// value runs first.
+var RenderScheduler = class {
+    constructor() {
+        this._tasks = [];
+        this._taskId = 0;
+    }
+
+    add(priority, iter) {
+        let task = { priority, iter };
+        let index = this._tasks.findIndex(t => t.priority > priority);
+        if (index < 0)
+            this._tasks.push(task);
+        else
+            this._tasks.splice(index, 0, task);
+
+        if (this._taskId == 0) {
+            this._taskId = global.task_scheduler.add(Shell.TaskPriority.HIGH,
+                                                     RENDER_BUDGET * 1000,
+                                                     this._runStep.bind(this));
+        }
+
+        return task;
+    }
+
+    remove(task) {
+        let index = this._tasks.indexOf(task);
+        if (index >= 0)
+            this._tasks.splice(index, 1);
+    }
+
+    _runStep() {
+        if (this._tasks.length > 0) {
+            let task = this._tasks[0];
+            let done;
+
+            try {
+                ({ done } = task.iter.next());
+            } catch (e) {
+                logError(e, 'Failed to create search results');
+                done = true;
+            }
+
+            // The task may have been removed while running
+            if (done)
+                this.remove(task);
+        }
+
+        if (this._tasks.length > 0)
+            return true;
+
+        this._taskId = 0;
+        return false;
+    }
+};
+
 var MaxWidthBox = GObject.registerClass(
 class MaxWidthBox extends St.BoxLayout {
     vfunc_allocate(box, flags) {
@@ -179,12 +242,14 @@ var SearchResultsBase = GObject.registerClass({
         this._resultDisplays = {};
 
         this._cancellable = new Gio.Cancellable();
+        this._renderTask = null;
 
         this.connect('destroy', this._onDestroy.bind(this));
     }
 
     _onDestroy() {
         this._terms = [];
+        this.cancelUpdate();
     }
 
     _createResultDisplay(meta) {
@@ -195,7 +260,7 @@ var SearchResultsBase = GObject.registerClass({
     }
 
     clear() {
-        this._cancellable.cancel();
+        this.cancelUpdate();
         for (let resultId in this._resultDisplays)
             this._resultDisplays[resultId].destroy();
         this._resultDisplays = {};
@@ -217,6 +282,31 @@ var SearchResultsBase = GObject.registerClass({
     _setMoreCount(_count) {
     }
 
+    // Drops result metas still being fetched and result actors still
+    // waiting to be created; whoever cancels owns the display now, so
+    // the callback of the dropped update is never called, and the caller
+    // has to reset whatever state waits for it
+    cancelUpdate() {
+        this._cancellable.cancel();
+
+        if (this._renderTask) {
+            this._resultsView.cancelRender(this._renderTask);
+            this._renderTask = null;
+        }
+    }
+
+    *_createResultActors(resultIds, metas, callback) {
+        for (let i = 0; i < resultIds.length; i++) {
+            let display = this._createResultDisplay(metas[i]);
+            display.connect('key-focus-in', this._keyFocusIn.bind(this));
+            this._resultDisplays[resultIds[i]] = display;
+            yield;
+        }
+
+        this._renderTask = null;
+        callback(true);
+    }
+
     _ensureResultActors(results, callback) {
         let metasNeeded = results.filter(
             resultId => this._resultDisplays[resultId] === undefined
@@ -232,7 +322,6 @@ var SearchResultsBase = GObject.registerClass({
                 if (this._cancellable.is_cancelled()) {
                     if (metas.length > 0)
                         log(`Search provider ${this.provider.id} returned results after the request was canceled`);
-                    callback(false);
                     return;
                 }
                 if (metas.length != metasNeeded.length) {
@@ -247,19 +336,20 @@ var SearchResultsBase = GObject.registerClass({
                     return;
                 }
 
-                metasNeeded.forEach((resultId, i) => {
-                    let meta = metas[i];
-                    let display = this._createResultDisplay(meta);
-                    display.connect('key-focus-in', this._keyFocusIn.bind(this));
-                    this._resultDisplays[resultId] = display;
-                });
-                callback(true);
+                this._renderTask = this._resultsView.scheduleRender(this.provider,
+                    this._createResultActors(metasNeeded, metas, callback));
             }, this._cancellable);
         }
     }
 
     updateSearch(providerResults, terms, callback) {
         this._terms = terms;
+
+        if (this._renderTask) {
+            this._resultsView.cancelRender(this._renderTask);
+            this._renderTask = null;
+        }
+
         if (providerResults.length == 0) {
             this._clearResultDisplay();
             this.hide();
@@ -469,6 +559,7 @@ var SearchResultsView = GObject.registerClass({
         this._results = {};
 
         this._providers = [];
+        this._remoteProvidersSerial = 0;
 
         this._highlightRegex = null;
 
@@ -480,6 +571,7 @@ var SearchResultsView = GObject.registerClass({
 
         this._searchTimeoutId = 0;
         this._cancellable = new Gio.Cancellable();
+        this._renderScheduler = new RenderScheduler();
 
         this._registerProvider(new AppDisplay.AppSearchProvider());
 
@@ -498,7 +590,11 @@ var SearchResultsView = GObject.registerClass({
             this._unregisterProvider(provider);
         });
 
+        // Providers load asynchronously; only the latest reload counts
+        let serial = ++this._remoteProvidersSerial;
         RemoteSearch.loadRemoteSearchProviders(this._searchSettings, providers => {
+            if (serial != this._remoteProvidersSerial)
+                return;
             providers.forEach(this._registerProvider.bind(this));
         });
     }
@@ -592,6 +688,12 @@ var SearchResultsView = GObject.registerClass({
         this._cancellable.cancel();
         this._cancellable.reset();
 
+        // Results still being fetched or created are for the old terms
+        this._providers.forEach(provider => {
+            provider.display.cancelUpdate();
+            provider.searchInProgress = false;
+        });
+
         if (terms.length == 0) {
             this._reset();
             return;
@@ -625,6 +727,16 @@ var SearchResultsView = GObject.registerClass({
         Util.ensureActorVisibleInScrollView(this._scrollView, provider.focusChild);
     }
 
+    // Queues @iter, a generator creating result actors for @provider;
+    // providers are handled in the order they are shown in
+    scheduleRender(provider, iter) {
+        return this._renderScheduler.add(this._providers.indexOf(provider), iter);
+    }
+
+    cancelRender(task) {
+        this._renderScheduler.remove(task);
+    }
+
     _ensureProviderDisplay(provider) {
         if (provider.display)
             return;
@@ -644,6 +756,7 @@ var SearchResultsView = GObject.registerClass({
     _clearDisplay() {
         this._providers.forEach(provider => {
             provider.display.clear();
+            provider.searchInProgress = false;
         });
     }
 
@@ -0,0 +1,186 @@
+// -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
+/* exported StatisticsService */
+
+const { Gio, GLib, Shell } = imports.gi;
+const ByteArray = imports.byteArray;
+
+const { loadInterfaceXML } = imports.misc.fileUtils;
+
+const StatisticsIface = loadInterfaceXML('org.gnome.Shell.Statistics');
+
+// Increase when the meaning of an existing statistic changes
+var SNAPSHOT_VERSION = 1;
+
+var DEFAULT_UPDATE_INTERVAL = 10000; // ms
+
+// Shortest interval between updates clients can ask for, and between
+// updates one client can force
+var MIN_UPDATE_INTERVAL = 250; // ms
+
+// Exports the statistics defined with Shell.PerfLog, so they can be
+// monitored without turning on performance logging. Collection only
+// runs the statistics callbacks, so it is cheap enough to do
+// periodically, but not arbitrarily often, so clients can only ask for
+// updates within limits. The connection and the interval used while no
+// client asks for one can be overridden for testing.
+var StatisticsService = class {
+    constructor(connection = Gio.DBus.session,
+                defaultInterval = DEFAULT_UPDATE_INTERVAL) {
+        this._perfLog = Shell.PerfLog.get_default();
+        this._connection = connection;
+
+        this._serial = 0;
+        this._timestamp = 0;
+        this._statistics = null;
+
+        this._defaultInterval = defaultInterval;
+        this._updateInterval = defaultInterval;
+        this._updateId = 0;
+
+        // sender => { interval, lastRefresh, watchId }
+        this._clients = new Map();
+
+        this._dbusImpl = Gio.DBusExportedObject.wrapJSObject(StatisticsIface, this);
+        this._dbusImpl.export(connection, '/org/gnome/Shell/Statistics');
+
+        this._update();
+        this._restartTimeout();
+    }
+
+    destroy() {
+        if (this._updateId) {
+            GLib.source_remove(this._updateId);
+            this._updateId = 0;
+        }
+
+        for (let client of this._clients.values())
+            this._connection.unwatch_name(client.watchId);
+        this._clients.clear();
+
+        this._dbusImpl.unexport();
+    }
+
+    _restartTimeout() {
+        if (this._updateId)
+            GLib.source_remove(this._updateId);
+        this._updateId = 0;
+
+        if (this._updateInterval == 0)
+            return;
+
+        this._updateId = GLib.timeout_add(GLib.PRIORITY_DEFAULT,
+                                          this._updateInterval, () => {
+                                              this._update();
+                                              return GLib.SOURCE_CONTINUE;
+                                          });
+        GLib.Source.set_name_by_id(this._updateId, '[gnome-shell] this._update');
+    }
+
+    _update() {
+        this._statistics = this._perfLog.snapshot_statistics();
+        this._timestamp = GLib.get_real_time();
+        this._serial++;
+
+        this._dbusImpl.emit_signal('SnapshotUpdated', this._packSnapshot());
+    }
+
+    _packSnapshot() {
+        return GLib.Variant.new_tuple([
+            new GLib.Variant('u', this._serial),
+            new GLib.Variant('x', this._timestamp),
+            this._statistics,
+        ]);
+    }
+
+    _ensureClient(sender) {
+        let client = this._clients.get(sender);
+        if (!client) {
+            client = { interval: 0, lastRefresh: 0 };
+            client.watchId = this._connection.watch_name(sender,
+                Gio.BusNameWatcherFlags.NONE, null,
+                this._onNameVanished.bind(this));
+            this._clients.set(sender, client);
+        }
+        return client;
+    }
+
+    _onNameVanished(connection, name) {
+        let client = this._clients.get(name);
+        if (!client)
+            return;
+
+        this._connection.unwatch_name(client.watchId);
+        this._clients.delete(name);
+        this._syncUpdateInterval();
+    }
+
+    _syncUpdateInterval() {
+        let interval = 0;
+        for (let client of this._clients.values()) {
+            if (client.interval > 0 && (interval == 0 || client.interval < interval))
+                interval = client.interval;
+        }
+
+        if (interval == 0)
+            interval = this._defaultInterval;
+
+        if (this._updateInterval == interval)
+            return;
+
+        this._updateInterval = interval;
+        this._restartTimeout();
+
+        this._dbusImpl.emit_property_changed('UpdateInterval',
+            new GLib.Variant('u', this._updateInterval));
+    }
+
+    GetSnapshotAsync(params, invocation) {
+        let [refresh] = params;
+
+        if (refresh) {
+            let client = this._ensureClient(invocation.get_sender());
+            let now = GLib.get_monotonic_time();
+
+            if (client.lastRefresh == 0 ||
+                now - client.lastRefresh >= MIN_UPDATE_INTERVAL * 1000) {
+                client.lastRefresh = now;
+                this._update();
+            }
+        }
+
+        invocation.return_value(this._packSnapshot());
+    }
+
+    SetUpdateIntervalAsync(params, invocation) {
+        let [interval] = params;
+        let client = this._ensureClient(invocation.get_sender());
+
+        client.interval = interval > 0 ? Math.max(interval, MIN_UPDATE_INTERVAL) : 0;
+        this._syncUpdateInterval();
+
+        invocation.return_value(null);
+    }
+
+    GetDescriptions() {
+        let out = Gio.MemoryOutputStream.new_resizable();
+        this._perfLog.dump_events(out);
+        out.close(null);
+
+        let events = JSON.parse(ByteArray.toString(out.steal_as_bytes().get_data()));
+        let descriptions = {};
+        for (let event of events) {
+            if (event.statistic)
+                descriptions[event.name] = event.description;
+        }
+
+        return descriptions;
+    }
+
+    get Version() {
+        return SNAPSHOT_VERSION;
+    }
+
+    get UpdateInterval() {
+        return this._updateInterval;
+    }
+};
@@ -45,6 +45,7 @@
 
 #include "shell-global-private.h"
 #include "shell-perf-log.h"
+#include "shell-startup-timeline-private.h"
 #include "shell-wm-private.h"
 
 #define GNOME_TYPE_SHELL_PLUGIN (gnome_shell_plugin_get_type ())
@@ -108,6 +109,8 @@ gnome_shell_plugin_start (MetaPlugin *plugin)
   GjsContext *gjs_context;
   ClutterBackend *backend;
 
+  shell_startup_timeline_begin ("plugin.start");
+
   backend = clutter_get_default_backend ();
   shell_plugin->cogl_context = clutter_backend_get_cogl_context (backend);
 
@@ -120,10 +123,14 @@ gnome_shell_plugin_start (MetaPlugin *plugin)
                                "x");
 
   shell_plugin->global = shell_global_get ();
+  shell_startup_timeline_begin ("plugin.setPlugin");
   _shell_global_set_plugin (shell_plugin->global, META_PLUGIN (shell_plugin));
+  shell_startup_timeline_end ("plugin.setPlugin");
 
   gjs_context = _shell_global_get_gjs_context (shell_plugin->global);
 
+  shell_startup_timeline_begin ("plugin.runJs");
+
   if (!gjs_context_eval (gjs_context,
                          "imports.ui.environment.init();"
                          "imports.ui.main.start();",
@@ -148,6 +155,11 @@ gnome_shell_plugin_start (MetaPlugin *plugin)
       g_object_unref (gjs_context);
       exit (1);
     }
+
+  shell_startup_timeline_end ("plugin.runJs");
+  shell_startup_timeline_end ("plugin.start");
+
+  _shell_startup_timeline_finish_on_first_frame (shell_global_get_stage (shell_plugin->global));
 }
 
 static ShellWM *
@@ -22,6 +22,7 @@
 #include "shell-global.h"
 #include "shell-global-private.h"
 #include "shell-perf-log.h"
+#include "shell-startup-timeline-private.h"
 #include "st.h"
 
 extern GType gnome_shell_plugin_get_type (void);
@@ -273,6 +274,59 @@ malloc_statistics_callback (ShellPerfLog *perf_log,
 #endif
 }
 
+static void
+memory_statistics_callback (ShellPerfLog *perf_log,
+                            gpointer      data)
+{
+  GHashTable *defined_subsystems = data;
+  g_autoptr(GVariant) usage = NULL;
+  GVariantIter iter;
+  const char *subsystem;
+  guint n_objects;
+  guint64 n_bytes;
+
+  usage = st_profiler_get_memory_usage ();
+
+  g_variant_iter_init (&iter, usage);
+  while (g_variant_iter_next (&iter, "(&sut)", &subsystem, &n_objects, &n_bytes))
+    {
+      g_autofree char *objects_name = NULL;
+      g_autofree char *bytes_name = NULL;
+
+      objects_name = g_strdup_printf ("memory.%sObjects", subsystem);
+      bytes_name = g_strdup_printf ("memory.%sBytes", subsystem);
+
+      /* Subsystems report in as they are first used */
+      if (!g_hash_table_contains (defined_subsystems, subsystem))
+        {
+          g_autofree char *objects_description = NULL;
+          g_autofree char *bytes_description = NULL;
+
+          objects_description =
+            g_strdup_printf ("Number of objects held by %s", subsystem);
+          bytes_description =
+            g_strdup_printf ("Memory used by %s, in bytes", subsystem);
+
+          shell_perf_log_define_statistic (perf_log, objects_name,
+                                           objects_description, "i");
+          shell_perf_log_define_statistic (perf_log, bytes_name,
+                                           bytes_description, "x");
+          g_hash_table_add (defined_subsystems, g_strdup (subsystem));
+        }
+
+      shell_perf_log_update_statistic_i (perf_log, objects_name, n_objects);
+      shell_perf_log_update_statistic_x (perf_log, bytes_name, n_bytes);
+    }
+}
+
+static void
+report_perf_log_memory (guint    *n_objects,
+                        guint64  *n_bytes,
+                        gpointer  user_data)
+{
+  shell_perf_log_get_memory_usage (user_data, n_objects, n_bytes);
+}
+
 static void
 shell_perf_log_init (void)
 {
@@ -298,6 +352,17 @@ shell_perf_log_init (void)
   shell_perf_log_add_statistics_callback (perf_log,
                                           malloc_statistics_callback,
                                           NULL, NULL);
+
+  /* Per-subsystem memory use, as reported to St's memory accounting */
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          memory_statistics_callback,
+                                          g_hash_table_new_full (g_str_hash,
+                                                                 g_str_equal,
+                                                                 g_free,
+                                                                 NULL),
+                                          (GDestroyNotify) g_hash_table_unref);
+
+  st_profiler_add_memory_reporter ("perfLog", report_perf_log_memory, perf_log);
 }
 
 static void
@@ -488,12 +553,16 @@ main (int argc, char **argv)
   GError *error = NULL;
   int ecode;
 
+  _shell_startup_timeline_init ();
+  shell_startup_timeline_begin ("main");
+
   bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
   bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
   textdomain (GETTEXT_PACKAGE);
 
   session_mode = (char *) g_getenv ("GNOME_SHELL_SESSION_MODE");
 
+  shell_startup_timeline_begin ("main.parseOptions");
   ctx = meta_get_option_context ();
   g_option_context_add_main_entries (ctx, gnome_shell_options, GETTEXT_PACKAGE);
   g_option_context_add_group (ctx, g_irepository_get_option_group ());
@@ -504,6 +573,7 @@ main (int argc, char **argv)
     }
 
   g_option_context_free (ctx);
+  shell_startup_timeline_end ("main.parseOptions");
 
   meta_plugin_manager_set_plugin_type (gnome_shell_plugin_get_type ());
 
@@ -512,7 +582,9 @@ main (int argc, char **argv)
 
   /* Prevent meta_init() from causing gtk to load the atk-bridge*/
   g_setenv ("NO_AT_BRIDGE", "1", TRUE);
+  shell_startup_timeline_begin ("main.metaInit");
   meta_init ();
+  shell_startup_timeline_end ("main.metaInit");
   g_unsetenv ("NO_AT_BRIDGE");
 
   /* FIXME: Add gjs API to set this stuff and don't depend on the
@@ -523,11 +595,13 @@ main (int argc, char **argv)
 
   shell_init_debug (g_getenv ("SHELL_DEBUG"));
 
+  shell_startup_timeline_begin ("main.shellInit");
   shell_dbus_init (meta_get_replace_current_wm ());
   shell_a11y_init ();
   shell_perf_log_init ();
   shell_introspection_init ();
   shell_fonts_init ();
+  shell_startup_timeline_end ("main.shellInit");
 
   g_log_set_default_handler (default_log_handler, NULL);
 
@@ -535,7 +609,9 @@ main (int argc, char **argv)
   if (session_mode == NULL)
     session_mode = is_gdm_mode ? (char *)"gdm" : (char *)"user";
 
+  shell_startup_timeline_begin ("main.globalInit");
   _shell_global_init ("session-mode", session_mode, NULL);
+  shell_startup_timeline_end ("main.globalInit");
 
   dump_gjs_stack_on_signal (SIGABRT);
   dump_gjs_stack_on_signal (SIGFPE);
@@ -549,9 +625,17 @@ main (int argc, char **argv)
     }
 
   shell_profiler_init ();
+
+  /* Everything from here on up to the first frame happens in the
+   * plugin's start() and the JS code it runs */
+  shell_startup_timeline_end ("main");
+
   ecode = meta_run ();
   shell_profiler_shutdown ();
 
+  /* Other references can keep the global alive past the end */
+  _shell_global_flush_state (shell_global_get ());
+
   g_debug ("Doing final cleanup");
   _shell_global_destroy_gjs_context (shell_global_get ());
   g_object_unref (shell_global_get ());
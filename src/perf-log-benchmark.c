@@ -0,0 +1,109 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Measures the cost of recording ShellPerfLog events by name and by
+ * handle, with the log enabled and disabled.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "shell-perf-log.h"
+
+#define DEFAULT_ITERATIONS 1000000
+
+/* A realistic number of defined events, so that the name lookups
+ * hit a hash table of representative size */
+#define N_FILLER_EVENTS 64
+
+static int iterations = DEFAULT_ITERATIONS;
+
+static GOptionEntry entries[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Events to record per measurement", "N" },
+  { NULL }
+};
+
+typedef enum {
+  BY_NAME,
+  BY_HANDLE
+} RecordMode;
+
+static double
+measure (ShellPerfLog *perf_log,
+         RecordMode    mode,
+         guint         handle)
+{
+  gint64 start, end;
+  int i;
+
+  start = g_get_monotonic_time ();
+
+  if (mode == BY_NAME)
+    {
+      for (i = 0; i < iterations; i++)
+        shell_perf_log_event_i (perf_log, "bench.event", i);
+    }
+  else
+    {
+      for (i = 0; i < iterations; i++)
+        shell_perf_log_record_i (perf_log, handle, i);
+    }
+
+  end = g_get_monotonic_time ();
+
+  return (end - start) * 1000.0 / iterations;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  ShellPerfLog *perf_log;
+  guint handle;
+  int i;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (iterations <= 0)
+    {
+      g_printerr ("Number of iterations must be positive\n");
+      return 1;
+    }
+
+  perf_log = shell_perf_log_get_default ();
+
+  for (i = 0; i < N_FILLER_EVENTS; i++)
+    {
+      char *name = g_strdup_printf ("bench.filler%d", i);
+      shell_perf_log_define_event (perf_log, name, "", "");
+      g_free (name);
+    }
+
+  handle = shell_perf_log_define_event (perf_log, "bench.event", "", "i");
+
+  printf ("%-10s %-8s %12s\n", "mode", "log", "ns/event");
+
+  shell_perf_log_set_enabled (perf_log, FALSE);
+  printf ("%-10s %-8s %12.2f\n", "by-name", "disabled",
+          measure (perf_log, BY_NAME, handle));
+  printf ("%-10s %-8s %12.2f\n", "by-handle", "disabled",
+          measure (perf_log, BY_HANDLE, handle));
+
+  shell_perf_log_set_enabled (perf_log, TRUE);
+  printf ("%-10s %-8s %12.2f\n", "by-name", "enabled",
+          measure (perf_log, BY_NAME, handle));
+  printf ("%-10s %-8s %12.2f\n", "by-handle", "enabled",
+          measure (perf_log, BY_HANDLE, handle));
+  shell_perf_log_set_enabled (perf_log, FALSE);
+
+  return 0;
+}
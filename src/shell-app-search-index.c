@@ -0,0 +1,693 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gio/gdesktopappinfo.h>
+
+#include "shell-app-search-index.h"
+
+/*
+ * ShellAppSearchIndex:
+ *
+ * An in-memory inverted index over the searchable fields of the
+ * installed applications, so that a search doesn't have to go over
+ * every desktop file on each keystroke.
+ *
+ * Field values are split into folded tokens with
+ * g_str_tokenize_and_fold(), like g_desktop_app_info_search() does. A
+ * search term matches the tokens it is a prefix of, which form a range
+ * of the sorted vocabulary, and, for terms of at least three bytes, the
+ * tokens it is a substring of, which are found through the trigrams of
+ * the term. Each token knows the applications it appears in, and the
+ * best field it appears in for each of them.
+ *
+ * Results are grouped by how well they match: by field, in the order
+ * of MatchField, with substring matches after prefix matches on the
+ * same field. When there are several search terms, all of them must
+ * match, and an application is ranked by its worst match.
+ *
+ * The index is updated incrementally: applications whose searchable
+ * fields didn't change keep their postings.
+ *
+ * When a search extends the previous one, the previous results can be
+ * narrowed down instead with shell_app_search_index_subsearch(), which
+ * matches the terms against the tokens of those results only.
+ */
+
+typedef enum {
+  MATCH_FIELD_NAME,
+  MATCH_FIELD_EXECUTABLE,
+  MATCH_FIELD_KEYWORDS,
+  MATCH_FIELD_GENERIC_NAME,
+  MATCH_FIELD_CATEGORIES,
+
+  N_MATCH_FIELDS
+} MatchField;
+
+/* A prefix and a substring match for each field */
+#define N_MATCH_SCORES (N_MATCH_FIELDS * 2)
+
+/* Shorter terms only match at the start of tokens */
+#define MIN_SUBSTRING_LENGTH 3
+
+typedef struct {
+  char *id;
+  char *fingerprint;      /* the indexed fields, to detect changes */
+  gboolean visible;
+  GPtrArray *tokens;      /* IndexToken, each once */
+} IndexEntry;
+
+typedef struct {
+  char *text;
+  GHashTable *entries;    /* IndexEntry -> best MatchField + 1 */
+} IndexToken;
+
+struct _ShellAppSearchIndex {
+  GHashTable *entries;    /* id -> IndexEntry */
+  GHashTable *tokens;     /* text -> IndexToken */
+  GPtrArray *vocabulary;  /* IndexToken, sorted by text */
+  GHashTable *trigrams;   /* trigram -> set of IndexToken */
+};
+
+ShellAppSearchIndex *
+shell_app_search_index_new (void)
+{
+  ShellAppSearchIndex *index;
+
+  index = g_new0 (ShellAppSearchIndex, 1);
+  index->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  index->tokens = g_hash_table_new (g_str_hash, g_str_equal);
+  index->vocabulary = g_ptr_array_new ();
+  index->trigrams = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free,
+                                           (GDestroyNotify) g_hash_table_unref);
+
+  return index;
+}
+
+/* Position of the first token in the vocabulary that doesn't sort
+ * before @text */
+static guint
+find_token_position (ShellAppSearchIndex *index,
+                     const char          *text)
+{
+  guint low = 0, high = index->vocabulary->len;
+
+  while (low < high)
+    {
+      guint mid = low + (high - low) / 2;
+      IndexToken *token = g_ptr_array_index (index->vocabulary, mid);
+
+      if (strcmp (token->text, text) < 0)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  return low;
+}
+
+static IndexToken *
+ensure_token (ShellAppSearchIndex *index,
+              const char          *text)
+{
+  IndexToken *token;
+  gsize i, len;
+
+  token = g_hash_table_lookup (index->tokens, text);
+  if (token != NULL)
+    return token;
+
+  token = g_new0 (IndexToken, 1);
+  token->text = g_strdup (text);
+  token->entries = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_insert (index->tokens, token->text, token);
+  g_ptr_array_insert (index->vocabulary,
+                      find_token_position (index, text), token);
+
+  len = strlen (text);
+  for (i = 0; i + 3 <= len; i++)
+    {
+      char trigram[4] = { text[i], text[i + 1], text[i + 2], '\0' };
+      GHashTable *tokens;
+
+      tokens = g_hash_table_lookup (index->trigrams, trigram);
+      if (tokens == NULL)
+        {
+          tokens = g_hash_table_new (NULL, NULL);
+          g_hash_table_insert (index->trigrams, g_strdup (trigram), tokens);
+        }
+
+      g_hash_table_add (tokens, token);
+    }
+
+  return token;
+}
+
+static void
+remove_token (ShellAppSearchIndex *index,
+              IndexToken          *token)
+{
+  gsize i, len;
+
+  len = strlen (token->text);
+  for (i = 0; i + 3 <= len; i++)
+    {
+      char trigram[4] = { token->text[i], token->text[i + 1],
+                          token->text[i + 2], '\0' };
+      GHashTable *tokens;
+
+      tokens = g_hash_table_lookup (index->trigrams, trigram);
+      if (tokens == NULL)
+        continue;
+
+      g_hash_table_remove (tokens, token);
+      if (g_hash_table_size (tokens) == 0)
+        g_hash_table_remove (index->trigrams, trigram);
+    }
+
+  g_ptr_array_remove_index (index->vocabulary,
+                            find_token_position (index, token->text));
+  g_hash_table_remove (index->tokens, token->text);
+
+  g_hash_table_unref (token->entries);
+  g_free (token->text);
+  g_free (token);
+}
+
+static void
+add_entry_token (ShellAppSearchIndex *index,
+                 IndexEntry          *entry,
+                 const char          *text,
+                 MatchField           field)
+{
+  IndexToken *token = ensure_token (index, text);
+  guint old_field;
+
+  old_field = GPOINTER_TO_UINT (g_hash_table_lookup (token->entries, entry));
+  if (old_field == 0)
+    g_ptr_array_add (entry->tokens, token);
+  else if (old_field <= field + 1)
+    return;
+
+  g_hash_table_insert (token->entries, entry, GUINT_TO_POINTER (field + 1));
+}
+
+static void
+add_field_tokens (ShellAppSearchIndex *index,
+                  IndexEntry          *entry,
+                  const char          *value,
+                  MatchField           field)
+{
+  g_auto(GStrv) tokens = NULL;
+  g_auto(GStrv) alternates = NULL;
+  int i;
+
+  if (value == NULL)
+    return;
+
+  tokens = g_str_tokenize_and_fold (value, NULL, &alternates);
+
+  for (i = 0; tokens[i]; i++)
+    add_entry_token (index, entry, tokens[i], field);
+  for (i = 0; alternates[i]; i++)
+    add_entry_token (index, entry, alternates[i], field);
+}
+
+static char *
+get_fingerprint (GDesktopAppInfo *info)
+{
+  GAppInfo *app_info = G_APP_INFO (info);
+  const char * const *keywords;
+  const char *generic_name, *executable, *categories;
+  g_autofree char *joined_keywords = NULL;
+
+  keywords = g_desktop_app_info_get_keywords (info);
+  generic_name = g_desktop_app_info_get_generic_name (info);
+  executable = g_app_info_get_executable (app_info);
+  categories = g_desktop_app_info_get_categories (info);
+
+  if (keywords != NULL)
+    joined_keywords = g_strjoinv (";", (char **) keywords);
+
+  return g_strdup_printf ("%d\n%s\n%s\n%s\n%s\n%s",
+                          g_app_info_should_show (app_info),
+                          g_app_info_get_name (app_info),
+                          executable ? executable : "",
+                          joined_keywords ? joined_keywords : "",
+                          generic_name ? generic_name : "",
+                          categories ? categories : "");
+}
+
+static IndexEntry *
+add_entry (ShellAppSearchIndex *index,
+           GDesktopAppInfo     *info,
+           char                *fingerprint)
+{
+  GAppInfo *app_info = G_APP_INFO (info);
+  const char * const *keywords;
+  const char *executable;
+  IndexEntry *entry;
+
+  entry = g_new0 (IndexEntry, 1);
+  entry->id = g_strdup (g_app_info_get_id (app_info));
+  entry->fingerprint = fingerprint;
+  entry->visible = g_app_info_should_show (app_info);
+  entry->tokens = g_ptr_array_new ();
+
+  add_field_tokens (index, entry, g_app_info_get_name (app_info),
+                    MATCH_FIELD_NAME);
+
+  executable = g_app_info_get_executable (app_info);
+  if (executable != NULL)
+    {
+      g_autofree char *basename = g_path_get_basename (executable);
+
+      add_field_tokens (index, entry, basename, MATCH_FIELD_EXECUTABLE);
+    }
+
+  keywords = g_desktop_app_info_get_keywords (info);
+  for (; keywords != NULL && *keywords != NULL; keywords++)
+    add_field_tokens (index, entry, *keywords, MATCH_FIELD_KEYWORDS);
+
+  add_field_tokens (index, entry, g_desktop_app_info_get_generic_name (info),
+                    MATCH_FIELD_GENERIC_NAME);
+  add_field_tokens (index, entry, g_desktop_app_info_get_categories (info),
+                    MATCH_FIELD_CATEGORIES);
+
+  g_hash_table_insert (index->entries, entry->id, entry);
+
+  return entry;
+}
+
+/* Frees @entry and drops its postings; the caller removes it from
+ * index->entries */
+static void
+free_entry (ShellAppSearchIndex *index,
+            IndexEntry          *entry)
+{
+  guint i;
+
+  for (i = 0; i < entry->tokens->len; i++)
+    {
+      IndexToken *token = g_ptr_array_index (entry->tokens, i);
+
+      g_hash_table_remove (token->entries, entry);
+      if (g_hash_table_size (token->entries) == 0)
+        remove_token (index, token);
+    }
+
+  g_ptr_array_unref (entry->tokens);
+  g_free (entry->fingerprint);
+  g_free (entry->id);
+  g_free (entry);
+}
+
+void
+shell_app_search_index_free (ShellAppSearchIndex *index)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, index->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      g_hash_table_iter_remove (&iter);
+      free_entry (index, value);
+    }
+
+  g_hash_table_unref (index->entries);
+  g_hash_table_unref (index->tokens);
+  g_ptr_array_unref (index->vocabulary);
+  g_hash_table_unref (index->trigrams);
+  g_free (index);
+}
+
+/*
+ * shell_app_search_index_update:
+ * @index: the index
+ * @app_infos: (element-type GAppInfo): all installed applications
+ *
+ * Brings @index up to date with @app_infos, reindexing only the
+ * applications that were added or changed since the last update.
+ */
+void
+shell_app_search_index_update (ShellAppSearchIndex *index,
+                               GList               *app_infos)
+{
+  g_autoptr(GHashTable) seen = NULL;
+  GHashTableIter iter;
+  gpointer value;
+  GList *l;
+
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (l = app_infos; l != NULL; l = l->next)
+    {
+      GDesktopAppInfo *info = l->data;
+      IndexEntry *entry;
+      const char *id;
+      char *fingerprint;
+
+      if (!G_IS_DESKTOP_APP_INFO (info))
+        continue;
+
+      id = g_app_info_get_id (G_APP_INFO (info));
+      if (id == NULL || !g_utf8_validate (id, -1, NULL))
+        continue;
+
+      g_hash_table_add (seen, (gpointer) id);
+
+      fingerprint = get_fingerprint (info);
+      entry = g_hash_table_lookup (index->entries, id);
+
+      if (entry != NULL && strcmp (entry->fingerprint, fingerprint) == 0)
+        {
+          g_free (fingerprint);
+          continue;
+        }
+
+      if (entry != NULL)
+        {
+          g_hash_table_remove (index->entries, id);
+          free_entry (index, entry);
+        }
+
+      add_entry (index, info, fingerprint);
+    }
+
+  g_hash_table_iter_init (&iter, index->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      IndexEntry *entry = value;
+
+      if (g_hash_table_contains (seen, entry->id))
+        continue;
+
+      g_hash_table_iter_remove (&iter);
+      free_entry (index, entry);
+    }
+}
+
+static void
+add_token_matches (GHashTable *matches,
+                   IndexToken *token,
+                   gboolean    is_substring)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, token->entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      guint field = GPOINTER_TO_UINT (value) - 1;
+      guint score = field * 2 + (is_substring ? 1 : 0);
+      guint old_score;
+
+      /* Scores are stored plus one, like fields */
+      old_score = GPOINTER_TO_UINT (g_hash_table_lookup (matches, key));
+      if (old_score == 0 || score + 1 < old_score)
+        g_hash_table_insert (matches, key, GUINT_TO_POINTER (score + 1));
+    }
+}
+
+static void
+add_substring_matches (ShellAppSearchIndex *index,
+                       GHashTable          *matches,
+                       const char          *term,
+                       gsize                len)
+{
+  GHashTable *candidates = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  gsize i;
+
+  /* Tokens containing the term contain all of its trigrams; the
+   * rarest one gives the fewest candidates to check */
+  for (i = 0; i + 3 <= len; i++)
+    {
+      char trigram[4] = { term[i], term[i + 1], term[i + 2], '\0' };
+      GHashTable *tokens;
+
+      tokens = g_hash_table_lookup (index->trigrams, trigram);
+      if (tokens == NULL)
+        return;
+
+      if (candidates == NULL ||
+          g_hash_table_size (tokens) < g_hash_table_size (candidates))
+        candidates = tokens;
+    }
+
+  g_hash_table_iter_init (&iter, candidates);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      IndexToken *token = key;
+
+      /* Prefix matches were already found, and score better */
+      if (strstr (token->text, term) != NULL &&
+          strncmp (token->text, term, len) != 0)
+        add_token_matches (matches, token, TRUE);
+    }
+}
+
+static GHashTable *
+match_term (ShellAppSearchIndex *index,
+            const char          *term)
+{
+  GHashTable *matches;
+  gsize len;
+  guint i;
+
+  matches = g_hash_table_new (NULL, NULL);
+  len = strlen (term);
+
+  /* Tokens starting with the term are a range of the vocabulary */
+  for (i = find_token_position (index, term); i < index->vocabulary->len; i++)
+    {
+      IndexToken *token = g_ptr_array_index (index->vocabulary, i);
+
+      if (strncmp (token->text, term, len) != 0)
+        break;
+
+      add_token_matches (matches, token, FALSE);
+    }
+
+  if (len >= MIN_SUBSTRING_LENGTH)
+    add_substring_matches (index, matches, term, len);
+
+  return matches;
+}
+
+static int
+compare_ids (gconstpointer a,
+             gconstpointer b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+static void
+add_result (GPtrArray  **groups,
+            IndexEntry  *entry,
+            guint        score)
+{
+  if (groups[score] == NULL)
+    groups[score] = g_ptr_array_new ();
+  g_ptr_array_add (groups[score], g_strdup (entry->id));
+}
+
+/* Frees @groups, returning the results in the format of
+ * g_desktop_app_info_search() */
+static char ***
+finish_results (GPtrArray **groups)
+{
+  GPtrArray *results;
+  int i;
+
+  results = g_ptr_array_new ();
+  for (i = 0; i < N_MATCH_SCORES; i++)
+    {
+      if (groups[i] == NULL)
+        continue;
+
+      g_ptr_array_sort (groups[i], compare_ids);
+      g_ptr_array_add (groups[i], NULL);
+      g_ptr_array_add (results, g_ptr_array_free (groups[i], FALSE));
+    }
+  g_ptr_array_add (results, NULL);
+
+  return (char ***) g_ptr_array_free (results, FALSE);
+}
+
+/*
+ * shell_app_search_index_search:
+ * @index: the index
+ * @search_string: the search string to use
+ *
+ * Searches @index, skipping applications that shouldn't be shown.
+ *
+ * Returns: groups of application IDs, best matches first, in the
+ *   format of g_desktop_app_info_search()
+ */
+char ***
+shell_app_search_index_search (ShellAppSearchIndex *index,
+                               const char          *search_string)
+{
+  g_auto(GStrv) terms = NULL;
+  g_autoptr(GHashTable) matches = NULL;
+  GPtrArray *groups[N_MATCH_SCORES] = { NULL, };
+  GHashTableIter iter;
+  gpointer key, value;
+  int i;
+
+  terms = g_str_tokenize_and_fold (search_string, NULL, NULL);
+
+  for (i = 0; terms[i]; i++)
+    {
+      GHashTable *term_matches = match_term (index, terms[i]);
+
+      if (matches == NULL)
+        {
+          matches = term_matches;
+          continue;
+        }
+
+      g_hash_table_iter_init (&iter, matches);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          gpointer term_score = g_hash_table_lookup (term_matches, key);
+
+          if (term_score == NULL)
+            g_hash_table_iter_remove (&iter);
+          else if (GPOINTER_TO_UINT (term_score) > GPOINTER_TO_UINT (value))
+            g_hash_table_iter_replace (&iter, term_score);
+        }
+
+      g_hash_table_unref (term_matches);
+    }
+
+  if (matches != NULL)
+    {
+      g_hash_table_iter_init (&iter, matches);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          IndexEntry *entry = key;
+          guint score = GPOINTER_TO_UINT (value) - 1;
+
+          if (entry->visible)
+            add_result (groups, entry, score);
+        }
+    }
+
+  return finish_results (groups);
+}
+
+/* Scores @entry against @terms by going through its tokens, the way
+ * a search through the whole index would; returns G_MAXUINT if some
+ * term doesn't match */
+static guint
+match_entry (IndexEntry  *entry,
+             char       **terms)
+{
+  guint worst_score = 0;
+  int i;
+
+  for (i = 0; terms[i]; i++)
+    {
+      gsize len = strlen (terms[i]);
+      guint best_score = G_MAXUINT;
+      guint j;
+
+      for (j = 0; j < entry->tokens->len; j++)
+        {
+          IndexToken *token = g_ptr_array_index (entry->tokens, j);
+          guint field, score;
+
+          field = GPOINTER_TO_UINT (g_hash_table_lookup (token->entries,
+                                                         entry)) - 1;
+
+          if (strncmp (token->text, terms[i], len) == 0)
+            score = field * 2;
+          else if (len >= MIN_SUBSTRING_LENGTH &&
+                   strstr (token->text, terms[i]) != NULL)
+            score = field * 2 + 1;
+          else
+            continue;
+
+          best_score = MIN (best_score, score);
+        }
+
+      if (best_score == G_MAXUINT)
+        return G_MAXUINT;
+
+      worst_score = MAX (worst_score, best_score);
+    }
+
+  return worst_score;
+}
+
+/*
+ * shell_app_search_index_subsearch:
+ * @index: the index
+ * @previous_ids: results of a previous search
+ * @previous_search_string: the search string of that search
+ * @search_string: the search string to use, which extends
+ *   @previous_search_string
+ *
+ * Like shell_app_search_index_search(), but only considers the
+ * applications in @previous_ids, so that the cost depends on the
+ * number of previous results rather than on the size of the index.
+ * Falls back to a full search if @search_string doesn't extend
+ * @previous_search_string term by term.
+ *
+ * Returns: groups of application IDs, best matches first, in the
+ *   format of g_desktop_app_info_search()
+ */
+char ***
+shell_app_search_index_subsearch (ShellAppSearchIndex *index,
+                                  const char * const  *previous_ids,
+                                  const char          *previous_search_string,
+                                  const char          *search_string)
+{
+  g_auto(GStrv) previous_terms = NULL;
+  g_auto(GStrv) terms = NULL;
+  GPtrArray *groups[N_MATCH_SCORES] = { NULL, };
+  int i;
+
+  previous_terms = g_str_tokenize_and_fold (previous_search_string, NULL, NULL);
+  terms = g_str_tokenize_and_fold (search_string, NULL, NULL);
+
+  if (terms[0] == NULL)
+    return finish_results (groups);
+
+  /* Only terms that extend the previous ones can narrow down the
+   * previous results. A term that just got long enough to match in the
+   * middle of tokens can match applications the previous search didn't
+   * find, too. */
+  for (i = 0; previous_terms[i]; i++)
+    {
+      if (terms[i] == NULL ||
+          !g_str_has_prefix (terms[i], previous_terms[i]) ||
+          (strlen (previous_terms[i]) < MIN_SUBSTRING_LENGTH &&
+           strlen (terms[i]) >= MIN_SUBSTRING_LENGTH))
+        return shell_app_search_index_search (index, search_string);
+    }
+
+  for (; *previous_ids != NULL; previous_ids++)
+    {
+      IndexEntry *entry;
+      guint score;
+
+      entry = g_hash_table_lookup (index->entries, *previous_ids);
+      if (entry == NULL || !entry->visible)
+        continue;
+
+      score = match_entry (entry, terms);
+      if (score != G_MAXUINT)
+        add_result (groups, entry, score);
+    }
+
+  return finish_results (groups);
+}
@@ -0,0 +1,21 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_APP_SEARCH_INDEX_H__
+#define __SHELL_APP_SEARCH_INDEX_H__
+
+#include <gio/gio.h>
+
+typedef struct _ShellAppSearchIndex ShellAppSearchIndex;
+
+ShellAppSearchIndex *shell_app_search_index_new    (void);
+void                 shell_app_search_index_free   (ShellAppSearchIndex *index);
+
+void                 shell_app_search_index_update (ShellAppSearchIndex *index,
+                                                    GList               *app_infos);
+char              ***shell_app_search_index_search (ShellAppSearchIndex *index,
+                                                    const char          *search_string);
+char              ***shell_app_search_index_subsearch (ShellAppSearchIndex *index,
+                                                       const char * const  *previous_ids,
+                                                       const char          *previous_search_string,
+                                                       const char          *search_string);
+
+#endif /* __SHELL_APP_SEARCH_INDEX_H__ */
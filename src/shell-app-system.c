@@ -8,8 +8,10 @@
 
 #include <gio/gio.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include "shell-app-private.h"
+#include "shell-app-search-index.h"
 #include "shell-window-tracker-private.h"
 #include "shell-app-system-private.h"
 #include "shell-global.h"
@@ -23,6 +25,14 @@
 #define RESCAN_TIMEOUT_MS 2500
 #define MAX_RESCAN_RETRIES 6
 
+/* Installing or upgrading packages changes many desktop files in a
+ * row; wait for INSTALLED_CHANGED_TIMEOUT_MS without changes before
+ * rescanning the installed apps, but no longer than
+ * INSTALLED_CHANGED_MAX_DELAY_MS after the first change.
+ */
+#define INSTALLED_CHANGED_TIMEOUT_MS 500
+#define INSTALLED_CHANGED_MAX_DELAY_MS 5000
+
 /* Vendor prefixes are something that can be preprended to a .desktop
  * file name.  Undo this.
  */
@@ -39,6 +49,7 @@ enum {
 
 enum {
   APP_STATE_CHANGED,
+  INSTALLED_APPS_CHANGED,
   INSTALLED_CHANGED,
   LAST_SIGNAL
 };
@@ -58,12 +69,26 @@ struct _ShellAppSystemPrivate {
   GHashTable *running_apps;
   GHashTable *id_to_app;
   GHashTable *startup_wm_class_to_id;
+  GHashTable *desktop_wm_class_to_id;
   GList *installed_apps;
+  GHashTable *installed_stamps;
+  ShellAppSearchIndex *search_index;
+
+  guint installed_changed_id;
+  gint64 first_installed_change;
 
   guint rescan_icons_timeout_id;
   guint n_rescan_retries;
 };
 
+/* What identifies a version of a desktop file, to tell which apps
+ * changed on a rescan without comparing their contents */
+typedef struct {
+  char *filename;
+  gint64 mtime;
+  gint64 size;
+} InstalledStamp;
+
 static void shell_app_system_finalize (GObject *object);
 
 G_DEFINE_TYPE_WITH_PRIVATE (ShellAppSystem, shell_app_system, G_TYPE_OBJECT);
@@ -81,6 +106,25 @@ static void shell_app_system_class_init(ShellAppSystemClass *klass)
                                              NULL, NULL, NULL,
                                              G_TYPE_NONE, 1,
                                              SHELL_TYPE_APP);
+  /**
+   * ShellAppSystem::installed-apps-changed:
+   * @self: the #ShellAppSystem
+   * @added: IDs of the apps that were installed
+   * @removed: IDs of the apps that were removed
+   * @changed: IDs of the apps whose desktop files changed
+   *
+   * Emitted when installed apps were added, removed or changed, right
+   * before #ShellAppSystem::installed-changed, for users that want to
+   * update only what changed.
+   */
+  signals[INSTALLED_APPS_CHANGED] =
+    g_signal_new ("installed-apps-changed",
+                  SHELL_TYPE_APP_SYSTEM,
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE, 3,
+                  G_TYPE_STRV, G_TYPE_STRV, G_TYPE_STRV);
   signals[INSTALLED_CHANGED] =
     g_signal_new ("installed-changed",
 		  SHELL_TYPE_APP_SYSTEM,
@@ -98,9 +142,6 @@ scan_startup_wm_class_to_id (ShellAppSystem *self)
 
   g_hash_table_remove_all (priv->startup_wm_class_to_id);
 
-  g_list_free_full (priv->installed_apps, g_object_unref);
-  priv->installed_apps = g_app_info_get_all ();
-
   for (l = priv->installed_apps; l != NULL; l = l->next)
     {
       GAppInfo *info = l->data;
@@ -121,6 +162,93 @@ scan_startup_wm_class_to_id (ShellAppSystem *self)
     }
 }
 
+static InstalledStamp *
+installed_stamp_new (GDesktopAppInfo *info)
+{
+  InstalledStamp *stamp;
+  GStatBuf buf;
+
+  stamp = g_new0 (InstalledStamp, 1);
+  stamp->filename = g_strdup (g_desktop_app_info_get_filename (info));
+
+  if (stamp->filename != NULL && g_stat (stamp->filename, &buf) == 0)
+    {
+      stamp->mtime = buf.st_mtime;
+      stamp->size = buf.st_size;
+    }
+
+  return stamp;
+}
+
+static void
+installed_stamp_free (InstalledStamp *stamp)
+{
+  g_free (stamp->filename);
+  g_free (stamp);
+}
+
+static gboolean
+installed_stamp_equal (InstalledStamp *a,
+                       InstalledStamp *b)
+{
+  return g_strcmp0 (a->filename, b->filename) == 0 &&
+         a->mtime == b->mtime &&
+         a->size == b->size;
+}
+
+/* Reloads the installed apps, and sorts the IDs of those that were
+ * added, removed or changed since the last time into @added, @removed
+ * and @changed */
+static void
+scan_installed_apps (ShellAppSystem *self,
+                     GPtrArray      *added,
+                     GPtrArray      *removed,
+                     GPtrArray      *changed)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  GHashTable *stamps;
+  GHashTableIter iter;
+  gpointer key;
+  GList *l;
+
+  g_list_free_full (priv->installed_apps, g_object_unref);
+  priv->installed_apps = g_app_info_get_all ();
+
+  stamps = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                  g_free, (GDestroyNotify) installed_stamp_free);
+
+  for (l = priv->installed_apps; l != NULL; l = l->next)
+    {
+      GAppInfo *info = l->data;
+      InstalledStamp *stamp, *old_stamp;
+      const char *id;
+
+      id = g_app_info_get_id (info);
+      if (id == NULL || !g_utf8_validate (id, -1, NULL))
+        continue;
+
+      stamp = installed_stamp_new (G_DESKTOP_APP_INFO (info));
+      old_stamp = g_hash_table_lookup (priv->installed_stamps, id);
+
+      if (old_stamp == NULL)
+        g_ptr_array_add (added, g_strdup (id));
+      else if (!installed_stamp_equal (old_stamp, stamp))
+        g_ptr_array_add (changed, g_strdup (id));
+
+      g_hash_table_insert (stamps, g_strdup (id), stamp);
+    }
+
+  g_hash_table_iter_init (&iter, priv->installed_stamps);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (!g_hash_table_contains (stamps, key))
+        g_ptr_array_add (removed, g_strdup (key));
+    }
+
+  g_hash_table_unref (priv->installed_stamps);
+  priv->installed_stamps = stamps;
+}
+
 static gboolean
 app_is_stale (ShellApp *app)
 {
@@ -160,12 +288,20 @@ app_is_stale (ShellApp *app)
   return !is_unchanged;
 }
 
-static gboolean
-stale_app_remove_func (gpointer key,
-                       gpointer value,
-                       gpointer user_data)
+static void
+remove_stale_apps (ShellAppSystem *self,
+                   GPtrArray      *ids)
 {
-  return app_is_stale (value);
+  guint i;
+
+  for (i = 0; i < ids->len; i++)
+    {
+      const char *id = g_ptr_array_index (ids, i);
+      ShellApp *app = g_hash_table_lookup (self->priv->id_to_app, id);
+
+      if (app != NULL && app_is_stale (app))
+        g_hash_table_remove (self->priv->id_to_app, id);
+    }
 }
 
 static gboolean
@@ -209,18 +345,83 @@ rescan_icon_theme (ShellAppSystem *self)
                                                  self);
 }
 
+static void
+rescan_installed_apps (ShellAppSystem *self)
+{
+  ShellAppSystemPrivate *priv = self->priv;
+  g_autoptr(GPtrArray) added = NULL;
+  g_autoptr(GPtrArray) removed = NULL;
+  g_autoptr(GPtrArray) changed = NULL;
+
+  rescan_icon_theme (self);
+
+  added = g_ptr_array_new_with_free_func (g_free);
+  removed = g_ptr_array_new_with_free_func (g_free);
+  changed = g_ptr_array_new_with_free_func (g_free);
+
+  scan_installed_apps (self, added, removed, changed);
+
+  /* Listeners of ::installed-changed also care about things that aren't
+   * desktop files, like search providers, so only the work that depends
+   * on the applications is skipped if none of them changed */
+  if (added->len > 0 || removed->len > 0 || changed->len > 0)
+    {
+      scan_startup_wm_class_to_id (self);
+      g_hash_table_remove_all (priv->desktop_wm_class_to_id);
+      shell_app_search_index_update (priv->search_index, priv->installed_apps);
+
+      remove_stale_apps (self, removed);
+      remove_stale_apps (self, changed);
+
+      g_ptr_array_add (added, NULL);
+      g_ptr_array_add (removed, NULL);
+      g_ptr_array_add (changed, NULL);
+
+      g_signal_emit (self, signals[INSTALLED_APPS_CHANGED], 0,
+                     added->pdata, removed->pdata, changed->pdata);
+    }
+
+  g_signal_emit (self, signals[INSTALLED_CHANGED], 0, NULL);
+}
+
+static gboolean
+installed_changed_timeout (gpointer user_data)
+{
+  ShellAppSystem *self = user_data;
+
+  self->priv->installed_changed_id = 0;
+  rescan_installed_apps (self);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 installed_changed (GAppInfoMonitor *monitor,
                    gpointer         user_data)
 {
   ShellAppSystem *self = user_data;
+  ShellAppSystemPrivate *priv = self->priv;
+  gint64 now = g_get_monotonic_time ();
 
-  rescan_icon_theme (self);
-  scan_startup_wm_class_to_id (self);
+  if (priv->installed_changed_id != 0)
+    {
+      /* Changes keep coming; let the pending rescan happen anyway */
+      if (now - priv->first_installed_change >=
+          INSTALLED_CHANGED_MAX_DELAY_MS * 1000)
+        return;
 
-  g_hash_table_foreach_remove (self->priv->id_to_app, stale_app_remove_func, NULL);
+      g_source_remove (priv->installed_changed_id);
+    }
+  else
+    {
+      priv->first_installed_change = now;
+    }
 
-  g_signal_emit (self, signals[INSTALLED_CHANGED], 0, NULL);
+  priv->installed_changed_id = g_timeout_add (INSTALLED_CHANGED_TIMEOUT_MS,
+                                              installed_changed_timeout,
+                                              self);
+  g_source_set_name_by_id (priv->installed_changed_id,
+                           "[gnome-shell] installed_changed_timeout");
 }
 
 static void
@@ -237,10 +438,15 @@ shell_app_system_init (ShellAppSystem *self)
                                            (GDestroyNotify)g_object_unref);
 
   priv->startup_wm_class_to_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  priv->desktop_wm_class_to_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  priv->installed_stamps = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  g_free,
+                                                  (GDestroyNotify) installed_stamp_free);
+  priv->search_index = shell_app_search_index_new ();
 
   monitor = g_app_info_monitor_get ();
   g_signal_connect (monitor, "changed", G_CALLBACK (installed_changed), self);
-  installed_changed (monitor, self);
+  rescan_installed_apps (self);
 }
 
 static void
@@ -252,7 +458,11 @@ shell_app_system_finalize (GObject *object)
   g_hash_table_destroy (priv->running_apps);
   g_hash_table_destroy (priv->id_to_app);
   g_hash_table_destroy (priv->startup_wm_class_to_id);
+  g_hash_table_destroy (priv->desktop_wm_class_to_id);
   g_list_free_full (priv->installed_apps, g_object_unref);
+  g_hash_table_destroy (priv->installed_stamps);
+  shell_app_search_index_free (priv->search_index);
+  g_clear_handle_id (&priv->installed_changed_id, g_source_remove);
   g_clear_handle_id (&priv->rescan_icons_timeout_id, g_source_remove);
 
   G_OBJECT_CLASS (shell_app_system_parent_class)->finalize (object);
@@ -337,26 +547,39 @@ shell_app_system_lookup_heuristic_basename (ShellAppSystem *system,
   return NULL;
 }
 
-/**
- * shell_app_system_lookup_desktop_wmclass:
- * @system: a #ShellAppSystem
- * @wmclass: (nullable): A WM_CLASS value
- *
- * Find a valid application whose .desktop file, without the extension
- * and properly canonicalized, matches @wmclass.
- *
- * Returns: (transfer none): A #ShellApp for @wmclass
- */
-ShellApp *
-shell_app_system_lookup_desktop_wmclass (ShellAppSystem *system,
-                                         const char     *wmclass)
+/* Like shell_app_system_lookup_heuristic_basename(), but only
+ * considers installed apps, so that misses don't have to go through
+ * g_desktop_app_info_new() */
+static char *
+find_installed_heuristic_basename (ShellAppSystem *system,
+                                   const char     *name)
+{
+  GHashTable *installed = system->priv->installed_stamps;
+  const char *const *prefix;
+
+  if (g_hash_table_contains (installed, name))
+    return g_strdup (name);
+
+  for (prefix = vendor_prefixes; *prefix != NULL; prefix++)
+    {
+      char *tmpid = g_strconcat (*prefix, name, NULL);
+
+      if (g_hash_table_contains (installed, tmpid))
+        return tmpid;
+
+      g_free (tmpid);
+    }
+
+  return NULL;
+}
+
+static char *
+find_desktop_id_for_wmclass (ShellAppSystem *system,
+                             const char     *wmclass)
 {
   char *canonicalized;
   char *desktop_file;
-  ShellApp *app;
-
-  if (wmclass == NULL)
-    return NULL;
+  char *id;
 
   /* First try without changing the case (this handles
      org.example.Foo.Bar.desktop applications)
@@ -366,11 +589,11 @@ shell_app_system_lookup_desktop_wmclass (ShellAppSystem *system,
      sets the instance part to org.example.Foo.Bar, so we're ok
   */
   desktop_file = g_strconcat (wmclass, ".desktop", NULL);
-  app = shell_app_system_lookup_heuristic_basename (system, desktop_file);
+  id = find_installed_heuristic_basename (system, desktop_file);
   g_free (desktop_file);
 
-  if (app)
-    return app;
+  if (id)
+    return id;
 
   canonicalized = g_ascii_strdown (wmclass, -1);
 
@@ -380,12 +603,51 @@ shell_app_system_lookup_desktop_wmclass (ShellAppSystem *system,
 
   desktop_file = g_strconcat (canonicalized, ".desktop", NULL);
 
-  app = shell_app_system_lookup_heuristic_basename (system, desktop_file);
+  id = find_installed_heuristic_basename (system, desktop_file);
 
   g_free (canonicalized);
   g_free (desktop_file);
 
-  return app;
+  return id;
+}
+
+/**
+ * shell_app_system_lookup_desktop_wmclass:
+ * @system: a #ShellAppSystem
+ * @wmclass: (nullable): A WM_CLASS value
+ *
+ * Find a valid application whose .desktop file, without the extension
+ * and properly canonicalized, matches @wmclass.
+ *
+ * Returns: (transfer none): A #ShellApp for @wmclass
+ */
+ShellApp *
+shell_app_system_lookup_desktop_wmclass (ShellAppSystem *system,
+                                         const char     *wmclass)
+{
+  ShellAppSystemPrivate *priv = system->priv;
+  char *id;
+
+  if (wmclass == NULL)
+    return NULL;
+
+  /* Windows of the same app keep asking for the same WM_CLASS, so the
+   * outcome of the heuristics is kept until the installed apps change,
+   * including when nothing matched (an empty ID) */
+  id = g_hash_table_lookup (priv->desktop_wm_class_to_id, wmclass);
+  if (id == NULL)
+    {
+      id = find_desktop_id_for_wmclass (system, wmclass);
+      if (id == NULL)
+        id = g_strdup ("");
+
+      g_hash_table_insert (priv->desktop_wm_class_to_id, g_strdup (wmclass), id);
+    }
+
+  if (*id == '\0')
+    return NULL;
+
+  return shell_app_system_lookup_app (system, id);
 }
 
 /**
@@ -472,25 +734,54 @@ shell_app_system_get_running (ShellAppSystem *self)
  * shell_app_system_search:
  * @search_string: the search string to use
  *
- * Wrapper around g_desktop_app_info_search() that replaces results that
- * don't validate as UTF-8 with the empty string.
+ * Searches the names, generic names, keywords, executables and
+ * categories of the installed applications, like
+ * g_desktop_app_info_search(). Unlike that function, this uses an index
+ * the app system keeps up to date as applications are installed and
+ * removed, and leaves out applications that shouldn't be shown.
  *
  * Returns: (array zero-terminated=1) (element-type GStrv) (transfer full): a
- *   list of strvs.  Free each item with g_strfreev() and free the outer
- *   list with g_free().
+ *   list of strvs, grouped by how well they match, best first.  Free each
+ *   item with g_strfreev() and free the outer list with g_free().
  */
 char ***
 shell_app_system_search (const char *search_string)
 {
-  char ***results = g_desktop_app_info_search (search_string);
-  char ***groups, **ids;
+  ShellAppSystem *self = shell_app_system_get_default ();
+
+  return shell_app_search_index_search (self->priv->search_index,
+                                        search_string);
+}
 
-  for (groups = results; *groups; groups++)
-    for (ids = *groups; *ids; ids++)
-      if (!g_utf8_validate (*ids, -1, NULL))
-        **ids = '\0';
+/**
+ * shell_app_system_subsearch:
+ * @previous_results: (array zero-terminated=1): application IDs found
+ *   by a previous search
+ * @previous_search_string: the search string of that search
+ * @search_string: the search string to use, which should start with
+ *   @previous_search_string
+ *
+ * Like shell_app_system_search(), but narrows down the results of a
+ * previous search rather than searching all installed applications,
+ * so that refining a search gets cheaper as the results get fewer.
+ * If @search_string doesn't extend @previous_search_string, all
+ * installed applications are searched.
+ *
+ * Returns: (array zero-terminated=1) (element-type GStrv) (transfer full): a
+ *   list of strvs, grouped by how well they match, best first.  Free each
+ *   item with g_strfreev() and free the outer list with g_free().
+ */
+char ***
+shell_app_system_subsearch (const char * const *previous_results,
+                            const char         *previous_search_string,
+                            const char         *search_string)
+{
+  ShellAppSystem *self = shell_app_system_get_default ();
 
-  return results;
+  return shell_app_search_index_subsearch (self->priv->search_index,
+                                           previous_results,
+                                           previous_search_string,
+                                           search_string);
 }
 
 /**
@@ -18,6 +18,7 @@
 #include "shell-app-usage.h"
 #include "shell-window-tracker.h"
 #include "shell-global.h"
+#include "st.h"
 
 /* This file includes modified code from
  * desktop-data-engine/engine-dbus/hippo-application-monitor.c
@@ -46,8 +47,32 @@
 
 #define USAGE_CLEAN_DAYS 7 /* If after 7 days we haven't seen an app, purge it */
 
-/* Data is saved to file SHELL_CONFIG_DIR/DATA_FILENAME */
+/* Data is saved to file SHELL_CONFIG_DIR/USAGE_FILENAME, as a
+ * serialized GVariant of type USAGE_FORMAT. Changes since then are
+ * appended to SHELL_CONFIG_DIR/JOURNAL_FILENAME, which starts with the
+ * format version and the generation of the usage file it applies to,
+ * as little-endian 32-bit integers, followed by records. Each record
+ * is the little-endian 64-bit size of a serialized GVariant of type
+ * USAGE_RECORD_FORMAT, and that variant, padded to 8 bytes. Once the
+ * journal holds JOURNAL_MAX_RECORDS records, or scores were normalized
+ * or apps forgotten, the usage file is rewritten and the journal
+ * started over.
+ *
+ * Older versions saved the data as XML to SHELL_CONFIG_DIR/DATA_FILENAME;
+ * that file is migrated and removed on first start.
+ */
 #define DATA_FILENAME "application_state"
+#define USAGE_FILENAME "application-usage"
+#define JOURNAL_FILENAME "application-usage.journal"
+
+/* Increase when changing the format of the usage file or the journal */
+#define USAGE_FORMAT_VERSION 1
+
+#define USAGE_FORMAT "(uua(sdx))" /* version, generation, apps */
+#define USAGE_RECORD_FORMAT "(sdx)" /* id, score, last seen */
+
+#define JOURNAL_HEADER_SIZE 8
+#define JOURNAL_MAX_RECORDS 256
 
 #define IDLE_TIME_TRANSITION_SECONDS 30 /* If we transition to idle, only count
                                          * this many seconds of usage */
@@ -81,6 +106,13 @@ struct _ShellAppUsage
   GObject parent;
 
   GFile *configfile;
+  char *usage_path;
+  char *journal_path;
+  GFile *journal_file;
+  guint generation;
+  guint n_journal_records;
+  gboolean needs_compaction;
+
   GDBusProxy *session_proxy;
   GSettings *privacy_settings;
   guint idle_focus_change_id;
@@ -93,6 +125,9 @@ struct _ShellAppUsage
 
   /* <char *appid, UsageData *usage> */
   GHashTable *app_usages;
+
+  /* UsageData, by decreasing score */
+  GPtrArray *ranking;
 };
 
 G_DEFINE_TYPE (ShellAppUsage, shell_app_usage, G_TYPE_OBJECT);
@@ -102,6 +137,9 @@ struct UsageData
 {
   gdouble score; /* Based on the number of times we'e seen the app and normalized */
   long last_seen; /* Used to clear old apps we've only seen a few times */
+  gboolean dirty; /* Changed since last saved */
+  const char *appid; /* Owned by the app_usages key */
+  guint rank; /* Position in the ranking */
 };
 
 static void shell_app_usage_finalize (GObject *object);
@@ -134,6 +172,71 @@ shell_app_usage_class_init (ShellAppUsageClass *klass)
   gobject_class->finalize = shell_app_usage_finalize;
 }
 
+static UsageData *
+add_usage (ShellAppUsage *self,
+           const char    *appid)
+{
+  UsageData *usage;
+  char *key;
+
+  key = g_strdup (appid);
+
+  /* No score yet, so it ranks last */
+  usage = g_new0 (UsageData, 1);
+  usage->appid = key;
+  usage->rank = self->ranking->len;
+
+  g_hash_table_insert (self->app_usages, key, usage);
+  g_ptr_array_add (self->ranking, usage);
+
+  return usage;
+}
+
+/* Move @usage up the ranking, past the apps whose score it exceeds now */
+static void
+promote_usage (ShellAppUsage *self,
+               UsageData     *usage)
+{
+  UsageData **ranking = (UsageData **) self->ranking->pdata;
+  guint rank = usage->rank;
+
+  while (rank > 0 && ranking[rank - 1]->score < usage->score)
+    {
+      ranking[rank] = ranking[rank - 1];
+      ranking[rank]->rank = rank;
+      rank--;
+    }
+
+  ranking[rank] = usage;
+  usage->rank = rank;
+}
+
+static int
+compare_usage_scores (gconstpointer a,
+                      gconstpointer b)
+{
+  const UsageData *usage_a = *(UsageData **) a;
+  const UsageData *usage_b = *(UsageData **) b;
+
+  if (usage_a->score > usage_b->score)
+    return -1;
+  else if (usage_a->score < usage_b->score)
+    return 1;
+
+  return strcmp (usage_a->appid, usage_b->appid);
+}
+
+static void
+sort_ranking (ShellAppUsage *self)
+{
+  guint i;
+
+  g_ptr_array_sort (self->ranking, compare_usage_scores);
+
+  for (i = 0; i < self->ranking->len; i++)
+    ((UsageData *) g_ptr_array_index (self->ranking, i))->rank = i;
+}
+
 static UsageData *
 get_usage_for_app (ShellAppUsage *self,
                    ShellApp      *app)
@@ -145,10 +248,7 @@ get_usage_for_app (ShellAppUsage *self,
   if (usage)
     return usage;
 
-  usage = g_new0 (UsageData, 1);
-  g_hash_table_insert (self->app_usages, g_strdup (appid), usage);
-
-  return usage;
+  return add_usage (self, appid);
 }
 
 /* Limit the score to a certain level so that most used apps can change */
@@ -162,6 +262,11 @@ normalize_usage (ShellAppUsage *self)
 
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &usage))
     usage->score /= 2;
+
+  /* Halving every score keeps the ranking in order */
+
+  /* Changes every app, which the journal isn't meant for */
+  self->needs_compaction = TRUE;
 }
 
 static void
@@ -176,12 +281,14 @@ increment_usage_for_app_at_time (ShellAppUsage *self,
   usage = get_usage_for_app (self, app);
 
   usage->last_seen = time;
+  usage->dirty = TRUE;
 
   elapsed = time - self->watch_start_time;
   usage_count = elapsed / FOCUS_TIME_MIN_SECONDS;
   if (usage_count > 0)
     {
       usage->score += usage_count;
+      promote_usage (self, usage);
       if (usage->score > SCORE_MAX)
         normalize_usage (self);
       ensure_queued_save (self);
@@ -213,7 +320,10 @@ on_app_state_changed (ShellAppSystem *app_system,
   running = shell_app_get_state (app) == SHELL_APP_STATE_RUNNING;
 
   if (running)
-    usage->last_seen = get_time ();
+    {
+      usage->last_seen = get_time ();
+      usage->dirty = TRUE;
+    }
 }
 
 static void
@@ -286,6 +396,7 @@ shell_app_usage_init (ShellAppUsage *self)
   global = shell_global_get ();
 
   self->app_usages = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->ranking = g_ptr_array_new ();
 
   tracker = shell_window_tracker_get_default ();
   g_signal_connect (tracker, "notify::focus-app", G_CALLBACK (on_focus_app_changed), self);
@@ -310,9 +421,12 @@ shell_app_usage_init (ShellAppUsage *self)
 
   g_object_get (global, "userdatadir", &shell_userdata_dir, NULL),
   path = g_build_filename (shell_userdata_dir, DATA_FILENAME, NULL);
-  g_free (shell_userdata_dir);
   self->configfile = g_file_new_for_path (path);
   g_free (path);
+  self->usage_path = g_build_filename (shell_userdata_dir, USAGE_FILENAME, NULL);
+  self->journal_path = g_build_filename (shell_userdata_dir, JOURNAL_FILENAME, NULL);
+  self->journal_file = g_file_new_for_path (self->journal_path);
+  g_free (shell_userdata_dir);
   restore_from_file (self);
 
   self->privacy_settings = g_settings_new(PRIVACY_SCHEMA);
@@ -333,28 +447,16 @@ shell_app_usage_finalize (GObject *object)
   g_object_unref (self->privacy_settings);
 
   g_object_unref (self->configfile);
+  g_object_unref (self->journal_file);
+  g_free (self->usage_path);
+  g_free (self->journal_path);
 
   g_object_unref (self->session_proxy);
 
-  G_OBJECT_CLASS (shell_app_usage_parent_class)->finalize(object);
-}
-
-static int
-sort_apps_by_usage (gconstpointer a,
-                    gconstpointer b,
-                    gpointer      datap)
-{
-  ShellAppUsage *self = datap;
-  ShellApp *app_a, *app_b;
-  UsageData *usage_a, *usage_b;
+  g_ptr_array_unref (self->ranking);
+  g_hash_table_destroy (self->app_usages);
 
-  app_a = (ShellApp*)a;
-  app_b = (ShellApp*)b;
-
-  usage_a = g_hash_table_lookup (self->app_usages, shell_app_get_id (app_a));
-  usage_b = g_hash_table_lookup (self->app_usages, shell_app_get_id (app_b));
-
-  return usage_b->score - usage_a->score;
+  G_OBJECT_CLASS (shell_app_usage_parent_class)->finalize(object);
 }
 
 /**
@@ -367,30 +469,98 @@ GSList *
 shell_app_usage_get_most_used (ShellAppUsage   *self)
 {
   GSList *apps;
-  char *appid;
   ShellAppSystem *appsys;
-  GHashTableIter iter;
+  guint i;
 
   appsys = shell_app_system_get_default ();
 
-  g_hash_table_iter_init (&iter, self->app_usages);
   apps = NULL;
-  while (g_hash_table_iter_next (&iter, (gpointer *) &appid, NULL))
+  for (i = self->ranking->len; i > 0; i--)
     {
+      UsageData *usage = g_ptr_array_index (self->ranking, i - 1);
       ShellApp *app;
 
-      app = shell_app_system_lookup_app (appsys, appid);
+      app = shell_app_system_lookup_app (appsys, usage->appid);
       if (!app)
         continue;
 
       apps = g_slist_prepend (apps, g_object_ref (app));
     }
 
-  apps = g_slist_sort_with_data (apps, sort_apps_by_usage, self);
-
   return apps;
 }
 
+/**
+ * shell_app_usage_get_rank:
+ * @self: the usage instance to request
+ * @id: ID of an app
+ *
+ * Get the position of @id among the apps ordered by frequency of use.
+ *
+ * Returns: the rank of @id, 0 being the most used app, or -1 if
+ *          @id has not been used
+ */
+int
+shell_app_usage_get_rank (ShellAppUsage *self,
+                          const char    *id)
+{
+  UsageData *usage;
+
+  usage = g_hash_table_lookup (self->app_usages, id);
+
+  return usage ? (int) usage->rank : -1;
+}
+
+/**
+ * shell_app_usage_sort_ids:
+ * @self: the usage instance to request
+ * @ids: (array zero-terminated=1): app IDs
+ *
+ * Sort @ids by frequency of use, most used first. Apps that have
+ * not been used follow in their original order.
+ *
+ * Returns: (array zero-terminated=1) (transfer full): the sorted IDs
+ */
+char **
+shell_app_usage_sort_ids (ShellAppUsage      *self,
+                          const char * const *ids)
+{
+  g_autofree const char **ranked = NULL;
+  GPtrArray *sorted;
+  guint n_ids, i;
+
+  n_ids = ids ? g_strv_length ((char **) ids) : 0;
+  sorted = g_ptr_array_sized_new (n_ids + 1);
+
+  /* Place the used apps by rank, then collect them in order */
+  ranked = g_new0 (const char *, self->ranking->len);
+
+  for (i = 0; i < n_ids; i++)
+    {
+      UsageData *usage = g_hash_table_lookup (self->app_usages, ids[i]);
+
+      if (usage && ranked[usage->rank] == NULL)
+        ranked[usage->rank] = ids[i];
+    }
+
+  for (i = 0; i < self->ranking->len; i++)
+    {
+      if (ranked[i])
+        g_ptr_array_add (sorted, g_strdup (ranked[i]));
+    }
+
+  for (i = 0; i < n_ids; i++)
+    {
+      UsageData *usage = g_hash_table_lookup (self->app_usages, ids[i]);
+
+      if (!usage || ranked[usage->rank] != ids[i])
+        g_ptr_array_add (sorted, g_strdup (ids[i]));
+    }
+
+  g_ptr_array_add (sorted, NULL);
+
+  return (char **) g_ptr_array_free (sorted, FALSE);
+}
 
 /**
  * shell_app_usage_compare:
@@ -408,19 +578,19 @@ shell_app_usage_compare (ShellAppUsage *self,
                          const char    *id_a,
                          const char    *id_b)
 {
-  UsageData *usage_a, *usage_b;
+  int rank_a, rank_b;
 
-  usage_a = g_hash_table_lookup (self->app_usages, id_a);
-  usage_b = g_hash_table_lookup (self->app_usages, id_b);
+  rank_a = shell_app_usage_get_rank (self, id_a);
+  rank_b = shell_app_usage_get_rank (self, id_b);
 
-  if (usage_a == NULL && usage_b == NULL)
+  if (rank_a == rank_b)
     return 0;
-  else if (usage_a == NULL)
+  else if (rank_a == -1)
     return 1;
-  else if (usage_b == NULL)
+  else if (rank_b == -1)
     return -1;
 
-  return usage_b->score - usage_a->score;
+  return rank_a < rank_b ? -1 : 1;
 }
 
 static void
@@ -439,163 +609,200 @@ ensure_queued_save (ShellAppUsage *self)
 static gboolean
 idle_clean_usage (ShellAppUsage *self)
 {
-  GHashTableIter iter;
   UsageData *usage;
   long current_time;
   long week_ago;
+  guint i, rank;
 
   current_time = get_time ();
   week_ago = current_time - (7 * 24 * 60 * 60);
 
-  g_hash_table_iter_init (&iter, self->app_usages);
-
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &usage))
+  for (i = 0, rank = 0; i < self->ranking->len; i++)
     {
+      usage = g_ptr_array_index (self->ranking, i);
+
       if ((usage->score < SCORE_MIN) &&
           (usage->last_seen < week_ago))
-        g_hash_table_iter_remove (&iter);
+        {
+          g_hash_table_remove (self->app_usages, usage->appid);
+
+          /* The journal can't forget apps */
+          self->needs_compaction = TRUE;
+          continue;
+        }
+
+      usage->rank = rank;
+      self->ranking->pdata[rank++] = usage;
     }
 
+  g_ptr_array_set_size (self->ranking, rank);
+
   return FALSE;
 }
 
-static gboolean
-write_escaped (GDataOutputStream   *stream,
-               const char          *str,
-               GError             **error)
+static void
+set_usage (ShellAppUsage *self,
+           const char    *appid,
+           double         score,
+           long           last_seen)
 {
-  gboolean ret;
-  char *quoted = g_markup_escape_text (str, -1);
-  ret = g_data_output_stream_put_string (stream, quoted, NULL, error);
-  g_free (quoted);
-  return ret;
+  UsageData *usage;
+
+  usage = g_hash_table_lookup (self->app_usages, appid);
+  if (usage == NULL)
+    usage = add_usage (self, appid);
+
+  /* Callers sort the ranking once they're done */
+  usage->score = score;
+  usage->last_seen = last_seen;
 }
 
-static gboolean
-write_attribute_string (GDataOutputStream *stream,
-                        const char        *elt_name,
-                        const char        *str,
-                        GError           **error)
+/* Rewrite the usage file with all data, and start a new journal */
+static void
+write_usage_file (ShellAppUsage *self)
 {
-  gboolean ret = FALSE;
-  char *elt;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  g_autoptr(GVariant) state = NULL;
+  g_autoptr(GError) error = NULL;
+  guint32 header[2];
+  char *id;
+  UsageData *usage;
 
-  elt = g_strdup_printf (" %s=\"", elt_name);
-  ret = g_data_output_stream_put_string (stream, elt, NULL, error);
-  g_free (elt);
-  if (!ret)
-    goto out;
+  /* Until this succeeds, the journal is no good */
+  self->needs_compaction = TRUE;
 
-  ret = write_escaped (stream, str, error);
-  if (!ret)
-    goto out;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sdx)"));
 
-  ret = g_data_output_stream_put_string (stream, "\"", NULL, error);
+  g_hash_table_iter_init (&iter, self->app_usages);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &id, (gpointer *) &usage))
+    {
+      usage->dirty = FALSE;
 
-out:
-  return ret;
-}
+      if (!shell_app_system_lookup_app (shell_app_system_get_default (), id))
+        continue;
 
-static gboolean
-write_attribute_uint (GDataOutputStream *stream,
-                      const char        *elt_name,
-                      guint              value,
-                      GError           **error)
-{
-  gboolean ret;
-  char *buf;
+      g_variant_builder_add (&builder, "(sdx)",
+                             id, usage->score, (gint64) usage->last_seen);
+    }
+
+  state = g_variant_ref_sink (g_variant_new (USAGE_FORMAT,
+                                             USAGE_FORMAT_VERSION,
+                                             self->generation + 1,
+                                             &builder));
+
+  /* Parent directory is already created by shell-global */
+  if (!g_file_set_contents (self->usage_path,
+                            g_variant_get_data (state),
+                            g_variant_get_size (state),
+                            &error))
+    {
+      g_debug ("Could not save applications usage data: %s", error->message);
+      return;
+    }
 
-  buf = g_strdup_printf ("%u", value);
-  ret = write_attribute_string (stream, elt_name, buf, error);
-  g_free (buf);
+  self->generation++;
 
-  return ret;
+  header[0] = GUINT32_TO_LE (USAGE_FORMAT_VERSION);
+  header[1] = GUINT32_TO_LE (self->generation);
+
+  if (!g_file_set_contents (self->journal_path,
+                            (const char *) header, sizeof (header),
+                            &error))
+    {
+      g_debug ("Could not save applications usage data: %s", error->message);
+      return;
+    }
+
+  self->n_journal_records = 0;
+  self->needs_compaction = FALSE;
 }
 
-static gboolean
-write_attribute_double (GDataOutputStream *stream,
-                        const char        *elt_name,
-                        double             value,
-                        GError           **error)
+static void
+append_journal_record (GByteArray *records,
+                       const char *appid,
+                       UsageData  *usage)
 {
-  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
-  gboolean ret;
+  static const guint8 padding[8] = { 0, };
+  g_autoptr(GVariant) record = NULL;
+  guint64 size_le;
+  gsize size, offset;
+
+  record = g_variant_ref_sink (g_variant_new (USAGE_RECORD_FORMAT,
+                                              appid, usage->score,
+                                              (gint64) usage->last_seen));
+  size = g_variant_get_size (record);
+  size_le = GUINT64_TO_LE (size);
 
-  g_ascii_dtostr (buf, sizeof (buf), value);
-  ret = write_attribute_string (stream, elt_name, buf, error);
+  g_byte_array_append (records, (const guint8 *) &size_le, sizeof (size_le));
 
-  return ret;
+  offset = records->len;
+  g_byte_array_set_size (records, offset + size);
+  g_variant_store (record, records->data + offset);
+
+  /* Keep the next record aligned */
+  g_byte_array_append (records, padding, (8 - size % 8) % 8);
 }
 
-/* Save app data lists to file */
-static gboolean
-idle_save_application_usage (gpointer data)
+/* Append the apps that changed since the last save to the journal */
+static void
+append_to_journal (ShellAppUsage *self)
 {
-  ShellAppUsage *self = SHELL_APP_USAGE (data);
-  char *id;
+  g_autoptr(GByteArray) records = NULL;
+  g_autoptr(GFileOutputStream) output = NULL;
+  g_autoptr(GError) error = NULL;
   GHashTableIter iter;
+  guint n_records = 0;
+  char *id;
   UsageData *usage;
-  GFileOutputStream *output;
-  GOutputStream *buffered_output;
-  GDataOutputStream *data_output;
-  GError *error = NULL;
-
-  self->save_id = 0;
-
-  /* Parent directory is already created by shell-global */
-  output = g_file_replace (self->configfile, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
-  if (!output)
-    {
-      g_debug ("Could not save applications usage data: %s", error->message);
-      g_error_free (error);
-      return FALSE;
-    }
-  buffered_output = g_buffered_output_stream_new (G_OUTPUT_STREAM (output));
-  g_object_unref (output);
-  data_output = g_data_output_stream_new (G_OUTPUT_STREAM (buffered_output));
-  g_object_unref (buffered_output);
 
-  if (!g_data_output_stream_put_string (data_output, "<?xml version=\"1.0\"?>\n<application-state>\n", NULL, &error))
-    goto out;
-  if (!g_data_output_stream_put_string (data_output, "  <context id=\"\">\n", NULL, &error))
-    goto out;
+  records = g_byte_array_new ();
 
   g_hash_table_iter_init (&iter, self->app_usages);
-
   while (g_hash_table_iter_next (&iter, (gpointer *) &id, (gpointer *) &usage))
     {
-      ShellApp *app;
-
-      app = shell_app_system_lookup_app (shell_app_system_get_default(), id);
-
-      if (!app)
+      if (!usage->dirty)
         continue;
 
-      if (!g_data_output_stream_put_string (data_output, "    <application", NULL, &error))
-        goto out;
-      if (!write_attribute_string (data_output, "id", id, &error))
-        goto out;
-      if (!write_attribute_double (data_output, "score", usage->score, &error))
-        goto out;
-      if (!write_attribute_uint (data_output, "last-seen", usage->last_seen, &error))
-        goto out;
-      if (!g_data_output_stream_put_string (data_output, "/>\n", NULL, &error))
-        goto out;
+      append_journal_record (records, id, usage);
+      usage->dirty = FALSE;
+      n_records++;
     }
-  if (!g_data_output_stream_put_string (data_output, "  </context>\n", NULL, &error))
-    goto out;
-  if (!g_data_output_stream_put_string (data_output, "</application-state>\n", NULL, &error))
-    goto out;
 
-out:
-  if (!error)
-    g_output_stream_close_async (G_OUTPUT_STREAM (data_output), 0, NULL, NULL, NULL);
-  g_object_unref (data_output);
-  if (error)
+  if (n_records == 0)
+    return;
+
+  output = g_file_append_to (self->journal_file, G_FILE_CREATE_NONE, NULL, &error);
+  if (output == NULL ||
+      !g_output_stream_write_all (G_OUTPUT_STREAM (output),
+                                  records->data, records->len,
+                                  NULL, NULL, &error) ||
+      !g_output_stream_close (G_OUTPUT_STREAM (output), NULL, &error))
     {
       g_debug ("Could not save applications usage data: %s", error->message);
-      g_error_free (error);
+
+      /* The changes are lost from the journal; write everything instead */
+      self->needs_compaction = TRUE;
+      return;
     }
+
+  self->n_journal_records += n_records;
+}
+
+/* Save app data lists to file */
+static gboolean
+idle_save_application_usage (gpointer data)
+{
+  ShellAppUsage *self = SHELL_APP_USAGE (data);
+
+  self->save_id = 0;
+
+  if (self->needs_compaction ||
+      self->n_journal_records >= JOURNAL_MAX_RECORDS)
+    write_usage_file (self);
+  else
+    append_to_journal (self);
+
   return FALSE;
 }
 
@@ -620,13 +827,13 @@ shell_app_usage_start_element_handler  (GMarkupParseContext *context,
       const char **attribute;
       const char **value;
       UsageData *usage;
-      char *appid = NULL;
+      const char *appid = NULL;
 
       for (attribute = attribute_names, value = attribute_values; *attribute; attribute++, value++)
         {
           if (strcmp (*attribute, "id") == 0)
             {
-              appid = g_strdup (*value);
+              appid = *value;
               break;
             }
         }
@@ -641,8 +848,9 @@ shell_app_usage_start_element_handler  (GMarkupParseContext *context,
           return;
         }
 
-      usage = g_new0 (UsageData, 1);
-      g_hash_table_insert (self->app_usages, appid, usage);
+      usage = g_hash_table_lookup (self->app_usages, appid);
+      if (usage == NULL)
+        usage = add_usage (self, appid);
 
       for (attribute = attribute_names, value = attribute_values; *attribute; attribute++, value++)
         {
@@ -675,9 +883,9 @@ static GMarkupParser app_state_parse_funcs =
   NULL
 };
 
-/* Load data about apps usage from file */
-static void
-restore_from_file (ShellAppUsage *self)
+/* Load data about apps usage from the XML file of older versions */
+static gboolean
+restore_from_xml_file (ShellAppUsage *self)
 {
   GFileInputStream *input;
   GMarkupParseContext *parse_context;
@@ -691,7 +899,7 @@ restore_from_file (ShellAppUsage *self)
         g_warning ("Could not load applications usage data: %s", error->message);
 
       g_error_free (error);
-      return;
+      return FALSE;
     }
 
   parse_context = g_markup_parse_context_new (&app_state_parse_funcs, 0, self, NULL);
@@ -710,13 +918,144 @@ out:
   g_input_stream_close ((GInputStream*)input, NULL, NULL);
   g_object_unref (input);
 
-  idle_clean_usage (self);
-
   if (error)
     {
       g_warning ("Could not load applications usage data: %s", error->message);
       g_error_free (error);
     }
+
+  return TRUE;
+}
+
+static gboolean
+restore_from_usage_file (ShellAppUsage *self)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) state = NULL;
+  g_autoptr(GVariant) apps = NULL;
+  g_autoptr(GError) error = NULL;
+  GVariantIter iter;
+  const char *appid;
+  double score;
+  gint64 last_seen;
+  guint32 version;
+
+  mapped = g_mapped_file_new (self->usage_path, FALSE, &error);
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Could not load applications usage data: %s", error->message);
+      return FALSE;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  state = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (USAGE_FORMAT),
+                                                        bytes, FALSE));
+
+  g_variant_get (state, "(uu@a(sdx))", &version, &self->generation, &apps);
+  if (version != USAGE_FORMAT_VERSION)
+    {
+      g_warning ("Could not load applications usage data: unknown version %u",
+                 version);
+      return FALSE;
+    }
+
+  g_variant_iter_init (&iter, apps);
+  while (g_variant_iter_next (&iter, "(&sdx)", &appid, &score, &last_seen))
+    set_usage (self, appid, score, last_seen);
+
+  return TRUE;
+}
+
+static void
+restore_from_journal (ShellAppUsage *self)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GError) error = NULL;
+  const char *contents;
+  gsize length, offset;
+  guint32 header[2];
+
+  mapped = g_mapped_file_new (self->journal_path, FALSE, &error);
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Could not load applications usage data: %s", error->message);
+      self->needs_compaction = TRUE;
+      return;
+    }
+
+  contents = g_mapped_file_get_contents (mapped);
+  length = g_mapped_file_get_length (mapped);
+
+  if (length >= JOURNAL_HEADER_SIZE)
+    memcpy (header, contents, sizeof (header));
+
+  /* A journal from before the usage file was last written may be left
+   * behind if we didn't get to replace it; its records are outdated */
+  if (length < JOURNAL_HEADER_SIZE ||
+      GUINT32_FROM_LE (header[0]) != USAGE_FORMAT_VERSION ||
+      GUINT32_FROM_LE (header[1]) != self->generation)
+    {
+      self->needs_compaction = TRUE;
+      return;
+    }
+
+  offset = JOURNAL_HEADER_SIZE;
+  while (length - offset >= sizeof (guint64))
+    {
+      g_autoptr(GVariant) record = NULL;
+      const char *appid;
+      double score;
+      gint64 last_seen;
+      guint64 size;
+
+      memcpy (&size, contents + offset, sizeof (size));
+      size = GUINT64_FROM_LE (size);
+      offset += sizeof (size);
+
+      /* The last record may have been cut short */
+      if (size > length - offset)
+        {
+          self->needs_compaction = TRUE;
+          break;
+        }
+
+      record = g_variant_ref_sink (g_variant_new_from_data (G_VARIANT_TYPE (USAGE_RECORD_FORMAT),
+                                                            contents + offset, size,
+                                                            FALSE, NULL, NULL));
+      g_variant_get (record, "(&sdx)", &appid, &score, &last_seen);
+      set_usage (self, appid, score, last_seen);
+
+      offset += MIN (length - offset, size + (8 - size % 8) % 8);
+      self->n_journal_records++;
+    }
+}
+
+/* Load data about apps usage from file */
+static void
+restore_from_file (ShellAppUsage *self)
+{
+  if (restore_from_usage_file (self))
+    {
+      restore_from_journal (self);
+    }
+  else
+    {
+      /* Nothing to append to yet */
+      self->needs_compaction = TRUE;
+
+      if (restore_from_xml_file (self))
+        {
+          write_usage_file (self);
+          if (!self->needs_compaction)
+            g_file_delete (self->configfile, NULL, NULL);
+        }
+    }
+
+  sort_ranking (self);
+  idle_clean_usage (self);
 }
 
 /* Enable or disable the timers, depending on the value of ENABLE_MONITORING_KEY
@@ -757,6 +1096,25 @@ on_enable_monitoring_key_changed (GSettings     *settings,
   update_enable_monitoring (self);
 }
 
+static void
+report_memory (guint    *n_objects,
+               guint64  *n_bytes,
+               gpointer  user_data)
+{
+  ShellAppUsage *self = user_data;
+  GHashTableIter iter;
+  gpointer key;
+
+  *n_objects = g_hash_table_size (self->app_usages);
+  *n_bytes = 0;
+
+  g_hash_table_iter_init (&iter, self->app_usages);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    *n_bytes += sizeof (UsageData) + strlen (key) + 1;
+
+  *n_bytes += self->ranking->len * sizeof (gpointer);
+}
+
 /**
  * shell_app_usage_get_default:
  *
@@ -768,7 +1126,10 @@ shell_app_usage_get_default (void)
   static ShellAppUsage *instance;
 
   if (instance == NULL)
-    instance = g_object_new (SHELL_TYPE_APP_USAGE, NULL);
+    {
+      instance = g_object_new (SHELL_TYPE_APP_USAGE, NULL);
+      st_profiler_add_memory_reporter ("appUsage", report_memory, instance);
+    }
 
   return instance;
 }
@@ -14,6 +14,10 @@ G_DECLARE_FINAL_TYPE (ShellAppUsage, shell_app_usage,
 ShellAppUsage* shell_app_usage_get_default(void);
 
 GSList *shell_app_usage_get_most_used (ShellAppUsage *usage);
+int shell_app_usage_get_rank (ShellAppUsage *self,
+                              const char    *id);
+char **shell_app_usage_sort_ids (ShellAppUsage      *self,
+                                 const char * const *ids);
 int shell_app_usage_compare (ShellAppUsage *self,
                              const char    *id_a,
                              const char    *id_b);
@@ -0,0 +1,620 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "shell-frame-profiler.h"
+#include "shell-perf-log.h"
+#include "st.h"
+
+/**
+ * SECTION:shell-frame-profiler
+ * @short_description: Per-frame phase timing for the stage
+ *
+ * ShellFrameProfiler hooks into the stage frame cycle and measures,
+ * for every painted frame, how much time was spent updating the
+ * layout, painting, and finishing the frame (which usually includes
+ * waiting for the buffer swap). It also samples the St profiling
+ * counters to find out how many style changes, texture uploads and
+ * offscreen prerenders happened during the frame.
+ *
+ * The bookkeeping is a handful of timestamps per frame, so the
+ * profiler is enabled by default. Frames are recorded as events in
+ * the #ShellPerfLog when that is enabled, and summarized as
+ * statistics over the last few seconds; the running totals can also
+ * be read directly through the properties of the profiler at any time.
+ */
+
+/* Refresh budget used until told otherwise, in microseconds */
+#define DEFAULT_FRAME_BUDGET_US (G_USEC_PER_SEC / 60)
+
+/* Statistics summarize the frames that finished within this window.
+ * The history is sized to hold the whole window at up to ~100fps;
+ * beyond that the window silently shrinks to the last FRAME_HISTORY
+ * frames, which doesn't matter for the statistics we compute.
+ */
+#define STATISTICS_WINDOW_US (5 * G_USEC_PER_SEC)
+#define FRAME_HISTORY 512
+
+typedef struct
+{
+  gint64 end;
+  gint64 duration;
+} FrameRecord;
+
+struct _ShellFrameProfiler
+{
+  GObject parent;
+
+  ClutterStage *stage;
+
+  guint pre_paint_id;
+  guint post_paint_id;
+
+  gint64 frame_budget;
+
+  /* Timestamps for the frame in progress; zero when not reached yet */
+  gint64 frame_start;
+  gint64 paint_start;
+  gint64 paint_end;
+
+  guint frame_counters[ST_PROFILER_N_COUNTERS];
+
+  guint frame_count;
+  guint slow_frame_count;
+  gint64 last_frame_time;
+
+  /* Ring buffer of the most recent frames */
+  FrameRecord history[FRAME_HISTORY];
+  guint history_next;
+  guint history_len;
+
+  guint enabled : 1;
+};
+
+enum {
+  PROP_0,
+
+  PROP_STAGE,
+  PROP_ENABLED,
+  PROP_FRAME_BUDGET,
+  PROP_FRAME_COUNT,
+  PROP_SLOW_FRAME_COUNT,
+  PROP_LAST_FRAME_TIME,
+
+  N_PROPS
+};
+
+static GParamSpec *props[N_PROPS] = { NULL, };
+
+G_DEFINE_TYPE (ShellFrameProfiler, shell_frame_profiler, G_TYPE_OBJECT);
+
+/* Perf log event handles, defined in class_init() */
+static guint layout_time_event;
+static guint paint_time_event;
+static guint swap_time_event;
+static guint over_budget_event;
+static guint counter_events[ST_PROFILER_N_COUNTERS];
+
+static void
+sample_counters (guint *counters)
+{
+  int i;
+
+  for (i = 0; i < ST_PROFILER_N_COUNTERS; i++)
+    counters[i] = st_profiler_get_counter (i);
+}
+
+static gboolean
+frame_profiler_pre_paint (gpointer data)
+{
+  ShellFrameProfiler *profiler = data;
+
+  if (!profiler->enabled)
+    return TRUE;
+
+  profiler->frame_start = g_get_monotonic_time ();
+  profiler->paint_start = 0;
+  profiler->paint_end = 0;
+
+  sample_counters (profiler->frame_counters);
+
+  return TRUE;
+}
+
+static void
+on_stage_paint_view (ClutterStage       *stage,
+                     ClutterStageView   *view,
+                     ShellFrameProfiler *profiler)
+{
+  /* With several views, the paint phase starts with the first one */
+  if (profiler->frame_start != 0 && profiler->paint_start == 0)
+    profiler->paint_start = g_get_monotonic_time ();
+}
+
+static void
+on_stage_after_paint (ClutterStage       *stage,
+                      ShellFrameProfiler *profiler)
+{
+  if (profiler->frame_start != 0)
+    profiler->paint_end = g_get_monotonic_time ();
+}
+
+static void
+record_frame (ShellFrameProfiler *profiler,
+              gint64              frame_end)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+  guint counters[ST_PROFILER_N_COUNTERS];
+  gint64 frame_time, layout_time, paint_time;
+  int i;
+
+  frame_time = frame_end - profiler->frame_start;
+
+  /* Without ::paint-view we can't tell layout and paint apart, so
+   * everything up to the end of painting is accounted as paint.
+   */
+  if (profiler->paint_start != 0)
+    {
+      layout_time = profiler->paint_start - profiler->frame_start;
+      paint_time = profiler->paint_end - profiler->paint_start;
+    }
+  else
+    {
+      layout_time = 0;
+      paint_time = profiler->paint_end - profiler->frame_start;
+    }
+
+  shell_perf_log_record_x (perf_log, layout_time_event, layout_time);
+  shell_perf_log_record_x (perf_log, paint_time_event, paint_time);
+  shell_perf_log_record_x (perf_log, swap_time_event,
+                           frame_end - profiler->paint_end);
+
+  sample_counters (counters);
+  for (i = 0; i < ST_PROFILER_N_COUNTERS; i++)
+    {
+      guint delta = counters[i] - profiler->frame_counters[i];
+
+      if (delta != 0)
+        shell_perf_log_record_i (perf_log, counter_events[i], delta);
+    }
+
+  profiler->frame_count++;
+  profiler->last_frame_time = frame_time;
+
+  if (frame_time > profiler->frame_budget)
+    {
+      profiler->slow_frame_count++;
+      shell_perf_log_record_x (perf_log, over_budget_event, frame_time);
+    }
+
+  profiler->history[profiler->history_next].end = frame_end;
+  profiler->history[profiler->history_next].duration = frame_time;
+  profiler->history_next = (profiler->history_next + 1) % FRAME_HISTORY;
+  profiler->history_len = MIN (profiler->history_len + 1, FRAME_HISTORY);
+}
+
+static gboolean
+frame_profiler_post_paint (gpointer data)
+{
+  ShellFrameProfiler *profiler = data;
+
+  /* Post-paint functions run on every master clock tick, but we only
+   * care about the ticks that actually painted the stage.
+   */
+  if (profiler->frame_start != 0 && profiler->paint_end != 0)
+    record_frame (profiler, g_get_monotonic_time ());
+
+  profiler->frame_start = 0;
+
+  return TRUE;
+}
+
+static int
+compare_durations (gconstpointer a,
+                   gconstpointer b)
+{
+  gint64 da = *(const gint64 *)a;
+  gint64 db = *(const gint64 *)b;
+
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+static void
+frame_profiler_statistics_callback (ShellPerfLog *perf_log,
+                                    gpointer      data)
+{
+  ShellFrameProfiler *profiler = data;
+  gint64 durations[FRAME_HISTORY];
+  gint64 now = g_get_monotonic_time ();
+  gint64 total = 0, mean = 0, max = 0, p99 = 0;
+  gint64 window = STATISTICS_WINDOW_US;
+  guint n_frames = 0;
+  guint i;
+
+  /* Walk back from the newest frame until we leave the window */
+  for (i = 0; i < profiler->history_len; i++)
+    {
+      guint pos = (profiler->history_next + FRAME_HISTORY - 1 - i) % FRAME_HISTORY;
+      FrameRecord *record = &profiler->history[pos];
+
+      if (now - record->end > STATISTICS_WINDOW_US)
+        break;
+
+      durations[n_frames++] = record->duration;
+      total += record->duration;
+    }
+
+  if (n_frames > 0)
+    {
+      /* If the history ran out before the window did, the frame rate
+       * is relative to the span the history covers. */
+      if (n_frames == FRAME_HISTORY)
+        {
+          FrameRecord *oldest = &profiler->history[profiler->history_next];
+          window = MAX (now - oldest->end, 1);
+        }
+
+      qsort (durations, n_frames, sizeof (gint64), compare_durations);
+
+      mean = total / n_frames;
+      max = durations[n_frames - 1];
+      p99 = durations[MIN (n_frames - 1, (n_frames * 99) / 100)];
+    }
+
+  shell_perf_log_update_statistic_i (perf_log, "frame.frameCount",
+                                     profiler->frame_count);
+  shell_perf_log_update_statistic_i (perf_log, "frame.slowFrameCount",
+                                     profiler->slow_frame_count);
+  shell_perf_log_update_statistic_i (perf_log, "frame.frameRate",
+                                     (n_frames * G_USEC_PER_SEC) / window);
+  shell_perf_log_update_statistic_x (perf_log, "frame.meanFrameTime", mean);
+  shell_perf_log_update_statistic_x (perf_log, "frame.maxFrameTime", max);
+  shell_perf_log_update_statistic_x (perf_log, "frame.p99FrameTime", p99);
+}
+
+static void
+shell_frame_profiler_constructed (GObject *object)
+{
+  ShellFrameProfiler *profiler = SHELL_FRAME_PROFILER (object);
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+
+  G_OBJECT_CLASS (shell_frame_profiler_parent_class)->constructed (object);
+
+  profiler->pre_paint_id =
+    clutter_threads_add_repaint_func_full (CLUTTER_REPAINT_FLAGS_PRE_PAINT,
+                                           frame_profiler_pre_paint,
+                                           profiler, NULL);
+  profiler->post_paint_id =
+    clutter_threads_add_repaint_func_full (CLUTTER_REPAINT_FLAGS_POST_PAINT,
+                                           frame_profiler_post_paint,
+                                           profiler, NULL);
+
+  /* ::paint-view is emitted before the stage paints each view, which
+   * gives us the boundary between layout and painting.
+   */
+  if (g_signal_lookup ("paint-view", CLUTTER_TYPE_STAGE) != 0)
+    g_signal_connect_object (profiler->stage, "paint-view",
+                             G_CALLBACK (on_stage_paint_view), profiler, 0);
+
+  g_signal_connect_object (profiler->stage, "after-paint",
+                           G_CALLBACK (on_stage_after_paint), profiler, 0);
+
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          frame_profiler_statistics_callback,
+                                          profiler, NULL);
+}
+
+static void
+shell_frame_profiler_dispose (GObject *object)
+{
+  ShellFrameProfiler *profiler = SHELL_FRAME_PROFILER (object);
+
+  if (profiler->pre_paint_id != 0)
+    {
+      clutter_threads_remove_repaint_func (profiler->pre_paint_id);
+      profiler->pre_paint_id = 0;
+    }
+
+  if (profiler->post_paint_id != 0)
+    {
+      clutter_threads_remove_repaint_func (profiler->post_paint_id);
+      profiler->post_paint_id = 0;
+    }
+
+  shell_perf_log_remove_statistics_callback (shell_perf_log_get_default (),
+                                             frame_profiler_statistics_callback,
+                                             profiler);
+
+  g_clear_object (&profiler->stage);
+
+  G_OBJECT_CLASS (shell_frame_profiler_parent_class)->dispose (object);
+}
+
+static void
+shell_frame_profiler_set_property (GObject      *object,
+                                   guint         prop_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+  ShellFrameProfiler *profiler = SHELL_FRAME_PROFILER (object);
+
+  switch (prop_id)
+    {
+    case PROP_STAGE:
+      profiler->stage = g_value_dup_object (value);
+      break;
+    case PROP_ENABLED:
+      shell_frame_profiler_set_enabled (profiler, g_value_get_boolean (value));
+      break;
+    case PROP_FRAME_BUDGET:
+      shell_frame_profiler_set_frame_budget (profiler, g_value_get_int64 (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+shell_frame_profiler_get_property (GObject    *object,
+                                   guint       prop_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+  ShellFrameProfiler *profiler = SHELL_FRAME_PROFILER (object);
+
+  switch (prop_id)
+    {
+    case PROP_STAGE:
+      g_value_set_object (value, profiler->stage);
+      break;
+    case PROP_ENABLED:
+      g_value_set_boolean (value, profiler->enabled);
+      break;
+    case PROP_FRAME_BUDGET:
+      g_value_set_int64 (value, profiler->frame_budget);
+      break;
+    case PROP_FRAME_COUNT:
+      g_value_set_uint (value, profiler->frame_count);
+      break;
+    case PROP_SLOW_FRAME_COUNT:
+      g_value_set_uint (value, profiler->slow_frame_count);
+      break;
+    case PROP_LAST_FRAME_TIME:
+      g_value_set_int64 (value, profiler->last_frame_time);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+shell_frame_profiler_init (ShellFrameProfiler *profiler)
+{
+  profiler->enabled = TRUE;
+  profiler->frame_budget = DEFAULT_FRAME_BUDGET_US;
+}
+
+static void
+shell_frame_profiler_class_init (ShellFrameProfilerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+
+  object_class->constructed = shell_frame_profiler_constructed;
+  object_class->dispose = shell_frame_profiler_dispose;
+  object_class->set_property = shell_frame_profiler_set_property;
+  object_class->get_property = shell_frame_profiler_get_property;
+
+  props[PROP_STAGE] =
+    g_param_spec_object ("stage",
+                         "Stage",
+                         "Stage whose frames are profiled",
+                         CLUTTER_TYPE_STAGE,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  props[PROP_ENABLED] =
+    g_param_spec_boolean ("enabled",
+                          "Enabled",
+                          "Whether frames are being profiled",
+                          TRUE,
+                          G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  props[PROP_FRAME_BUDGET] =
+    g_param_spec_int64 ("frame-budget",
+                        "Frame budget",
+                        "Time a frame may take before it is flagged as slow, in microseconds",
+                        1, G_MAXINT64, DEFAULT_FRAME_BUDGET_US,
+                        G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  props[PROP_FRAME_COUNT] =
+    g_param_spec_uint ("frame-count",
+                       "Frame count",
+                       "Number of frames profiled",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  props[PROP_SLOW_FRAME_COUNT] =
+    g_param_spec_uint ("slow-frame-count",
+                       "Slow frame count",
+                       "Number of profiled frames that exceeded the frame budget",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  props[PROP_LAST_FRAME_TIME] =
+    g_param_spec_int64 ("last-frame-time",
+                        "Last frame time",
+                        "Duration of the most recently profiled frame, in microseconds",
+                        0, G_MAXINT64, 0,
+                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, N_PROPS, props);
+
+  layout_time_event =
+    shell_perf_log_define_event (perf_log,
+                                 "frame.layoutTime",
+                                 "Time from the start of the frame until painting starts, in microseconds",
+                                 "x");
+  paint_time_event =
+    shell_perf_log_define_event (perf_log,
+                                 "frame.paintTime",
+                                 "Time spent painting the stage, in microseconds",
+                                 "x");
+  swap_time_event =
+    shell_perf_log_define_event (perf_log,
+                                 "frame.swapTime",
+                                 "Time from the end of painting to the end of the frame, in microseconds",
+                                 "x");
+  counter_events[ST_PROFILER_COUNTER_STYLE_CHANGES] =
+    shell_perf_log_define_event (perf_log,
+                                 "frame.styleChanges",
+                                 "Number of widgets restyled during the frame",
+                                 "i");
+  counter_events[ST_PROFILER_COUNTER_TEXTURE_UPLOADS] =
+    shell_perf_log_define_event (perf_log,
+                                 "frame.textureUploads",
+                                 "Number of images uploaded by the texture cache during the frame",
+                                 "i");
+  counter_events[ST_PROFILER_COUNTER_PRERENDERS] =
+    shell_perf_log_define_event (perf_log,
+                                 "frame.prerenders",
+                                 "Number of offscreen background and shadow renders during the frame",
+                                 "i");
+  over_budget_event =
+    shell_perf_log_define_event (perf_log,
+                                 "frame.overBudget",
+                                 "Frame exceeded the frame budget; argument is the frame time in microseconds",
+                                 "x");
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "frame.frameCount",
+                                   "Number of frames painted",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "frame.slowFrameCount",
+                                   "Number of frames that exceeded the frame budget",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "frame.frameRate",
+                                   "Frames painted per second over the last few seconds",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "frame.meanFrameTime",
+                                   "Mean frame time over the last few seconds, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "frame.maxFrameTime",
+                                   "Longest frame time over the last few seconds, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "frame.p99FrameTime",
+                                   "99th percentile frame time over the last few seconds, in microseconds",
+                                   "x");
+}
+
+/**
+ * shell_frame_profiler_new:
+ * @stage: the #ClutterStage to profile
+ *
+ * Creates a profiler for the frames of @stage.
+ *
+ * Returns: (transfer full): a new #ShellFrameProfiler
+ */
+ShellFrameProfiler *
+shell_frame_profiler_new (ClutterStage *stage)
+{
+  return g_object_new (SHELL_TYPE_FRAME_PROFILER,
+                       "stage", stage,
+                       NULL);
+}
+
+/**
+ * shell_frame_profiler_set_enabled:
+ * @profiler: a #ShellFrameProfiler
+ * @enabled: whether to profile frames
+ *
+ * Sets whether frames are profiled. Totals are kept when profiling
+ * is turned off and resumed when it is turned back on.
+ */
+void
+shell_frame_profiler_set_enabled (ShellFrameProfiler *profiler,
+                                  gboolean            enabled)
+{
+  g_return_if_fail (SHELL_IS_FRAME_PROFILER (profiler));
+
+  enabled = enabled != FALSE;
+  if (profiler->enabled == enabled)
+    return;
+
+  profiler->enabled = enabled;
+  profiler->frame_start = 0;
+
+  g_object_notify_by_pspec (G_OBJECT (profiler), props[PROP_ENABLED]);
+}
+
+gboolean
+shell_frame_profiler_get_enabled (ShellFrameProfiler *profiler)
+{
+  g_return_val_if_fail (SHELL_IS_FRAME_PROFILER (profiler), FALSE);
+
+  return profiler->enabled;
+}
+
+/**
+ * shell_frame_profiler_set_frame_budget:
+ * @profiler: a #ShellFrameProfiler
+ * @budget_us: frame budget in microseconds
+ *
+ * Sets the time a frame may take before it is counted as a slow
+ * frame. This would normally be the refresh interval of the
+ * display; the default assumes a 60Hz refresh rate.
+ */
+void
+shell_frame_profiler_set_frame_budget (ShellFrameProfiler *profiler,
+                                       gint64              budget_us)
+{
+  g_return_if_fail (SHELL_IS_FRAME_PROFILER (profiler));
+  g_return_if_fail (budget_us > 0);
+
+  if (profiler->frame_budget == budget_us)
+    return;
+
+  profiler->frame_budget = budget_us;
+
+  g_object_notify_by_pspec (G_OBJECT (profiler), props[PROP_FRAME_BUDGET]);
+}
+
+gint64
+shell_frame_profiler_get_frame_budget (ShellFrameProfiler *profiler)
+{
+  g_return_val_if_fail (SHELL_IS_FRAME_PROFILER (profiler), 0);
+
+  return profiler->frame_budget;
+}
+
+guint
+shell_frame_profiler_get_frame_count (ShellFrameProfiler *profiler)
+{
+  g_return_val_if_fail (SHELL_IS_FRAME_PROFILER (profiler), 0);
+
+  return profiler->frame_count;
+}
+
+guint
+shell_frame_profiler_get_slow_frame_count (ShellFrameProfiler *profiler)
+{
+  g_return_val_if_fail (SHELL_IS_FRAME_PROFILER (profiler), 0);
+
+  return profiler->slow_frame_count;
+}
+
+gint64
+shell_frame_profiler_get_last_frame_time (ShellFrameProfiler *profiler)
+{
+  g_return_val_if_fail (SHELL_IS_FRAME_PROFILER (profiler), 0);
+
+  return profiler->last_frame_time;
+}
@@ -0,0 +1,30 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_FRAME_PROFILER_H__
+#define __SHELL_FRAME_PROFILER_H__
+
+#include <clutter/clutter.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SHELL_TYPE_FRAME_PROFILER (shell_frame_profiler_get_type ())
+G_DECLARE_FINAL_TYPE (ShellFrameProfiler, shell_frame_profiler,
+                      SHELL, FRAME_PROFILER, GObject)
+
+ShellFrameProfiler *shell_frame_profiler_new (ClutterStage *stage);
+
+void     shell_frame_profiler_set_enabled      (ShellFrameProfiler *profiler,
+                                                gboolean            enabled);
+gboolean shell_frame_profiler_get_enabled      (ShellFrameProfiler *profiler);
+
+void     shell_frame_profiler_set_frame_budget (ShellFrameProfiler *profiler,
+                                                gint64              budget_us);
+gint64   shell_frame_profiler_get_frame_budget (ShellFrameProfiler *profiler);
+
+guint    shell_frame_profiler_get_frame_count      (ShellFrameProfiler *profiler);
+guint    shell_frame_profiler_get_slow_frame_count (ShellFrameProfiler *profiler);
+gint64   shell_frame_profiler_get_last_frame_time  (ShellFrameProfiler *profiler);
+
+G_END_DECLS
+
+#endif /* __SHELL_FRAME_PROFILER_H__ */
@@ -20,4 +20,6 @@ gboolean _shell_global_check_xdnd_event (ShellGlobal  *global,
 
 void _shell_global_locate_pointer (ShellGlobal  *global);
 
+void _shell_global_flush_state (ShellGlobal  *global);
+
 #endif /* __SHELL_GLOBAL_PRIVATE_H__ */
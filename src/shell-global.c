@@ -42,8 +42,11 @@
 #endif
 
 #include "shell-enum-types.h"
+#include "shell-frame-profiler.h"
 #include "shell-global-private.h"
 #include "shell-perf-log.h"
+#include "shell-state-store.h"
+#include "shell-task-scheduler.h"
 #include "shell-window-tracker.h"
 #include "shell-wm.h"
 #include "shell-util.h"
@@ -68,6 +71,8 @@ struct _ShellGlobal {
   GjsContext *js_context;
   MetaPlugin *plugin;
   ShellWM *wm;
+  ShellFrameProfiler *frame_profiler;
+  ShellTaskScheduler *task_scheduler;
   GSettings *settings;
   const char *datadir;
   char *imagedir;
@@ -81,7 +86,8 @@ struct _ShellGlobal {
   GSList *leisure_closures;
   guint leisure_function_id;
 
-  GHashTable *save_ops;
+  ShellStateStore *runtime_state;
+  ShellStateStore *persistent_state;
 
   gboolean has_modal;
   gboolean frame_timestamps;
@@ -110,6 +116,8 @@ enum {
   PROP_FOCUS_MANAGER,
   PROP_FRAME_TIMESTAMPS,
   PROP_FRAME_FINISH_TIMESTAMP,
+  PROP_FRAME_PROFILER,
+  PROP_TASK_SCHEDULER,
   PROP_SWITCHEROO_CONTROL,
 };
 
@@ -285,6 +293,12 @@ shell_global_get_property(GObject         *object,
     case PROP_FRAME_FINISH_TIMESTAMP:
       g_value_set_boolean (value, global->frame_finish_timestamp);
       break;
+    case PROP_FRAME_PROFILER:
+      g_value_set_object (value, global->frame_profiler);
+      break;
+    case PROP_TASK_SCHEDULER:
+      g_value_set_object (value, global->task_scheduler);
+      break;
     case PROP_SWITCHEROO_CONTROL:
       g_value_set_object (value, global->switcheroo_control);
       break;
@@ -384,9 +398,8 @@ shell_global_init (ShellGlobal *global)
 
   g_strfreev (search_path);
 
-  global->save_ops = g_hash_table_new_full (g_file_hash,
-                                            (GEqualFunc) g_file_equal,
-                                            g_object_unref, g_object_unref);
+  global->runtime_state = shell_state_store_new (global->runtime_state_path);
+  global->persistent_state = shell_state_store_new (global->userdatadir_path);
 
   global->switcheroo_cancellable = g_cancellable_new ();
   shell_net_hadess_switcheroo_control_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
@@ -404,6 +417,8 @@ shell_global_finalize (GObject *object)
   ShellGlobal *global = SHELL_GLOBAL (object);
 
   g_clear_object (&global->js_context);
+  g_clear_object (&global->frame_profiler);
+  g_clear_object (&global->task_scheduler);
   g_object_unref (global->settings);
 
   the_object = NULL;
@@ -418,7 +433,8 @@ shell_global_finalize (GObject *object)
   g_free (global->imagedir);
   g_free (global->userdatadir);
 
-  g_hash_table_unref (global->save_ops);
+  g_clear_pointer (&global->runtime_state, shell_state_store_free);
+  g_clear_pointer (&global->persistent_state, shell_state_store_free);
 
   G_OBJECT_CLASS(shell_global_parent_class)->finalize (object);
 }
@@ -567,6 +583,20 @@ shell_global_class_init (ShellGlobalClass *klass)
                                                          "Whether at the end of a frame to call glFinish and log paintCompletedTimestamp",
                                                          FALSE,
                                                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_FRAME_PROFILER,
+                                   g_param_spec_object ("frame-profiler",
+                                                        "Frame Profiler",
+                                                        "Per-frame phase profiler for the stage",
+                                                        SHELL_TYPE_FRAME_PROFILER,
+                                                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_TASK_SCHEDULER,
+                                   g_param_spec_object ("task-scheduler",
+                                                        "Task Scheduler",
+                                                        "Scheduler for work deferred to the slack between frames",
+                                                        SHELL_TYPE_TASK_SCHEDULER,
+                                                        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class,
                                    PROP_SWITCHEROO_CONTROL,
                                    g_param_spec_object ("switcheroo-control",
@@ -981,6 +1011,9 @@ _shell_global_set_plugin (ShellGlobal *global,
                                          global_stage_after_swap,
                                          global, NULL);
 
+  global->frame_profiler = shell_frame_profiler_new (global->stage);
+  global->task_scheduler = shell_task_scheduler_new (global->stage);
+
   shell_perf_log_define_event (shell_perf_log_get_default(),
                                "clutter.stagePaintStart",
                                "Start of stage page repaint",
@@ -1176,6 +1209,20 @@ pre_exec_close_fds(void)
   fdwalk (set_cloexec, GINT_TO_POINTER(3));
 }
 
+/*
+ * _shell_global_flush_state:
+ * @global: A #ShellGlobal
+ *
+ * Writes runtime and persistent state that isn't on disk yet, for
+ * when the process is about to go away without finalizing @global.
+ */
+void
+_shell_global_flush_state (ShellGlobal *global)
+{
+  shell_state_store_flush_sync (global->runtime_state);
+  shell_state_store_flush_sync (global->persistent_state);
+}
+
 /**
  * shell_global_reexec_self:
  * @global: A #ShellGlobal
@@ -1263,6 +1310,8 @@ shell_global_reexec_self (ShellGlobal *global)
    */
   pre_exec_close_fds ();
 
+  _shell_global_flush_state (global);
+
   meta_display_close (shell_global_get_display (global),
                       shell_global_get_current_time (global));
 
@@ -1636,119 +1685,6 @@ shell_global_get_session_mode (ShellGlobal *global)
   return global->session_mode;
 }
 
-static void
-delete_variant_cb (GObject      *object,
-                   GAsyncResult *result,
-                   gpointer      user_data)
-{
-  ShellGlobal *global = user_data;
-  GError *error = NULL;
-
-  if (!g_file_delete_finish (G_FILE (object), result, &error))
-    {
-      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
-          !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-        {
-          g_warning ("Could not delete runtime/persistent state file: %s\n",
-                     error->message);
-        }
-
-      g_error_free (error);
-    }
-
-  g_hash_table_remove (global->save_ops, object);
-}
-
-static void
-replace_variant_cb (GObject      *object,
-                    GAsyncResult *result,
-                    gpointer      user_data)
-{
-  ShellGlobal *global = user_data;
-  GError *error = NULL;
-
-  if (!g_file_replace_contents_finish (G_FILE (object), result, NULL, &error))
-    {
-      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        {
-          g_warning ("Could not replace runtime/persistent state file: %s\n",
-                     error->message);
-        }
-
-      g_error_free (error);
-    }
-
-  g_hash_table_remove (global->save_ops, object);
-}
-
-static void
-save_variant (ShellGlobal *global,
-              GFile       *dir,
-              const char  *property_name,
-              GVariant    *variant)
-{
-  GFile *path = g_file_get_child (dir, property_name);
-  GCancellable *cancellable;
-
-  cancellable = g_hash_table_lookup (global->save_ops, path);
-  g_cancellable_cancel (cancellable);
-
-  cancellable = g_cancellable_new ();
-  g_hash_table_insert (global->save_ops, g_object_ref (path), cancellable);
-
-  if (variant == NULL || g_variant_get_data (variant) == NULL)
-    {
-      g_file_delete_async (path, G_PRIORITY_DEFAULT, cancellable,
-                           delete_variant_cb, global);
-    }
-  else
-    {
-      g_file_replace_contents_async (path,
-                                     g_variant_get_data (variant),
-                                     g_variant_get_size (variant),
-                                     NULL, FALSE,
-                                     G_FILE_CREATE_REPLACE_DESTINATION,
-                                     cancellable, replace_variant_cb, global);
-    }
-
-  g_object_unref (path);
-}
-
-static GVariant *
-load_variant (GFile      *dir,
-              const char *property_type,
-              const char *property_name)
-{
-  GVariant *res = NULL;
-  GMappedFile *mfile;
-  GFile *path = g_file_get_child (dir, property_name);
-  char *pathstr;
-  GError *local_error = NULL;
-
-  pathstr = g_file_get_path (path);
-  mfile = g_mapped_file_new (pathstr, FALSE, &local_error);
-  if (!mfile)
-    {
-      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
-        {
-          g_warning ("Failed to open runtime state: %s", local_error->message);
-        }
-      g_clear_error (&local_error);
-    }
-  else
-    {
-      GBytes *bytes = g_mapped_file_get_bytes (mfile);
-      res = g_variant_new_from_bytes (G_VARIANT_TYPE (property_type), bytes, FALSE);
-      g_bytes_unref (bytes);
-      g_mapped_file_unref (mfile);
-    }
-
-  g_object_unref (path);
-  g_free (pathstr);
-
-  return res;
-}
-
 /**
  * shell_global_set_runtime_state:
  * @global: a #ShellGlobal
@@ -1762,7 +1698,12 @@ shell_global_set_runtime_state (ShellGlobal  *global,
                                 const char   *property_name,
                                 GVariant     *variant)
 {
-  save_variant (global, global->runtime_state_path, property_name, variant);
+  shell_state_store_set (global->runtime_state, property_name, variant);
+
+  /* Runtime state, like whether the screen is locked, is what a shell
+   * restarting after a crash needs; it lives in XDG_RUNTIME_DIR, so
+   * writing it right away is cheap */
+  shell_state_store_flush_sync (global->runtime_state);
 }
 
 /**
@@ -1781,7 +1722,7 @@ shell_global_get_runtime_state (ShellGlobal  *global,
                                 const char   *property_type,
                                 const char   *property_name)
 {
-  return load_variant (global->runtime_state_path, property_type, property_name);
+  return shell_state_store_get (global->runtime_state, property_type, property_name);
 }
 
 /**
@@ -1797,7 +1738,7 @@ shell_global_set_persistent_state (ShellGlobal *global,
                                    const char  *property_name,
                                    GVariant    *variant)
 {
-  save_variant (global, global->userdatadir_path, property_name, variant);
+  shell_state_store_set (global->persistent_state, property_name, variant);
 }
 
 /**
@@ -1816,7 +1757,7 @@ shell_global_get_persistent_state (ShellGlobal  *global,
                                    const char   *property_type,
                                    const char   *property_name)
 {
-  return load_variant (global->userdatadir_path, property_type, property_name);
+  return shell_state_store_get (global->persistent_state, property_type, property_name);
 }
 
 void
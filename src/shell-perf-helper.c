@@ -5,6 +5,18 @@
  * Running performance tests with whatever windows a user has open results
  * in unreliable results, so instead we hide all other windows and talk
  * to this program over D-Bus to create just the windows we want.
+ *
+ * Besides individual windows, it can spawn and destroy large numbers of
+ * windows at a controlled rate, to stress window tracking. Such windows
+ * can have varying WM_CLASS and GApplication IDs, and transient dialogs.
+ * They all come from this process, so they share its PID, which is
+ * what the window tracker falls back to for windows that don't match
+ * an app otherwise. GApplication IDs are only set on X11.
+ *
+ * Spawning or destroying many windows can take much longer than a D-Bus
+ * call may, so SpawnWindows and DestroyOldestWindows reply right away
+ * with an operation ID, and ChurnFinished is emitted with that ID once
+ * the operation is done.
  */
 
 #include "config.h"
@@ -12,6 +24,9 @@
 #include <math.h>
 
 #include <gtk/gtk.h>
+#ifdef GDK_WINDOWING_X11
+#include <gdk/gdkx.h>
+#endif
 
 #define BUS_NAME "org.gnome.Shell.PerfHelper"
 
@@ -32,11 +47,26 @@ static const gchar introspection_xml[] =
 	  "    </method>"
 	  "    <method name='WaitWindows'/>"
 	  "    <method name='DestroyWindows'/>"
+	  "    <method name='SpawnWindows'>"
+	  "      <arg type='u' name='count' direction='in'/>"
+	  "      <arg type='d' name='rate' direction='in'/>"
+	  "      <arg type='a{sv}' name='options' direction='in'/>"
+	  "      <arg type='u' name='id' direction='out'/>"
+	  "    </method>"
+	  "    <method name='DestroyOldestWindows'>"
+	  "      <arg type='u' name='count' direction='in'/>"
+	  "      <arg type='d' name='rate' direction='in'/>"
+	  "      <arg type='u' name='id' direction='out'/>"
+	  "    </method>"
+	  "    <signal name='ChurnFinished'>"
+	  "      <arg type='u' name='id'/>"
+	  "    </signal>"
 	  "  </interface>"
 	"</node>";
 
 typedef struct {
   GtkWidget *window;
+  GtkWidget *dialog;
   int width;
   int height;
 
@@ -51,6 +81,24 @@ typedef struct {
   gint64 time;
 } WindowInfo;
 
+/* A SpawnWindows or DestroyOldestWindows call in progress */
+typedef struct {
+  GDBusConnection *connection;
+  char *sender;
+  guint id;
+  guint timeout_id;
+  guint remaining;
+  gboolean spawn;
+
+  /* Options of SpawnWindows */
+  int width;
+  int height;
+  guint n_wm_classes;
+  guint n_app_ids;
+  guint dialog_every;
+  gboolean modal;
+} ChurnOperation;
+
 static int opt_idle_timeout = 30;
 
 static GOptionEntry opt_entries[] =
@@ -62,6 +110,9 @@ static GOptionEntry opt_entries[] =
 static guint timeout_id;
 static GList *our_windows;
 static GList *wait_windows_invocations;
+static GList *churn_operations;
+static guint n_spawned_windows;
+static guint next_churn_id = 1;
 
 static gboolean
 on_timeout (gpointer data)
@@ -84,18 +135,39 @@ establish_timeout (void)
 }
 
 static void
-destroy_windows (void)
+destroy_window_info (WindowInfo *info)
 {
-  GList *l;
+  if (info->dialog)
+    gtk_widget_destroy (info->dialog);
+  gtk_widget_destroy (info->window);
+  g_free (info);
+}
 
-  for (l = our_windows; l; l = l->next)
-    {
-      WindowInfo *info = l->data;
-      gtk_widget_destroy (info->window);
-      g_free (info);
-    }
+static void
+finish_churn_operation (ChurnOperation *op)
+{
+  g_clear_handle_id (&op->timeout_id, g_source_remove);
+  g_dbus_connection_emit_signal (op->connection,
+                                 op->sender,
+                                 "/org/gnome/Shell/PerfHelper",
+                                 BUS_NAME,
+                                 "ChurnFinished",
+                                 g_variant_new ("(u)", op->id),
+                                 NULL);
+
+  churn_operations = g_list_remove (churn_operations, op);
+  g_object_unref (op->connection);
+  g_free (op->sender);
+  g_free (op);
+}
+
+static void
+destroy_windows (void)
+{
+  while (churn_operations)
+    finish_churn_operation (churn_operations->data);
 
-  g_list_free (our_windows);
+  g_list_free_full (our_windows, (GDestroyNotify) destroy_window_info);
   our_windows = NULL;
 
   check_finish_wait_windows ();
@@ -189,11 +261,26 @@ tick_callback (GtkWidget     *widget,
 }
 
 static void
-create_window (int      width,
-	       int      height,
-               gboolean alpha,
-               gboolean maximized,
-               gboolean redraws)
+set_application_id (GtkWidget  *window,
+                    const char *app_id)
+{
+#ifdef GDK_WINDOWING_X11
+  GdkWindow *gdk_window = gtk_widget_get_window (window);
+
+  /* This is what GtkApplication does for its windows */
+  if (GDK_IS_X11_WINDOW (gdk_window))
+    gdk_x11_window_set_utf8_property (gdk_window, "_GTK_APPLICATION_ID", app_id);
+#endif
+}
+
+static WindowInfo *
+create_window (int         width,
+	       int         height,
+               gboolean    alpha,
+               gboolean    maximized,
+               gboolean    redraws,
+               const char *wm_class,
+               const char *app_id)
 {
   WindowInfo *info;
   GtkWidget *child;
@@ -219,6 +306,21 @@ create_window (int      width,
   gtk_widget_set_app_paintable (info->window, TRUE);
   g_signal_connect (info->window, "map-event", G_CALLBACK (on_window_map_event), info);
   g_signal_connect (child, "draw", G_CALLBACK (on_child_draw), info);
+
+  /* Both have to be in place when the window is mapped, so that the
+   * window tracker sees them right away */
+  if (wm_class)
+    {
+      G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+      gtk_window_set_wmclass (GTK_WINDOW (info->window), wm_class, wm_class);
+      G_GNUC_END_IGNORE_DEPRECATIONS
+    }
+  if (app_id)
+    {
+      gtk_widget_realize (info->window);
+      set_application_id (info->window, app_id);
+    }
+
   gtk_widget_show (info->window);
 
   if (info->redraws)
@@ -226,6 +328,108 @@ create_window (int      width,
                                   info, NULL);
 
   our_windows = g_list_prepend (our_windows, info);
+
+  return info;
+}
+
+static void
+create_dialog (WindowInfo *info,
+               gboolean    modal)
+{
+  info->dialog = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_type_hint (GTK_WINDOW (info->dialog), GDK_WINDOW_TYPE_HINT_DIALOG);
+  gtk_window_set_transient_for (GTK_WINDOW (info->dialog), GTK_WINDOW (info->window));
+  gtk_window_set_modal (GTK_WINDOW (info->dialog), modal);
+  gtk_widget_set_size_request (info->dialog, 200, 100);
+  gtk_widget_show (info->dialog);
+}
+
+static void
+spawn_window (ChurnOperation *op)
+{
+  g_autofree char *wm_class = NULL;
+  g_autofree char *app_id = NULL;
+  WindowInfo *info;
+  guint n = n_spawned_windows++;
+
+  if (op->n_wm_classes > 0)
+    wm_class = g_strdup_printf ("PerfHelper%u", n % op->n_wm_classes);
+  if (op->n_app_ids > 0)
+    app_id = g_strdup_printf ("org.gnome.Shell.PerfHelper.App%u", n % op->n_app_ids);
+
+  info = create_window (op->width, op->height, FALSE, FALSE, FALSE,
+                        wm_class, app_id);
+
+  if (op->dialog_every > 0 && n % op->dialog_every == 0)
+    create_dialog (info, op->modal);
+}
+
+static gboolean
+churn_timeout (gpointer data)
+{
+  ChurnOperation *op = data;
+
+  /* Operations can take longer than the idle timeout */
+  establish_timeout ();
+
+  if (op->spawn)
+    {
+      spawn_window (op);
+    }
+  else if (our_windows != NULL)
+    {
+      GList *oldest = g_list_last (our_windows);
+
+      destroy_window_info (oldest->data);
+      our_windows = g_list_delete_link (our_windows, oldest);
+      check_finish_wait_windows ();
+    }
+  else
+    {
+      /* Nothing left to destroy */
+      op->remaining = 1;
+    }
+
+  if (--op->remaining == 0)
+    {
+      op->timeout_id = 0;
+      finish_churn_operation (op);
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Spawns or destroys one window every 1/@rate seconds; as fast as the
+ * main loop allows if @rate is 0. Replies with the ID of the operation
+ * right away; ChurnFinished is emitted with it once the operation is done.
+ */
+static void
+start_churn_operation (ChurnOperation        *op,
+                       GDBusMethodInvocation *invocation,
+                       guint                  count,
+                       double                 rate)
+{
+  guint interval = rate > 0 ? (guint) (1000 / rate) : 0;
+
+  op->connection = g_object_ref (g_dbus_method_invocation_get_connection (invocation));
+  op->sender = g_strdup (g_dbus_method_invocation_get_sender (invocation));
+  op->id = next_churn_id++;
+  op->remaining = count;
+
+  churn_operations = g_list_prepend (churn_operations, op);
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(u)", op->id));
+
+  if (count == 0)
+    {
+      finish_churn_operation (op);
+      return;
+    }
+
+  op->timeout_id = g_timeout_add (interval, churn_timeout, op);
+  g_source_set_name_by_id (op->timeout_id, "[gnome-shell] churn_timeout");
 }
 
 static void
@@ -286,7 +490,7 @@ handle_method_call (GDBusConnection       *connection,
 
       g_variant_get (parameters, "(iibbb)", &width, &height, &alpha, &maximized, &redraws);
 
-      create_window (width, height, alpha, maximized, redraws);
+      create_window (width, height, alpha, maximized, redraws, NULL, NULL);
       g_dbus_method_invocation_return_value (invocation, NULL);
     }
   else if (g_strcmp0 (method_name, "WaitWindows") == 0)
@@ -299,6 +503,37 @@ handle_method_call (GDBusConnection       *connection,
       destroy_windows ();
       g_dbus_method_invocation_return_value (invocation, NULL);
     }
+  else if (g_strcmp0 (method_name, "SpawnWindows") == 0)
+    {
+      g_autoptr(GVariant) options = NULL;
+      ChurnOperation *op;
+      guint count;
+      double rate;
+
+      g_variant_get (parameters, "(ud@a{sv})", &count, &rate, &options);
+
+      op = g_new0 (ChurnOperation, 1);
+      op->spawn = TRUE;
+      op->width = 320;
+      op->height = 240;
+      g_variant_lookup (options, "width", "i", &op->width);
+      g_variant_lookup (options, "height", "i", &op->height);
+      g_variant_lookup (options, "wm-classes", "u", &op->n_wm_classes);
+      g_variant_lookup (options, "app-ids", "u", &op->n_app_ids);
+      g_variant_lookup (options, "dialog-every", "u", &op->dialog_every);
+      g_variant_lookup (options, "modal", "b", &op->modal);
+
+      start_churn_operation (op, invocation, count, rate);
+    }
+  else if (g_strcmp0 (method_name, "DestroyOldestWindows") == 0)
+    {
+      guint count;
+      double rate;
+
+      g_variant_get (parameters, "(ud)", &count, &rate);
+
+      start_churn_operation (g_new0 (ChurnOperation, 1), invocation, count, rate);
+    }
 }
 
 static const GDBusInterfaceVTable interface_vtable =
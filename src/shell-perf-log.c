@@ -31,6 +31,11 @@ typedef struct _ShellPerfBlock ShellPerfBlock;
  * Arguments are identified by a D-Bus style signature; at the moment
  * only a limited number of event signatures are supported to
  * simplify the code.
+ *
+ * Events can be recorded by name, which costs a hash table lookup
+ * each time, or through the handle returned by
+ * shell_perf_log_define_event() or shell_perf_log_get_event_handle(),
+ * which is preferable for events recorded from frequently run code.
  */
 struct _ShellPerfLog
 {
@@ -287,14 +292,20 @@ define_event (ShellPerfLog *perf_log,
  *   integer.
  *
  * Defines a performance event for later recording.
+ *
+ * Return value: a handle that can be passed to shell_perf_log_record()
+ *   and friends to record the event, or 0 if the event could not
+ *   be defined
  */
-void
+guint
 shell_perf_log_define_event (ShellPerfLog *perf_log,
                              const char   *name,
                              const char   *description,
                              const char   *signature)
 {
-  define_event (perf_log, name, description, signature);
+  ShellPerfEvent *event = define_event (perf_log, name, description, signature);
+
+  return event != NULL ? event->id : 0;
 }
 
 static ShellPerfEvent *
@@ -346,7 +357,7 @@ record_event (ShellPerfLog   *perf_log,
     {
       perf_log->last_time = event_time;
       record_event (perf_log, event_time,
-                    lookup_event (perf_log, "perf.setTime", "x"),
+                    g_ptr_array_index (perf_log->events, EVENT_SET_TIME),
                     (const guchar *)&event_time, sizeof(gint64));
       time_delta = 0;
     }
@@ -462,6 +473,162 @@ shell_perf_log_event_s (ShellPerfLog *perf_log,
                 (const guchar *)arg, strlen (arg) + 1);
 }
 
+/**
+ * shell_perf_log_get_event_handle:
+ * @perf_log: a #ShellPerfLog
+ * @name: name of the event
+ * @signature: signature the event was defined with
+ *
+ * Looks up an event defined with shell_perf_log_define_event() and
+ * returns a handle that can be used to record it without looking
+ * it up by name again each time.
+ *
+ * Return value: a handle for the event, or 0 if there is no event
+ *   @name with the given @signature
+ */
+guint
+shell_perf_log_get_event_handle (ShellPerfLog *perf_log,
+                                 const char   *name,
+                                 const char   *signature)
+{
+  ShellPerfEvent *event = lookup_event (perf_log, name, signature);
+
+  return event != NULL ? event->id : 0;
+}
+
+static inline ShellPerfEvent *
+event_for_handle (ShellPerfLog *perf_log,
+                  guint         handle,
+                  char          signature)
+{
+  ShellPerfEvent *event;
+
+  /* Handle 0 is perf.setTime, which is internal, so it doubles as
+   * the invalid handle */
+  if (G_UNLIKELY (handle == 0 || handle >= perf_log->events->len))
+    {
+      g_warning ("Discarding event with invalid handle %u\n", handle);
+      return NULL;
+    }
+
+  event = g_ptr_array_index (perf_log->events, handle);
+
+  if (G_UNLIKELY (event->signature[0] != signature))
+    {
+      g_warning ("Event '%s'; defined with signature '%s', used with '%c'\n",
+                 event->name, event->signature, signature);
+      return NULL;
+    }
+
+  return event;
+}
+
+/**
+ * shell_perf_log_record:
+ * @perf_log: a #ShellPerfLog
+ * @handle: handle of the event
+ *
+ * Records a performance event with no arguments, using a handle
+ * returned from shell_perf_log_define_event() or
+ * shell_perf_log_get_event_handle().
+ */
+void
+shell_perf_log_record (ShellPerfLog *perf_log,
+                       guint         handle)
+{
+  ShellPerfEvent *event;
+
+  if (!perf_log->enabled)
+    return;
+
+  event = event_for_handle (perf_log, handle, '\0');
+  if (G_UNLIKELY (event == NULL))
+    return;
+
+  record_event (perf_log, get_time(), event, NULL, 0);
+}
+
+/**
+ * shell_perf_log_record_i:
+ * @perf_log: a #ShellPerfLog
+ * @handle: handle of the event
+ * @arg: the argument
+ *
+ * Records a performance event with one 32-bit integer argument,
+ * using a handle for the event.
+ */
+void
+shell_perf_log_record_i (ShellPerfLog *perf_log,
+                         guint         handle,
+                         gint32        arg)
+{
+  ShellPerfEvent *event;
+
+  if (!perf_log->enabled)
+    return;
+
+  event = event_for_handle (perf_log, handle, 'i');
+  if (G_UNLIKELY (event == NULL))
+    return;
+
+  record_event (perf_log, get_time(), event,
+                (const guchar *)&arg, sizeof (arg));
+}
+
+/**
+ * shell_perf_log_record_x:
+ * @perf_log: a #ShellPerfLog
+ * @handle: handle of the event
+ * @arg: the argument
+ *
+ * Records a performance event with one 64-bit integer argument,
+ * using a handle for the event.
+ */
+void
+shell_perf_log_record_x (ShellPerfLog *perf_log,
+                         guint         handle,
+                         gint64        arg)
+{
+  ShellPerfEvent *event;
+
+  if (!perf_log->enabled)
+    return;
+
+  event = event_for_handle (perf_log, handle, 'x');
+  if (G_UNLIKELY (event == NULL))
+    return;
+
+  record_event (perf_log, get_time(), event,
+                (const guchar *)&arg, sizeof (arg));
+}
+
+/**
+ * shell_perf_log_record_s:
+ * @perf_log: a #ShellPerfLog
+ * @handle: handle of the event
+ * @arg: the argument
+ *
+ * Records a performance event with one string argument, using
+ * a handle for the event.
+ */
+void
+shell_perf_log_record_s (ShellPerfLog *perf_log,
+                         guint         handle,
+                         const char   *arg)
+{
+  ShellPerfEvent *event;
+
+  if (!perf_log->enabled)
+    return;
+
+  event = event_for_handle (perf_log, handle, 's');
+  if (G_UNLIKELY (event == NULL))
+    return;
+
+  record_event (perf_log, get_time(), event,
+                (const guchar *)arg, strlen (arg) + 1);
+}
+
 /**
  * shell_perf_log_define_statistic:
  * @name: name of the statistic and of the corresponding event.
@@ -580,6 +747,23 @@ shell_perf_log_update_statistic_x (ShellPerfLog *perf_log,
   statistic->initialized = TRUE;
 }
 
+/**
+ * shell_perf_log_get_memory_usage:
+ * @perf_log: a #ShellPerfLog
+ * @n_blocks: (out): location to store the number of blocks of events
+ * @n_bytes: (out): location to store the memory the blocks take up, in bytes
+ *
+ * Gets how much memory the recorded events take up.
+ */
+void
+shell_perf_log_get_memory_usage (ShellPerfLog *perf_log,
+                                 guint        *n_blocks,
+                                 guint64      *n_bytes)
+{
+  *n_blocks = perf_log->blocks->length;
+  *n_bytes = (guint64) perf_log->blocks->length * sizeof (ShellPerfBlock);
+}
+
 /**
  * shell_perf_log_add_statistics_callback:
  * @perf_log: a #ShellPerfLog
@@ -607,6 +791,55 @@ shell_perf_log_add_statistics_callback (ShellPerfLog               *perf_log,
   g_ptr_array_add (perf_log->statistics_closures, closure);
 }
 
+static void
+update_statistics (ShellPerfLog *perf_log)
+{
+  guint i;
+
+  for (i = 0; i < perf_log->statistics_closures->len; i++)
+    {
+      ShellPerfStatisticsClosure *closure;
+
+      closure = g_ptr_array_index (perf_log->statistics_closures, i);
+      closure->callback (perf_log, closure->user_data);
+    }
+}
+
+/**
+ * shell_perf_log_remove_statistics_callback:
+ * @perf_log: a #ShellPerfLog
+ * @callback: a function added with shell_perf_log_add_statistics_callback()
+ * @user_data: the data it was added with
+ *
+ * Removes a function added with shell_perf_log_add_statistics_callback(),
+ * calling the notify function it was added with. Does nothing if there
+ * is no such function.
+ */
+void
+shell_perf_log_remove_statistics_callback (ShellPerfLog               *perf_log,
+                                           ShellPerfStatisticsCallback callback,
+                                           gpointer                    user_data)
+{
+  guint i;
+
+  for (i = 0; i < perf_log->statistics_closures->len; i++)
+    {
+      ShellPerfStatisticsClosure *closure;
+
+      closure = g_ptr_array_index (perf_log->statistics_closures, i);
+      if (closure->callback != callback || closure->user_data != user_data)
+        continue;
+
+      g_ptr_array_remove_index (perf_log->statistics_closures, i);
+
+      if (closure->notify)
+        closure->notify (closure->user_data);
+      g_slice_free (ShellPerfStatisticsClosure, closure);
+
+      return;
+    }
+}
+
 /**
  * shell_perf_log_collect_statistics:
  * @perf_log: a #ShellPerfLog
@@ -625,13 +858,7 @@ shell_perf_log_collect_statistics (ShellPerfLog *perf_log)
   if (!perf_log->enabled)
     return;
 
-  for (i = 0; i < perf_log->statistics_closures->len; i++)
-    {
-      ShellPerfStatisticsClosure *closure;
-
-      closure = g_ptr_array_index (perf_log->statistics_closures, i);
-      closure->callback (perf_log, closure->user_data);
-    }
+  update_statistics (perf_log);
 
   collection_time = get_time() - event_time;
 
@@ -677,6 +904,56 @@ shell_perf_log_collect_statistics (ShellPerfLog *perf_log)
                 (const guchar *)&collection_time, sizeof (gint64));
 }
 
+/**
+ * shell_perf_log_snapshot_statistics:
+ * @perf_log: a #ShellPerfLog
+ *
+ * Calls all the update functions added with
+ * shell_perf_log_add_statistics_callback() and returns the current
+ * values of all statistics that have a value. Unlike
+ * shell_perf_log_collect_statistics(), this works whether or not
+ * event recording is enabled, and nothing is written to the log.
+ *
+ * Return value: (transfer full): a #GVariant of type a{sv},
+ *   mapping statistic names to their values, with type 'i' or 'x'
+ *   according to the signature of the statistic
+ */
+GVariant *
+shell_perf_log_snapshot_statistics (ShellPerfLog *perf_log)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  update_statistics (perf_log);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  for (i = 0; i < perf_log->statistics->len; i++)
+    {
+      ShellPerfStatistic *statistic = g_ptr_array_index (perf_log->statistics, i);
+
+      if (!statistic->initialized)
+        continue;
+
+      switch (statistic->event->signature[0])
+        {
+        case 'i':
+          g_variant_builder_add (&builder, "{sv}", statistic->event->name,
+                                 g_variant_new_int32 (statistic->current_value.i));
+          break;
+        case 'x':
+          g_variant_builder_add (&builder, "{sv}", statistic->event->name,
+                                 g_variant_new_int64 (statistic->current_value.x));
+          break;
+        default:
+          g_warning ("Unsupported signature in event");
+          break;
+        }
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 /**
  * shell_perf_log_replay:
  * @perf_log: a #ShellPerfLog
@@ -15,10 +15,10 @@ ShellPerfLog *shell_perf_log_get_default (void);
 void shell_perf_log_set_enabled (ShellPerfLog *perf_log,
 				 gboolean      enabled);
 
-void shell_perf_log_define_event (ShellPerfLog *perf_log,
-				  const char   *name,
-				  const char   *description,
-				  const char   *signature);
+guint shell_perf_log_define_event (ShellPerfLog *perf_log,
+                                   const char   *name,
+                                   const char   *description,
+                                   const char   *signature);
 void shell_perf_log_event        (ShellPerfLog *perf_log,
 				  const char   *name);
 void shell_perf_log_event_i      (ShellPerfLog *perf_log,
@@ -31,6 +31,22 @@ void shell_perf_log_event_s      (ShellPerfLog *perf_log,
 				  const char   *name,
 				  const char   *arg);
 
+guint shell_perf_log_get_event_handle (ShellPerfLog *perf_log,
+                                       const char   *name,
+                                       const char   *signature);
+
+void shell_perf_log_record   (ShellPerfLog *perf_log,
+                              guint         handle);
+void shell_perf_log_record_i (ShellPerfLog *perf_log,
+                              guint         handle,
+                              gint32        arg);
+void shell_perf_log_record_x (ShellPerfLog *perf_log,
+                              guint         handle,
+                              gint64        arg);
+void shell_perf_log_record_s (ShellPerfLog *perf_log,
+                              guint         handle,
+                              const char   *arg);
+
 void shell_perf_log_define_statistic (ShellPerfLog *perf_log,
                                       const char   *name,
                                       const char   *description,
@@ -50,9 +66,18 @@ void shell_perf_log_add_statistics_callback (ShellPerfLog               *perf_lo
                                              ShellPerfStatisticsCallback callback,
                                              gpointer                    user_data,
                                              GDestroyNotify              notify);
+void shell_perf_log_remove_statistics_callback (ShellPerfLog               *perf_log,
+                                                ShellPerfStatisticsCallback callback,
+                                                gpointer                    user_data);
 
 void shell_perf_log_collect_statistics (ShellPerfLog *perf_log);
 
+void shell_perf_log_get_memory_usage (ShellPerfLog *perf_log,
+                                      guint        *n_blocks,
+                                      guint64      *n_bytes);
+
+GVariant *shell_perf_log_snapshot_statistics (ShellPerfLog *perf_log);
+
 typedef void (*ShellPerfReplayFunction) (gint64      time,
 					 const char *name,
 					 const char *signature,
@@ -0,0 +1,442 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "shell-recorder-convert.h"
+
+/*
+ * Frames are converted two rows at a time, which share a row of chroma
+ * samples, each the average of a 2x2 block of pixels. The planes are
+ * laid out the way GStreamer lays out these formats by default, with
+ * rows padded to a multiple of four bytes, so the buffers can go into
+ * the pipeline without describing the layout.
+ *
+ * With BT.709 limited range, in 8-bit fixed point:
+ *
+ *   Y = (( 47 R + 157 G +  16 B + 128) >> 8) + 16
+ *   U = ((-26 R -  86 G + 112 B + 128) >> 8) + 128
+ *   V = ((112 R - 102 G -  10 B + 128) >> 8) + 128
+ */
+
+#define ROUND_UP_2(n) (((n) + 1) & ~1)
+#define ROUND_UP_4(n) (((n) + 3) & ~3)
+
+typedef struct {
+  gsize offsets[3];
+  int strides[3];
+  gsize size;
+} FrameLayout;
+
+static void
+get_layout (ShellRecorderFormat  format,
+            int                  width,
+            int                  height,
+            FrameLayout         *layout)
+{
+  int chroma_height = ROUND_UP_2 (height) / 2;
+
+  memset (layout, 0, sizeof (FrameLayout));
+
+  switch (format)
+    {
+    case SHELL_RECORDER_FORMAT_XRGB:
+      layout->strides[0] = width * 4;
+      layout->size = (gsize) layout->strides[0] * height;
+      break;
+    case SHELL_RECORDER_FORMAT_I420:
+      layout->strides[0] = ROUND_UP_4 (width);
+      layout->strides[1] = ROUND_UP_4 (ROUND_UP_2 (width) / 2);
+      layout->strides[2] = layout->strides[1];
+      layout->offsets[1] = (gsize) layout->strides[0] * ROUND_UP_2 (height);
+      layout->offsets[2] = layout->offsets[1] + (gsize) layout->strides[1] * chroma_height;
+      layout->size = layout->offsets[2] + (gsize) layout->strides[2] * chroma_height;
+      break;
+    case SHELL_RECORDER_FORMAT_NV12:
+      layout->strides[0] = ROUND_UP_4 (width);
+      layout->strides[1] = layout->strides[0];
+      layout->offsets[1] = (gsize) layout->strides[0] * ROUND_UP_2 (height);
+      layout->size = layout->offsets[1] + (gsize) layout->strides[1] * chroma_height;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/**
+ * shell_recorder_format_get_size:
+ * @format: a #ShellRecorderFormat
+ * @width: width of the frame, in pixels
+ * @height: height of the frame, in pixels
+ *
+ * Return value: the size of a frame in @format, in bytes
+ */
+gsize
+shell_recorder_format_get_size (ShellRecorderFormat format,
+                                int                 width,
+                                int                 height)
+{
+  FrameLayout layout;
+
+  get_layout (format, width, height, &layout);
+
+  return layout.size;
+}
+
+static inline guint8
+rgb_to_y (int r,
+          int g,
+          int b)
+{
+  return ((47 * r + 157 * g + 16 * b + 128) >> 8) + 16;
+}
+
+static inline guint8
+rgb_to_u (int r,
+          int g,
+          int b)
+{
+  return ((-26 * r - 86 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline guint8
+rgb_to_v (int r,
+          int g,
+          int b)
+{
+  return ((112 * r - 102 * g - 10 * b + 128) >> 8) + 128;
+}
+
+#define PIXEL_R(p) (((p) >> 16) & 0xff)
+#define PIXEL_G(p) (((p) >> 8) & 0xff)
+#define PIXEL_B(p) ((p) & 0xff)
+
+/* Converts the pixels from @x on of two rows; @uv_step is 1 for
+ * separate chroma planes, and 2 for interleaved ones
+ */
+static void
+convert_rows_c (const guint32 *row0,
+                const guint32 *row1,
+                int            x,
+                int            width,
+                guint8        *y0,
+                guint8        *y1,
+                guint8        *u,
+                guint8        *v,
+                int            uv_step)
+{
+  int i;
+
+  for (i = x; i < width; i += 2)
+    {
+      /* The last pixel of an odd width stands in for its neighbour */
+      int j = MIN (i + 1, width - 1);
+      guint32 p00 = row0[i], p01 = row0[j], p10 = row1[i], p11 = row1[j];
+      int r, g, b;
+
+      y0[i] = rgb_to_y (PIXEL_R (p00), PIXEL_G (p00), PIXEL_B (p00));
+      y0[j] = rgb_to_y (PIXEL_R (p01), PIXEL_G (p01), PIXEL_B (p01));
+      y1[i] = rgb_to_y (PIXEL_R (p10), PIXEL_G (p10), PIXEL_B (p10));
+      y1[j] = rgb_to_y (PIXEL_R (p11), PIXEL_G (p11), PIXEL_B (p11));
+
+      r = (PIXEL_R (p00) + PIXEL_R (p01) + PIXEL_R (p10) + PIXEL_R (p11) + 2) >> 2;
+      g = (PIXEL_G (p00) + PIXEL_G (p01) + PIXEL_G (p10) + PIXEL_G (p11) + 2) >> 2;
+      b = (PIXEL_B (p00) + PIXEL_B (p01) + PIXEL_B (p10) + PIXEL_B (p11) + 2) >> 2;
+
+      u[(i / 2) * uv_step] = rgb_to_u (r, g, b);
+      v[(i / 2) * uv_step] = rgb_to_v (r, g, b);
+    }
+}
+
+#ifdef __SSE2__
+/* Splits four pixels into 32-bit channels
+ */
+static inline void
+unpack_pixels_sse2 (__m128i  pixels,
+                    __m128i *r,
+                    __m128i *g,
+                    __m128i *b)
+{
+  const __m128i mask = _mm_set1_epi32 (0xff);
+
+  *r = _mm_and_si128 (_mm_srli_epi32 (pixels, 16), mask);
+  *g = _mm_and_si128 (_mm_srli_epi32 (pixels, 8), mask);
+  *b = _mm_and_si128 (pixels, mask);
+}
+
+/* Loads eight pixels as 16-bit channels
+ */
+static inline void
+load_pixels_sse2 (const guint32 *row,
+                  __m128i       *r,
+                  __m128i       *g,
+                  __m128i       *b)
+{
+  __m128i r0, g0, b0, r1, g1, b1;
+
+  unpack_pixels_sse2 (_mm_loadu_si128 ((const __m128i *) row), &r0, &g0, &b0);
+  unpack_pixels_sse2 (_mm_loadu_si128 ((const __m128i *) (row + 4)), &r1, &g1, &b1);
+
+  *r = _mm_packs_epi32 (r0, r1);
+  *g = _mm_packs_epi32 (g0, g1);
+  *b = _mm_packs_epi32 (b0, b1);
+}
+
+/* Computes luma for eight pixels; the sum stays below 2^16, so it is
+ * done on unsigned 16-bit lanes
+ */
+static inline __m128i
+convert_y_sse2 (__m128i r,
+                __m128i g,
+                __m128i b)
+{
+  __m128i y;
+
+  y = _mm_mullo_epi16 (r, _mm_set1_epi16 (47));
+  y = _mm_add_epi16 (y, _mm_mullo_epi16 (g, _mm_set1_epi16 (157)));
+  y = _mm_add_epi16 (y, _mm_mullo_epi16 (b, _mm_set1_epi16 (16)));
+  y = _mm_add_epi16 (y, _mm_set1_epi16 (128));
+  y = _mm_srli_epi16 (y, 8);
+
+  return _mm_add_epi16 (y, _mm_set1_epi16 (16));
+}
+
+/* Averages 2x2 blocks of the 16-bit channels of two rows of eight
+ * pixels into four 16-bit samples, in the low half
+ */
+static inline __m128i
+average_blocks_sse2 (__m128i c0,
+                     __m128i c1)
+{
+  __m128i sum;
+
+  /* Adds up vertical pairs, then horizontal ones into 32-bit lanes */
+  sum = _mm_madd_epi16 (_mm_add_epi16 (c0, c1), _mm_set1_epi16 (1));
+  sum = _mm_srli_epi32 (_mm_add_epi32 (sum, _mm_set1_epi32 (2)), 2);
+
+  return _mm_packs_epi32 (sum, sum);
+}
+
+/* Computes a chroma sample from 16-bit channels; the weighted sum
+ * stays within a signed 16-bit lane
+ */
+static inline __m128i
+convert_chroma_sse2 (__m128i r,
+                     __m128i g,
+                     __m128i b,
+                     short   r_weight,
+                     short   g_weight,
+                     short   b_weight)
+{
+  __m128i c;
+
+  c = _mm_mullo_epi16 (r, _mm_set1_epi16 (r_weight));
+  c = _mm_add_epi16 (c, _mm_mullo_epi16 (g, _mm_set1_epi16 (g_weight)));
+  c = _mm_add_epi16 (c, _mm_mullo_epi16 (b, _mm_set1_epi16 (b_weight)));
+  c = _mm_srai_epi16 (_mm_add_epi16 (c, _mm_set1_epi16 (128)), 8);
+
+  return _mm_add_epi16 (c, _mm_set1_epi16 (128));
+}
+
+/* Converts eight pixels at a time of two rows, for as far as they go;
+ * returns where the rest has to be picked up
+ */
+static int
+convert_rows_sse2 (const guint32 *row0,
+                   const guint32 *row1,
+                   int            width,
+                   guint8        *y0,
+                   guint8        *y1,
+                   guint8        *u,
+                   guint8        *v,
+                   int            uv_step)
+{
+  int x;
+
+  for (x = 0; x + 8 <= width; x += 8)
+    {
+      __m128i r0, g0, b0, r1, g1, b1;
+      __m128i r, g, b, cu, cv;
+      guint32 packed;
+
+      load_pixels_sse2 (row0 + x, &r0, &g0, &b0);
+      load_pixels_sse2 (row1 + x, &r1, &g1, &b1);
+
+      _mm_storel_epi64 ((__m128i *) (y0 + x),
+                        _mm_packus_epi16 (convert_y_sse2 (r0, g0, b0), _mm_setzero_si128 ()));
+      _mm_storel_epi64 ((__m128i *) (y1 + x),
+                        _mm_packus_epi16 (convert_y_sse2 (r1, g1, b1), _mm_setzero_si128 ()));
+
+      r = average_blocks_sse2 (r0, r1);
+      g = average_blocks_sse2 (g0, g1);
+      b = average_blocks_sse2 (b0, b1);
+
+      cu = _mm_packus_epi16 (convert_chroma_sse2 (r, g, b, -26, -86, 112), _mm_setzero_si128 ());
+      cv = _mm_packus_epi16 (convert_chroma_sse2 (r, g, b, 112, -102, -10), _mm_setzero_si128 ());
+
+      if (uv_step == 2)
+        {
+          _mm_storel_epi64 ((__m128i *) (u + x), _mm_unpacklo_epi8 (cu, cv));
+        }
+      else
+        {
+          packed = _mm_cvtsi128_si32 (cu);
+          memcpy (u + x / 2, &packed, 4);
+          packed = _mm_cvtsi128_si32 (cv);
+          memcpy (v + x / 2, &packed, 4);
+        }
+    }
+
+  return x;
+}
+#endif /* __SSE2__ */
+
+static void
+convert_rows (const guint32 *row0,
+              const guint32 *row1,
+              int            width,
+              guint8        *y0,
+              guint8        *y1,
+              guint8        *u,
+              guint8        *v,
+              int            uv_step)
+{
+  int x = 0;
+
+#ifdef __SSE2__
+  x = convert_rows_sse2 (row0, row1, width, y0, y1, u, v, uv_step);
+#endif
+
+  convert_rows_c (row0, row1, x, width, y0, y1, u, v, uv_step);
+}
+
+static inline guint32
+blend_pixel (guint32 dest,
+             guint32 src)
+{
+  guint alpha = 255 - (src >> 24);
+  guint32 result = 0xff000000;
+  int shift;
+
+  /* Both are premultiplied; the frame is opaque */
+  for (shift = 0; shift < 24; shift += 8)
+    {
+      guint t = ((dest >> shift) & 0xff) * alpha + 0x80;
+
+      t = ((t + (t >> 8)) >> 8) + ((src >> shift) & 0xff);
+      result |= MIN (t, 0xff) << shift;
+    }
+
+  return result;
+}
+
+/* Copies row @y of the frame to @dest with the cursor drawn over it,
+ * if the cursor covers that row; returns the row to convert
+ */
+static const guint32 *
+draw_cursor_row (const guint8              *src,
+                 int                        width,
+                 int                        y,
+                 const ShellRecorderCursor *cursor,
+                 guint32                   *dest)
+{
+  const guint32 *row = (const guint32 *) (src + (gsize) y * width * 4);
+  const guint32 *cursor_row;
+  int cursor_width, cursor_height;
+  int x_start, x_end, i;
+
+  if (cursor == NULL)
+    return row;
+
+  cursor_width = cairo_image_surface_get_width (cursor->image);
+  cursor_height = cairo_image_surface_get_height (cursor->image);
+
+  x_start = MAX (cursor->x, 0);
+  x_end = MIN (cursor->x + cursor_width, width);
+
+  if (y < cursor->y || y >= cursor->y + cursor_height || x_start >= x_end)
+    return row;
+
+  cursor_row = (const guint32 *) (cairo_image_surface_get_data (cursor->image) +
+                                  (y - cursor->y) * cairo_image_surface_get_stride (cursor->image));
+
+  memcpy (dest, row, width * 4);
+  for (i = x_start; i < x_end; i++)
+    dest[i] = blend_pixel (dest[i], cursor_row[i - cursor->x]);
+
+  return dest;
+}
+
+/**
+ * shell_recorder_convert_frame:
+ * @format: the format to convert to
+ * @src: the frame, in native-endian xRGB without padding
+ * @width: width of the frame, in pixels
+ * @height: height of the frame, in pixels
+ * @cursor: (allow-none): a cursor to draw over the frame
+ * @dest: where to put the converted frame, of the size given by
+ *   shell_recorder_format_get_size()
+ *
+ * Converts a frame, drawing @cursor over it on the way without
+ * changing @src.
+ */
+void
+shell_recorder_convert_frame (ShellRecorderFormat        format,
+                              const guint8              *src,
+                              int                        width,
+                              int                        height,
+                              const ShellRecorderCursor *cursor,
+                              guint8                    *dest)
+{
+  FrameLayout layout;
+  guint32 *cursor_rows = NULL;
+  int uv_step;
+  int y;
+
+  get_layout (format, width, height, &layout);
+
+  if (format == SHELL_RECORDER_FORMAT_XRGB)
+    {
+      memcpy (dest, src, layout.size);
+
+      if (cursor != NULL)
+        for (y = 0; y < height; y++)
+          draw_cursor_row (src, width, y, cursor,
+                           (guint32 *) (dest + (gsize) y * layout.strides[0]));
+      return;
+    }
+
+  if (cursor != NULL)
+    cursor_rows = g_new (guint32, 2 * width);
+
+  uv_step = format == SHELL_RECORDER_FORMAT_NV12 ? 2 : 1;
+
+  for (y = 0; y < height; y += 2)
+    {
+      /* The last row of an odd height stands in for its neighbour */
+      int y1 = MIN (y + 1, height - 1);
+      const guint32 *row0, *row1;
+      guint8 *luma0, *luma1, *u, *v;
+
+      row0 = draw_cursor_row (src, width, y, cursor, cursor_rows);
+      row1 = draw_cursor_row (src, width, y1, cursor, cursor_rows + width);
+
+      luma0 = dest + (gsize) y * layout.strides[0];
+      luma1 = dest + (gsize) y1 * layout.strides[0];
+      u = dest + layout.offsets[1] + (gsize) (y / 2) * layout.strides[1];
+
+      if (uv_step == 2)
+        v = u + 1;
+      else
+        v = dest + layout.offsets[2] + (gsize) (y / 2) * layout.strides[2];
+
+      convert_rows (row0, row1, width, luma0, luma1, u, v, uv_step);
+    }
+
+  g_free (cursor_rows);
+}
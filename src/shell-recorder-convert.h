@@ -0,0 +1,42 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_RECORDER_CONVERT_H__
+#define __SHELL_RECORDER_CONVERT_H__
+
+#include <cairo.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Conversion of recorded frames, which are native-endian xRGB with a
+ * stride of four bytes per pixel, into the planar YUV formats encoders
+ * take, with BT.709 limited range colors. A cursor can be blended in
+ * on the way, leaving the frame itself untouched.
+ */
+
+typedef enum {
+  SHELL_RECORDER_FORMAT_XRGB,
+  SHELL_RECORDER_FORMAT_I420,
+  SHELL_RECORDER_FORMAT_NV12,
+} ShellRecorderFormat;
+
+typedef struct {
+  cairo_surface_t *image; /* Premultiplied ARGB32 */
+  int x;                  /* Position of the image in the frame */
+  int y;
+} ShellRecorderCursor;
+
+gsize shell_recorder_format_get_size (ShellRecorderFormat format,
+                                      int                 width,
+                                      int                 height);
+
+void  shell_recorder_convert_frame   (ShellRecorderFormat        format,
+                                      const guint8              *src,
+                                      int                        width,
+                                      int                        height,
+                                      const ShellRecorderCursor *cursor,
+                                      guint8                    *dest);
+
+G_END_DECLS
+
+#endif /* __SHELL_RECORDER_CONVERT_H__ */
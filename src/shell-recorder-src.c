@@ -5,8 +5,27 @@
 #define GST_USE_UNSTABLE_API
 #include <gst/base/gstpushsrc.h>
 
+#include "shell-perf-log.h"
 #include "shell-recorder-src.h"
 
+/* The number of frame buffers the pool allocates up front */
+#define MIN_POOL_BUFFERS 2
+
+/* A frame to convert, along with what it was added for, in case the
+ * caps change in the meantime
+ */
+typedef struct {
+  GstBuffer *buffer;
+  ShellRecorderCursor cursor;
+  gboolean has_cursor;
+
+  ShellRecorderFormat format;
+  int width;
+  int height;
+  GstBufferPool *output_pool;
+  guint output_size;
+} ConvertJob;
+
 struct _ShellRecorderSrc
 {
   GstPushSrc parent;
@@ -14,9 +33,26 @@ struct _ShellRecorderSrc
   GMutex mutex;
 
   GstCaps *caps;
+  guint memory_target;
+  GstBufferPool *pool;
+  guint frame_size;
+
+  /* Frames added with shell_recorder_src_add_frame() are converted to
+   * the format in the caps on a thread of our own, into buffers of
+   * output_size from output_pool, and queued from there.
+   */
+  ShellRecorderFormat format;
+  int width;
+  int height;
+  GThreadPool *convert_pool;
+  GstBufferPool *output_pool;
+  guint output_size;
+
   GMutex queue_lock;
   GCond queue_cond;
   GQueue *queue;
+  guint n_converting;
+  guint64 n_buffers_sent;
 
   gboolean eos;
   gboolean flushing;
@@ -32,12 +68,108 @@ struct _ShellRecorderSrcClass
 enum {
   PROP_0,
   PROP_CAPS,
+  PROP_MEMORY_TARGET,
   PROP_MEMORY_USED
 };
 
+/* Counters for the frame buffer pool, shared by all sources; the
+ * memory is tracked from both the main thread and streaming threads.
+ */
+G_LOCK_DEFINE_STATIC (pool_statistics);
+static guint n_pool_hits;
+static guint n_pool_misses;
+static guint n_pool_allocations;
+static gint64 pool_memory;
+static gint64 pool_peak_memory;
+
+/* Running average of the time to convert a frame, in microseconds */
+G_LOCK_DEFINE_STATIC (convert_statistics);
+static gint64 convert_time;
+static guint n_frames_converted;
+
+/* A plain GstBufferPool that keeps track of the memory it holds
+ */
+typedef GstBufferPool ShellRecorderBufferPool;
+typedef GstBufferPoolClass ShellRecorderBufferPoolClass;
+
+G_DEFINE_TYPE (ShellRecorderBufferPool, shell_recorder_buffer_pool, GST_TYPE_BUFFER_POOL);
+
+static void
+shell_recorder_buffer_pool_memory_changed (gint64 delta)
+{
+  G_LOCK (pool_statistics);
+  if (delta > 0)
+    n_pool_allocations++;
+  pool_memory += delta;
+  pool_peak_memory = MAX (pool_peak_memory, pool_memory);
+  G_UNLOCK (pool_statistics);
+}
+
+static GstFlowReturn
+shell_recorder_buffer_pool_alloc_buffer (GstBufferPool              *pool,
+                                         GstBuffer                 **buffer,
+                                         GstBufferPoolAcquireParams *params)
+{
+  GstBufferPoolClass *parent_class = GST_BUFFER_POOL_CLASS (shell_recorder_buffer_pool_parent_class);
+  GstFlowReturn result;
+
+  result = parent_class->alloc_buffer (pool, buffer, params);
+  if (result == GST_FLOW_OK)
+    shell_recorder_buffer_pool_memory_changed (gst_buffer_get_size (*buffer));
+
+  return result;
+}
+
+static void
+shell_recorder_buffer_pool_free_buffer (GstBufferPool *pool,
+                                        GstBuffer     *buffer)
+{
+  GstBufferPoolClass *parent_class = GST_BUFFER_POOL_CLASS (shell_recorder_buffer_pool_parent_class);
+
+  shell_recorder_buffer_pool_memory_changed (- (gint64) gst_buffer_get_size (buffer));
+
+  parent_class->free_buffer (pool, buffer);
+}
+
+static void
+shell_recorder_buffer_pool_init (ShellRecorderBufferPool *pool)
+{
+}
+
+static void
+shell_recorder_buffer_pool_class_init (ShellRecorderBufferPoolClass *klass)
+{
+  klass->alloc_buffer = shell_recorder_buffer_pool_alloc_buffer;
+  klass->free_buffer = shell_recorder_buffer_pool_free_buffer;
+}
+
+static void
+shell_recorder_src_statistics_callback (ShellPerfLog *perf_log,
+                                        gpointer      data)
+{
+  G_LOCK (pool_statistics);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.bufferPoolHits",
+                                     n_pool_hits);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.bufferPoolMisses",
+                                     n_pool_misses);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.bufferPoolPeakMemory",
+                                     pool_peak_memory);
+  G_UNLOCK (pool_statistics);
+
+  G_LOCK (convert_statistics);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.convertTime",
+                                     convert_time);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.convertedFrameCount",
+                                     n_frames_converted);
+  G_UNLOCK (convert_statistics);
+}
+
 #define shell_recorder_src_parent_class parent_class
 G_DEFINE_TYPE(ShellRecorderSrc, shell_recorder_src, GST_TYPE_PUSH_SRC);
 
+static void shell_recorder_src_convert (gpointer data,
+                                        gpointer user_data);
+
 static void
 shell_recorder_src_init (ShellRecorderSrc      *src)
 {
@@ -48,6 +180,10 @@ shell_recorder_src_init (ShellRecorderSrc      *src)
   g_mutex_init (&src->mutex);
   g_mutex_init (&src->queue_lock);
   g_cond_init (&src->queue_cond);
+
+  /* A single thread, so frames come out in the order they went in */
+  src->convert_pool = g_thread_pool_new (shell_recorder_src_convert, src,
+                                         1, FALSE, NULL);
 }
 
 static gboolean
@@ -191,11 +327,13 @@ shell_recorder_src_create (GstPushSrc  *push_src,
     buffer = g_queue_pop_head (src->queue);
 
     /* we have a buffer, exit the loop to handle it */
-    if (buffer != NULL)
+    if (buffer != NULL) {
+      src->n_buffers_sent++;
       break;
+    }
 
-    /* no buffer, check EOS */
-    if (src->eos) {
+    /* no buffer, check EOS once the frames being converted are in */
+    if (src->eos && src->n_converting == 0) {
       g_mutex_unlock (&src->queue_lock);
       return GST_FLOW_EOS;
     }
@@ -212,6 +350,115 @@ shell_recorder_src_create (GstPushSrc  *push_src,
   return GST_FLOW_OK;
 }
 
+/* Sets up a pool of buffers of @size, which keeps at most as many
+ * around as fit in the memory target.
+ */
+static GstBufferPool *
+shell_recorder_src_create_pool (ShellRecorderSrc *src,
+                                GstCaps          *caps,
+                                guint             size)
+{
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstAllocationParams params;
+  guint max_buffers;
+
+  if (src->memory_target > 0)
+    max_buffers = MAX (src->memory_target / MAX (size / 1024, 1), MIN_POOL_BUFFERS);
+  else
+    max_buffers = 0;
+
+  pool = g_object_new (shell_recorder_buffer_pool_get_type (), NULL);
+
+  /* Aligned to cache lines, for converting frames a row at a time */
+  gst_allocation_params_init (&params);
+  params.align = 63;
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size,
+                                     MIN_POOL_BUFFERS, max_buffers);
+  gst_buffer_pool_config_set_allocator (config, NULL, &params);
+
+  if (!gst_buffer_pool_set_config (pool, config) ||
+      !gst_buffer_pool_set_active (pool, TRUE))
+    {
+      g_warning ("ShellRecorderSrc: can't set up frame buffer pool");
+      gst_object_unref (pool);
+      return NULL;
+    }
+
+  return pool;
+}
+
+static void
+shell_recorder_src_clear_pool (GstBufferPool **pool)
+{
+  if (*pool == NULL)
+    return;
+
+  /* Buffers still in the pipeline are freed when they come back */
+  gst_buffer_pool_set_active (*pool, FALSE);
+  g_clear_pointer (pool, gst_object_unref);
+}
+
+static ShellRecorderFormat
+get_format (const GstStructure *structure)
+{
+  const char *format = gst_structure_get_string (structure, "format");
+
+  if (g_strcmp0 (format, "I420") == 0)
+    return SHELL_RECORDER_FORMAT_I420;
+  else if (g_strcmp0 (format, "NV12") == 0)
+    return SHELL_RECORDER_FORMAT_NV12;
+  else
+    return SHELL_RECORDER_FORMAT_XRGB;
+}
+
+/* Sets up pools of buffers for captured frames of the configured size,
+ * and for converted ones if the caps are for a format other than the
+ * one frames are captured in.
+ */
+static void
+shell_recorder_src_update_pool (ShellRecorderSrc *src)
+{
+  GstStructure *structure;
+  int width, height;
+
+  shell_recorder_src_clear_pool (&src->pool);
+  shell_recorder_src_clear_pool (&src->output_pool);
+
+  src->frame_size = 0;
+  src->output_size = 0;
+  src->format = SHELL_RECORDER_FORMAT_XRGB;
+  src->width = src->height = 0;
+
+  if (src->caps == NULL)
+    return;
+
+  structure = gst_caps_get_structure (src->caps, 0);
+  if (!gst_structure_get_int (structure, "width", &width) ||
+      !gst_structure_get_int (structure, "height", &height) ||
+      width <= 0 || height <= 0)
+    return;
+
+  src->format = get_format (structure);
+  src->width = width;
+  src->height = height;
+
+  /* Frames are always captured as 32-bit xRGB or BGRx */
+  src->pool = shell_recorder_src_create_pool (src,
+                                              src->format == SHELL_RECORDER_FORMAT_XRGB ? src->caps : NULL,
+                                              width * height * 4);
+  if (src->pool != NULL)
+    src->frame_size = width * height * 4;
+
+  if (src->format == SHELL_RECORDER_FORMAT_XRGB)
+    return;
+
+  src->output_size = shell_recorder_format_get_size (src->format, width, height);
+  src->output_pool = shell_recorder_src_create_pool (src, src->caps, src->output_size);
+}
+
 static void
 shell_recorder_src_set_caps (ShellRecorderSrc *src,
 			     const GstCaps    *caps)
@@ -234,6 +481,20 @@ shell_recorder_src_set_caps (ShellRecorderSrc *src,
     }
   else
     src->caps = NULL;
+
+  shell_recorder_src_update_pool (src);
+}
+
+static void
+shell_recorder_src_set_memory_target (ShellRecorderSrc *src,
+                                      guint             memory_target)
+{
+  if (memory_target == src->memory_target)
+    return;
+
+  src->memory_target = memory_target;
+
+  shell_recorder_src_update_pool (src);
 }
 
 static void
@@ -241,6 +502,9 @@ shell_recorder_src_finalize (GObject *object)
 {
   ShellRecorderSrc *src = SHELL_RECORDER_SRC (object);
 
+  /* Lets the conversions still queued finish first */
+  g_thread_pool_free (src->convert_pool, FALSE, TRUE);
+
   g_clear_handle_id (&src->memory_used_update_idle, g_source_remove);
 
   shell_recorder_src_set_caps (src, NULL);
@@ -266,6 +530,9 @@ shell_recorder_src_set_property (GObject      *object,
     case PROP_CAPS:
       shell_recorder_src_set_caps (src, gst_value_get_caps (value));
       break;
+    case PROP_MEMORY_TARGET:
+      shell_recorder_src_set_memory_target (src, g_value_get_uint (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -285,6 +552,9 @@ shell_recorder_src_get_property (GObject         *object,
     case PROP_CAPS:
       gst_value_set_caps (value, src->caps);
       break;
+    case PROP_MEMORY_TARGET:
+      g_value_set_uint (value, src->memory_target);
+      break;
     case PROP_MEMORY_USED:
       g_mutex_lock (&src->mutex);
       g_value_set_uint (value, src->memory_used);
@@ -321,6 +591,13 @@ shell_recorder_src_class_init (ShellRecorderSrcClass *klass)
 						       "Fixed GstCaps for the source",
 						       GST_TYPE_CAPS,
 						       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class,
+                                   PROP_MEMORY_TARGET,
+                                   g_param_spec_uint ("memory-target",
+						      "Memory Target",
+						      "Memory to use at most for recycled frame buffers (in kB), or 0 for no limit",
+						      0, G_MAXUINT, 0,
+						      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (object_class,
                                    PROP_MEMORY_USED,
                                    g_param_spec_uint ("memory-used",
@@ -354,7 +631,8 @@ shell_recorder_src_class_init (ShellRecorderSrcClass *klass)
  * Adds a buffer to the internal queue to be pushed out at the next opportunity.
  * There is no flow control, so arbitrary amounts of memory may be used by
  * the buffers on the queue. The buffer contents must match the #GstCaps
- * set in the :caps property.
+ * set in the :caps property; see shell_recorder_src_add_frame() for
+ * frames that still need to be converted to them.
  */
 void
 shell_recorder_src_add_buffer (ShellRecorderSrc *src,
@@ -372,6 +650,224 @@ shell_recorder_src_add_buffer (ShellRecorderSrc *src,
   g_mutex_unlock (&src->queue_lock);
 }
 
+static GstBuffer *
+acquire_from_pool (GstBufferPool *pool,
+                   guint          size)
+{
+  GstBufferPoolAcquireParams params = { 0, };
+  GstBuffer *buffer = NULL;
+  guint n_allocations;
+
+  G_LOCK (pool_statistics);
+  n_allocations = n_pool_allocations;
+  G_UNLOCK (pool_statistics);
+
+  /* Rather than waiting for the encoder to give a buffer back when all
+   * are in use, allocate one outside the pool */
+  params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+  if (pool == NULL ||
+      gst_buffer_pool_acquire_buffer (pool, &buffer, &params) != GST_FLOW_OK)
+    buffer = gst_buffer_new_allocate (NULL, size, NULL);
+
+  G_LOCK (pool_statistics);
+  if (n_pool_allocations == n_allocations && buffer->pool != NULL)
+    n_pool_hits++;
+  else
+    n_pool_misses++;
+  G_UNLOCK (pool_statistics);
+
+  return buffer;
+}
+
+/**
+ * shell_recorder_src_acquire_buffer:
+ *
+ * Gets a buffer for a captured frame of the size in the #GstCaps set
+ * in the :caps property, in native-endian xRGB, recycled from an
+ * earlier frame when possible. The contents of the buffer are undefined.
+ *
+ * Return value: (transfer full): a #GstBuffer, or %NULL if no caps are set
+ */
+GstBuffer *
+shell_recorder_src_acquire_buffer (ShellRecorderSrc *src)
+{
+  g_return_val_if_fail (SHELL_IS_RECORDER_SRC (src), NULL);
+  g_return_val_if_fail (src->caps != NULL, NULL);
+
+  if (src->pool == NULL)
+    return NULL;
+
+  return acquire_from_pool (src->pool, src->frame_size);
+}
+
+static void
+convert_job_free (ConvertJob *job)
+{
+  gst_buffer_unref (job->buffer);
+  if (job->has_cursor)
+    cairo_surface_destroy (job->cursor.image);
+  g_clear_pointer (&job->output_pool, gst_object_unref);
+  g_free (job);
+}
+
+/* Runs on the conversion thread
+ */
+static void
+shell_recorder_src_convert (gpointer data,
+                            gpointer user_data)
+{
+  ConvertJob *job = data;
+  ShellRecorderSrc *src = user_data;
+  GstBuffer *output;
+  GstMapInfo in_info, out_info;
+  gint64 start_time, elapsed;
+
+  start_time = g_get_monotonic_time ();
+
+  output = acquire_from_pool (job->output_pool, job->output_size);
+
+  gst_buffer_map (job->buffer, &in_info, GST_MAP_READ);
+  gst_buffer_map (output, &out_info, GST_MAP_WRITE);
+  shell_recorder_convert_frame (job->format, in_info.data,
+                                job->width, job->height,
+                                job->has_cursor ? &job->cursor : NULL,
+                                out_info.data);
+  gst_buffer_unmap (output, &out_info);
+  gst_buffer_unmap (job->buffer, &in_info);
+
+  GST_BUFFER_PTS (output) = GST_BUFFER_PTS (job->buffer);
+
+  elapsed = g_get_monotonic_time () - start_time;
+
+  G_LOCK (convert_statistics);
+  if (convert_time == 0)
+    convert_time = elapsed;
+  else
+    convert_time = (7 * convert_time + elapsed) / 8;
+  n_frames_converted++;
+  G_UNLOCK (convert_statistics);
+
+  shell_recorder_src_update_memory_used (src,
+					 (int)(gst_buffer_get_size(output) / 1024) -
+					 (int)(gst_buffer_get_size(job->buffer) / 1024));
+
+  g_mutex_lock (&src->queue_lock);
+  src->n_converting--;
+  if (src->flushing)
+    {
+      shell_recorder_src_update_memory_used (src,
+					     - (int)(gst_buffer_get_size(output) / 1024));
+      gst_buffer_unref (output);
+    }
+  else
+    {
+      g_queue_push_tail (src->queue, output);
+    }
+  g_cond_signal (&src->queue_cond);
+  g_mutex_unlock (&src->queue_lock);
+
+  convert_job_free (job);
+}
+
+/**
+ * shell_recorder_src_add_frame:
+ * @src: a #ShellRecorderSrc
+ * @buffer: a captured frame, in native-endian xRGB
+ * @cursor: (allow-none): a cursor to draw over the frame
+ *
+ * Adds a frame to be converted to the format in the #GstCaps set in
+ * the :caps property, with @cursor drawn over it, and pushed out at the
+ * next opportunity. The conversion happens on a thread of its own and
+ * leaves @buffer as it is; a reference is held to it until then.
+ */
+void
+shell_recorder_src_add_frame (ShellRecorderSrc          *src,
+                              GstBuffer                 *buffer,
+                              const ShellRecorderCursor *cursor)
+{
+  ConvertJob *job;
+
+  g_return_if_fail (SHELL_IS_RECORDER_SRC (src));
+  g_return_if_fail (src->caps != NULL);
+
+  if (src->format == SHELL_RECORDER_FORMAT_XRGB && cursor == NULL)
+    {
+      shell_recorder_src_add_buffer (src, buffer);
+      return;
+    }
+
+  job = g_new0 (ConvertJob, 1);
+  job->buffer = gst_buffer_ref (buffer);
+  job->format = src->format;
+  job->width = src->width;
+  job->height = src->height;
+  job->output_size = shell_recorder_format_get_size (src->format,
+                                                     src->width, src->height);
+  if (src->output_pool != NULL)
+    job->output_pool = gst_object_ref (src->output_pool);
+
+  if (cursor != NULL)
+    {
+      job->cursor = *cursor;
+      job->cursor.image = cairo_surface_reference (cursor->image);
+      job->has_cursor = TRUE;
+    }
+
+  shell_recorder_src_update_memory_used (src,
+					 (int)(gst_buffer_get_size(buffer) / 1024));
+
+  g_mutex_lock (&src->queue_lock);
+  src->n_converting++;
+  g_mutex_unlock (&src->queue_lock);
+
+  g_thread_pool_push (src->convert_pool, job, NULL);
+}
+
+/**
+ * shell_recorder_src_get_queue_length:
+ *
+ * Gets the number of buffers added with shell_recorder_src_add_buffer()
+ * or shell_recorder_src_add_frame() that are still waiting to go into
+ * the pipeline, including the ones being converted.
+ *
+ * Return value: the number of buffers in the queue
+ */
+guint
+shell_recorder_src_get_queue_length (ShellRecorderSrc *src)
+{
+  guint queue_length;
+
+  g_return_val_if_fail (SHELL_IS_RECORDER_SRC (src), 0);
+
+  g_mutex_lock (&src->queue_lock);
+  queue_length = g_queue_get_length (src->queue) + src->n_converting;
+  g_mutex_unlock (&src->queue_lock);
+
+  return queue_length;
+}
+
+/**
+ * shell_recorder_src_get_n_buffers_sent:
+ *
+ * Gets the number of buffers that went into the pipeline so far; how
+ * quickly this grows is how quickly the pipeline takes frames.
+ *
+ * Return value: the number of buffers sent
+ */
+guint64
+shell_recorder_src_get_n_buffers_sent (ShellRecorderSrc *src)
+{
+  guint64 n_buffers_sent;
+
+  g_return_val_if_fail (SHELL_IS_RECORDER_SRC (src), 0);
+
+  g_mutex_lock (&src->queue_lock);
+  n_buffers_sent = src->n_buffers_sent;
+  g_mutex_unlock (&src->queue_lock);
+
+  return n_buffers_sent;
+}
+
 /**
  * shell_recorder_src_close:
  *
@@ -410,9 +906,38 @@ void
 shell_recorder_src_register (void)
 {
   static gboolean registered = FALSE;
+  ShellPerfLog *perf_log;
+
   if (registered)
     return;
 
+  perf_log = shell_perf_log_get_default ();
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.bufferPoolHits",
+                                   "Number of recorded frames that reused a buffer",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.bufferPoolMisses",
+                                   "Number of recorded frames that needed a new buffer",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.bufferPoolPeakMemory",
+                                   "Most memory held by recycled frame buffers at once, in bytes",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.convertTime",
+                                   "Time to convert a frame and draw the cursor over it, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.convertedFrameCount",
+                                   "Number of recorded frames converted before going into the pipeline",
+                                   "i");
+
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          shell_recorder_src_statistics_callback,
+                                          NULL, NULL);
+
   gst_plugin_register_static (GST_VERSION_MAJOR, GST_VERSION_MINOR,
 			      "shellrecorder",
 			      "Plugin for ShellRecorder",
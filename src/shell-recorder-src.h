@@ -4,6 +4,8 @@
 
 #include <gst/gst.h>
 
+#include "shell-recorder-convert.h"
+
 G_BEGIN_DECLS
 
 /**
@@ -31,10 +33,18 @@ GType              shell_recorder_src_get_type     (void) G_GNUC_CONST;
 
 void shell_recorder_src_register (void);
 
+GstBuffer *shell_recorder_src_acquire_buffer (ShellRecorderSrc *src);
+
 void shell_recorder_src_add_buffer (ShellRecorderSrc *src,
 				    GstBuffer        *buffer);
+void shell_recorder_src_add_frame  (ShellRecorderSrc          *src,
+                                    GstBuffer                 *buffer,
+                                    const ShellRecorderCursor *cursor);
 void shell_recorder_src_close      (ShellRecorderSrc *src);
 
+guint   shell_recorder_src_get_queue_length   (ShellRecorderSrc *src);
+guint64 shell_recorder_src_get_n_buffers_sent (ShellRecorderSrc *src);
+
 G_END_DECLS
 
 #endif /* __SHELL_RECORDER_SRC_H__ */
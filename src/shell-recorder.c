@@ -20,9 +20,9 @@
 #include <st/st.h>
 
 #include "shell-global.h"
+#include "shell-perf-log.h"
 #include "shell-recorder-src.h"
 #include "shell-recorder.h"
-#include "shell-util.h"
 
 typedef enum {
   RECORDER_STATE_CLOSED,
@@ -30,6 +30,27 @@ typedef enum {
 } RecorderState;
 
 typedef struct _RecorderPipeline RecorderPipeline;
+typedef struct _RecorderReadback RecorderReadback;
+
+/* Number of readbacks that can be in flight at once; see
+ * recorder_record_frame_pipelined()
+ */
+#define N_READBACK_SLOTS 3
+
+struct _RecorderReadback
+{
+  CoglPixelBuffer *pixel_buffer; /* Laid out like a whole frame */
+  int width;
+  int height;
+
+  cairo_region_t *damage; /* The part of the frame read back */
+  gboolean full;          /* Whether that is all of it */
+
+  guint64 frame;       /* Value of paint_count when started */
+  gint64 start_time;   /* Monotonic time when started */
+  gint64 issue_time;   /* Time it took to start, in microseconds */
+  GstClockTime pts;
+};
 
 struct _ShellRecorder {
   GObject parent;
@@ -59,7 +80,6 @@ struct _ShellRecorder {
   gboolean draw_cursor;
   MetaCursorTracker *cursor_tracker;
   cairo_surface_t *cursor_image;
-  guint8 *cursor_memory;
   int cursor_hot_x;
   int cursor_hot_y;
 
@@ -75,12 +95,45 @@ struct _ShellRecorder {
 
   GstClockTime last_frame_time; /* Timestamp for the last frame */
 
+  /* The frame rate we record at, which is lowered below framerate when
+   * the pipeline can't keep up; see recorder_adapt_capture_rate()
+   */
+  double capture_rate;
+  double encoder_rate; /* Frames per second the pipeline takes, smoothed */
+  guint64 last_n_buffers_sent;
+  gint64 last_adapt_time;
+
+  /* Ring of readbacks into pixel buffers that the GPU fills in while
+   * we go on with the next frame; next_readback is the slot to use
+   * next, and the n_readbacks before it are in flight.
+   */
+  gboolean readback_supported;
+  gboolean captured_sync; /* Whether this recording captured a frame directly */
+  RecorderReadback readbacks[N_READBACK_SLOTS];
+  guint next_readback;
+  guint n_readbacks;
+  guint64 paint_count; /* Paints of the view being captured */
+
+  /* The frame the readbacks are patched into. It goes into the pipeline
+   * as is when it may, and is copied if it has to change while the
+   * pipeline still has it. The cursor is drawn into it, so we keep what
+   * is under the cursor to put back before the next change.
+   */
+  GstBuffer *frame;
+  gboolean frame_valid;   /* Whether all of it was read back */
+  gboolean frame_pending; /* Whether it changed since it went out */
+  guint8 *cursor_backing;
+  cairo_rectangle_int_t cursor_backing_rect;
+
   /* GSource IDs for different timeouts and idles */
   guint redraw_timeout;
   guint redraw_idle;
   guint update_memory_used_timeout;
   guint update_pointer_timeout;
   guint repaint_hook_id;
+  guint readback_timeout;
+  guint emit_timeout;
+  guint adapt_timeout;
 };
 
 struct _RecorderPipeline
@@ -88,6 +141,7 @@ struct _RecorderPipeline
   ShellRecorder *recorder;
   GstElement *pipeline;
   GstElement *src;
+  ShellRecorderFormat format; /* What src converts frames to */
   int outfile;
   char *filename;
 };
@@ -108,6 +162,9 @@ static void recorder_pipeline_closed   (RecorderPipeline *pipeline);
 
 static void recorder_remove_redraw_timeout (ShellRecorder *recorder);
 
+static ClutterStageView *recorder_get_readback_view (ShellRecorder *recorder);
+static gboolean recorder_refresh_frame (ShellRecorder *recorder);
+
 enum {
   PROP_0,
   PROP_DISPLAY,
@@ -153,6 +210,118 @@ G_DEFINE_TYPE(ShellRecorder, shell_recorder, G_TYPE_OBJECT);
  */
 #define DEFAULT_MEMORY_TARGET (512*1024)
 
+/* The number of frames after which we pick up the result of a readback
+ * started when painting a frame. By then the GPU has long finished it,
+ * so mapping the pixel buffer doesn't wait.
+ */
+#define READBACK_DELAY_FRAMES 2
+
+/* The time (in milliseconds) after which we pick up readbacks if no
+ * more frames are painted.
+ */
+#define READBACK_TIMEOUT 50
+
+/* The most rectangles we read back separately from a frame; we read
+ * back the extents of more than that.
+ */
+#define MAX_DAMAGE_RECTANGLES 16
+
+/* The time (in milliseconds) between adjustments of the capture rate
+ * to what the pipeline keeps up with.
+ */
+#define ADAPT_INTERVAL 250
+
+/* The pipeline is falling behind when more frames than this wait to go
+ * in, or more than a quarter of the memory target is used; it has room
+ * to spare when at most LOW_WATER_FRAMES wait.
+ */
+#define HIGH_WATER_FRAMES 4
+#define LOW_WATER_FRAMES 1
+
+/* We never go below this fraction of the frame rate */
+#define MIN_CAPTURE_RATE_FRACTION 0.2
+
+/* Running averages over recent frames, in microseconds, and counts of
+ * how frames were captured; for the performance log.
+ */
+static gint64 capture_time_sync;
+static gint64 capture_time_pipelined;
+static gint64 capture_latency;
+static gint64 damaged_area; /* In percent of the frame */
+static guint n_frames_sync;
+static guint n_frames_pipelined;
+static guint n_frames_undamaged;
+static gint64 capture_rate_fps;
+static gint64 encoder_rate_fps;
+static guint queue_length;
+static guint n_rate_decreases;
+static guint n_rate_increases;
+
+static void
+update_average (gint64 *average,
+                gint64  sample)
+{
+  if (*average == 0)
+    *average = sample;
+  else
+    *average = (7 * *average + sample) / 8;
+}
+
+static gint64
+region_get_area (const cairo_region_t *region)
+{
+  gint64 area = 0;
+  int i, n_rects;
+
+  n_rects = cairo_region_num_rectangles (region);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+
+      cairo_region_get_rectangle (region, i, &rect);
+      area += (gint64) rect.width * rect.height;
+    }
+
+  return area;
+}
+
+static void
+recorder_statistics_callback (ShellPerfLog *perf_log,
+                              gpointer      data)
+{
+  gint64 saved = 0;
+
+  if (capture_time_sync > 0 && capture_time_pipelined > 0)
+    saved = MAX (0, capture_time_sync - capture_time_pipelined);
+
+  shell_perf_log_update_statistic_x (perf_log, "recorder.captureTimeSync",
+                                     capture_time_sync);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.captureTimePipelined",
+                                     capture_time_pipelined);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.captureTimeSaved",
+                                     saved);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.captureLatency",
+                                     capture_latency);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.syncFrameCount",
+                                     n_frames_sync);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.pipelinedFrameCount",
+                                     n_frames_pipelined);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.undamagedFrameCount",
+                                     n_frames_undamaged);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.damagedArea",
+                                     damaged_area);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.captureRate",
+                                     capture_rate_fps);
+  shell_perf_log_update_statistic_x (perf_log, "recorder.encoderRate",
+                                     encoder_rate_fps);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.queueLength",
+                                     queue_length);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.rateDecreaseCount",
+                                     n_rate_decreases);
+  shell_perf_log_update_statistic_i (perf_log, "recorder.rateIncreaseCount",
+                                     n_rate_increases);
+}
+
 static guint
 get_memory_target (void)
 {
@@ -189,13 +358,16 @@ get_memory_target (void)
  *
  * Note: That this will cause the stage to be repainted on
  * every animation frame even if the frame wouldn't normally cause any new
- * drawing
+ * drawing. It isn't needed when frames are put together from the parts
+ * that were painted; see recorder_record_frame_pipelined().
  */
 static gboolean
 recorder_repaint_hook (gpointer data)
 {
-  ClutterActor *stage = data;
-  clutter_actor_queue_redraw (stage);
+  ShellRecorder *recorder = data;
+
+  if (recorder_get_readback_view (recorder) == NULL)
+    clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
 
   return TRUE;
 }
@@ -212,6 +384,7 @@ shell_recorder_init (ShellRecorder *recorder)
 
   recorder->state = RECORDER_STATE_CLOSED;
   recorder->framerate = DEFAULT_FRAMES_PER_SECOND;
+  recorder->capture_rate = DEFAULT_FRAMES_PER_SECOND;
   recorder->draw_cursor = TRUE;
 }
 
@@ -222,10 +395,7 @@ shell_recorder_finalize (GObject  *object)
 
   g_clear_handle_id (&recorder->update_memory_used_timeout, g_source_remove);
 
-  if (recorder->cursor_image)
-    cairo_surface_destroy (recorder->cursor_image);
-  if (recorder->cursor_memory)
-    g_free (recorder->cursor_memory);
+  g_clear_pointer (&recorder->cursor_image, cairo_surface_destroy);
 
   recorder_set_stage (recorder, NULL);
   recorder_set_pipeline (recorder, NULL);
@@ -254,134 +424,952 @@ recorder_update_memory_used (ShellRecorder *recorder,
   guint memory_used = 0;
   GSList *l;
 
-  for (l = recorder->pipelines; l; l = l->next)
+  for (l = recorder->pipelines; l; l = l->next)
+    {
+      RecorderPipeline *pipeline = l->data;
+      guint pipeline_memory_used;
+
+      g_object_get (pipeline->src,
+                    "memory-used", &pipeline_memory_used,
+                    NULL);
+      memory_used += pipeline_memory_used;
+    }
+
+  if (memory_used != recorder->memory_used)
+    recorder->memory_used = memory_used;
+}
+
+/* Timeout used to avoid not drawing for more than MAXIMUM_PAUSE_TIME
+ */
+static gboolean
+recorder_redraw_timeout (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  recorder->redraw_timeout = 0;
+
+  if (!recorder_refresh_frame (recorder))
+    clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+
+  return FALSE;
+}
+
+static void
+recorder_add_redraw_timeout (ShellRecorder *recorder)
+{
+  if (recorder->redraw_timeout == 0)
+    {
+      recorder->redraw_timeout = g_timeout_add (MAXIMUM_PAUSE_TIME,
+                                                recorder_redraw_timeout,
+                                                recorder);
+      g_source_set_name_by_id (recorder->redraw_timeout, "[gnome-shell] recorder_redraw_timeout");
+    }
+}
+
+static void
+recorder_remove_redraw_timeout (ShellRecorder *recorder)
+{
+  g_clear_handle_id (&recorder->redraw_timeout, g_source_remove);
+}
+
+static const cairo_user_data_key_t cursor_data_key;
+
+static void
+recorder_fetch_cursor_image (ShellRecorder *recorder)
+{
+  CoglTexture *texture;
+  int width, height;
+  int stride;
+  guint8 *data;
+
+  texture = meta_cursor_tracker_get_sprite (recorder->cursor_tracker);
+  if (!texture)
+    return;
+
+  meta_cursor_tracker_get_hot (recorder->cursor_tracker,
+                               &recorder->cursor_hot_x, &recorder->cursor_hot_y);
+
+  width = cogl_texture_get_width (texture);
+  height = cogl_texture_get_height (texture);
+  stride = 4 * width;
+  data = g_new (guint8, stride * height);
+  cogl_texture_get_data (texture, CLUTTER_CAIRO_FORMAT_ARGB32, stride, data);
+
+  /* FIXME: cairo-gl? */
+  recorder->cursor_image = cairo_image_surface_create_for_data (data,
+                                                                CAIRO_FORMAT_ARGB32,
+                                                                width, height,
+                                                                stride);
+
+  /* The image is passed on to convert frames, so it holds on to the data */
+  cairo_surface_set_user_data (recorder->cursor_image, &cursor_data_key,
+                               data, g_free);
+}
+
+/* Works out where the cursor goes in a frame, clipped to the frame;
+ * returns %FALSE if it isn't drawn at all.
+ */
+static gboolean
+recorder_get_cursor_rect (ShellRecorder         *recorder,
+                          int                    pointer_x,
+                          int                    pointer_y,
+                          cairo_rectangle_int_t *rect)
+{
+  cairo_rectangle_int_t frame_rect = { 0, 0, recorder->area.width, recorder->area.height };
+
+  /* We don't show a cursor unless the hot spot is in the frame; this
+   * means that sometimes we aren't going to draw a cursor even when
+   * there is a little bit overlapping within the stage */
+  if (pointer_x < recorder->area.x ||
+      pointer_y < recorder->area.y ||
+      pointer_x >= recorder->area.x + recorder->area.width ||
+      pointer_y >= recorder->area.y + recorder->area.height)
+    return FALSE;
+
+  if (!recorder->cursor_image)
+    recorder_fetch_cursor_image (recorder);
+
+  if (!recorder->cursor_image)
+    return FALSE;
+
+  rect->x = pointer_x - recorder->cursor_hot_x - recorder->area.x;
+  rect->y = pointer_y - recorder->cursor_hot_y - recorder->area.y;
+  rect->width = cairo_image_surface_get_width (recorder->cursor_image);
+  rect->height = cairo_image_surface_get_height (recorder->cursor_image);
+
+  return gdk_rectangle_intersect (rect, &frame_rect, rect);
+}
+
+/* Overlay the cursor image on the frame. We draw the cursor image
+ * into the host-memory buffer after  we've captured the frame. An
+ * alternate approach would be to turn off the cursor while recording
+ * and draw the cursor ourselves with GL, but then we'd need to figure
+ * out what the cursor looks like, or hard-code a non-system cursor.
+ */
+static void
+recorder_draw_cursor (ShellRecorder *recorder,
+                      GstBuffer     *buffer,
+                      int            pointer_x,
+                      int            pointer_y)
+{
+  cairo_rectangle_int_t rect;
+  GstMapInfo info;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  if (!recorder_get_cursor_rect (recorder, pointer_x, pointer_y, &rect))
+    return;
+
+  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+  surface = cairo_image_surface_create_for_data (info.data,
+                                                 CAIRO_FORMAT_ARGB32,
+                                                 recorder->area.width,
+                                                 recorder->area.height,
+                                                 recorder->area.width * 4);
+
+  cr = cairo_create (surface);
+  cairo_set_source_surface (cr,
+                            recorder->cursor_image,
+                            pointer_x - recorder->cursor_hot_x - recorder->area.x,
+                            pointer_y - recorder->cursor_hot_y - recorder->area.y);
+  cairo_paint (cr);
+
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+  gst_buffer_unmap (buffer, &info);
+}
+
+static gboolean
+recorder_should_draw_cursor (ShellRecorder *recorder)
+{
+  StSettings *settings = st_settings_get ();
+  gboolean magnifier_active = FALSE;
+
+  if (!recorder->draw_cursor)
+    return FALSE;
+
+  g_object_get (settings, "magnifier-active", &magnifier_active, NULL);
+
+  return !magnifier_active;
+}
+
+/* Finds the cursor to have the source draw over a frame as it converts
+ * it; returns %FALSE if there is none to draw.
+ */
+static gboolean
+recorder_get_cursor (ShellRecorder       *recorder,
+                     int                  pointer_x,
+                     int                  pointer_y,
+                     ShellRecorderCursor *cursor)
+{
+  cairo_rectangle_int_t rect;
+
+  if (!recorder_should_draw_cursor (recorder) ||
+      !recorder_get_cursor_rect (recorder, pointer_x, pointer_y, &rect))
+    return FALSE;
+
+  cursor->image = recorder->cursor_image;
+  cursor->x = pointer_x - recorder->cursor_hot_x - recorder->area.x;
+  cursor->y = pointer_y - recorder->cursor_hot_y - recorder->area.y;
+
+  return TRUE;
+}
+
+/* Has the source convert a frame, with the cursor drawn over it, and
+ * feed it into the pipeline
+ */
+static void
+recorder_add_frame (ShellRecorder *recorder,
+                    GstBuffer     *buffer,
+                    int            pointer_x,
+                    int            pointer_y)
+{
+  ShellRecorderCursor cursor;
+  gboolean has_cursor;
+
+  has_cursor = recorder_get_cursor (recorder, pointer_x, pointer_y, &cursor);
+  shell_recorder_src_add_frame (SHELL_RECORDER_SRC (recorder->current_pipeline->src),
+                                buffer, has_cursor ? &cursor : NULL);
+}
+
+/* Overlay the cursor on a captured frame and feed it into the pipeline
+ */
+static void
+recorder_push_frame (ShellRecorder *recorder,
+                     GstBuffer     *buffer,
+                     int            pointer_x,
+                     int            pointer_y)
+{
+  if (recorder->current_pipeline->format != SHELL_RECORDER_FORMAT_XRGB)
+    {
+      recorder_add_frame (recorder, buffer, pointer_x, pointer_y);
+    }
+  else
+    {
+      if (recorder_should_draw_cursor (recorder))
+        recorder_draw_cursor (recorder, buffer, pointer_x, pointer_y);
+
+      shell_recorder_src_add_buffer (SHELL_RECORDER_SRC (recorder->current_pipeline->src), buffer);
+    }
+
+  /* Reset the timeout that we used to avoid an overlong pause in the stream */
+  recorder_remove_redraw_timeout (recorder);
+  recorder_add_redraw_timeout (recorder);
+}
+
+static gboolean
+recorder_get_clock_time (ShellRecorder *recorder,
+                         GstClockTime  *clock_time)
+{
+  GstClock *clock;
+  GstClockTime base_time;
+
+  clock = gst_element_get_clock (recorder->current_pipeline->src);
+
+  /* If we have no clock yet, the pipeline is not yet in PLAYING */
+  if (!clock)
+    return FALSE;
+
+  base_time = gst_element_get_base_time (recorder->current_pipeline->src);
+  *clock_time = gst_clock_get_time (clock) - base_time;
+  gst_object_unref (clock);
+
+  return TRUE;
+}
+
+/* Whether a frame for @frame_time can go into the pipeline
+ */
+static gboolean
+recorder_frame_is_due (ShellRecorder *recorder,
+                       GstClockTime   frame_time)
+{
+  /* If we get into the red zone, stop buffering new frames; 13/16 is
+  * a bit more than the 3/4 threshold for a red indicator to keep the
+  * indicator from flashing between red and yellow. Lowering the capture
+  * rate should normally keep us well away from this. */
+  if (recorder->memory_used > (recorder->memory_target * 13) / 16)
+    return FALSE;
+
+  /* Drop frames to get down to something like the capture rate; since frames
+   * are generated with VBlank sync, we don't have full control anyways, so we just
+   * drop frames if the interval since the last frame is less than 75% of the
+   * desired inter-frame interval.
+   */
+  if (GST_CLOCK_TIME_IS_VALID (recorder->last_frame_time) &&
+      (frame_time <= recorder->last_frame_time ||
+       frame_time - recorder->last_frame_time < (GstClockTime) (0.75 * GST_SECOND / recorder->capture_rate)))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Decide whether to record a frame now, and if so, the timestamp to
+ * record it with
+ */
+static gboolean
+recorder_get_frame_time (ShellRecorder *recorder,
+                         GstClockTime  *frame_time)
+{
+  GstClockTime now;
+
+  if (!recorder_get_clock_time (recorder, &now))
+    return FALSE;
+
+  if (!recorder_frame_is_due (recorder, now))
+    return FALSE;
+  recorder->last_frame_time = now;
+
+  *frame_time = now;
+
+  return TRUE;
+}
+
+static void
+copy_pixels (guint8       *dest,
+             int           dest_stride,
+             const guint8 *src,
+             int           src_stride,
+             int           width,
+             int           height)
+{
+  int i;
+
+  for (i = 0; i < height; i++)
+    memcpy (dest + i * dest_stride, src + i * src_stride, width * 4);
+}
+
+/* Remembers what is under the cursor in the frame, to put it back
+ * before the frame is next changed
+ */
+static void
+recorder_save_cursor_backing (ShellRecorder               *recorder,
+                              const guint8                *data,
+                              const cairo_rectangle_int_t *rect)
+{
+  int stride = recorder->area.width * 4;
+
+  recorder->cursor_backing = g_realloc (recorder->cursor_backing,
+                                        rect->width * rect->height * 4);
+  copy_pixels (recorder->cursor_backing, rect->width * 4,
+               data + rect->y * stride + rect->x * 4, stride,
+               rect->width, rect->height);
+
+  recorder->cursor_backing_rect = *rect;
+}
+
+static void
+recorder_restore_cursor_backing (ShellRecorder *recorder,
+                                 guint8        *data)
+{
+  cairo_rectangle_int_t *rect = &recorder->cursor_backing_rect;
+  int stride = recorder->area.width * 4;
+
+  if (rect->width == 0)
+    return;
+
+  copy_pixels (data + rect->y * stride + rect->x * 4, stride,
+               recorder->cursor_backing, rect->width * 4,
+               rect->width, rect->height);
+
+  rect->width = 0;
+}
+
+/* Makes sure the frame can be changed without affecting what the
+ * pipeline still has of it, and takes the cursor back out of it
+ */
+static gboolean
+recorder_make_frame_writable (ShellRecorder *recorder)
+{
+  ShellRecorderSrc *src = SHELL_RECORDER_SRC (recorder->current_pipeline->src);
+  GstMapInfo info;
+
+  if (recorder->frame == NULL)
+    {
+      recorder->frame = shell_recorder_src_acquire_buffer (src);
+      recorder->frame_valid = FALSE;
+      recorder->cursor_backing_rect.width = 0;
+
+      return recorder->frame != NULL;
+    }
+
+  if (!gst_buffer_is_writable (recorder->frame))
+    {
+      GstBuffer *copy;
+
+      copy = shell_recorder_src_acquire_buffer (src);
+      if (copy == NULL)
+        return FALSE;
+
+      gst_buffer_map (recorder->frame, &info, GST_MAP_READ);
+      gst_buffer_fill (copy, 0, info.data, info.size);
+      gst_buffer_unmap (recorder->frame, &info);
+
+      gst_buffer_unref (recorder->frame);
+      recorder->frame = copy;
+    }
+
+  if (recorder->cursor_backing_rect.width > 0)
+    {
+      gst_buffer_map (recorder->frame, &info, GST_MAP_WRITE);
+      recorder_restore_cursor_backing (recorder, info.data);
+      gst_buffer_unmap (recorder->frame, &info);
+    }
+
+  return TRUE;
+}
+
+static void
+recorder_clear_frame (ShellRecorder *recorder)
+{
+  g_clear_pointer (&recorder->frame, gst_buffer_unref);
+  g_clear_pointer (&recorder->cursor_backing, g_free);
+  recorder->cursor_backing_rect.width = 0;
+  recorder->frame_valid = FALSE;
+  recorder->frame_pending = FALSE;
+  g_clear_handle_id (&recorder->emit_timeout, g_source_remove);
+}
+
+/* Overlay the cursor on the frame put together from readbacks and feed
+ * it into the pipeline; the frame itself is left without the cursor when
+ * the source converts it
+ */
+static void
+recorder_emit_frame (ShellRecorder *recorder,
+                     GstClockTime   frame_time)
+{
+  cairo_rectangle_int_t rect;
+  GstMapInfo info;
+
+  if (!recorder_make_frame_writable (recorder))
+    return;
+
+  GST_BUFFER_PTS(recorder->frame) = frame_time;
+
+  if (recorder->current_pipeline->format != SHELL_RECORDER_FORMAT_XRGB)
+    {
+      /* The cursor is drawn over the converted frame instead */
+      recorder_add_frame (recorder, recorder->frame,
+                          recorder->pointer_x, recorder->pointer_y);
+    }
+  else
+    {
+      if (recorder_should_draw_cursor (recorder) &&
+          recorder_get_cursor_rect (recorder, recorder->pointer_x, recorder->pointer_y, &rect))
+        {
+          gst_buffer_map (recorder->frame, &info, GST_MAP_READ);
+          recorder_save_cursor_backing (recorder, info.data, &rect);
+          gst_buffer_unmap (recorder->frame, &info);
+
+          recorder_draw_cursor (recorder, recorder->frame,
+                                recorder->pointer_x, recorder->pointer_y);
+        }
+
+      shell_recorder_src_add_buffer (SHELL_RECORDER_SRC (recorder->current_pipeline->src),
+                                     recorder->frame);
+    }
+
+  recorder->last_frame_time = frame_time;
+  recorder->frame_pending = FALSE;
+  n_frames_pipelined++;
+
+  /* Reset the timeout that we used to avoid an overlong pause in the stream */
+  recorder_remove_redraw_timeout (recorder);
+  recorder_add_redraw_timeout (recorder);
+}
+
+static gboolean
+recorder_emit_timeout (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  recorder->emit_timeout = 0;
+
+  if (recorder->frame_pending)
+    recorder_refresh_frame (recorder);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Feeds the frame, as of @frame_time, into the pipeline if that keeps
+ * us within the frame rate, or otherwise as soon as it does
+ */
+static void
+recorder_emit_frame_when_due (ShellRecorder *recorder,
+                              GstClockTime   frame_time)
+{
+  recorder->frame_pending = TRUE;
+
+  if (!recorder->frame_valid)
+    return;
+
+  if (recorder_frame_is_due (recorder, frame_time))
+    {
+      recorder_emit_frame (recorder, frame_time);
+      return;
+    }
+
+  if (recorder->emit_timeout == 0)
+    {
+      recorder->emit_timeout = g_timeout_add (MAX ((guint) (1000 / recorder->capture_rate), 1),
+                                              recorder_emit_timeout,
+                                              recorder);
+      g_source_set_name_by_id (recorder->emit_timeout, "[gnome-shell] recorder_emit_timeout");
+    }
+}
+
+static RecorderReadback *
+recorder_get_oldest_readback (ShellRecorder *recorder)
+{
+  guint oldest;
+
+  if (recorder->n_readbacks == 0)
+    return NULL;
+
+  oldest = (recorder->next_readback + N_READBACK_SLOTS - recorder->n_readbacks) % N_READBACK_SLOTS;
+
+  return &recorder->readbacks[oldest];
+}
+
+/* Picks up the oldest readback in flight and patches the parts of the
+ * frame it has into the frame; this waits for the GPU if it isn't done
+ * with it yet.
+ */
+static void
+recorder_finish_readback (ShellRecorder *recorder)
+{
+  RecorderReadback *readback;
+  cairo_region_t *damage;
+  GstMapInfo info;
+  guint8 *data;
+  gint64 start_time;
+  int stride;
+  int i, n_rects;
+
+  readback = recorder_get_oldest_readback (recorder);
+  g_return_if_fail (readback != NULL);
+
+  recorder->n_readbacks--;
+  if (recorder->n_readbacks == 0)
+    g_clear_handle_id (&recorder->readback_timeout, g_source_remove);
+
+  damage = g_steal_pointer (&readback->damage);
+
+  /* The pipeline went away on an error */
+  if (recorder->current_pipeline == NULL)
+    goto out;
+
+  start_time = g_get_monotonic_time ();
+
+  if (!recorder_make_frame_writable (recorder))
+    goto out;
+
+  data = cogl_buffer_map (COGL_BUFFER (readback->pixel_buffer),
+                          COGL_BUFFER_ACCESS_READ, 0);
+  if (data == NULL)
+    {
+      /* We are missing part of the frame now */
+      recorder->frame_valid = FALSE;
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+      goto out;
+    }
+
+  gst_buffer_map (recorder->frame, &info, GST_MAP_WRITE);
+
+  stride = readback->width * 4;
+  n_rects = cairo_region_num_rectangles (damage);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      int offset;
+
+      cairo_region_get_rectangle (damage, i, &rect);
+      offset = rect.y * stride + rect.x * 4;
+      copy_pixels (info.data + offset, stride,
+                   data + offset, stride,
+                   rect.width, rect.height);
+    }
+
+  gst_buffer_unmap (recorder->frame, &info);
+  cogl_buffer_unmap (COGL_BUFFER (readback->pixel_buffer));
+
+  if (readback->full)
+    recorder->frame_valid = TRUE;
+
+  update_average (&capture_time_pipelined,
+                  readback->issue_time + g_get_monotonic_time () - start_time);
+  update_average (&capture_latency,
+                  g_get_monotonic_time () - readback->start_time);
+
+  recorder_emit_frame_when_due (recorder, readback->pts);
+
+ out:
+  cairo_region_destroy (damage);
+}
+
+static void
+recorder_flush_readbacks (ShellRecorder *recorder)
+{
+  while (recorder->n_readbacks > 0)
+    recorder_finish_readback (recorder);
+}
+
+static gboolean
+recorder_readback_timeout (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  recorder->readback_timeout = 0;
+
+  /* No paints came along to pick up the readbacks in flight */
+  recorder_flush_readbacks (recorder);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+recorder_readback_clear (RecorderReadback *readback)
+{
+  g_clear_pointer (&readback->pixel_buffer, cogl_object_unref);
+  readback->width = 0;
+  readback->height = 0;
+}
+
+/* Frames read back before a change of size or area don't fit the
+ * frame after it; start over
+ */
+static void
+recorder_reset_frame (ShellRecorder *recorder)
+{
+  recorder_flush_readbacks (recorder);
+  recorder_clear_frame (recorder);
+}
+
+static void
+recorder_free_readbacks (ShellRecorder *recorder)
+{
+  int i;
+
+  recorder_reset_frame (recorder);
+
+  for (i = 0; i < N_READBACK_SLOTS; i++)
+    recorder_readback_clear (&recorder->readbacks[i]);
+
+  recorder->next_readback = 0;
+}
+
+static gboolean
+recorder_readback_ensure_size (RecorderReadback *readback,
+                               int               width,
+                               int               height)
+{
+  ClutterBackend *backend = clutter_get_default_backend ();
+  CoglContext *context = clutter_backend_get_cogl_context (backend);
+
+  if (readback->pixel_buffer && readback->width == width && readback->height == height)
+    return TRUE;
+
+  recorder_readback_clear (readback);
+
+  readback->pixel_buffer = cogl_pixel_buffer_new (context, (size_t) width * height * 4, NULL);
+  if (readback->pixel_buffer == NULL)
+    return FALSE;
+
+  /* Filled in once by the GPU, then read once by us */
+  cogl_buffer_set_update_hint (COGL_BUFFER (readback->pixel_buffer),
+                               COGL_BUFFER_UPDATE_HINT_STREAM);
+
+  readback->width = width;
+  readback->height = height;
+
+  return TRUE;
+}
+
+/* Returns the view to read frames back from without waiting for the
+ * GPU, or %NULL if we have to use clutter_stage_capture()
+ */
+static ClutterStageView *
+recorder_get_readback_view (ShellRecorder *recorder)
+{
+  ClutterStageView *view;
+  cairo_rectangle_int_t layout;
+
+  if (!recorder->readback_supported)
+    return NULL;
+
+  /* Read one frame of each recording back directly first, to know
+   * what we are saving */
+  if (!recorder->captured_sync)
+    return NULL;
+
+  if (recorder->capture_width <= 0 || recorder->capture_height <= 0)
+    return NULL;
+
+  view = clutter_stage_get_view_at (recorder->stage,
+                                    recorder->area.x + recorder->area.width / 2.0f,
+                                    recorder->area.y + recorder->area.height / 2.0f);
+  if (view == NULL)
+    return NULL;
+
+  /* An area on more than one monitor is put together from a capture
+   * of each; leave that to clutter_stage_capture()
+   */
+  clutter_stage_view_get_layout (view, &layout);
+  if (recorder->area.x < layout.x ||
+      recorder->area.y < layout.y ||
+      recorder->area.x + recorder->area.width > layout.x + layout.width ||
+      recorder->area.y + recorder->area.height > layout.y + layout.height)
+    return NULL;
+
+  if (clutter_stage_view_get_scale (view) != recorder->scale)
+    return NULL;
+
+  return view;
+}
+
+/* When frames are put together from what changed, there is no need to
+ * redraw the stage to record the cursor moving or to repeat a frame;
+ * feeds the frame as it is now into the pipeline instead, once that
+ * keeps us within the frame rate. Returns %FALSE if a redraw is needed.
+ */
+static gboolean
+recorder_refresh_frame (ShellRecorder *recorder)
+{
+  GstClockTime now;
+
+  if (recorder->current_pipeline == NULL || !recorder->frame_valid ||
+      recorder_get_readback_view (recorder) == NULL)
+    return FALSE;
+
+  /* Readbacks in flight are older than now */
+  recorder_flush_readbacks (recorder);
+
+  if (recorder_get_clock_time (recorder, &now))
+    recorder_emit_frame_when_due (recorder, now);
+
+  return TRUE;
+}
+
+/* Works out the part of the frame that was painted, in frame pixels;
+ * returns %NULL if the frame wasn't painted at all.
+ */
+static cairo_region_t *
+recorder_get_damage (ShellRecorder       *recorder,
+                     ClutterPaintContext *paint_context,
+                     gboolean            *full)
+{
+  const cairo_region_t *redraw_clip;
+  cairo_rectangle_int_t frame_rect = { 0, 0, recorder->capture_width, recorder->capture_height };
+  cairo_region_t *damage;
+  int i, n_rects;
+
+  redraw_clip = clutter_paint_context_get_redraw_clip (paint_context);
+  if (redraw_clip == NULL)
+    {
+      *full = TRUE;
+      return cairo_region_create_rectangle (&frame_rect);
+    }
+
+  damage = cairo_region_create ();
+
+  n_rects = cairo_region_num_rectangles (redraw_clip);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      int x1, y1, x2, y2;
+
+      cairo_region_get_rectangle (redraw_clip, i, &rect);
+
+      /* Round outwards, to cover all pixels the clip touches */
+      x1 = floorf ((rect.x - recorder->area.x) * recorder->scale);
+      y1 = floorf ((rect.y - recorder->area.y) * recorder->scale);
+      x2 = ceilf ((rect.x + rect.width - recorder->area.x) * recorder->scale);
+      y2 = ceilf ((rect.y + rect.height - recorder->area.y) * recorder->scale);
+
+      cairo_region_union_rectangle (damage,
+                                    &(cairo_rectangle_int_t) { x1, y1, x2 - x1, y2 - y1 });
+    }
+
+  cairo_region_intersect_rectangle (damage, &frame_rect);
+
+  if (cairo_region_is_empty (damage))
+    {
+      cairo_region_destroy (damage);
+      return NULL;
+    }
+
+  *full = cairo_region_contains_rectangle (damage, &frame_rect) == CAIRO_REGION_OVERLAP_IN;
+
+  /* Past a point, reading back many small rectangles costs more than
+   * reading back a few unchanged pixels */
+  if (cairo_region_num_rectangles (damage) > MAX_DAMAGE_RECTANGLES)
     {
-      RecorderPipeline *pipeline = l->data;
-      guint pipeline_memory_used;
+      cairo_rectangle_int_t extents;
 
-      g_object_get (pipeline->src,
-                    "memory-used", &pipeline_memory_used,
-                    NULL);
-      memory_used += pipeline_memory_used;
+      cairo_region_get_extents (damage, &extents);
+      cairo_region_destroy (damage);
+      damage = cairo_region_create_rectangle (&extents);
     }
 
-  if (memory_used != recorder->memory_used)
-    recorder->memory_used = memory_used;
+  return damage;
 }
 
-/* Timeout used to avoid not drawing for more than MAXIMUM_PAUSE_TIME
- */
 static gboolean
-recorder_redraw_timeout (gpointer data)
+recorder_has_full_readback (ShellRecorder *recorder)
 {
-  ShellRecorder *recorder = data;
+  guint i;
 
-  recorder->redraw_timeout = 0;
-  clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+  for (i = 0; i < recorder->n_readbacks; i++)
+    {
+      guint slot = (recorder->next_readback + N_READBACK_SLOTS - 1 - i) % N_READBACK_SLOTS;
+
+      if (recorder->readbacks[slot].full)
+        return TRUE;
+    }
 
   return FALSE;
 }
 
-static void
-recorder_add_redraw_timeout (ShellRecorder *recorder)
+/* Start copying the @damage part of the frame just painted in @view
+ * into a pixel buffer; this only queues the copy, the GPU does it
+ * after the frame.
+ */
+static gboolean
+recorder_start_readback (ShellRecorder    *recorder,
+                         ClutterStageView *view,
+                         cairo_region_t   *damage,
+                         gboolean          full,
+                         GstClockTime      now)
 {
-  if (recorder->redraw_timeout == 0)
-    {
-      recorder->redraw_timeout = g_timeout_add (MAXIMUM_PAUSE_TIME,
-                                                recorder_redraw_timeout,
-                                                recorder);
-      g_source_set_name_by_id (recorder->redraw_timeout, "[gnome-shell] recorder_redraw_timeout");
-    }
-}
+  RecorderReadback *readback;
+  CoglFramebuffer *framebuffer;
+  cairo_rectangle_int_t layout;
+  gint64 start_time;
+  int x, y, stride;
+  int i, n_rects;
+
+  /* All slots are in use; make room */
+  if (recorder->n_readbacks == N_READBACK_SLOTS)
+    recorder_finish_readback (recorder);
+
+  start_time = g_get_monotonic_time ();
+
+  readback = &recorder->readbacks[recorder->next_readback];
+  if (!recorder_readback_ensure_size (readback,
+                                      recorder->capture_width,
+                                      recorder->capture_height))
+    return FALSE;
 
-static void
-recorder_remove_redraw_timeout (ShellRecorder *recorder)
-{
-  g_clear_handle_id (&recorder->redraw_timeout, g_source_remove);
-}
+  framebuffer = clutter_stage_view_get_framebuffer (view);
+  clutter_stage_view_get_layout (view, &layout);
+  x = roundf ((recorder->area.x - layout.x) * recorder->scale);
+  y = roundf ((recorder->area.y - layout.y) * recorder->scale);
+  stride = readback->width * 4;
 
-static void
-recorder_fetch_cursor_image (ShellRecorder *recorder)
-{
-  CoglTexture *texture;
-  int width, height;
-  int stride;
-  guint8 *data;
+  /* Each rectangle lands where it belongs in a whole frame */
+  n_rects = cairo_region_num_rectangles (damage);
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t rect;
+      CoglBitmap *bitmap;
+      gboolean success;
+
+      cairo_region_get_rectangle (damage, i, &rect);
+
+      bitmap = cogl_bitmap_new_from_buffer (COGL_BUFFER (readback->pixel_buffer),
+                                            CLUTTER_CAIRO_FORMAT_ARGB32,
+                                            rect.width, rect.height, stride,
+                                            rect.y * stride + rect.x * 4);
+      success = cogl_framebuffer_read_pixels_into_bitmap (framebuffer,
+                                                          x + rect.x, y + rect.y,
+                                                          COGL_READ_PIXELS_COLOR_BUFFER,
+                                                          bitmap);
+      cogl_object_unref (bitmap);
+
+      if (!success)
+        return FALSE;
+    }
 
-  texture = meta_cursor_tracker_get_sprite (recorder->cursor_tracker);
-  if (!texture)
-    return;
+  readback->damage = cairo_region_reference (damage);
+  readback->full = full;
+  readback->frame = recorder->paint_count;
+  readback->start_time = start_time;
+  readback->pts = now;
+  readback->issue_time = g_get_monotonic_time () - start_time;
 
-  meta_cursor_tracker_get_hot (recorder->cursor_tracker,
-                               &recorder->cursor_hot_x, &recorder->cursor_hot_y);
+  recorder->next_readback = (recorder->next_readback + 1) % N_READBACK_SLOTS;
+  recorder->n_readbacks++;
 
-  width = cogl_texture_get_width (texture);
-  height = cogl_texture_get_height (texture);
-  stride = 4 * width;
-  data = g_new (guint8, stride * height);
-  cogl_texture_get_data (texture, CLUTTER_CAIRO_FORMAT_ARGB32, stride, data);
+  g_clear_handle_id (&recorder->readback_timeout, g_source_remove);
+  recorder->readback_timeout = g_timeout_add (READBACK_TIMEOUT,
+                                              recorder_readback_timeout,
+                                              recorder);
+  g_source_set_name_by_id (recorder->readback_timeout, "[gnome-shell] recorder_readback_timeout");
 
-  /* FIXME: cairo-gl? */
-  recorder->cursor_image = cairo_image_surface_create_for_data (data,
-                                                                CAIRO_FORMAT_ARGB32,
-                                                                width, height,
-                                                                stride);
-  recorder->cursor_memory = data;
+  return TRUE;
 }
 
-/* Overlay the cursor image on the frame. We draw the cursor image
- * into the host-memory buffer after  we've captured the frame. An
- * alternate approach would be to turn off the cursor while recording
- * and draw the cursor ourselves with GL, but then we'd need to figure
- * out what the cursor looks like, or hard-code a non-system cursor.
+/* Put together the captures of the views the area is on, in a frame
+ * buffer from the pool
  */
-static void
-recorder_draw_cursor (ShellRecorder *recorder,
-                      GstBuffer     *buffer)
+static GstBuffer *
+recorder_composite_captures (ShellRecorder  *recorder,
+                             ClutterCapture *captures,
+                             int             n_captures)
 {
+  GstBuffer *buffer;
   GstMapInfo info;
-  cairo_surface_t *surface;
+  cairo_surface_t *image;
   cairo_t *cr;
+  int i;
 
-  /* We don't show a cursor unless the hot spot is in the frame; this
-   * means that sometimes we aren't going to draw a cursor even when
-   * there is a little bit overlapping within the stage */
-  if (recorder->pointer_x < recorder->area.x ||
-      recorder->pointer_y < recorder->area.y ||
-      recorder->pointer_x >= recorder->area.x + recorder->area.width ||
-      recorder->pointer_y >= recorder->area.y + recorder->area.height)
-    return;
+  buffer = shell_recorder_src_acquire_buffer (SHELL_RECORDER_SRC (recorder->current_pipeline->src));
+  if (buffer == NULL)
+    return NULL;
 
-  if (!recorder->cursor_image)
-    recorder_fetch_cursor_image (recorder);
+  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+  image = cairo_image_surface_create_for_data (info.data,
+                                               CAIRO_FORMAT_ARGB32,
+                                               recorder->capture_width,
+                                               recorder->capture_height,
+                                               recorder->capture_width * 4);
+  cairo_surface_set_device_scale (image, recorder->scale, recorder->scale);
+
+  cr = cairo_create (image);
+
+  /* The buffer still holds an older frame, and the views might not
+   * cover all of the area */
+  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
 
-  if (!recorder->cursor_image)
-    return;
+  for (i = 0; i < n_captures; i++)
+    {
+      ClutterCapture *capture = &captures[i];
 
-  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
-  surface = cairo_image_surface_create_for_data (info.data,
-                                                 CAIRO_FORMAT_ARGB32,
-                                                 recorder->area.width,
-                                                 recorder->area.height,
-                                                 recorder->area.width * 4);
+      cairo_save (cr);
 
-  cr = cairo_create (surface);
-  cairo_set_source_surface (cr,
-                            recorder->cursor_image,
-                            recorder->pointer_x - recorder->cursor_hot_x - recorder->area.x,
-                            recorder->pointer_y - recorder->cursor_hot_y - recorder->area.y);
-  cairo_paint (cr);
+      cairo_translate (cr,
+                       capture->rect.x - recorder->area.x,
+                       capture->rect.y - recorder->area.y);
+      cairo_set_source_surface (cr, capture->image, 0, 0);
+      cairo_paint (cr);
+
+      cairo_restore (cr);
+    }
 
   cairo_destroy (cr);
-  cairo_surface_destroy (surface);
+  cairo_surface_destroy (image);
   gst_buffer_unmap (buffer, &info);
+
+  return buffer;
 }
 
-/* Retrieve a frame and feed it into the pipeline
+/* Read the frame back from the stage and feed it into the pipeline
  */
 static void
-recorder_record_frame (ShellRecorder *recorder,
-                       gboolean       paint)
+recorder_capture_frame (ShellRecorder *recorder,
+                        gboolean       paint,
+                        GstClockTime   now)
 {
   GstBuffer *buffer;
   ClutterCapture *captures;
@@ -391,85 +1379,139 @@ recorder_record_frame (ShellRecorder *recorder,
   uint8_t *data;
   GstMemory *memory;
   int i;
-  GstClock *clock;
-  GstClockTime now, base_time;
-
-  g_return_if_fail (recorder->current_pipeline != NULL);
-
-  /* If we get into the red zone, stop buffering new frames; 13/16 is
-  * a bit more than the 3/4 threshold for a red indicator to keep the
-  * indicator from flashing between red and yellow. */
-  if (recorder->memory_used > (recorder->memory_target * 13) / 16)
-    return;
-
-  /* Drop frames to get down to something like the target frame rate; since frames
-   * are generated with VBlank sync, we don't have full control anyways, so we just
-   * drop frames if the interval since the last frame is less than 75% of the
-   * desired inter-frame interval.
-   */
-  clock = gst_element_get_clock (recorder->current_pipeline->src);
-
-  /* If we have no clock yet, the pipeline is not yet in PLAYING */
-  if (!clock)
-    return;
+  gint64 start_time;
 
-  base_time = gst_element_get_base_time (recorder->current_pipeline->src);
-  now = gst_clock_get_time (clock) - base_time;
-  gst_object_unref (clock);
-
-  if (GST_CLOCK_TIME_IS_VALID (recorder->last_frame_time) &&
-      now - recorder->last_frame_time < gst_util_uint64_scale_int (GST_SECOND, 3, 4 * recorder->framerate))
-    return;
-  recorder->last_frame_time = now;
+  start_time = g_get_monotonic_time ();
 
   if (!clutter_stage_capture (recorder->stage, paint, &recorder->area,
                               &captures, &n_captures))
     return;
 
   if (n_captures == 1)
-    image = cairo_surface_reference (captures[0].image);
+    {
+      /* Hand the capture to the pipeline as it is, rather than copying it */
+      image = cairo_surface_reference (captures[0].image);
+      data = cairo_image_surface_get_data (image);
+      size = (cairo_image_surface_get_height (image) *
+              cairo_image_surface_get_stride (image));
+
+      buffer = gst_buffer_new();
+      memory = gst_memory_new_wrapped (0, data, size, 0, size,
+                                       image,
+                                       (GDestroyNotify) cairo_surface_destroy);
+      gst_buffer_insert_memory (buffer, -1, memory);
+    }
   else
-    image = shell_util_composite_capture_images (captures,
-                                                 n_captures,
-                                                 recorder->area.x,
-                                                 recorder->area.y,
-                                                 recorder->capture_width,
-                                                 recorder->capture_height,
-                                                 recorder->scale);
-
-  data = cairo_image_surface_get_data (image);
-  size = (cairo_image_surface_get_height (image) *
-          cairo_image_surface_get_stride (image));
+    {
+      buffer = recorder_composite_captures (recorder, captures, n_captures);
+    }
 
   for (i = 0; i < n_captures; i++)
     cairo_surface_destroy (captures[i].image);
   g_free (captures);
 
-  buffer = gst_buffer_new();
-  memory = gst_memory_new_wrapped (0, data, size, 0, size,
-                                   image,
-                                   (GDestroyNotify) cairo_surface_destroy);
-  gst_buffer_insert_memory (buffer, -1, memory);
+  if (buffer == NULL)
+    return;
 
   GST_BUFFER_PTS(buffer) = now;
 
-  if (recorder->draw_cursor)
+  recorder_push_frame (recorder, buffer,
+                       recorder->pointer_x, recorder->pointer_y);
+  gst_buffer_unref (buffer);
+
+  n_frames_sync++;
+  update_average (&capture_time_sync, g_get_monotonic_time () - start_time);
+  recorder->captured_sync = TRUE;
+}
+
+/* Retrieve a frame and feed it into the pipeline
+ */
+static void
+recorder_record_frame (ShellRecorder *recorder,
+                       gboolean       paint)
+{
+  GstClockTime now;
+
+  g_return_if_fail (recorder->current_pipeline != NULL);
+
+  /* Frames still being read back go first */
+  recorder_flush_readbacks (recorder);
+
+  if (!recorder_get_frame_time (recorder, &now))
+    return;
+
+  recorder_capture_frame (recorder, paint, now);
+
+  /* The frame put together from readbacks is behind now */
+  recorder->frame_valid = FALSE;
+}
+
+/* Retrieve the parts of a frame that were painted without waiting for
+ * the GPU to finish drawing it: the readback started when painting
+ * frame N is patched into the frame when painting frame
+ * N + READBACK_DELAY_FRAMES, or N + 1 if its slot is needed. Paints
+ * that leave the recorded area alone cost nothing.
+ *
+ * Returns %FALSE if that isn't possible, and the frame should go through
+ * recorder_record_frame() instead.
+ */
+static gboolean
+recorder_record_frame_pipelined (ShellRecorder       *recorder,
+                                 ClutterPaintContext *paint_context)
+{
+  ClutterStageView *view;
+  RecorderReadback *readback;
+  cairo_region_t *damage;
+  gboolean full = FALSE;
+  GstClockTime now;
+
+  g_return_val_if_fail (recorder->current_pipeline != NULL, TRUE);
+
+  view = recorder_get_readback_view (recorder);
+  if (view == NULL)
+    return FALSE;
+
+  /* Views are painted one after the other; wait for the one we record */
+  if (clutter_paint_context_get_framebuffer (paint_context) !=
+      clutter_stage_view_get_framebuffer (view))
+    return TRUE;
+
+  recorder->paint_count++;
+
+  while ((readback = recorder_get_oldest_readback (recorder)) != NULL &&
+         readback->frame + READBACK_DELAY_FRAMES <= recorder->paint_count)
+    recorder_finish_readback (recorder);
+
+  damage = recorder_get_damage (recorder, paint_context, &full);
+  if (damage == NULL)
     {
-      StSettings *settings = st_settings_get ();
-      gboolean magnifier_active = FALSE;
+      n_frames_undamaged++;
+      return TRUE;
+    }
 
-      g_object_get (settings, "magnifier-active", &magnifier_active, NULL);
+  /* Changes can only be patched into a complete frame; get one first */
+  if (!full && !recorder->frame_valid && !recorder_has_full_readback (recorder))
+    {
+      cairo_region_destroy (damage);
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+      return TRUE;
+    }
 
-      if (!magnifier_active)
-        recorder_draw_cursor (recorder, buffer);
+  if (!recorder_get_clock_time (recorder, &now))
+    {
+      cairo_region_destroy (damage);
+      return TRUE;
     }
 
-  shell_recorder_src_add_buffer (SHELL_RECORDER_SRC (recorder->current_pipeline->src), buffer);
-  gst_buffer_unref (buffer);
+  update_average (&damaged_area,
+                  100 * region_get_area (damage) / ((gint64) recorder->capture_width * recorder->capture_height));
 
-  /* Reset the timeout that we used to avoid an overlong pause in the stream */
-  recorder_remove_redraw_timeout (recorder);
-  recorder_add_redraw_timeout (recorder);
+  if (!recorder_start_readback (recorder, view, damage, full, now))
+    recorder_record_frame (recorder, FALSE);
+
+  cairo_region_destroy (damage);
+
+  return TRUE;
 }
 
 /* We hook in by recording each frame right after the stage is painted
@@ -480,7 +1522,10 @@ recorder_on_stage_paint (ClutterActor        *actor,
                          ClutterPaintContext *paint_context,
                          ShellRecorder       *recorder)
 {
-  if (recorder->state == RECORDER_STATE_RECORDING)
+  if (recorder->state != RECORDER_STATE_RECORDING)
+    return;
+
+  if (!recorder_record_frame_pipelined (recorder, paint_context))
     recorder_record_frame (recorder, FALSE);
 }
 
@@ -512,6 +1557,9 @@ recorder_on_stage_notify_size (GObject          *object,
                                GParamSpec       *pspec,
                                ShellRecorder    *recorder)
 {
+  /* Frames read back so far have the old size */
+  recorder_reset_frame (recorder);
+
   recorder_update_size (recorder);
 
   /* This breaks the recording but tweaking the GStreamer pipeline a bit
@@ -528,7 +1576,9 @@ recorder_idle_redraw (gpointer data)
   ShellRecorder *recorder = data;
 
   recorder->redraw_idle = 0;
-  clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
+
+  if (!recorder_refresh_frame (recorder))
+    clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
 
   return FALSE;
 }
@@ -552,16 +1602,7 @@ static void
 on_cursor_changed (MetaCursorTracker *tracker,
                    ShellRecorder     *recorder)
 {
-  if (recorder->cursor_image)
-    {
-      cairo_surface_destroy (recorder->cursor_image);
-      recorder->cursor_image = NULL;
-    }
-  if (recorder->cursor_memory)
-    {
-      g_free (recorder->cursor_memory);
-      recorder->cursor_memory = NULL;
-    }
+  g_clear_pointer (&recorder->cursor_image, cairo_surface_destroy);
 
   recorder_queue_redraw (recorder);
 }
@@ -812,11 +1853,71 @@ static void
 shell_recorder_class_init (ShellRecorderClass *klass)
 {
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  ShellPerfLog *perf_log;
 
   gobject_class->finalize = shell_recorder_finalize;
   gobject_class->get_property = shell_recorder_get_property;
   gobject_class->set_property = shell_recorder_set_property;
 
+  perf_log = shell_perf_log_get_default ();
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.captureTimeSync",
+                                   "Main loop time to capture a frame by reading it back directly, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.captureTimePipelined",
+                                   "Main loop time to capture a frame through a pixel buffer, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.captureTimeSaved",
+                                   "Main loop time saved per frame by capturing through a pixel buffer, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.captureLatency",
+                                   "Time from painting a frame to reading it back through a pixel buffer, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.syncFrameCount",
+                                   "Number of frames captured by reading them back directly",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.pipelinedFrameCount",
+                                   "Number of frames put together from pixel buffer readbacks",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.undamagedFrameCount",
+                                   "Number of painted frames that left the recorded area alone",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.damagedArea",
+                                   "Part of the recorded area read back per painted frame, in percent",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.captureRate",
+                                   "Frame rate the recorder captures at, in frames per second",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.encoderRate",
+                                   "Frame rate the recording pipeline takes frames at, in frames per second",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.queueLength",
+                                   "Number of frames waiting to go into the recording pipeline",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.rateDecreaseCount",
+                                   "Number of times the capture rate was lowered for the pipeline to keep up",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "recorder.rateIncreaseCount",
+                                   "Number of times the capture rate was raised again",
+                                   "i");
+
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          recorder_statistics_callback,
+                                          NULL, NULL);
+
   g_object_class_install_property (gobject_class,
                                    PROP_DISPLAY,
                                    g_param_spec_object ("display",
@@ -868,35 +1969,87 @@ shell_recorder_class_init (ShellRecorderClass *klass)
                                                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
+static GstCaps *
+recorder_pipeline_make_caps (RecorderPipeline    *pipeline,
+                             ShellRecorderFormat  format)
+{
+  ShellRecorder *recorder = pipeline->recorder;
+
+  switch (format)
+    {
+    case SHELL_RECORDER_FORMAT_I420:
+    case SHELL_RECORDER_FORMAT_NV12:
+      return gst_caps_new_simple ("video/x-raw",
+                                  "format", G_TYPE_STRING,
+                                  format == SHELL_RECORDER_FORMAT_I420 ? "I420" : "NV12",
+                                  "colorimetry", G_TYPE_STRING, "bt709",
+                                  "framerate", GST_TYPE_FRACTION, recorder->framerate, 1,
+                                  "width", G_TYPE_INT, recorder->capture_width,
+                                  "height", G_TYPE_INT, recorder->capture_height,
+                                  NULL);
+    case SHELL_RECORDER_FORMAT_XRGB:
+    default:
+      /* The data is always native-endian xRGB; videoconvert
+       * doesn't support little-endian xRGB, but does support
+       * big-endian BGRx.
+       */
+      return gst_caps_new_simple ("video/x-raw",
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+                                  "format", G_TYPE_STRING, "BGRx",
+#else
+                                  "format", G_TYPE_STRING, "xRGB",
+#endif
+                                  "framerate", GST_TYPE_FRACTION, recorder->framerate, 1,
+                                  "width", G_TYPE_INT, recorder->capture_width,
+                                  "height", G_TYPE_INT, recorder->capture_height,
+                                  NULL);
+    }
+}
+
 /* Sets the GstCaps (video format, in this case) on the stream
  */
 static void
 recorder_pipeline_set_caps (RecorderPipeline *pipeline)
 {
-  ShellRecorder *recorder = pipeline->recorder;
   GstCaps *caps;
 
-  /* The data is always native-endian xRGB; videoconvert
-   * doesn't support little-endian xRGB, but does support
-   * big-endian BGRx.
-   */
-  caps = gst_caps_new_simple ("video/x-raw",
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-                              "format", G_TYPE_STRING, "BGRx",
-#else
-                              "format", G_TYPE_STRING, "xRGB",
-#endif
-                              "framerate", GST_TYPE_FRACTION, recorder->framerate, 1,
-                              "width", G_TYPE_INT, recorder->capture_width,
-                              "height", G_TYPE_INT, recorder->capture_height,
-                              NULL);
+  caps = recorder_pipeline_make_caps (pipeline, pipeline->format);
   g_object_set (pipeline->src, "caps", caps, NULL);
   gst_caps_unref (caps);
 }
 
+/* Picks a format the source can convert frames to that @sink_pad takes
+ * as is, so that no videoconvert element is needed; most encoders take
+ * I420.
+ */
+static ShellRecorderFormat
+recorder_pipeline_choose_format (RecorderPipeline *pipeline,
+                                 GstPad           *sink_pad)
+{
+  static const ShellRecorderFormat formats[] = {
+    SHELL_RECORDER_FORMAT_I420,
+    SHELL_RECORDER_FORMAT_NV12,
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (formats); i++)
+    {
+      GstCaps *caps = recorder_pipeline_make_caps (pipeline, formats[i]);
+      gboolean accepted = gst_pad_query_accept_caps (sink_pad, caps);
+
+      gst_caps_unref (caps);
+
+      if (accepted)
+        return formats[i];
+    }
+
+  return SHELL_RECORDER_FORMAT_XRGB;
+}
+
 /* Augments the supplied pipeline with the source elements: the actual
- * ShellRecorderSrc element where we inject frames then additional elements
- * to convert the output into something palatable.
+ * ShellRecorderSrc element where we inject frames then, unless it can
+ * convert frames into something the pipeline takes itself, additional
+ * elements to convert the output into something palatable.
  */
 static gboolean
 recorder_pipeline_add_source (RecorderPipeline *pipeline)
@@ -920,21 +2073,31 @@ recorder_pipeline_add_source (RecorderPipeline *pipeline)
     }
   gst_bin_add (GST_BIN (pipeline->pipeline), pipeline->src);
 
+  g_object_set (pipeline->src, "memory-target", pipeline->recorder->memory_target, NULL);
+
+  pipeline->format = recorder_pipeline_choose_format (pipeline, sink_pad);
   recorder_pipeline_set_caps (pipeline);
 
-  /* The videoconvert element is a generic converter; it will convert
-   * our supplied fixed format data into whatever the encoder wants
-   */
-  videoconvert = gst_element_factory_make ("videoconvert", NULL);
-  if (!videoconvert)
+  if (pipeline->format != SHELL_RECORDER_FORMAT_XRGB)
     {
-      g_warning("Can't create videoconvert element");
-      goto out;
+      src_pad = gst_element_get_static_pad (pipeline->src, "src");
     }
-  gst_bin_add (GST_BIN (pipeline->pipeline), videoconvert);
+  else
+    {
+      /* The videoconvert element is a generic converter; it will convert
+       * our supplied fixed format data into whatever the encoder wants
+       */
+      videoconvert = gst_element_factory_make ("videoconvert", NULL);
+      if (!videoconvert)
+        {
+          g_warning("Can't create videoconvert element");
+          goto out;
+        }
+      gst_bin_add (GST_BIN (pipeline->pipeline), videoconvert);
 
-  gst_element_link_many (pipeline->src, videoconvert, NULL);
-  src_pad = gst_element_get_static_pad (videoconvert, "src");
+      gst_element_link_many (pipeline->src, videoconvert, NULL);
+      src_pad = gst_element_get_static_pad (videoconvert, "src");
+    }
 
   if (!src_pad)
     {
@@ -1179,6 +2342,92 @@ recorder_pipeline_on_memory_used_changed (ShellRecorderSrc *src,
     }
 }
 
+/* Moves the capture rate towards what the pipeline keeps up with: when
+ * frames pile up in front of it, halfway down to a bit below the rate
+ * it takes them at, so the backlog drains; when it has room to spare,
+ * a step back up towards the frame rate. Lowering the rate this way
+ * spaces out frames evenly, rather than dropping runs of them once
+ * memory runs out.
+ */
+static void
+recorder_adapt_capture_rate (ShellRecorder *recorder)
+{
+  ShellRecorderSrc *src = SHELL_RECORDER_SRC (recorder->current_pipeline->src);
+  double min_rate = MAX (recorder->framerate * MIN_CAPTURE_RATE_FRACTION, 1.0);
+  double rate;
+  guint64 n_buffers_sent;
+  guint n_queued;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+  n_buffers_sent = shell_recorder_src_get_n_buffers_sent (src);
+  n_queued = shell_recorder_src_get_queue_length (src);
+
+  rate = (double) (n_buffers_sent - recorder->last_n_buffers_sent) * G_USEC_PER_SEC /
+         MAX (now - recorder->last_adapt_time, 1);
+
+  if (recorder->encoder_rate == 0)
+    recorder->encoder_rate = rate;
+  else
+    recorder->encoder_rate = 0.7 * recorder->encoder_rate + 0.3 * rate;
+
+  recorder->last_n_buffers_sent = n_buffers_sent;
+  recorder->last_adapt_time = now;
+
+  if (n_queued > HIGH_WATER_FRAMES ||
+      recorder->memory_used > recorder->memory_target / 4)
+    {
+      double target = MIN (recorder->capture_rate, 0.9 * recorder->encoder_rate);
+
+      target = MAX (target, min_rate);
+      if (target < recorder->capture_rate)
+        {
+          recorder->capture_rate -= (recorder->capture_rate - target) / 2;
+          n_rate_decreases++;
+        }
+    }
+  else if (n_queued <= LOW_WATER_FRAMES && recorder->capture_rate < recorder->framerate)
+    {
+      recorder->capture_rate = MIN (recorder->capture_rate + recorder->framerate / 10.0,
+                                    recorder->framerate);
+      n_rate_increases++;
+    }
+
+  capture_rate_fps = (gint64) (recorder->capture_rate + 0.5);
+  encoder_rate_fps = (gint64) (recorder->encoder_rate + 0.5);
+  queue_length = n_queued;
+}
+
+static gboolean
+recorder_adapt_timeout (gpointer data)
+{
+  ShellRecorder *recorder = data;
+
+  if (recorder->current_pipeline == NULL)
+    {
+      recorder->adapt_timeout = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  recorder_adapt_capture_rate (recorder);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+recorder_start_adapting (ShellRecorder *recorder)
+{
+  recorder->capture_rate = recorder->framerate;
+  recorder->encoder_rate = 0;
+  recorder->last_n_buffers_sent = 0;
+  recorder->last_adapt_time = g_get_monotonic_time ();
+
+  recorder->adapt_timeout = g_timeout_add (ADAPT_INTERVAL,
+                                           recorder_adapt_timeout,
+                                           recorder);
+  g_source_set_name_by_id (recorder->adapt_timeout, "[gnome-shell] recorder_adapt_timeout");
+}
+
 static void
 recorder_pipeline_free (RecorderPipeline *pipeline)
 {
@@ -1487,6 +2736,8 @@ shell_recorder_set_area (ShellRecorder *recorder,
 {
   g_return_if_fail (SHELL_IS_RECORDER (recorder));
 
+  recorder_reset_frame (recorder);
+
   recorder->custom_area = TRUE;
   recorder->area.x = CLAMP (x, 0, recorder->stage_width);
   recorder->area.y = CLAMP (y, 0, recorder->stage_height);
@@ -1545,6 +2796,15 @@ shell_recorder_record (ShellRecorder  *recorder,
 
   recorder->last_frame_time = GST_CLOCK_TIME_NONE;
 
+  /* Frames are read back into pixel buffers that we map later */
+  recorder->readback_supported =
+    cogl_has_feature (clutter_backend_get_cogl_context (clutter_get_default_backend ()),
+                      COGL_FEATURE_ID_MAP_BUFFER_FOR_READ);
+  recorder->captured_sync = FALSE;
+  recorder->paint_count = 0;
+
+  recorder_start_adapting (recorder);
+
   recorder->state = RECORDER_STATE_RECORDING;
   recorder_update_pointer (recorder);
   recorder_add_update_pointer_timeout (recorder);
@@ -1553,7 +2813,7 @@ shell_recorder_record (ShellRecorder  *recorder,
   meta_disable_unredirect_for_display (shell_global_get_display (shell_global_get ()));
 
   /* Set up repaint hook */
-  recorder->repaint_hook_id = clutter_threads_add_repaint_func(recorder_repaint_hook, recorder->stage, NULL);
+  recorder->repaint_hook_id = clutter_threads_add_repaint_func(recorder_repaint_hook, recorder, NULL);
 
   /* Record an initial frame and also redraw with the indicator */
   clutter_actor_queue_redraw (CLUTTER_ACTOR (recorder->stage));
@@ -1585,8 +2845,10 @@ shell_recorder_close (ShellRecorder *recorder)
    * elapsed since the last frame
    */
   recorder_record_frame (recorder, TRUE);
+  recorder_free_readbacks (recorder);
 
   recorder_remove_update_pointer_timeout (recorder);
+  g_clear_handle_id (&recorder->adapt_timeout, g_source_remove);
   recorder_close_pipeline (recorder);
 
   /* Queue a redraw to remove the recording indicator */
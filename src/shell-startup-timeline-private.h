@@ -0,0 +1,13 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_STARTUP_TIMELINE_PRIVATE_H__
+#define __SHELL_STARTUP_TIMELINE_PRIVATE_H__
+
+#include <clutter/clutter.h>
+
+#include "shell-startup-timeline.h"
+
+void _shell_startup_timeline_init (void);
+
+void _shell_startup_timeline_finish_on_first_frame (ClutterStage *stage);
+
+#endif /* __SHELL_STARTUP_TIMELINE_PRIVATE_H__ */
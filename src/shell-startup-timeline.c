@@ -0,0 +1,294 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "shell-perf-log.h"
+#include "shell-startup-timeline-private.h"
+
+/**
+ * SECTION:shell-startup-timeline
+ * @short_description: Breakdown of the time from main() to the first frame
+ *
+ * The startup timeline records how long each phase of startup takes,
+ * from the start of main() until the stage has painted its first
+ * frame: initializing mutter and the shell libraries, setting up the
+ * compositor plugin, importing JavaScript modules, loading the theme,
+ * enabling each extension and so on. Phases are named spans, started
+ * with shell_startup_timeline_begin() and ended with
+ * shell_startup_timeline_end(), and may nest.
+ *
+ * Once the first frame is painted the timeline is finished; later
+ * calls are ignored, so the functions can be left in code paths that
+ * also run after startup. The finished timeline is written as JSON to
+ * the file named by the SHELL_STARTUP_TIMELINE_OUTPUT environment
+ * variable, or to gnome-shell/startup-timeline.json in the user runtime
+ * directory. Phases are also recorded as startup.phaseBegin and
+ * startup.phaseEnd events in the #ShellPerfLog, when that is enabled.
+ */
+
+/* Increase when the meaning of existing fields in the dump changes */
+#define TIMELINE_VERSION 1
+
+typedef struct {
+  char *name;
+  gint64 start;
+  gint64 end;   /* 0 while the phase is open */
+  guint depth;
+} ShellStartupPhase;
+
+static gint64 timeline_origin = 0;
+static gint64 first_frame_time = 0;
+static gboolean finished = FALSE;
+static guint open_phases = 0;
+static GArray *phases = NULL;
+
+static guint phase_begin_event = 0;
+static guint phase_end_event = 0;
+
+/* Microseconds since the timeline was initialized at the top of main() */
+static gint64
+get_time (void)
+{
+  return g_get_monotonic_time () - timeline_origin;
+}
+
+void
+_shell_startup_timeline_init (void)
+{
+  ShellPerfLog *perf_log;
+
+  g_return_if_fail (phases == NULL);
+
+  timeline_origin = g_get_monotonic_time ();
+  phases = g_array_new (FALSE, TRUE, sizeof (ShellStartupPhase));
+
+  perf_log = shell_perf_log_get_default ();
+  phase_begin_event = shell_perf_log_define_event (perf_log,
+                                                   "startup.phaseBegin",
+                                                   "Start of a startup phase",
+                                                   "s");
+  phase_end_event = shell_perf_log_define_event (perf_log,
+                                                 "startup.phaseEnd",
+                                                 "End of a startup phase",
+                                                 "s");
+}
+
+/**
+ * shell_startup_timeline_begin:
+ * @phase: name of the phase
+ *
+ * Marks the start of a startup phase. Phases started while another
+ * phase is open are nested inside it. Does nothing once the timeline
+ * is finished.
+ */
+void
+shell_startup_timeline_begin (const char *phase)
+{
+  ShellStartupPhase new_phase = { 0, };
+
+  g_return_if_fail (phase != NULL);
+
+  if (phases == NULL || finished)
+    return;
+
+  new_phase.name = g_strdup (phase);
+  new_phase.start = get_time ();
+  new_phase.depth = open_phases++;
+  g_array_append_val (phases, new_phase);
+
+  shell_perf_log_record_s (shell_perf_log_get_default (),
+                           phase_begin_event, phase);
+}
+
+/**
+ * shell_startup_timeline_end:
+ * @phase: name of the phase
+ *
+ * Marks the end of the most recently started phase named @phase.
+ * Does nothing once the timeline is finished.
+ */
+void
+shell_startup_timeline_end (const char *phase)
+{
+  int i;
+
+  g_return_if_fail (phase != NULL);
+
+  if (phases == NULL || finished)
+    return;
+
+  for (i = phases->len - 1; i >= 0; i--)
+    {
+      ShellStartupPhase *p = &g_array_index (phases, ShellStartupPhase, i);
+
+      if (p->end == 0 && strcmp (p->name, phase) == 0)
+        {
+          p->end = get_time ();
+          open_phases--;
+
+          shell_perf_log_record_s (shell_perf_log_get_default (),
+                                   phase_end_event, phase);
+          return;
+        }
+    }
+
+  g_warning ("Startup phase '%s' ended without being started", phase);
+}
+
+/**
+ * shell_startup_timeline_is_finished:
+ *
+ * Returns: %TRUE once the first frame has been painted and the
+ *   timeline no longer changes, or if no timeline is being recorded
+ *   in this process
+ */
+gboolean
+shell_startup_timeline_is_finished (void)
+{
+  return phases == NULL || finished;
+}
+
+/**
+ * shell_startup_timeline_get_first_frame_time:
+ *
+ * Returns: the time the first frame finished painting, in microseconds
+ *   since the start of main(), or 0 if that hasn't happened yet
+ */
+gint64
+shell_startup_timeline_get_first_frame_time (void)
+{
+  return first_frame_time;
+}
+
+/**
+ * shell_startup_timeline_get_phases:
+ *
+ * Gets the phases recorded so far, in the order they were started.
+ * Each element is a tuple of (name, start time, end time, nesting
+ * depth); times are in microseconds since the start of main(), and
+ * the end time is 0 for phases that were never ended.
+ *
+ * Returns: (transfer full): a #GVariant of type a(sxxu)
+ */
+GVariant *
+shell_startup_timeline_get_phases (void)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxxu)"));
+
+  for (i = 0; phases != NULL && i < phases->len; i++)
+    {
+      ShellStartupPhase *p = &g_array_index (phases, ShellStartupPhase, i);
+
+      g_variant_builder_add (&builder, "(sxxu)",
+                             p->name, p->start, p->end, p->depth);
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+append_json_string (GString    *out,
+                    const char *str)
+{
+  g_string_append_c (out, '"');
+  for (; *str; str++)
+    {
+      if (*str == '"' || *str == '\\')
+        g_string_append_printf (out, "\\%c", *str);
+      else if ((guchar) *str < 0x20)
+        g_string_append_printf (out, "\\u%04x", *str);
+      else
+        g_string_append_c (out, *str);
+    }
+  g_string_append_c (out, '"');
+}
+
+static void
+dump_timeline (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree char *dir = NULL;
+  g_autofree char *path = NULL;
+  GString *out;
+  guint i;
+
+  if (g_getenv ("SHELL_STARTUP_TIMELINE_OUTPUT"))
+    {
+      path = g_strdup (g_getenv ("SHELL_STARTUP_TIMELINE_OUTPUT"));
+    }
+  else
+    {
+      dir = g_build_filename (g_get_user_runtime_dir (), "gnome-shell", NULL);
+      if (g_mkdir_with_parents (dir, 0700) < 0)
+        {
+          g_warning ("Failed to create %s: %s", dir, g_strerror (errno));
+          return;
+        }
+
+      path = g_build_filename (dir, "startup-timeline.json", NULL);
+    }
+
+  out = g_string_new (NULL);
+  g_string_append_printf (out,
+                          "{ \"version\": %d,\n"
+                          "  \"firstFrame\": %" G_GINT64_FORMAT ",\n"
+                          "  \"phases\": [",
+                          TIMELINE_VERSION, first_frame_time);
+
+  for (i = 0; i < phases->len; i++)
+    {
+      ShellStartupPhase *p = &g_array_index (phases, ShellStartupPhase, i);
+
+      g_string_append (out, i == 0 ? "\n    { \"name\": " : ",\n    { \"name\": ");
+      append_json_string (out, p->name);
+      g_string_append_printf (out,
+                              ", \"start\": %" G_GINT64_FORMAT
+                              ", \"end\": %" G_GINT64_FORMAT
+                              ", \"depth\": %u }",
+                              p->start, p->end, p->depth);
+    }
+
+  g_string_append (out, " ]\n}\n");
+
+  if (!g_file_set_contents (path, out->str, out->len, &error))
+    g_warning ("Failed to write startup timeline: %s", error->message);
+
+  g_string_free (out, TRUE);
+}
+
+static void
+on_first_frame (ClutterStage *stage,
+                gpointer      data)
+{
+  g_signal_handlers_disconnect_by_func (stage, on_first_frame, data);
+
+  if (phases == NULL || finished)
+    return;
+
+  first_frame_time = get_time ();
+  finished = TRUE;
+
+  dump_timeline ();
+}
+
+/*
+ * _shell_startup_timeline_finish_on_first_frame:
+ * @stage: the stage
+ *
+ * Arranges for the timeline to be finished and written out after
+ * @stage paints for the first time.
+ */
+void
+_shell_startup_timeline_finish_on_first_frame (ClutterStage *stage)
+{
+  g_signal_connect (stage, "after-paint",
+                    G_CALLBACK (on_first_frame), NULL);
+}
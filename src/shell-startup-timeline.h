@@ -0,0 +1,18 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_STARTUP_TIMELINE_H__
+#define __SHELL_STARTUP_TIMELINE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void      shell_startup_timeline_begin (const char *phase);
+void      shell_startup_timeline_end   (const char *phase);
+
+gboolean  shell_startup_timeline_is_finished         (void);
+gint64    shell_startup_timeline_get_first_frame_time (void);
+GVariant *shell_startup_timeline_get_phases          (void);
+
+G_END_DECLS
+
+#endif /* __SHELL_STARTUP_TIMELINE_H__ */
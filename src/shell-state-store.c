@@ -0,0 +1,418 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include "shell-perf-log.h"
+#include "shell-state-store.h"
+
+/*
+ * ShellStateStore:
+ *
+ * Keeps the serialized properties of the runtime or persistent state
+ * in one file, STATE_FILENAME in the state directory, as an a{sv}
+ * dictionary. The file is mapped into memory once when the store is
+ * created, and the values point into the mapping until they are
+ * replaced.
+ *
+ * Changes are written out together once no more came in for
+ * FLUSH_TIMEOUT_MS, so a burst of changes to any number of properties
+ * costs one atomic replacement of the file. A change made while the
+ * file is being written is picked up by the next write, rather than
+ * cancelling the current one. shell_state_store_flush_sync() writes
+ * pending changes right away, for state that has to survive a crash,
+ * and before the process exits or replaces itself.
+ *
+ * Older versions kept each property in a file of its own, named after
+ * the property, in the same directory. Such a file is read the first
+ * time the property is asked for and is not in the store; it is
+ * removed once the store has been written without it.
+ */
+
+#define STATE_FILENAME "state.gvariant"
+
+#define FLUSH_TIMEOUT_MS 100
+
+struct _ShellStateStore {
+  GFile *dir;
+  GFile *file;
+
+  /* <char *property_name, GVariant *value> */
+  GHashTable *values;
+
+  /* Properties whose file from older versions was read or superseded */
+  GHashTable *checked;
+
+  /* Files from older versions, to remove after the next write, and
+   * after the one in progress */
+  GPtrArray *legacy_files;
+  GPtrArray *writing_legacy_files;
+
+  GCancellable *cancellable;
+  guint flush_id;
+  gboolean writing;
+  gboolean dirty;
+};
+
+static guint n_changes;
+static guint n_writes;
+static guint64 n_bytes_written;
+
+static void
+state_store_statistics_callback (ShellPerfLog *perf_log,
+                                 gpointer      data)
+{
+  shell_perf_log_update_statistic_i (perf_log, "state.changeCount",
+                                     n_changes);
+  shell_perf_log_update_statistic_i (perf_log, "state.writeCount",
+                                     n_writes);
+  shell_perf_log_update_statistic_x (perf_log, "state.writeBytes",
+                                     n_bytes_written);
+}
+
+static void
+init_statistics (void)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "state.changeCount",
+                                   "Number of changes to runtime and persistent state",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "state.writeCount",
+                                   "Number of times runtime and persistent state was written",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "state.writeBytes",
+                                   "Amount of runtime and persistent state written, in bytes",
+                                   "x");
+
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          state_store_statistics_callback,
+                                          NULL, NULL);
+}
+
+static void
+load_state (ShellStateStore *store)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) state = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
+  GVariantIter iter;
+  const char *name;
+  GVariant *value;
+
+  path = g_file_get_path (store->file);
+  mapped = g_mapped_file_new (path, FALSE, &error);
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Failed to open runtime/persistent state: %s", error->message);
+      return;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  state = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE_VARDICT,
+                                                        bytes, FALSE));
+
+  g_variant_iter_init (&iter, state);
+  while (g_variant_iter_next (&iter, "{&sv}", &name, &value))
+    g_hash_table_insert (store->values, g_strdup (name), value);
+}
+
+static GVariant *
+build_state (ShellStateStore *store)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  const char *name;
+  GVariant *value;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  g_hash_table_iter_init (&iter, store->values);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &name, (gpointer *) &value))
+    g_variant_builder_add (&builder, "{sv}", name, value);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+delete_legacy_files (GPtrArray *legacy_files)
+{
+  guint i;
+
+  for (i = 0; i < legacy_files->len; i++)
+    g_file_delete_async (g_ptr_array_index (legacy_files, i),
+                         G_PRIORITY_LOW, NULL, NULL, NULL);
+}
+
+static void queue_flush (ShellStateStore *store);
+
+static void
+replace_state_cb (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  ShellStateStore *store = user_data;
+  g_autoptr(GError) error = NULL;
+  guint i;
+
+  if (!g_file_replace_contents_finish (G_FILE (object), result, NULL, &error))
+    {
+      /* The store wrote its state itself, and may be gone */
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+      g_warning ("Could not replace runtime/persistent state file: %s",
+                 error->message);
+
+      /* Try again with the next write */
+      for (i = 0; i < store->writing_legacy_files->len; i++)
+        g_ptr_array_add (store->legacy_files,
+                         g_object_ref (g_ptr_array_index (store->writing_legacy_files, i)));
+    }
+  else
+    {
+      delete_legacy_files (store->writing_legacy_files);
+    }
+
+  g_clear_pointer (&store->writing_legacy_files, g_ptr_array_unref);
+
+  store->writing = FALSE;
+
+  /* Write what changed in the meantime */
+  if (store->dirty)
+    queue_flush (store);
+}
+
+static gboolean
+flush_timeout (gpointer data)
+{
+  ShellStateStore *store = data;
+  g_autoptr(GVariant) state = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+
+  store->flush_id = 0;
+  store->dirty = FALSE;
+  store->writing = TRUE;
+
+  state = build_state (store);
+  bytes = g_variant_get_data_as_bytes (state);
+
+  n_writes++;
+  n_bytes_written += g_bytes_get_size (bytes);
+
+  store->writing_legacy_files = g_steal_pointer (&store->legacy_files);
+  store->legacy_files = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_file_replace_contents_bytes_async (store->file, bytes,
+                                       NULL, FALSE,
+                                       G_FILE_CREATE_REPLACE_DESTINATION,
+                                       store->cancellable,
+                                       replace_state_cb, store);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+queue_flush (ShellStateStore *store)
+{
+  store->dirty = TRUE;
+
+  if (store->flush_id != 0 || store->writing)
+    return;
+
+  store->flush_id = g_timeout_add (FLUSH_TIMEOUT_MS, flush_timeout, store);
+  g_source_set_name_by_id (store->flush_id, "[gnome-shell] flush_timeout");
+}
+
+ShellStateStore *
+shell_state_store_new (GFile *dir)
+{
+  static gsize statistics_initialized = 0;
+  ShellStateStore *store;
+
+  if (g_once_init_enter (&statistics_initialized))
+    {
+      init_statistics ();
+      g_once_init_leave (&statistics_initialized, 1);
+    }
+
+  store = g_new0 (ShellStateStore, 1);
+  store->dir = g_object_ref (dir);
+  store->file = g_file_get_child (dir, STATE_FILENAME);
+  store->values = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free,
+                                         (GDestroyNotify) g_variant_unref);
+  store->checked = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, NULL);
+  store->legacy_files = g_ptr_array_new_with_free_func (g_object_unref);
+  store->cancellable = g_cancellable_new ();
+
+  load_state (store);
+
+  return store;
+}
+
+/*
+ * shell_state_store_flush_sync:
+ * @store: the store
+ *
+ * Writes changes that aren't on disk yet, blocking until they are. A
+ * write in progress is cancelled, since this one supersedes it.
+ */
+void
+shell_state_store_flush_sync (ShellStateStore *store)
+{
+  g_autoptr(GVariant) state = NULL;
+  g_autoptr(GError) error = NULL;
+  guint i;
+
+  g_clear_handle_id (&store->flush_id, g_source_remove);
+
+  if (!store->dirty && !store->writing)
+    return;
+
+  if (store->writing)
+    {
+      g_cancellable_cancel (store->cancellable);
+      g_object_unref (store->cancellable);
+      store->cancellable = g_cancellable_new ();
+
+      /* The cancelled write leaves its files to us */
+      for (i = 0; i < store->writing_legacy_files->len; i++)
+        g_ptr_array_add (store->legacy_files,
+                         g_object_ref (g_ptr_array_index (store->writing_legacy_files, i)));
+      g_clear_pointer (&store->writing_legacy_files, g_ptr_array_unref);
+      store->writing = FALSE;
+    }
+
+  store->dirty = FALSE;
+
+  state = build_state (store);
+
+  n_writes++;
+  n_bytes_written += g_variant_get_size (state);
+
+  if (g_file_replace_contents (store->file,
+                               g_variant_get_data (state),
+                               g_variant_get_size (state),
+                               NULL, FALSE,
+                               G_FILE_CREATE_REPLACE_DESTINATION,
+                               NULL, NULL, &error))
+    {
+      delete_legacy_files (store->legacy_files);
+      g_ptr_array_set_size (store->legacy_files, 0);
+    }
+  else
+    {
+      g_warning ("Could not replace runtime/persistent state file: %s",
+                 error->message);
+    }
+}
+
+void
+shell_state_store_free (ShellStateStore *store)
+{
+  /* Whatever didn't make it to disk yet has to now */
+  shell_state_store_flush_sync (store);
+
+  g_cancellable_cancel (store->cancellable);
+  g_object_unref (store->cancellable);
+  g_ptr_array_unref (store->legacy_files);
+  g_hash_table_unref (store->checked);
+  g_hash_table_unref (store->values);
+  g_object_unref (store->file);
+  g_object_unref (store->dir);
+  g_free (store);
+}
+
+static void
+supersede_legacy_file (ShellStateStore *store,
+                       const char      *property_name)
+{
+  g_hash_table_add (store->checked, g_strdup (property_name));
+  g_ptr_array_add (store->legacy_files,
+                   g_file_get_child (store->dir, property_name));
+}
+
+static GVariant *
+load_legacy_file (ShellStateStore *store,
+                  const char      *property_type,
+                  const char      *property_name)
+{
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *path = NULL;
+  GVariant *value;
+
+  file = g_file_get_child (store->dir, property_name);
+  path = g_file_get_path (file);
+
+  mapped = g_mapped_file_new (path, FALSE, &error);
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Failed to open runtime state: %s", error->message);
+
+      /* Nothing to migrate, but don't look again */
+      g_hash_table_add (store->checked, g_strdup (property_name));
+      return NULL;
+    }
+
+  /* Move it into the store */
+  bytes = g_mapped_file_get_bytes (mapped);
+  value = g_variant_new_from_bytes (G_VARIANT_TYPE (property_type), bytes, FALSE);
+  g_hash_table_insert (store->values,
+                       g_strdup (property_name), g_variant_ref_sink (value));
+
+  supersede_legacy_file (store, property_name);
+  queue_flush (store);
+
+  return value;
+}
+
+GVariant *
+shell_state_store_get (ShellStateStore *store,
+                       const char      *property_type,
+                       const char      *property_name)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  GVariant *value;
+
+  value = g_hash_table_lookup (store->values, property_name);
+
+  if (value == NULL && !g_hash_table_contains (store->checked, property_name))
+    value = load_legacy_file (store, property_type, property_name);
+
+  if (value == NULL)
+    return NULL;
+
+  /* Like the data was read back from disk; as the requested type */
+  bytes = g_variant_get_data_as_bytes (value);
+
+  return g_variant_new_from_bytes (G_VARIANT_TYPE (property_type), bytes, FALSE);
+}
+
+void
+shell_state_store_set (ShellStateStore *store,
+                       const char      *property_name,
+                       GVariant        *variant)
+{
+  if (!g_hash_table_contains (store->checked, property_name))
+    supersede_legacy_file (store, property_name);
+
+  if (variant == NULL || g_variant_get_data (variant) == NULL)
+    g_hash_table_remove (store->values, property_name);
+  else
+    g_hash_table_insert (store->values,
+                         g_strdup (property_name), g_variant_ref_sink (variant));
+
+  n_changes++;
+  queue_flush (store);
+}
@@ -0,0 +1,21 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_STATE_STORE_H__
+#define __SHELL_STATE_STORE_H__
+
+#include <gio/gio.h>
+
+typedef struct _ShellStateStore ShellStateStore;
+
+ShellStateStore *shell_state_store_new  (GFile           *dir);
+void             shell_state_store_free (ShellStateStore *store);
+
+void             shell_state_store_flush_sync (ShellStateStore *store);
+
+GVariant        *shell_state_store_get  (ShellStateStore *store,
+                                         const char      *property_type,
+                                         const char      *property_name);
+void             shell_state_store_set  (ShellStateStore *store,
+                                         const char      *property_name,
+                                         GVariant        *variant);
+
+#endif /* __SHELL_STATE_STORE_H__ */
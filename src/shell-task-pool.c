@@ -0,0 +1,658 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include "shell-perf-log.h"
+#include "shell-task-pool.h"
+
+/**
+ * SECTION:shell-task-pool
+ * @short_description: Run blocking file jobs on worker threads
+ *
+ * All of the shell's JavaScript runs on the main thread, so reading
+ * and enumerating files there holds up the next frame until the disk
+ * answers. ShellTaskPool runs a small set of such jobs on a bounded
+ * pool of worker threads instead, and completes them on the main loop
+ * with the usual #GAsyncResult pattern:
+ *
+ * - shell_task_pool_enumerate_directory() lists a directory
+ * - shell_task_pool_load_variant() loads and validates a serialized
+ *   #GVariant
+ * - shell_task_pool_read_files() reads the contents of many files,
+ *   for instance JSON or key files to parse on the main thread
+ * - shell_task_pool_hash_files() computes checksums of many files
+ *
+ * Jobs over many files are split into one work item per file, which
+ * idle workers pick up as soon as they are free, so one big job
+ * spreads over all the workers instead of keeping a single one busy.
+ * Cancelling a job skips its items that haven't started yet.
+ */
+
+/* Keep some cores for the compositor and the clients */
+#define MAX_THREADS 4
+
+typedef enum {
+  JOB_ENUMERATE_DIRECTORY,
+  JOB_LOAD_VARIANT,
+  JOB_READ_FILES,
+  JOB_HASH_FILES,
+} JobType;
+
+typedef struct
+{
+  JobType type;
+
+  GFile **files;
+  guint n_files;
+
+  char *attributes;
+  GVariantType *variant_type;
+  GChecksumType checksum_type;
+
+  /* One per file, filled in by the workers */
+  gpointer *results;
+  GDestroyNotify result_free;
+
+  /* Jobs over a single file fail with it; others leave a hole */
+  GError *error;
+
+  gint n_remaining;
+} Job;
+
+typedef struct
+{
+  GTask *task;
+  guint index;
+} WorkItem;
+
+struct _ShellTaskPool
+{
+  GObject parent;
+
+  GThreadPool *threads;
+
+  /* Running totals, for the statistics */
+  guint n_jobs;
+  guint max_queue_length;
+};
+
+G_DEFINE_TYPE (ShellTaskPool, shell_task_pool, G_TYPE_OBJECT);
+
+static void
+free_file_info_list (gpointer data)
+{
+  g_list_free_full (data, g_object_unref);
+}
+
+static void
+bytes_unref_nullable (gpointer data)
+{
+  if (data)
+    g_bytes_unref (data);
+}
+
+static void
+job_free (Job *job)
+{
+  guint i;
+
+  for (i = 0; i < job->n_files; i++)
+    {
+      g_object_unref (job->files[i]);
+      if (job->results[i])
+        job->result_free (job->results[i]);
+    }
+
+  g_free (job->files);
+  g_free (job->results);
+  g_free (job->attributes);
+  g_clear_pointer (&job->variant_type, g_variant_type_free);
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+static gpointer
+enumerate_directory (Job           *job,
+                     GFile         *dir,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  g_autoptr(GFileEnumerator) enumerator = NULL;
+  GList *infos = NULL;
+
+  enumerator = g_file_enumerate_children (dir, job->attributes,
+                                          G_FILE_QUERY_INFO_NONE,
+                                          cancellable, error);
+  if (enumerator == NULL)
+    return NULL;
+
+  while (TRUE)
+    {
+      GError *local_error = NULL;
+      GFileInfo *info;
+
+      info = g_file_enumerator_next_file (enumerator, cancellable, &local_error);
+      if (info == NULL)
+        {
+          if (local_error)
+            {
+              free_file_info_list (infos);
+              g_propagate_error (error, local_error);
+              return NULL;
+            }
+          break;
+        }
+
+      infos = g_list_prepend (infos, info);
+    }
+
+  return g_list_reverse (infos);
+}
+
+static gpointer
+load_variant (Job           *job,
+              GFile         *file,
+              GCancellable  *cancellable,
+              GError       **error)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  char *contents;
+  gsize length;
+
+  if (!g_file_load_contents (file, cancellable, &contents, &length, NULL, error))
+    return NULL;
+
+  bytes = g_bytes_new_take (contents, length);
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (job->variant_type,
+                                                          bytes, FALSE));
+
+  /* Validating untrusted data is the expensive part; do it here */
+  return g_variant_get_normal_form (variant);
+}
+
+static gpointer
+read_file (Job           *job,
+           GFile         *file,
+           GCancellable  *cancellable,
+           GError       **error)
+{
+  char *contents;
+  gsize length;
+
+  if (!g_file_load_contents (file, cancellable, &contents, &length, NULL, error))
+    return NULL;
+
+  return g_bytes_new_take (contents, length);
+}
+
+static gpointer
+hash_file (Job           *job,
+           GFile         *file,
+           GCancellable  *cancellable,
+           GError       **error)
+{
+  g_autoptr(GFileInputStream) input = NULL;
+  g_autoptr(GChecksum) checksum = NULL;
+  guchar buffer[64 * 1024];
+
+  input = g_file_read (file, cancellable, error);
+  if (input == NULL)
+    return NULL;
+
+  checksum = g_checksum_new (job->checksum_type);
+
+  while (TRUE)
+    {
+      gssize n_read;
+
+      n_read = g_input_stream_read (G_INPUT_STREAM (input),
+                                    buffer, sizeof (buffer),
+                                    cancellable, error);
+      if (n_read < 0)
+        return NULL;
+      if (n_read == 0)
+        break;
+
+      g_checksum_update (checksum, buffer, n_read);
+    }
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static void
+finish_job (GTask *task)
+{
+  Job *job = g_task_get_task_data (task);
+  GPtrArray *results;
+  guint i;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  if (job->error)
+    {
+      g_task_return_error (task, g_steal_pointer (&job->error));
+      return;
+    }
+
+  switch (job->type)
+    {
+    case JOB_ENUMERATE_DIRECTORY:
+    case JOB_LOAD_VARIANT:
+      g_task_return_pointer (task,
+                             g_steal_pointer (&job->results[0]),
+                             job->result_free);
+      break;
+    case JOB_READ_FILES:
+    case JOB_HASH_FILES:
+      results = g_ptr_array_new_full (job->n_files, job->result_free);
+      for (i = 0; i < job->n_files; i++)
+        g_ptr_array_add (results, g_steal_pointer (&job->results[i]));
+
+      g_task_return_pointer (task, results, (GDestroyNotify) g_ptr_array_unref);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+run_work_item (gpointer data,
+               gpointer user_data)
+{
+  WorkItem *item = data;
+  Job *job = g_task_get_task_data (item->task);
+  GCancellable *cancellable = g_task_get_cancellable (item->task);
+  GFile *file = job->files[item->index];
+  g_autoptr(GError) error = NULL;
+  gpointer result = NULL;
+
+  if (!g_cancellable_is_cancelled (cancellable))
+    {
+      switch (job->type)
+        {
+        case JOB_ENUMERATE_DIRECTORY:
+          result = enumerate_directory (job, file, cancellable, &error);
+          break;
+        case JOB_LOAD_VARIANT:
+          result = load_variant (job, file, cancellable, &error);
+          break;
+        case JOB_READ_FILES:
+          result = read_file (job, file, cancellable, &error);
+          break;
+        case JOB_HASH_FILES:
+          result = hash_file (job, file, cancellable, &error);
+          break;
+        default:
+          g_assert_not_reached ();
+        }
+
+      /* Each item has a slot of its own, so no locking is needed */
+      job->results[item->index] = result;
+
+      if (error)
+        {
+          if (job->n_files == 1)
+            job->error = g_steal_pointer (&error);
+          else
+            g_debug ("Skipping file in task pool job: %s", error->message);
+        }
+    }
+
+  if (g_atomic_int_dec_and_test (&job->n_remaining))
+    finish_job (item->task);
+
+  g_object_unref (item->task);
+  g_free (item);
+}
+
+static Job *
+job_new (JobType   type,
+         GFile   **files,
+         guint     n_files)
+{
+  Job *job;
+  guint i;
+
+  job = g_new0 (Job, 1);
+  job->type = type;
+  job->files = g_new (GFile *, n_files);
+  job->n_files = n_files;
+  job->results = g_new0 (gpointer, n_files);
+  job->n_remaining = n_files;
+
+  for (i = 0; i < n_files; i++)
+    job->files[i] = g_object_ref (files[i]);
+
+  return job;
+}
+
+static void
+push_job (ShellTaskPool       *pool,
+          Job                 *job,
+          gpointer             source_tag,
+          GCancellable        *cancellable,
+          GAsyncReadyCallback  callback,
+          gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  guint i;
+
+  task = g_task_new (pool, cancellable, callback, user_data);
+  g_task_set_source_tag (task, source_tag);
+  g_task_set_task_data (task, job, (GDestroyNotify) job_free);
+
+  pool->n_jobs++;
+
+  /* Nothing to wait for */
+  if (job->n_files == 0)
+    {
+      finish_job (task);
+      return;
+    }
+
+  for (i = 0; i < job->n_files; i++)
+    {
+      WorkItem *item = g_new0 (WorkItem, 1);
+
+      item->task = g_object_ref (task);
+      item->index = i;
+
+      g_thread_pool_push (pool->threads, item, NULL);
+    }
+
+  pool->max_queue_length = MAX (pool->max_queue_length,
+                                g_thread_pool_unprocessed (pool->threads));
+}
+
+static gpointer
+propagate_job (ShellTaskPool  *pool,
+               GAsyncResult   *result,
+               gpointer        source_tag,
+               GError        **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, pool), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == source_tag, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+task_pool_statistics_callback (ShellPerfLog *perf_log,
+                               gpointer      data)
+{
+  ShellTaskPool *pool = data;
+
+  shell_perf_log_update_statistic_i (perf_log, "taskPool.jobCount",
+                                     pool->n_jobs);
+  shell_perf_log_update_statistic_i (perf_log, "taskPool.queueLength",
+                                     g_thread_pool_unprocessed (pool->threads));
+  shell_perf_log_update_statistic_i (perf_log, "taskPool.maxQueueLength",
+                                     pool->max_queue_length);
+}
+
+static void
+shell_task_pool_finalize (GObject *object)
+{
+  ShellTaskPool *pool = SHELL_TASK_POOL (object);
+
+  g_thread_pool_free (pool->threads, TRUE, TRUE);
+
+  G_OBJECT_CLASS (shell_task_pool_parent_class)->finalize (object);
+}
+
+static void
+shell_task_pool_init (ShellTaskPool *pool)
+{
+  int max_threads;
+
+  max_threads = CLAMP ((int) g_get_num_processors () - 1, 1, MAX_THREADS);
+  pool->threads = g_thread_pool_new (run_work_item, pool,
+                                     max_threads, FALSE, NULL);
+}
+
+static void
+shell_task_pool_class_init (ShellTaskPoolClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+
+  object_class->finalize = shell_task_pool_finalize;
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "taskPool.jobCount",
+                                   "Number of jobs handed to worker threads",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "taskPool.queueLength",
+                                   "Number of work items waiting for a worker thread",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "taskPool.maxQueueLength",
+                                   "Largest number of work items that waited for a worker thread",
+                                   "i");
+}
+
+/**
+ * shell_task_pool_get_default:
+ *
+ * Gets the global singleton task pool.
+ *
+ * Return value: (transfer none): the global singleton task pool
+ */
+ShellTaskPool *
+shell_task_pool_get_default (void)
+{
+  static ShellTaskPool *pool;
+
+  if (pool == NULL)
+    {
+      pool = g_object_new (SHELL_TYPE_TASK_POOL, NULL);
+      shell_perf_log_add_statistics_callback (shell_perf_log_get_default (),
+                                              task_pool_statistics_callback,
+                                              pool, NULL);
+    }
+
+  return pool;
+}
+
+/**
+ * shell_task_pool_enumerate_directory:
+ * @pool: the #ShellTaskPool
+ * @dir: the directory to list
+ * @attributes: the attributes to query, as for g_file_enumerate_children()
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: function to call when done
+ * @user_data: data to pass to @callback
+ *
+ * Lists the children of @dir on a worker thread.
+ */
+void
+shell_task_pool_enumerate_directory (ShellTaskPool       *pool,
+                                     GFile               *dir,
+                                     const char          *attributes,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  Job *job;
+
+  g_return_if_fail (SHELL_IS_TASK_POOL (pool));
+  g_return_if_fail (G_IS_FILE (dir));
+
+  job = job_new (JOB_ENUMERATE_DIRECTORY, &dir, 1);
+  job->attributes = g_strdup (attributes);
+  job->result_free = free_file_info_list;
+
+  push_job (pool, job, shell_task_pool_enumerate_directory,
+            cancellable, callback, user_data);
+}
+
+/**
+ * shell_task_pool_enumerate_directory_finish:
+ * @pool: the #ShellTaskPool
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error
+ *
+ * Returns: (element-type Gio.FileInfo) (transfer full): the children
+ *   of the directory
+ */
+GList *
+shell_task_pool_enumerate_directory_finish (ShellTaskPool  *pool,
+                                            GAsyncResult   *result,
+                                            GError        **error)
+{
+  return propagate_job (pool, result,
+                        shell_task_pool_enumerate_directory, error);
+}
+
+/**
+ * shell_task_pool_load_variant:
+ * @pool: the #ShellTaskPool
+ * @file: the file to load
+ * @type_string: the type of the serialized #GVariant in @file
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: function to call when done
+ * @user_data: data to pass to @callback
+ *
+ * Loads a serialized #GVariant from @file, and brings it into normal
+ * form, on a worker thread.
+ */
+void
+shell_task_pool_load_variant (ShellTaskPool       *pool,
+                              GFile               *file,
+                              const char          *type_string,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  Job *job;
+
+  g_return_if_fail (SHELL_IS_TASK_POOL (pool));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (g_variant_type_string_is_valid (type_string));
+
+  job = job_new (JOB_LOAD_VARIANT, &file, 1);
+  job->variant_type = g_variant_type_new (type_string);
+  job->result_free = (GDestroyNotify) g_variant_unref;
+
+  push_job (pool, job, shell_task_pool_load_variant,
+            cancellable, callback, user_data);
+}
+
+/**
+ * shell_task_pool_load_variant_finish:
+ * @pool: the #ShellTaskPool
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error
+ *
+ * Returns: (transfer full): the loaded #GVariant
+ */
+GVariant *
+shell_task_pool_load_variant_finish (ShellTaskPool  *pool,
+                                     GAsyncResult   *result,
+                                     GError        **error)
+{
+  return propagate_job (pool, result, shell_task_pool_load_variant, error);
+}
+
+/**
+ * shell_task_pool_read_files:
+ * @pool: the #ShellTaskPool
+ * @files: (array length=n_files): the files to read
+ * @n_files: the number of files
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: function to call when done
+ * @user_data: data to pass to @callback
+ *
+ * Reads the contents of @files on worker threads.
+ */
+void
+shell_task_pool_read_files (ShellTaskPool       *pool,
+                            GFile              **files,
+                            int                  n_files,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  Job *job;
+
+  g_return_if_fail (SHELL_IS_TASK_POOL (pool));
+  g_return_if_fail (n_files >= 0);
+
+  job = job_new (JOB_READ_FILES, files, n_files);
+  job->result_free = bytes_unref_nullable;
+
+  push_job (pool, job, shell_task_pool_read_files,
+            cancellable, callback, user_data);
+}
+
+/**
+ * shell_task_pool_read_files_finish:
+ * @pool: the #ShellTaskPool
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error
+ *
+ * Returns: (element-type GLib.Bytes) (transfer full): the contents of
+ *   each file, in order, or %NULL for files that could not be read
+ */
+GPtrArray *
+shell_task_pool_read_files_finish (ShellTaskPool  *pool,
+                                   GAsyncResult   *result,
+                                   GError        **error)
+{
+  return propagate_job (pool, result, shell_task_pool_read_files, error);
+}
+
+/**
+ * shell_task_pool_hash_files:
+ * @pool: the #ShellTaskPool
+ * @files: (array length=n_files): the files to hash
+ * @n_files: the number of files
+ * @checksum_type: the hashing algorithm to use
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: function to call when done
+ * @user_data: data to pass to @callback
+ *
+ * Computes checksums of the contents of @files on worker threads.
+ */
+void
+shell_task_pool_hash_files (ShellTaskPool       *pool,
+                            GFile              **files,
+                            int                  n_files,
+                            GChecksumType        checksum_type,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+  Job *job;
+
+  g_return_if_fail (SHELL_IS_TASK_POOL (pool));
+  g_return_if_fail (n_files >= 0);
+
+  job = job_new (JOB_HASH_FILES, files, n_files);
+  job->checksum_type = checksum_type;
+  job->result_free = g_free;
+
+  push_job (pool, job, shell_task_pool_hash_files,
+            cancellable, callback, user_data);
+}
+
+/**
+ * shell_task_pool_hash_files_finish:
+ * @pool: the #ShellTaskPool
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error
+ *
+ * Returns: (element-type utf8) (transfer full): the hexadecimal
+ *   checksum of each file, in order, or %NULL for files that could
+ *   not be read
+ */
+GPtrArray *
+shell_task_pool_hash_files_finish (ShellTaskPool  *pool,
+                                   GAsyncResult   *result,
+                                   GError        **error)
+{
+  return propagate_job (pool, result, shell_task_pool_hash_files, error);
+}
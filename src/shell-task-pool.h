@@ -0,0 +1,58 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_TASK_POOL_H__
+#define __SHELL_TASK_POOL_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define SHELL_TYPE_TASK_POOL (shell_task_pool_get_type ())
+G_DECLARE_FINAL_TYPE (ShellTaskPool, shell_task_pool,
+                      SHELL, TASK_POOL, GObject)
+
+ShellTaskPool *shell_task_pool_get_default (void);
+
+void        shell_task_pool_enumerate_directory        (ShellTaskPool        *pool,
+                                                        GFile                *dir,
+                                                        const char           *attributes,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+GList      *shell_task_pool_enumerate_directory_finish (ShellTaskPool        *pool,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+
+void        shell_task_pool_load_variant               (ShellTaskPool        *pool,
+                                                        GFile                *file,
+                                                        const char           *type_string,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+GVariant   *shell_task_pool_load_variant_finish        (ShellTaskPool        *pool,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+
+void        shell_task_pool_read_files                 (ShellTaskPool        *pool,
+                                                        GFile               **files,
+                                                        int                   n_files,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+GPtrArray  *shell_task_pool_read_files_finish          (ShellTaskPool        *pool,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+
+void        shell_task_pool_hash_files                 (ShellTaskPool        *pool,
+                                                        GFile               **files,
+                                                        int                   n_files,
+                                                        GChecksumType         checksum_type,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+GPtrArray  *shell_task_pool_hash_files_finish          (ShellTaskPool        *pool,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+
+G_END_DECLS
+
+#endif /* __SHELL_TASK_POOL_H__ */
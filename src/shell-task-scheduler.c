@@ -0,0 +1,609 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+#include "config.h"
+
+#include "shell-perf-log.h"
+#include "shell-task-scheduler.h"
+
+/**
+ * SECTION:shell-task-scheduler
+ * @short_description: Run deferred work in the slack between frames
+ *
+ * ShellTaskScheduler runs background work, like prefetching or warming
+ * caches, in small steps that fit into the time left over after the
+ * stage painted a frame, so that the work doesn't make animations
+ * stutter.
+ *
+ * A task is a function that does one step of the work per call, and
+ * a budget: how long one step is expected to take. A step only starts
+ * if its budget fits into what is left of the current frame interval;
+ * otherwise the task waits for the next frame. Still, one step runs
+ * after every frame, so that a task whose budget exceeds the frame
+ * interval makes progress during long animations. When the stage isn't
+ * painting at all, steps run in slices of half a frame interval, so
+ * that a frame that gets scheduled meanwhile isn't held up much. The
+ * frame interval follows the refresh rate the stage reports.
+ *
+ * Tasks run by priority, and tasks of the same priority take turns.
+ * A task can be removed at any time, including from its own step.
+ */
+
+/* Refresh interval used until the stage reports one, in microseconds */
+#define DEFAULT_FRAME_BUDGET_US (G_USEC_PER_SEC / 60)
+
+#define N_PRIORITIES (SHELL_TASK_PRIORITY_LOW + 1)
+
+typedef struct
+{
+  guint id;
+  ShellTaskPriority priority;
+  gint64 budget;
+
+  ShellTaskFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  /* Link in the queue of its priority; NULL while it runs */
+  GList *link;
+
+  guint removed : 1;
+} Task;
+
+struct _ShellTaskScheduler
+{
+  GObject parent;
+
+  ClutterStage *stage;
+
+  guint pre_paint_id;
+  guint post_paint_id;
+
+  gint64 frame_budget;
+  gint64 last_frame_start;
+
+  /* Start of the frame after which a step last ran */
+  gint64 last_step_frame;
+
+  /* <guint id, Task *task> */
+  GHashTable *tasks;
+  GQueue queues[N_PRIORITIES];
+  guint next_id;
+
+  guint run_id;
+  guint fallback_id;
+
+  /* Running totals, for the statistics */
+  guint n_steps;
+  gint64 step_time;
+  guint n_deferred;
+};
+
+enum {
+  PROP_0,
+
+  PROP_STAGE,
+  PROP_FRAME_BUDGET,
+
+  N_PROPS
+};
+
+static GParamSpec *props[N_PROPS] = { NULL, };
+
+G_DEFINE_TYPE (ShellTaskScheduler, shell_task_scheduler, G_TYPE_OBJECT);
+
+static void
+task_free (Task *task)
+{
+  if (task->notify)
+    task->notify (task->user_data);
+
+  g_free (task);
+}
+
+static Task *
+peek_next_task (ShellTaskScheduler *scheduler)
+{
+  int i;
+
+  for (i = 0; i < N_PRIORITIES; i++)
+    {
+      if (!g_queue_is_empty (&scheduler->queues[i]))
+        return g_queue_peek_head (&scheduler->queues[i]);
+    }
+
+  return NULL;
+}
+
+/* Whether the stage painted recently enough that another frame is
+ * likely on its way */
+static gboolean
+is_animating (ShellTaskScheduler *scheduler,
+              gint64              now)
+{
+  return scheduler->last_frame_start != 0 &&
+         now - scheduler->last_frame_start < scheduler->frame_budget;
+}
+
+static gint64
+get_deadline (ShellTaskScheduler *scheduler,
+              gint64              now)
+{
+  if (is_animating (scheduler, now))
+    return scheduler->last_frame_start + scheduler->frame_budget;
+  else
+    return now + scheduler->frame_budget / 2;
+}
+
+static void
+run_step (ShellTaskScheduler *scheduler,
+          Task               *task)
+{
+  gint64 start;
+  gboolean more;
+
+  g_queue_unlink (&scheduler->queues[task->priority], task->link);
+  g_list_free (task->link);
+  task->link = NULL;
+
+  start = g_get_monotonic_time ();
+  more = task->func (task->user_data);
+
+  scheduler->n_steps++;
+  scheduler->step_time += g_get_monotonic_time () - start;
+
+  /* The task may have been removed while it ran */
+  if (more && !task->removed)
+    {
+      g_queue_push_tail (&scheduler->queues[task->priority], task);
+      task->link = g_queue_peek_tail_link (&scheduler->queues[task->priority]);
+    }
+  else
+    {
+      g_hash_table_remove (scheduler->tasks, GUINT_TO_POINTER (task->id));
+    }
+}
+
+static void ensure_run_tasks (ShellTaskScheduler *scheduler);
+
+static gboolean
+fallback_timeout (gpointer data)
+{
+  ShellTaskScheduler *scheduler = data;
+
+  scheduler->fallback_id = 0;
+  ensure_run_tasks (scheduler);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Makes sure waiting tasks run once the frame interval is over, in
+ * case no frame follows to pick them up
+ */
+static void
+ensure_fallback (ShellTaskScheduler *scheduler,
+                 gint64              delay_us)
+{
+  guint delay_ms;
+
+  if (scheduler->fallback_id != 0)
+    return;
+
+  /* Rounded up, so that the stage no longer counts as animating */
+  delay_ms = MAX ((delay_us + 999) / 1000, 1);
+
+  scheduler->fallback_id = g_timeout_add (delay_ms, fallback_timeout, scheduler);
+  g_source_set_name_by_id (scheduler->fallback_id, "[gnome-shell] fallback_timeout");
+}
+
+static gboolean
+run_tasks (gpointer data)
+{
+  ShellTaskScheduler *scheduler = data;
+  gboolean ran = FALSE;
+  gint64 now, deadline;
+  Task *task;
+
+  g_clear_handle_id (&scheduler->fallback_id, g_source_remove);
+
+  now = g_get_monotonic_time ();
+  deadline = get_deadline (scheduler, now);
+
+  while ((task = peek_next_task (scheduler)) != NULL)
+    {
+      if (now + task->budget > deadline)
+        {
+          /* Give the main loop a turn, then see how much time is left */
+          if (ran)
+            return G_SOURCE_CONTINUE;
+
+          /* Wait for the next frame to finish, unless none is coming or
+           * nothing ran after this one yet; then the task gets its turn
+           * regardless of its budget */
+          if (is_animating (scheduler, now) &&
+              scheduler->last_step_frame == scheduler->last_frame_start)
+            {
+              scheduler->n_deferred++;
+              scheduler->run_id = 0;
+              ensure_fallback (scheduler, deadline - now);
+              return G_SOURCE_REMOVE;
+            }
+        }
+
+      run_step (scheduler, task);
+      ran = TRUE;
+      scheduler->last_step_frame = scheduler->last_frame_start;
+
+      now = g_get_monotonic_time ();
+    }
+
+  scheduler->run_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ensure_run_tasks (ShellTaskScheduler *scheduler)
+{
+  if (scheduler->run_id != 0)
+    return;
+
+  /* Below redraws, so this only runs when the frame is done */
+  scheduler->run_id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                                       run_tasks, scheduler, NULL);
+  g_source_set_name_by_id (scheduler->run_id, "[gnome-shell] run_tasks");
+}
+
+static gboolean
+task_scheduler_pre_paint (gpointer data)
+{
+  ShellTaskScheduler *scheduler = data;
+
+  scheduler->last_frame_start = g_get_monotonic_time ();
+
+  return TRUE;
+}
+
+static gboolean
+task_scheduler_post_paint (gpointer data)
+{
+  ShellTaskScheduler *scheduler = data;
+
+  /* Tasks that were waiting for this frame */
+  if (g_hash_table_size (scheduler->tasks) > 0)
+    ensure_run_tasks (scheduler);
+
+  return TRUE;
+}
+
+static void
+on_stage_presented (ClutterStage       *stage,
+                    ClutterFrameEvent   frame_event,
+                    ClutterFrameInfo   *frame_info,
+                    ShellTaskScheduler *scheduler)
+{
+  /* Not every backend knows the refresh rate */
+  if (frame_event != CLUTTER_FRAME_EVENT_COMPLETE ||
+      frame_info->refresh_rate <= 1.0)
+    return;
+
+  shell_task_scheduler_set_frame_budget (scheduler,
+                                         G_USEC_PER_SEC / frame_info->refresh_rate);
+}
+
+static void
+task_scheduler_statistics_callback (ShellPerfLog *perf_log,
+                                    gpointer      data)
+{
+  ShellTaskScheduler *scheduler = data;
+
+  shell_perf_log_update_statistic_i (perf_log, "taskScheduler.stepCount",
+                                     scheduler->n_steps);
+  shell_perf_log_update_statistic_x (perf_log, "taskScheduler.stepTime",
+                                     scheduler->step_time);
+  shell_perf_log_update_statistic_i (perf_log, "taskScheduler.deferredCount",
+                                     scheduler->n_deferred);
+  shell_perf_log_update_statistic_i (perf_log, "taskScheduler.pendingCount",
+                                     g_hash_table_size (scheduler->tasks));
+}
+
+static void
+shell_task_scheduler_constructed (GObject *object)
+{
+  ShellTaskScheduler *scheduler = SHELL_TASK_SCHEDULER (object);
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+
+  G_OBJECT_CLASS (shell_task_scheduler_parent_class)->constructed (object);
+
+  scheduler->pre_paint_id =
+    clutter_threads_add_repaint_func_full (CLUTTER_REPAINT_FLAGS_PRE_PAINT,
+                                           task_scheduler_pre_paint,
+                                           scheduler, NULL);
+  scheduler->post_paint_id =
+    clutter_threads_add_repaint_func_full (CLUTTER_REPAINT_FLAGS_POST_PAINT,
+                                           task_scheduler_post_paint,
+                                           scheduler, NULL);
+
+  if (scheduler->stage != NULL)
+    g_signal_connect_object (scheduler->stage, "presented",
+                             G_CALLBACK (on_stage_presented), scheduler, 0);
+
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          task_scheduler_statistics_callback,
+                                          scheduler, NULL);
+}
+
+static void
+shell_task_scheduler_dispose (GObject *object)
+{
+  ShellTaskScheduler *scheduler = SHELL_TASK_SCHEDULER (object);
+  int i;
+
+  if (scheduler->pre_paint_id != 0)
+    {
+      clutter_threads_remove_repaint_func (scheduler->pre_paint_id);
+      scheduler->pre_paint_id = 0;
+    }
+
+  if (scheduler->post_paint_id != 0)
+    {
+      clutter_threads_remove_repaint_func (scheduler->post_paint_id);
+      scheduler->post_paint_id = 0;
+    }
+
+  g_clear_handle_id (&scheduler->run_id, g_source_remove);
+  g_clear_handle_id (&scheduler->fallback_id, g_source_remove);
+
+  shell_perf_log_remove_statistics_callback (shell_perf_log_get_default (),
+                                             task_scheduler_statistics_callback,
+                                             scheduler);
+
+  for (i = 0; i < N_PRIORITIES; i++)
+    g_queue_clear (&scheduler->queues[i]);
+  g_hash_table_remove_all (scheduler->tasks);
+
+  g_clear_object (&scheduler->stage);
+
+  G_OBJECT_CLASS (shell_task_scheduler_parent_class)->dispose (object);
+}
+
+static void
+shell_task_scheduler_finalize (GObject *object)
+{
+  ShellTaskScheduler *scheduler = SHELL_TASK_SCHEDULER (object);
+
+  g_hash_table_unref (scheduler->tasks);
+
+  G_OBJECT_CLASS (shell_task_scheduler_parent_class)->finalize (object);
+}
+
+static void
+shell_task_scheduler_set_property (GObject      *object,
+                                   guint         prop_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+  ShellTaskScheduler *scheduler = SHELL_TASK_SCHEDULER (object);
+
+  switch (prop_id)
+    {
+    case PROP_STAGE:
+      scheduler->stage = g_value_dup_object (value);
+      break;
+    case PROP_FRAME_BUDGET:
+      shell_task_scheduler_set_frame_budget (scheduler, g_value_get_int64 (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+shell_task_scheduler_get_property (GObject    *object,
+                                   guint       prop_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+  ShellTaskScheduler *scheduler = SHELL_TASK_SCHEDULER (object);
+
+  switch (prop_id)
+    {
+    case PROP_STAGE:
+      g_value_set_object (value, scheduler->stage);
+      break;
+    case PROP_FRAME_BUDGET:
+      g_value_set_int64 (value, scheduler->frame_budget);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+shell_task_scheduler_init (ShellTaskScheduler *scheduler)
+{
+  int i;
+
+  scheduler->frame_budget = DEFAULT_FRAME_BUDGET_US;
+  scheduler->tasks = g_hash_table_new_full (NULL, NULL, NULL,
+                                            (GDestroyNotify) task_free);
+
+  for (i = 0; i < N_PRIORITIES; i++)
+    g_queue_init (&scheduler->queues[i]);
+}
+
+static void
+shell_task_scheduler_class_init (ShellTaskSchedulerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+
+  object_class->constructed = shell_task_scheduler_constructed;
+  object_class->dispose = shell_task_scheduler_dispose;
+  object_class->finalize = shell_task_scheduler_finalize;
+  object_class->set_property = shell_task_scheduler_set_property;
+  object_class->get_property = shell_task_scheduler_get_property;
+
+  props[PROP_STAGE] =
+    g_param_spec_object ("stage",
+                         "Stage",
+                         "Stage whose frames tasks are fitted around",
+                         CLUTTER_TYPE_STAGE,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  props[PROP_FRAME_BUDGET] =
+    g_param_spec_int64 ("frame-budget",
+                        "Frame budget",
+                        "Time between the starts of two frames, in microseconds; follows the refresh rate of the stage",
+                        1, G_MAXINT64, DEFAULT_FRAME_BUDGET_US,
+                        G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, N_PROPS, props);
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "taskScheduler.stepCount",
+                                   "Number of deferred task steps run",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "taskScheduler.stepTime",
+                                   "Time spent running deferred task steps, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "taskScheduler.deferredCount",
+                                   "Number of times tasks waited for the next frame for lack of time",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "taskScheduler.pendingCount",
+                                   "Number of tasks waiting to run",
+                                   "i");
+}
+
+/**
+ * shell_task_scheduler_new:
+ * @stage: the #ClutterStage whose frames to fit tasks around
+ *
+ * Creates a scheduler that runs tasks in the slack between the
+ * frames of @stage.
+ *
+ * Returns: (transfer full): a new #ShellTaskScheduler
+ */
+ShellTaskScheduler *
+shell_task_scheduler_new (ClutterStage *stage)
+{
+  return g_object_new (SHELL_TYPE_TASK_SCHEDULER,
+                       "stage", stage,
+                       NULL);
+}
+
+/**
+ * shell_task_scheduler_add:
+ * @scheduler: the #ShellTaskScheduler
+ * @priority: the priority of the task
+ * @budget_us: how long one step of the task takes, in microseconds
+ * @func: function doing one step of the task
+ * @user_data: data to pass to @func
+ * @notify: function to call to free @user_data
+ *
+ * Queues a task. @func is called whenever there is time for a step of
+ * the task, until it returns %FALSE or the task is removed.
+ *
+ * Returns: the ID of the task, for shell_task_scheduler_remove()
+ */
+guint
+shell_task_scheduler_add (ShellTaskScheduler *scheduler,
+                          ShellTaskPriority   priority,
+                          gint64              budget_us,
+                          ShellTaskFunc       func,
+                          gpointer            user_data,
+                          GDestroyNotify      notify)
+{
+  Task *task;
+
+  g_return_val_if_fail (SHELL_IS_TASK_SCHEDULER (scheduler), 0);
+  g_return_val_if_fail (priority < N_PRIORITIES, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  task = g_new0 (Task, 1);
+  task->id = ++scheduler->next_id;
+  task->priority = priority;
+  task->budget = MAX (budget_us, 0);
+  task->func = func;
+  task->user_data = user_data;
+  task->notify = notify;
+
+  g_hash_table_insert (scheduler->tasks, GUINT_TO_POINTER (task->id), task);
+  g_queue_push_tail (&scheduler->queues[priority], task);
+  task->link = g_queue_peek_tail_link (&scheduler->queues[priority]);
+
+  ensure_run_tasks (scheduler);
+
+  return task->id;
+}
+
+/**
+ * shell_task_scheduler_remove:
+ * @scheduler: the #ShellTaskScheduler
+ * @task_id: the ID of a task, as returned by shell_task_scheduler_add()
+ *
+ * Removes a task before it is done. Removing a task that is already
+ * done does nothing.
+ */
+void
+shell_task_scheduler_remove (ShellTaskScheduler *scheduler,
+                             guint               task_id)
+{
+  Task *task;
+
+  g_return_if_fail (SHELL_IS_TASK_SCHEDULER (scheduler));
+
+  task = g_hash_table_lookup (scheduler->tasks, GUINT_TO_POINTER (task_id));
+  if (task == NULL)
+    return;
+
+  /* A running task is dropped once its step returns */
+  if (task->link == NULL)
+    {
+      task->removed = TRUE;
+      return;
+    }
+
+  g_queue_delete_link (&scheduler->queues[task->priority], task->link);
+  task->link = NULL;
+  g_hash_table_remove (scheduler->tasks, GUINT_TO_POINTER (task_id));
+}
+
+void
+shell_task_scheduler_set_frame_budget (ShellTaskScheduler *scheduler,
+                                       gint64              budget_us)
+{
+  g_return_if_fail (SHELL_IS_TASK_SCHEDULER (scheduler));
+  g_return_if_fail (budget_us > 0);
+
+  if (scheduler->frame_budget == budget_us)
+    return;
+
+  scheduler->frame_budget = budget_us;
+  g_object_notify_by_pspec (G_OBJECT (scheduler), props[PROP_FRAME_BUDGET]);
+}
+
+gint64
+shell_task_scheduler_get_frame_budget (ShellTaskScheduler *scheduler)
+{
+  g_return_val_if_fail (SHELL_IS_TASK_SCHEDULER (scheduler), 0);
+
+  return scheduler->frame_budget;
+}
+
+/**
+ * shell_task_scheduler_get_n_pending:
+ * @scheduler: the #ShellTaskScheduler
+ *
+ * Returns: the number of tasks that are not done yet
+ */
+guint
+shell_task_scheduler_get_n_pending (ShellTaskScheduler *scheduler)
+{
+  g_return_val_if_fail (SHELL_IS_TASK_SCHEDULER (scheduler), 0);
+
+  return g_hash_table_size (scheduler->tasks);
+}
@@ -0,0 +1,60 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+#ifndef __SHELL_TASK_SCHEDULER_H__
+#define __SHELL_TASK_SCHEDULER_H__
+
+#include <clutter/clutter.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * ShellTaskPriority:
+ * @SHELL_TASK_PRIORITY_HIGH: work the user is waiting for, like
+ *   filling in search results
+ * @SHELL_TASK_PRIORITY_DEFAULT: work the user will likely need soon
+ * @SHELL_TASK_PRIORITY_LOW: housekeeping, like warming caches
+ *
+ * Tasks with a higher priority run first; tasks of the same priority
+ * take turns.
+ */
+typedef enum {
+  SHELL_TASK_PRIORITY_HIGH,
+  SHELL_TASK_PRIORITY_DEFAULT,
+  SHELL_TASK_PRIORITY_LOW,
+} ShellTaskPriority;
+
+#define SHELL_TYPE_TASK_SCHEDULER (shell_task_scheduler_get_type ())
+G_DECLARE_FINAL_TYPE (ShellTaskScheduler, shell_task_scheduler,
+                      SHELL, TASK_SCHEDULER, GObject)
+
+/**
+ * ShellTaskFunc:
+ * @user_data: data passed to shell_task_scheduler_add()
+ *
+ * Does one step of a task, which should take about as long as the
+ * budget the task was added with.
+ *
+ * Returns: %TRUE if there is more work to do, %FALSE if the task is done
+ */
+typedef gboolean (*ShellTaskFunc) (gpointer user_data);
+
+ShellTaskScheduler *shell_task_scheduler_new (ClutterStage *stage);
+
+guint    shell_task_scheduler_add    (ShellTaskScheduler *scheduler,
+                                      ShellTaskPriority   priority,
+                                      gint64              budget_us,
+                                      ShellTaskFunc       func,
+                                      gpointer            user_data,
+                                      GDestroyNotify      notify);
+void     shell_task_scheduler_remove (ShellTaskScheduler *scheduler,
+                                      guint               task_id);
+
+void     shell_task_scheduler_set_frame_budget (ShellTaskScheduler *scheduler,
+                                                gint64              budget_us);
+gint64   shell_task_scheduler_get_frame_budget (ShellTaskScheduler *scheduler);
+
+guint    shell_task_scheduler_get_n_pending    (ShellTaskScheduler *scheduler);
+
+G_END_DECLS
+
+#endif /* __SHELL_TASK_SCHEDULER_H__ */
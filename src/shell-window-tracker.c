@@ -15,6 +15,7 @@
 #include "shell-window-tracker-private.h"
 #include "shell-app-private.h"
 #include "shell-global.h"
+#include "shell-perf-log.h"
 #include "st.h"
 
 /* This file includes modified code from
@@ -42,8 +43,28 @@ struct _ShellWindowTracker
 
   /* <MetaWindow * window, ShellApp *app> */
   GHashTable *window_to_app;
+
+  /* <int pid, GSList *PidApp> */
+  GHashTable *pid_to_apps;
+
+  /* <MetaWindow * window, int pid>; the PID a window was indexed under,
+   * which can differ from what it has by the time it goes away */
+  GHashTable *window_to_pid;
+
+  /* Cost of starting and stopping to track windows, including the
+   * handlers of the resulting app and tracker signals */
+  guint n_added;
+  gint64 added_time;
+  guint n_removed;
+  gint64 removed_time;
 };
 
+/* An app with tracked windows owned by some process */
+typedef struct {
+  ShellApp *app;
+  guint n_windows;
+} PidApp;
+
 G_DEFINE_TYPE (ShellWindowTracker, shell_window_tracker, G_TYPE_OBJECT);
 
 enum {
@@ -512,6 +533,79 @@ on_gtk_application_id_changed (MetaWindow  *window,
   tracked_window_changed (self, window);
 }
 
+static void
+free_pid_app (gpointer data)
+{
+  PidApp *pid_app = data;
+
+  g_object_unref (pid_app->app);
+  g_free (pid_app);
+}
+
+static void
+add_window_pid (ShellWindowTracker *self,
+                MetaWindow         *window,
+                ShellApp           *app)
+{
+  gpointer pid = GINT_TO_POINTER (meta_window_get_pid (window));
+  GSList *apps, *l;
+  PidApp *pid_app;
+
+  g_hash_table_insert (self->window_to_pid, window, pid);
+
+  apps = g_hash_table_lookup (self->pid_to_apps, pid);
+  for (l = apps; l; l = l->next)
+    {
+      pid_app = l->data;
+      if (pid_app->app == app)
+        {
+          pid_app->n_windows++;
+          return;
+        }
+    }
+
+  pid_app = g_new0 (PidApp, 1);
+  pid_app->app = g_object_ref (app);
+  pid_app->n_windows = 1;
+
+  g_hash_table_steal (self->pid_to_apps, pid);
+  g_hash_table_insert (self->pid_to_apps, pid, g_slist_prepend (apps, pid_app));
+}
+
+static void
+remove_window_pid (ShellWindowTracker *self,
+                   MetaWindow         *window,
+                   ShellApp           *app)
+{
+  gpointer pid;
+  GSList *apps, *l;
+
+  /* On X11, the PID may have become known since the window was tracked */
+  if (!g_hash_table_lookup_extended (self->window_to_pid, window, NULL, &pid))
+    return;
+  g_hash_table_remove (self->window_to_pid, window);
+
+  apps = g_hash_table_lookup (self->pid_to_apps, pid);
+  for (l = apps; l; l = l->next)
+    {
+      PidApp *pid_app = l->data;
+
+      if (pid_app->app != app)
+        continue;
+
+      if (--pid_app->n_windows > 0)
+        return;
+
+      g_hash_table_steal (self->pid_to_apps, pid);
+      apps = g_slist_delete_link (apps, l);
+      free_pid_app (pid_app);
+
+      if (apps != NULL)
+        g_hash_table_insert (self->pid_to_apps, pid, apps);
+      return;
+    }
+}
+
 static void
 track_window (ShellWindowTracker *self,
               MetaWindow      *window)
@@ -529,6 +623,7 @@ track_window (ShellWindowTracker *self,
   g_signal_connect (window, "notify::gtk-application-id", G_CALLBACK (on_gtk_application_id_changed), self);
 
   _shell_app_add_window (app, window);
+  add_window_pid (self, window, app);
 
   g_signal_emit (self, signals[TRACKED_WINDOWS_CHANGED], 0);
 }
@@ -540,12 +635,19 @@ shell_window_tracker_on_window_added (MetaWorkspace   *workspace,
 {
   ShellWindowTracker *self = SHELL_WINDOW_TRACKER (user_data);
   MetaWindowType window_type = meta_window_get_window_type (window);
+  gint64 start_time;
 
   if (window_type == META_WINDOW_NORMAL ||
       window_type == META_WINDOW_DIALOG ||
       window_type == META_WINDOW_UTILITY ||
       window_type == META_WINDOW_MODAL_DIALOG)
-    track_window (self, window);
+    {
+      start_time = g_get_monotonic_time ();
+      track_window (self, window);
+
+      self->n_added++;
+      self->added_time += g_get_monotonic_time () - start_time;
+    }
 }
 
 static void
@@ -561,6 +663,7 @@ disassociate_window (ShellWindowTracker   *self,
   g_object_ref (app);
 
   g_hash_table_remove (self->window_to_app, window);
+  remove_window_pid (self, window, app);
 
   _shell_app_remove_window (app, window);
   g_signal_handlers_disconnect_by_func (window, G_CALLBACK (on_wm_class_changed), self);
@@ -576,7 +679,17 @@ shell_window_tracker_on_window_removed (MetaWorkspace   *workspace,
                                      MetaWindow      *window,
                                      gpointer         user_data)
 {
-  disassociate_window (SHELL_WINDOW_TRACKER (user_data), window);
+  ShellWindowTracker *self = SHELL_WINDOW_TRACKER (user_data);
+  gint64 start_time;
+
+  if (!g_hash_table_contains (self->window_to_app, window))
+    return;
+
+  start_time = g_get_monotonic_time ();
+  disassociate_window (self, window);
+
+  self->n_removed++;
+  self->removed_time += g_get_monotonic_time () - start_time;
 }
 
 static void
@@ -666,6 +779,56 @@ on_startup_sequence_changed (MetaStartupNotification *sn,
   g_signal_emit (G_OBJECT (self), signals[STARTUP_SEQUENCE_CHANGED], 0, sequence);
 }
 
+static void
+window_tracker_statistics_callback (ShellPerfLog *perf_log,
+                                    gpointer      data)
+{
+  ShellWindowTracker *self = data;
+
+  shell_perf_log_update_statistic_i (perf_log, "windowTracker.addedCount",
+                                     self->n_added);
+  shell_perf_log_update_statistic_x (perf_log, "windowTracker.addedTime",
+                                     self->added_time);
+  shell_perf_log_update_statistic_i (perf_log, "windowTracker.removedCount",
+                                     self->n_removed);
+  shell_perf_log_update_statistic_x (perf_log, "windowTracker.removedTime",
+                                     self->removed_time);
+}
+
+static void
+init_statistics (ShellWindowTracker *self)
+{
+  ShellPerfLog *perf_log = shell_perf_log_get_default ();
+
+  shell_perf_log_define_statistic (perf_log,
+                                   "windowTracker.addedCount",
+                                   "Number of windows the tracker started tracking",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "windowTracker.addedTime",
+                                   "Time spent starting to track windows, in microseconds",
+                                   "x");
+  shell_perf_log_define_statistic (perf_log,
+                                   "windowTracker.removedCount",
+                                   "Number of windows the tracker stopped tracking",
+                                   "i");
+  shell_perf_log_define_statistic (perf_log,
+                                   "windowTracker.removedTime",
+                                   "Time spent stopping to track windows, in microseconds",
+                                   "x");
+
+  /* The tracker is a singleton that lives as long as the shell */
+  shell_perf_log_add_statistics_callback (perf_log,
+                                          window_tracker_statistics_callback,
+                                          self, NULL);
+}
+
+static void
+free_pid_apps (gpointer data)
+{
+  g_slist_free_full (data, free_pid_app);
+}
+
 static void
 shell_window_tracker_init (ShellWindowTracker *self)
 {
@@ -674,11 +837,16 @@ shell_window_tracker_init (ShellWindowTracker *self)
 
   self->window_to_app = g_hash_table_new_full (g_direct_hash, g_direct_equal,
                                                NULL, (GDestroyNotify) g_object_unref);
+  self->pid_to_apps = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, free_pid_apps);
+  self->window_to_pid = g_hash_table_new (g_direct_hash, g_direct_equal);
 
 
   g_signal_connect (sn, "changed",
                     G_CALLBACK (on_startup_sequence_changed), self);
 
+  init_statistics (self);
+
   load_initial_windows (self);
   init_window_tracking (self);
 }
@@ -689,6 +857,8 @@ shell_window_tracker_finalize (GObject *object)
   ShellWindowTracker *self = SHELL_WINDOW_TRACKER (object);
 
   g_hash_table_destroy (self->window_to_app);
+  g_hash_table_destroy (self->pid_to_apps);
+  g_hash_table_destroy (self->window_to_pid);
 
   G_OBJECT_CLASS (shell_window_tracker_parent_class)->finalize(object);
 }
@@ -714,12 +884,47 @@ shell_window_tracker_get_window_app (ShellWindowTracker *tracker,
 }
 
 
+/* On X11, the PID of a window may only become known after it was indexed,
+ * and there is no notification for that; so index tracked windows again
+ * under the PID they have now. Returns whether any window moved. */
+static gboolean
+reindex_window_pids (ShellWindowTracker *tracker)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  g_autoptr(GSList) moved = NULL;
+  GSList *l;
+
+  g_hash_table_iter_init (&iter, tracker->window_to_app);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      MetaWindow *window = key;
+      gpointer pid = g_hash_table_lookup (tracker->window_to_pid, window);
+
+      if (GPOINTER_TO_INT (pid) != meta_window_get_pid (window))
+        moved = g_slist_prepend (moved, window);
+    }
+
+  for (l = moved; l; l = l->next)
+    {
+      MetaWindow *window = l->data;
+      ShellApp *app = g_hash_table_lookup (tracker->window_to_app, window);
+
+      remove_window_pid (tracker, window, app);
+      add_window_pid (tracker, window, app);
+    }
+
+  return moved != NULL;
+}
+
 /**
  * shell_window_tracker_get_app_from_pid:
  * @tracker: A #ShellAppSystem
  * @pid: A Unix process identifier
  *
- * Look up the application corresponding to a process.
+ * Look up the application corresponding to a process. If windows of
+ * the process belong to several applications, the one that sorts first
+ * with shell_app_compare() is returned.
  *
  * Returns: (transfer none): A #ShellApp, or %NULL if none
  */
@@ -727,33 +932,21 @@ ShellApp *
 shell_window_tracker_get_app_from_pid (ShellWindowTracker *tracker,
                                        int                 pid)
 {
-  GSList *running = shell_app_system_get_running (shell_app_system_get_default());
-  GSList *iter;
+  GSList *apps, *iter;
   ShellApp *result = NULL;
 
-  for (iter = running; iter; iter = iter->next)
-    {
-      ShellApp *app = iter->data;
-      GSList *pids = shell_app_get_pids (app);
-      GSList *pids_iter;
+  apps = g_hash_table_lookup (tracker->pid_to_apps, GINT_TO_POINTER (pid));
+  if (apps == NULL && reindex_window_pids (tracker))
+    apps = g_hash_table_lookup (tracker->pid_to_apps, GINT_TO_POINTER (pid));
 
-      for (pids_iter = pids; pids_iter; pids_iter = pids_iter->next)
-        {
-          int app_pid = GPOINTER_TO_INT (pids_iter->data);
-          if (app_pid == pid)
-            {
-              result = app;
-              break;
-            }
-        }
-      g_slist_free (pids);
+  for (iter = apps; iter; iter = iter->next)
+    {
+      PidApp *pid_app = iter->data;
 
-      if (result != NULL)
-        break;
+      if (result == NULL || shell_app_compare (pid_app->app, result) < 0)
+        result = pid_app->app;
     }
 
-  g_slist_free (running);
-
   return result;
 }
 
@@ -0,0 +1,672 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-bench.c: microbenchmarks for the St styling code
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Builds synthetic trees of theme nodes and times the stages of
+ * styling them, printing the results as JSON. All randomness comes
+ * from --seed, so two runs with the same options style the same tree
+ * against the same stylesheet and can be compared across releases;
+ * the results record a checksum of the stylesheet to check that.
+ *
+ *   st-bench --depth 5 --fanout 4 --output results.json
+ *   st-bench --stylesheet _build/data/theme/gnome-shell.css
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <meta/main.h>
+
+#include "st-bin.h"
+#include "st-box-layout.h"
+#include "st-button.h"
+#include "st-icon.h"
+#include "st-label.h"
+#include "st-private.h"
+#include "st-theme.h"
+#include "st-theme-context.h"
+#include "st-theme-node.h"
+#include "st-theme-private.h"
+
+/* Increase when results stop being comparable with older versions */
+#define BENCH_VERSION 1
+
+static int depth = 4;
+static int fanout = 4;
+static int n_classes = 24;
+static int n_rules = 240;
+static int iterations = 15;
+static int seed = 1;
+static char *stylesheet_path = NULL;
+static char *output_path = NULL;
+
+static GOptionEntry entries[] = {
+  { "depth", 'd', 0, G_OPTION_ARG_INT, &depth,
+    "Depth of the node tree", "N" },
+  { "fanout", 'f', 0, G_OPTION_ARG_INT, &fanout,
+    "Number of children of each node", "N" },
+  { "classes", 'c', 0, G_OPTION_ARG_INT, &n_classes,
+    "Number of distinct style classes in the synthetic stylesheet", "N" },
+  { "rules", 'r', 0, G_OPTION_ARG_INT, &n_rules,
+    "Number of rules in the synthetic stylesheet", "N" },
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+    "Number of times to run each benchmark", "N" },
+  { "seed", 's', 0, G_OPTION_ARG_INT, &seed,
+    "Seed for generating the tree and stylesheet", "N" },
+  { "stylesheet", 0, 0, G_OPTION_ARG_FILENAME, &stylesheet_path,
+    "Use this stylesheet instead of a synthetic one", "FILE" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path,
+    "Write results to FILE instead of stdout", "FILE" },
+  { NULL }
+};
+
+/* Style classes used by the shell's own stylesheet, for trees styled
+ * with a real stylesheet */
+static const char *shell_classes[] = {
+  "panel-button", "system-status-icon", "clock-display", "app-well-app",
+  "overview-icon", "show-apps", "dash-item-container", "search-section",
+  "search-provider-icon", "list-search-result", "popup-menu",
+  "popup-menu-item", "popup-sub-menu", "message", "message-title",
+  "message-body", "button", "modal-dialog", "modal-dialog-button",
+  "notification-banner", "calendar", "calendar-day-base", "keyboard-key",
+  "icon-grid", "window-caption", "workspace-thumbnail", "osd-window",
+  "switcher-list", "item-box", "events-button", "world-clocks-button",
+};
+
+static const char *pseudo_classes[] = { NULL, NULL, NULL, "hover", "active", "checked", "focus" };
+
+typedef struct {
+  StThemeContext *context;
+  StTheme *theme;
+  GPtrArray *class_names;
+  GType types[5];
+  char *stylesheet_checksum; /* SHA-256 of the stylesheet */
+} Bench;
+
+typedef struct {
+  const char *name;
+  const char *unit;
+  GArray *samples;
+} Result;
+
+/* Random values are drawn one statement at a time throughout, since
+ * the evaluation order of function arguments is unspecified and the
+ * output has to be the same for every compiler */
+static void
+append_color (GString *out,
+              GRand   *rand)
+{
+  int r = g_rand_int_range (rand, 0, 256);
+  int g = g_rand_int_range (rand, 0, 256);
+  int b = g_rand_int_range (rand, 0, 256);
+
+  g_string_append_printf (out, "#%02x%02x%02x", r, g, b);
+}
+
+
+static char *
+generate_stylesheet (Bench *bench,
+                     GRand *rand)
+{
+  GString *out = g_string_new (NULL);
+  static const char *type_names[] = { "StBin", "StBoxLayout", "StLabel", "StButton", "StIcon" };
+  int i;
+
+  g_string_append (out,
+                   "stage { font-family: sans-serif; font-size: 10pt; color: #eeeeec; }\n");
+
+  for (i = 0; i < n_rules; i++)
+    {
+      const char *class = g_ptr_array_index (bench->class_names,
+                                             g_rand_int_range (rand, 0, bench->class_names->len));
+      const char *other = g_ptr_array_index (bench->class_names,
+                                             g_rand_int_range (rand, 0, bench->class_names->len));
+      const char *pseudo = pseudo_classes[g_rand_int_range (rand, 0, G_N_ELEMENTS (pseudo_classes))];
+
+      /* Selector: a mix of simple, compound, descendant and child selectors */
+      switch (g_rand_int_range (rand, 0, 5))
+        {
+        case 0:
+          g_string_append_printf (out, ".%s", class);
+          break;
+        case 1:
+          g_string_append_printf (out, "%s.%s",
+                                  type_names[g_rand_int_range (rand, 0, G_N_ELEMENTS (type_names))],
+                                  class);
+          break;
+        case 2:
+          g_string_append_printf (out, ".%s .%s", other, class);
+          break;
+        case 3:
+          g_string_append_printf (out, ".%s > .%s", other, class);
+          break;
+        default:
+          g_string_append_printf (out, ".%s.%s", class, other);
+          break;
+        }
+      if (pseudo)
+        g_string_append_printf (out, ":%s", pseudo);
+
+      /* Declarations: geometry, background, borders, fonts and shadows */
+      g_string_append_printf (out, " {\n  padding: %dpx", g_rand_int_range (rand, 0, 12));
+      g_string_append_printf (out, " %dpx;\n", g_rand_int_range (rand, 0, 12));
+      g_string_append (out, "  color: ");
+      append_color (out, rand);
+      g_string_append (out, ";\n  background-color: ");
+      append_color (out, rand);
+      g_string_append (out, ";\n");
+
+      if (g_rand_boolean (rand))
+        {
+          g_string_append_printf (out, "  border: %dpx solid ",
+                                  g_rand_int_range (rand, 1, 3));
+          append_color (out, rand);
+          g_string_append_printf (out, ";\n  border-radius: %dpx;\n",
+                                  g_rand_int_range (rand, 0, 12));
+        }
+      if (g_rand_int_range (rand, 0, 4) == 0)
+        {
+          g_string_append (out, "  background-gradient-direction: vertical;\n"
+                                "  background-gradient-start: ");
+          append_color (out, rand);
+          g_string_append (out, ";\n  background-gradient-end: ");
+          append_color (out, rand);
+          g_string_append (out, ";\n");
+        }
+      if (g_rand_int_range (rand, 0, 3) == 0)
+        {
+          g_string_append_printf (out, "  font-size: %dpt;\n", g_rand_int_range (rand, 8, 16));
+          g_string_append_printf (out, "  font-weight: %s;\n",
+                                  g_rand_boolean (rand) ? "bold" : "normal");
+        }
+      if (g_rand_int_range (rand, 0, 4) == 0)
+        {
+          g_string_append_printf (out, "  box-shadow: 0 %dpx", g_rand_int_range (rand, 0, 4));
+          g_string_append_printf (out, " %dpx rgba(0,0,0,0.4);\n", g_rand_int_range (rand, 2, 16));
+        }
+
+      g_string_append (out, "}\n");
+    }
+
+  return g_string_free (out, FALSE);
+}
+
+static StTheme *
+load_theme (Bench *bench,
+            GRand *rand)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) file = NULL;
+  StTheme *theme;
+
+  if (stylesheet_path != NULL)
+    {
+      g_autofree char *css = NULL;
+      gsize length;
+
+      file = g_file_new_for_commandline_arg (stylesheet_path);
+      if (!g_file_load_contents (file, NULL, &css, &length, NULL, &error))
+        g_error ("Failed to read stylesheet: %s", error->message);
+
+      bench->stylesheet_checksum =
+        g_compute_checksum_for_data (G_CHECKSUM_SHA256, (guchar *) css, length);
+    }
+  else
+    {
+      g_autofree char *css = generate_stylesheet (bench, rand);
+      g_autofree char *path = NULL;
+      int fd;
+
+      bench->stylesheet_checksum =
+        g_compute_checksum_for_string (G_CHECKSUM_SHA256, css, -1);
+
+      fd = g_file_open_tmp ("st-bench-XXXXXX.css", &path, &error);
+      if (fd < 0 || !g_file_set_contents (path, css, -1, &error))
+        g_error ("Failed to write stylesheet: %s", error->message);
+      close (fd);
+
+      file = g_file_new_for_path (path);
+    }
+
+  theme = st_theme_new (file, NULL, NULL);
+
+  if (stylesheet_path == NULL)
+    g_file_delete (file, NULL, NULL);
+
+  return theme;
+}
+
+static void
+append_json_string (GString    *out,
+                    const char *str)
+{
+  const char *p;
+
+  g_string_append_c (out, '"');
+  for (p = str; *p; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        g_string_append_printf (out, "\\%c", *p);
+      else if ((guchar) *p < 0x20)
+        g_string_append_printf (out, "\\u%04x", (guchar) *p);
+      else
+        g_string_append_c (out, *p);
+    }
+  g_string_append_c (out, '"');
+}
+
+static char *
+random_classes (Bench *bench,
+                GRand *rand)
+{
+  GString *classes = g_string_new (NULL);
+  int i, n = g_rand_int_range (rand, 0, 4);
+
+  for (i = 0; i < n; i++)
+    {
+      if (i > 0)
+        g_string_append_c (classes, ' ');
+      g_string_append (classes,
+                       g_ptr_array_index (bench->class_names,
+                                          g_rand_int_range (rand, 0, bench->class_names->len)));
+    }
+
+  return g_string_free (classes, classes->len == 0);
+}
+
+static void
+build_subtree (Bench       *bench,
+               GRand       *rand,
+               StThemeNode *parent,
+               int          level,
+               GPtrArray   *nodes)
+{
+  int i;
+
+  if (level == depth)
+    return;
+
+  for (i = 0; i < fanout; i++)
+    {
+      g_autofree char *classes = random_classes (bench, rand);
+      GType type = bench->types[g_rand_int_range (rand, 0, G_N_ELEMENTS (bench->types))];
+      const char *pseudo = pseudo_classes[g_rand_int_range (rand, 0, G_N_ELEMENTS (pseudo_classes))];
+      StThemeNode *node;
+
+      node = st_theme_node_new (bench->context, parent, NULL,
+                                type, NULL, classes, pseudo, NULL);
+      g_ptr_array_add (nodes, node);
+
+      build_subtree (bench, rand, node, level + 1, nodes);
+    }
+}
+
+/* Every benchmark iteration gets a fresh tree, since theme nodes cache
+ * everything they compute; the same seed gives the same tree each time */
+static GPtrArray *
+build_tree (Bench *bench)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (seed + 1);
+  GPtrArray *nodes = g_ptr_array_new_with_free_func (g_object_unref);
+
+  build_subtree (bench, rand,
+                 st_theme_context_get_root_node (bench->context),
+                 0, nodes);
+
+  return nodes;
+}
+
+static void
+resolve_properties (GPtrArray *nodes)
+{
+  double dummy;
+  guint i;
+
+  /* Looking up a property nobody sets forces the matched properties
+   * to be resolved, at the price of one scan of the declarations */
+  for (i = 0; i < nodes->len; i++)
+    st_theme_node_lookup_double (g_ptr_array_index (nodes, i),
+                                 "-st-bench-unset", FALSE, &dummy);
+}
+
+static void
+add_sample (Result *result,
+            gint64  elapsed_us,
+            guint   n_ops)
+{
+  double ns_per_op = (double) elapsed_us * 1000 / n_ops;
+
+  g_array_append_val (result->samples, ns_per_op);
+}
+
+static void
+bench_selector_matching (Bench  *bench,
+                         Result *result)
+{
+  g_autoptr(GPtrArray) nodes = build_tree (bench);
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < nodes->len; i++)
+    {
+      GPtrArray *props = _st_theme_get_matched_properties (bench->theme,
+                                                           g_ptr_array_index (nodes, i));
+      g_ptr_array_free (props, TRUE);
+    }
+  add_sample (result, g_get_monotonic_time () - start, nodes->len);
+}
+
+static void
+bench_ensure_properties (Bench  *bench,
+                         Result *result)
+{
+  g_autoptr(GPtrArray) nodes = build_tree (bench);
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+  resolve_properties (nodes);
+  add_sample (result, g_get_monotonic_time () - start, nodes->len);
+}
+
+static void
+bench_geometry (Bench  *bench,
+                Result *result)
+{
+  g_autoptr(GPtrArray) nodes = build_tree (bench);
+  gint64 start;
+  guint i;
+
+  resolve_properties (nodes);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < nodes->len; i++)
+    st_theme_node_get_border_width (g_ptr_array_index (nodes, i), ST_SIDE_TOP);
+  add_sample (result, g_get_monotonic_time () - start, nodes->len);
+}
+
+static void
+bench_background (Bench  *bench,
+                  Result *result)
+{
+  g_autoptr(GPtrArray) nodes = build_tree (bench);
+  ClutterColor color;
+  gint64 start;
+  guint i;
+
+  resolve_properties (nodes);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < nodes->len; i++)
+    st_theme_node_get_background_color (g_ptr_array_index (nodes, i), &color);
+  add_sample (result, g_get_monotonic_time () - start, nodes->len);
+}
+
+static void
+bench_font (Bench  *bench,
+            Result *result)
+{
+  g_autoptr(GPtrArray) nodes = build_tree (bench);
+  gint64 start;
+  guint i;
+
+  resolve_properties (nodes);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < nodes->len; i++)
+    st_theme_node_get_font (g_ptr_array_index (nodes, i));
+  add_sample (result, g_get_monotonic_time () - start, nodes->len);
+}
+
+#define PAINT_EQUAL_REPEATS 20
+
+static void
+bench_paint_equal (Bench  *bench,
+                   Result *result)
+{
+  g_autoptr(GPtrArray) nodes = build_tree (bench);
+  g_autoptr(GPtrArray) others = build_tree (bench);
+  gint64 start;
+  guint i, j;
+
+  /* Compare identically styled but distinct nodes, so that the
+   * comparison can't take the pointer equality shortcut */
+  for (i = 0; i < nodes->len; i++)
+    st_theme_node_paint_equal (g_ptr_array_index (nodes, i),
+                               g_ptr_array_index (others, i));
+
+  start = g_get_monotonic_time ();
+  for (j = 0; j < PAINT_EQUAL_REPEATS; j++)
+    for (i = 0; i < nodes->len; i++)
+      st_theme_node_paint_equal (g_ptr_array_index (nodes, i),
+                                 g_ptr_array_index (others, i));
+  add_sample (result, g_get_monotonic_time () - start,
+              nodes->len * PAINT_EQUAL_REPEATS);
+}
+
+#define SHADOW_SIZE 256
+
+static void
+bench_shadow_blur (Result *result,
+                   double  blur)
+{
+  ClutterColor black = { 0, 0, 0, 255 };
+  cairo_surface_t *surface;
+  cairo_pattern_t *pattern, *shadow_pattern;
+  StShadow *shadow;
+  cairo_t *cr;
+  gint64 start;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, SHADOW_SIZE, SHADOW_SIZE);
+  cr = cairo_create (surface);
+  cairo_arc (cr, SHADOW_SIZE / 2, SHADOW_SIZE / 2, SHADOW_SIZE / 3, 0, 2 * G_PI);
+  cairo_fill (cr);
+  cairo_destroy (cr);
+
+  pattern = cairo_pattern_create_for_surface (surface);
+  shadow = st_shadow_new (&black, 0, 0, blur, 0, FALSE);
+
+  start = g_get_monotonic_time ();
+  shadow_pattern = _st_create_shadow_cairo_pattern (shadow, pattern);
+  /* Reported per pixel of the source image */
+  add_sample (result, g_get_monotonic_time () - start, SHADOW_SIZE * SHADOW_SIZE);
+
+  cairo_pattern_destroy (shadow_pattern);
+  st_shadow_unref (shadow);
+  cairo_pattern_destroy (pattern);
+  cairo_surface_destroy (surface);
+}
+
+static int
+compare_doubles (const void *a,
+                 const void *b)
+{
+  double da = *(const double *) a, db = *(const double *) b;
+
+  return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static void
+write_result (GString *out,
+              Result  *result,
+              gboolean last)
+{
+  double *samples = (double *) result->samples->data;
+  guint n = result->samples->len;
+  double median;
+
+  qsort (samples, n, sizeof (double), compare_doubles);
+  median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+
+  g_string_append_printf (out,
+                          "    { \"name\": \"%s\", \"unit\": \"%s\", "
+                          "\"median\": %.2f, \"min\": %.2f, \"max\": %.2f }%s\n",
+                          result->name, result->unit,
+                          median, samples[0], samples[n - 1],
+                          last ? "" : ",");
+}
+
+int
+main (int argc, char **argv)
+{
+  g_autoptr(GOptionContext) option_context = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GRand) rand = NULL;
+  g_autofree char *cwd = NULL;
+  PangoFontDescription *font_desc;
+  Bench bench = { 0, };
+  Result results[] = {
+    { "selector-matching", "ns/node" },
+    { "ensure-properties", "ns/node" },
+    { "geometry", "ns/node" },
+    { "background", "ns/node" },
+    { "font", "ns/node" },
+    { "paint-equal", "ns/comparison" },
+    { "shadow-blur-4px", "ns/pixel" },
+    { "shadow-blur-16px", "ns/pixel" },
+    { "shadow-blur-48px", "ns/pixel" },
+  };
+  GString *out;
+  guint i, n_nodes;
+  int it;
+
+  option_context = g_option_context_new (NULL);
+  g_option_context_set_summary (option_context,
+                                "Measures the performance of St styling and prints it as JSON");
+  g_option_context_add_main_entries (option_context, entries, NULL);
+  if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (depth < 1 || fanout < 1 || n_classes < 1 || iterations < 1)
+    {
+      g_printerr ("--depth, --fanout, --classes and --iterations must be positive\n");
+      return 1;
+    }
+
+  gtk_init (&argc, &argv);
+
+  /* meta_init() cds to $HOME */
+  cwd = g_get_current_dir ();
+  meta_test_init ();
+  if (chdir (cwd) != 0)
+    {
+      g_printerr ("Failed to change back to %s: %s\n", cwd, g_strerror (errno));
+      return 1;
+    }
+
+  /* Keep font sizes independent of the machine */
+  g_object_set (clutter_settings_get_default (), "font-dpi", -1, NULL);
+
+  rand = g_rand_new_with_seed (seed);
+
+  bench.class_names = g_ptr_array_new_with_free_func (g_free);
+  if (stylesheet_path != NULL)
+    {
+      for (i = 0; i < G_N_ELEMENTS (shell_classes); i++)
+        g_ptr_array_add (bench.class_names, g_strdup (shell_classes[i]));
+    }
+  else
+    {
+      for (i = 0; i < (guint) n_classes; i++)
+        g_ptr_array_add (bench.class_names, g_strdup_printf ("bench-class-%u", i));
+    }
+
+  bench.types[0] = ST_TYPE_BIN;
+  bench.types[1] = ST_TYPE_BOX_LAYOUT;
+  bench.types[2] = ST_TYPE_LABEL;
+  bench.types[3] = ST_TYPE_BUTTON;
+  bench.types[4] = ST_TYPE_ICON;
+
+  bench.theme = load_theme (&bench, rand);
+  bench.context = st_theme_context_new ();
+  st_theme_context_set_theme (bench.context, bench.theme);
+
+  font_desc = pango_font_description_from_string ("sans-serif 10");
+  st_theme_context_set_font (bench.context, font_desc);
+  pango_font_description_free (font_desc);
+
+  for (i = 0; i < G_N_ELEMENTS (results); i++)
+    results[i].samples = g_array_new (FALSE, FALSE, sizeof (double));
+
+  for (it = 0; it < iterations; it++)
+    {
+      bench_selector_matching (&bench, &results[0]);
+      bench_ensure_properties (&bench, &results[1]);
+      bench_geometry (&bench, &results[2]);
+      bench_background (&bench, &results[3]);
+      bench_font (&bench, &results[4]);
+      bench_paint_equal (&bench, &results[5]);
+      bench_shadow_blur (&results[6], 4);
+      bench_shadow_blur (&results[7], 16);
+      bench_shadow_blur (&results[8], 48);
+    }
+
+  {
+    g_autoptr(GPtrArray) nodes = build_tree (&bench);
+    n_nodes = nodes->len;
+  }
+
+  out = g_string_new (NULL);
+  g_string_append_printf (out,
+                          "{\n"
+                          "  \"version\": %d,\n"
+                          "  \"config\": { \"depth\": %d, \"fanout\": %d, "
+                          "\"classes\": %u, \"rules\": %d, \"seed\": %d, "
+                          "\"iterations\": %d, \"stylesheet\": ",
+                          BENCH_VERSION, depth, fanout,
+                          bench.class_names->len,
+                          stylesheet_path ? 0 : n_rules,
+                          seed, iterations);
+  append_json_string (out, stylesheet_path ? stylesheet_path : "synthetic");
+  g_string_append_printf (out,
+                          ", \"stylesheetChecksum\": \"%s\" },\n"
+                          "  \"nodes\": %u,\n"
+                          "  \"results\": [\n",
+                          bench.stylesheet_checksum,
+                          n_nodes);
+  for (i = 0; i < G_N_ELEMENTS (results); i++)
+    write_result (out, &results[i], i == G_N_ELEMENTS (results) - 1);
+  g_string_append (out, "  ]\n}\n");
+
+  if (output_path != NULL)
+    {
+      if (!g_file_set_contents (output_path, out->str, out->len, &error))
+        {
+          g_printerr ("Failed to write %s: %s\n", output_path, error->message);
+          return 1;
+        }
+    }
+  else
+    {
+      g_print ("%s", out->str);
+    }
+
+  g_string_free (out, TRUE);
+  for (i = 0; i < G_N_ELEMENTS (results); i++)
+    g_array_unref (results[i].samples);
+  g_ptr_array_unref (bench.class_names);
+  g_free (bench.stylesheet_checksum);
+  g_object_unref (bench.context);
+  g_object_unref (bench.theme);
+
+  return 0;
+}
@@ -772,6 +772,9 @@ st_entry_paint (ClutterActor        *actor,
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
   StShadow *shadow_spec = st_theme_node_get_text_shadow (theme_node);
   ClutterActorClass *parent_class;
+  StPaintTiming timing;
+
+  _st_paint_timing_begin (&timing);
 
   st_widget_paint_background (ST_WIDGET (actor), paint_context);
 
@@ -818,6 +821,8 @@ st_entry_paint (ClutterActor        *actor,
    */
   parent_class = g_type_class_peek_parent (st_entry_parent_class);
   parent_class->paint (actor, paint_context);
+
+  _st_paint_timing_end (ST_WIDGET (actor), &timing);
 }
 
 static void
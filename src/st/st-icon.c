@@ -178,6 +178,9 @@ st_icon_paint (ClutterActor        *actor,
 {
   StIcon *icon = ST_ICON (actor);
   StIconPrivate *priv = icon->priv;
+  StPaintTiming timing;
+
+  _st_paint_timing_begin (&timing);
 
   st_widget_paint_background (ST_WIDGET (actor), paint_context);
 
@@ -201,6 +204,8 @@ st_icon_paint (ClutterActor        *actor,
 
       clutter_actor_paint (priv->icon_texture, paint_context);
     }
+
+  _st_paint_timing_end (ST_WIDGET (actor), &timing);
 }
 
 static void
@@ -197,6 +197,9 @@ st_label_paint (ClutterActor        *actor,
   StLabelPrivate *priv = ST_LABEL (actor)->priv;
   StThemeNode *theme_node = st_widget_get_theme_node (ST_WIDGET (actor));
   StShadow *shadow_spec = st_theme_node_get_text_shadow (theme_node);
+  StPaintTiming timing;
+
+  _st_paint_timing_begin (&timing);
 
   st_widget_paint_background (ST_WIDGET (actor), paint_context);
 
@@ -244,6 +247,8 @@ st_label_paint (ClutterActor        *actor,
     }
 
   clutter_actor_paint (priv->label, paint_context);
+
+  _st_paint_timing_end (ST_WIDGET (actor), &timing);
 }
 
 static void
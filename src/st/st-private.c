@@ -401,6 +401,9 @@ _st_create_shadow_pipeline (StShadow    *shadow_spec,
       g_error_free (error);
     }
 
+  if (texture != NULL)
+    _st_profiler_account_texture (texture, ST_TEXTURE_ACCOUNT_SHADOWS, 1);
+
   g_free (pixels_out);
 
   if (G_UNLIKELY (shadow_pipeline_template == NULL))
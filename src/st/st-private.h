@@ -27,6 +27,7 @@
 #include <cairo.h>
 #include "st-widget.h"
 #include "st-bin.h"
+#include "st-profiler.h"
 #include "st-shadow.h"
 
 G_BEGIN_DECLS
@@ -72,4 +73,59 @@ void _st_paint_shadow_with_opacity (StShadow        *shadow_spec,
                                     ClutterActorBox *box,
                                     guint8           paint_opacity);
 
+extern guint _st_profiler_counters[ST_PROFILER_N_COUNTERS];
+
+static inline void
+_st_profiler_count (StProfilerCounter counter)
+{
+  _st_profiler_counters[counter]++;
+}
+
+/* Textures St renders itself, by what they are used for */
+typedef enum {
+  ST_TEXTURE_ACCOUNT_PAINT_STATES,
+  ST_TEXTURE_ACCOUNT_SHADOWS,
+
+  ST_N_TEXTURE_ACCOUNTS
+} StTextureAccount;
+
+void _st_profiler_account_texture (CoglTexture      *texture,
+                                   StTextureAccount  account,
+                                   guint             bytes_per_pixel);
+
+/* Paint profiling; see st_profiler_set_paint_profiling() */
+extern gboolean _st_profiler_paint_profiling;
+
+typedef struct {
+  gboolean active;
+  gint64 start_time;
+  gint64 outer_children_time;
+} StPaintTiming;
+
+void _st_profiler_paint_begin     (StPaintTiming *timing);
+void _st_profiler_paint_end       (StWidget      *widget,
+                                   StPaintTiming *timing);
+void _st_profiler_add_node_time   (StWidget      *widget,
+                                   gint64         node_time);
+void _st_profiler_forget_widget   (StWidget      *widget);
+
+/* Bracket the paint vfunc of widgets with these; they do nothing
+ * beyond a flag check unless paint profiling is enabled.
+ */
+static inline void
+_st_paint_timing_begin (StPaintTiming *timing)
+{
+  timing->active = _st_profiler_paint_profiling;
+  if (G_UNLIKELY (timing->active))
+    _st_profiler_paint_begin (timing);
+}
+
+static inline void
+_st_paint_timing_end (StWidget      *widget,
+                      StPaintTiming *timing)
+{
+  if (G_UNLIKELY (timing->active))
+    _st_profiler_paint_end (widget, timing);
+}
+
 #endif /* __ST_PRIVATE_H__ */
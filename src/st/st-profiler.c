@@ -0,0 +1,429 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-profiler.c: Lightweight instrumentation counters
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "st-private.h"
+#include "st-profiler.h"
+
+/* Incremented from the paint and style code paths through
+ * _st_profiler_count(); plain increments are enough since St is only
+ * used from the main thread.
+ */
+guint _st_profiler_counters[ST_PROFILER_N_COUNTERS];
+
+/**
+ * st_profiler_get_counter:
+ * @counter: a #StProfilerCounter
+ *
+ * Gets the current value of one of the counters St maintains for
+ * profiling. Counting is always enabled, so it can be sampled at
+ * any time.
+ *
+ * Returns: the number of times @counter has been hit since startup
+ */
+guint
+st_profiler_get_counter (StProfilerCounter counter)
+{
+  g_return_val_if_fail (counter < ST_PROFILER_N_COUNTERS, 0);
+
+  return _st_profiler_counters[counter];
+}
+
+gboolean _st_profiler_paint_profiling = FALSE;
+
+typedef struct {
+  guint paints;
+  gint64 self_time;
+  gint64 node_time;
+} StPaintProfile;
+
+/* StWidget => StPaintProfile, for widgets painted while profiling.
+ * Widgets remove themselves when disposed. */
+static GHashTable *paint_profiles = NULL;
+
+/* Time spent in the profiled descendants of the widget being painted */
+static gint64 children_time = 0;
+
+static StPaintProfile *
+ensure_paint_profile (StWidget *widget)
+{
+  StPaintProfile *profile;
+
+  if (paint_profiles == NULL)
+    paint_profiles = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  profile = g_hash_table_lookup (paint_profiles, widget);
+  if (profile == NULL)
+    {
+      profile = g_new0 (StPaintProfile, 1);
+      g_hash_table_insert (paint_profiles, widget, profile);
+    }
+
+  return profile;
+}
+
+void
+_st_profiler_paint_begin (StPaintTiming *timing)
+{
+  timing->start_time = g_get_monotonic_time ();
+  timing->outer_children_time = children_time;
+  children_time = 0;
+}
+
+void
+_st_profiler_paint_end (StWidget      *widget,
+                        StPaintTiming *timing)
+{
+  StPaintProfile *profile = ensure_paint_profile (widget);
+  gint64 total_time = g_get_monotonic_time () - timing->start_time;
+
+  /* Attribute to the widget only what its profiled children didn't
+   * already account for; non-St children count as the widget's own. */
+  profile->self_time += total_time - children_time;
+  profile->paints++;
+
+  children_time = timing->outer_children_time + total_time;
+}
+
+void
+_st_profiler_add_node_time (StWidget *widget,
+                            gint64    node_time)
+{
+  ensure_paint_profile (widget)->node_time += node_time;
+}
+
+void
+_st_profiler_forget_widget (StWidget *widget)
+{
+  if (paint_profiles != NULL)
+    g_hash_table_remove (paint_profiles, widget);
+}
+
+/**
+ * st_profiler_set_paint_profiling:
+ * @enabled: whether to profile painting
+ *
+ * Sets whether the time spent painting each #StWidget is measured.
+ * For every widget, the profiler records the time spent in its paint
+ * function, excluding the time spent painting St children, and
+ * separately how much of that went to painting its theme node
+ * (background, borders and shadows).
+ *
+ * Results accumulate until st_profiler_reset_paint_profile() is called,
+ * and are kept when profiling is turned off.
+ */
+void
+st_profiler_set_paint_profiling (gboolean enabled)
+{
+  _st_profiler_paint_profiling = enabled != FALSE;
+}
+
+/**
+ * st_profiler_get_paint_profiling:
+ *
+ * Returns: whether painting is currently being profiled
+ */
+gboolean
+st_profiler_get_paint_profiling (void)
+{
+  return _st_profiler_paint_profiling;
+}
+
+/**
+ * st_profiler_reset_paint_profile:
+ *
+ * Discards all paint profiling results collected so far.
+ */
+void
+st_profiler_reset_paint_profile (void)
+{
+  if (paint_profiles != NULL)
+    g_hash_table_remove_all (paint_profiles);
+}
+
+typedef struct {
+  guint paints;
+  gint64 self_time;
+  gint64 node_time;
+  guint n_actors;
+} StPaintProfileTotals;
+
+/**
+ * st_profiler_get_paint_profile:
+ *
+ * Gets the paint profiling results aggregated by widget type and
+ * style class. Each element of the returned array is a tuple of
+ * (type name, style class, number of widgets, number of paints,
+ * self time, theme node time); times are in microseconds and the
+ * style class is an empty string for widgets without one.
+ *
+ * Returns: (transfer full): a #GVariant of type a(ssuuxx)
+ */
+GVariant *
+st_profiler_get_paint_profile (void)
+{
+  GVariantBuilder builder;
+  GHashTable *totals;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  totals = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (paint_profiles != NULL)
+    {
+      g_hash_table_iter_init (&iter, paint_profiles);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          StWidget *widget = key;
+          StPaintProfile *profile = value;
+          StPaintProfileTotals *total;
+          const char *style_class;
+          char *total_key;
+
+          style_class = st_widget_get_style_class_name (widget);
+          /* Type names can't contain '\n', so use it as separator */
+          total_key = g_strconcat (G_OBJECT_TYPE_NAME (widget), "\n",
+                                   style_class ? style_class : "", NULL);
+
+          total = g_hash_table_lookup (totals, total_key);
+          if (total == NULL)
+            {
+              total = g_new0 (StPaintProfileTotals, 1);
+              g_hash_table_insert (totals, total_key, total);
+            }
+          else
+            {
+              g_free (total_key);
+            }
+
+          total->paints += profile->paints;
+          total->self_time += profile->self_time;
+          total->node_time += profile->node_time;
+          total->n_actors++;
+        }
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssuuxx)"));
+
+  g_hash_table_iter_init (&iter, totals);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      StPaintProfileTotals *total = value;
+      g_auto(GStrv) parts = g_strsplit (key, "\n", 2);
+
+      g_variant_builder_add (&builder, "(ssuuxx)",
+                             parts[0], parts[1],
+                             total->n_actors, total->paints,
+                             total->self_time, total->node_time);
+    }
+
+  g_hash_table_unref (totals);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * st_profiler_get_profiled_actors:
+ *
+ * Gets the widgets for which paint profiling results exist.
+ *
+ * Returns: (transfer container) (element-type Clutter.Actor): the
+ *   profiled widgets
+ */
+GList *
+st_profiler_get_profiled_actors (void)
+{
+  if (paint_profiles == NULL)
+    return NULL;
+
+  return g_hash_table_get_keys (paint_profiles);
+}
+
+/**
+ * st_profiler_get_actor_paint_time:
+ * @actor: a #ClutterActor
+ *
+ * Gets the time spent painting @actor itself, excluding its St
+ * children, since paint profiling results were last reset.
+ *
+ * Returns: the paint time in microseconds, or 0 if @actor hasn't been
+ *   profiled
+ */
+gint64
+st_profiler_get_actor_paint_time (ClutterActor *actor)
+{
+  StPaintProfile *profile;
+
+  if (paint_profiles == NULL)
+    return 0;
+
+  profile = g_hash_table_lookup (paint_profiles, actor);
+
+  return profile != NULL ? profile->self_time : 0;
+}
+
+typedef struct {
+  char *subsystem;
+  StMemoryReportFunc func;
+  gpointer user_data;
+} StMemoryReporter;
+
+static GArray *memory_reporters = NULL;
+
+typedef struct {
+  guint n_textures;
+  guint64 n_bytes;
+} StTextureTotals;
+
+/* Attached to accounted textures, so they are subtracted again when
+ * Cogl frees them */
+typedef struct {
+  StTextureAccount account;
+  guint64 n_bytes;
+} StTextureRecord;
+
+static StTextureTotals texture_totals[ST_N_TEXTURE_ACCOUNTS];
+static CoglUserDataKey texture_record_key;
+
+static void
+texture_record_free (gpointer data)
+{
+  StTextureRecord *record = data;
+
+  texture_totals[record->account].n_textures--;
+  texture_totals[record->account].n_bytes -= record->n_bytes;
+
+  g_free (record);
+}
+
+void
+_st_profiler_account_texture (CoglTexture      *texture,
+                              StTextureAccount  account,
+                              guint             bytes_per_pixel)
+{
+  StTextureRecord *record;
+
+  record = g_new (StTextureRecord, 1);
+  record->account = account;
+  record->n_bytes = (guint64) cogl_texture_get_width (texture) *
+                    cogl_texture_get_height (texture) * bytes_per_pixel;
+
+  texture_totals[account].n_textures++;
+  texture_totals[account].n_bytes += record->n_bytes;
+
+  cogl_object_set_user_data (COGL_OBJECT (texture), &texture_record_key,
+                             record, texture_record_free);
+}
+
+static void
+report_texture_memory (guint    *n_objects,
+                       guint64  *n_bytes,
+                       gpointer  user_data)
+{
+  StTextureTotals *totals = user_data;
+
+  *n_objects = totals->n_textures;
+  *n_bytes = totals->n_bytes;
+}
+
+static void
+append_memory_reporter (const char         *subsystem,
+                        StMemoryReportFunc  func,
+                        gpointer            user_data)
+{
+  StMemoryReporter reporter;
+
+  reporter.subsystem = g_strdup (subsystem);
+  reporter.func = func;
+  reporter.user_data = user_data;
+
+  g_array_append_val (memory_reporters, reporter);
+}
+
+static void
+ensure_memory_reporters (void)
+{
+  if (memory_reporters != NULL)
+    return;
+
+  memory_reporters = g_array_new (FALSE, FALSE, sizeof (StMemoryReporter));
+
+  append_memory_reporter ("paintStates", report_texture_memory,
+                          &texture_totals[ST_TEXTURE_ACCOUNT_PAINT_STATES]);
+  append_memory_reporter ("shadows", report_texture_memory,
+                          &texture_totals[ST_TEXTURE_ACCOUNT_SHADOWS]);
+}
+
+/**
+ * st_profiler_add_memory_reporter: (skip)
+ * @subsystem: name of the subsystem, in camelCase
+ * @func: function reporting the memory use of the subsystem
+ * @user_data: data to pass to @func
+ *
+ * Adds a subsystem to the memory accounting of
+ * st_profiler_get_memory_usage(). Subsystems report the number of
+ * objects they hold and an estimate of the memory these take up,
+ * including any texture memory. Reporters can't be removed, so this
+ * is meant for subsystems that live as long as the process.
+ */
+void
+st_profiler_add_memory_reporter (const char         *subsystem,
+                                 StMemoryReportFunc  func,
+                                 gpointer            user_data)
+{
+  g_return_if_fail (subsystem != NULL);
+  g_return_if_fail (func != NULL);
+
+  ensure_memory_reporters ();
+  append_memory_reporter (subsystem, func, user_data);
+}
+
+/**
+ * st_profiler_get_memory_usage:
+ *
+ * Gets the current memory use of each subsystem added with
+ * st_profiler_add_memory_reporter(), as well as that of the textures
+ * St renders for the backgrounds of widgets (paintStates) and for
+ * shadows. Each element of the returned array is a tuple of
+ * (subsystem, number of objects, number of bytes), in the order the
+ * subsystems were added.
+ *
+ * Returns: (transfer full): a #GVariant of type a(sut)
+ */
+GVariant *
+st_profiler_get_memory_usage (void)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  ensure_memory_reporters ();
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sut)"));
+
+  for (i = 0; i < memory_reporters->len; i++)
+    {
+      StMemoryReporter *reporter = &g_array_index (memory_reporters,
+                                                   StMemoryReporter, i);
+      guint n_objects = 0;
+      guint64 n_bytes = 0;
+
+      reporter->func (&n_objects, &n_bytes, reporter->user_data);
+      g_variant_builder_add (&builder, "(sut)",
+                             reporter->subsystem, n_objects, n_bytes);
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
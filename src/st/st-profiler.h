@@ -0,0 +1,80 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+/*
+ * st-profiler.h: Lightweight instrumentation counters
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ST_H_INSIDE) && !defined(ST_COMPILATION)
+#error "Only <st/st.h> can be included directly.h"
+#endif
+
+#ifndef __ST_PROFILER_H__
+#define __ST_PROFILER_H__
+
+#include <clutter/clutter.h>
+
+G_BEGIN_DECLS
+
+/**
+ * StProfilerCounter:
+ * @ST_PROFILER_COUNTER_STYLE_CHANGES: number of times a widget picked up
+ *   a different theme node
+ * @ST_PROFILER_COUNTER_TEXTURE_UPLOADS: number of images uploaded to
+ *   textures by the texture cache
+ * @ST_PROFILER_COUNTER_PRERENDERS: number of theme node backgrounds and
+ *   shadows rendered offscreen
+ * @ST_PROFILER_N_COUNTERS: number of counters
+ *
+ * Counters maintained by St for profiling purposes. The counters are
+ * cumulative; callers interested in a rate (such as per-frame counts)
+ * should compute differences between two reads.
+ */
+typedef enum {
+  ST_PROFILER_COUNTER_STYLE_CHANGES,
+  ST_PROFILER_COUNTER_TEXTURE_UPLOADS,
+  ST_PROFILER_COUNTER_PRERENDERS,
+
+  ST_PROFILER_N_COUNTERS /*< skip >*/
+} StProfilerCounter;
+
+guint st_profiler_get_counter (StProfilerCounter counter);
+
+void      st_profiler_set_paint_profiling (gboolean enabled);
+gboolean  st_profiler_get_paint_profiling (void);
+void      st_profiler_reset_paint_profile (void);
+
+GVariant *st_profiler_get_paint_profile   (void);
+GList    *st_profiler_get_profiled_actors (void);
+gint64    st_profiler_get_actor_paint_time (ClutterActor *actor);
+
+/**
+ * StMemoryReportFunc:
+ * @n_objects: (out): return location for the number of objects
+ * @n_bytes: (out): return location for the number of bytes
+ * @user_data: the data passed to st_profiler_add_memory_reporter()
+ *
+ * Reports how much memory a subsystem currently uses.
+ */
+typedef void (* StMemoryReportFunc) (guint    *n_objects,
+                                     guint64  *n_bytes,
+                                     gpointer  user_data);
+
+void      st_profiler_add_memory_reporter (const char         *subsystem,
+                                           StMemoryReportFunc  func,
+                                           gpointer            user_data);
+GVariant *st_profiler_get_memory_usage    (void);
+
+G_END_DECLS
+
+#endif /* __ST_PROFILER_H__ */
@@ -280,6 +280,9 @@ st_scroll_view_paint (ClutterActor        *actor,
                       ClutterPaintContext *paint_context)
 {
   StScrollViewPrivate *priv = ST_SCROLL_VIEW (actor)->priv;
+  StPaintTiming timing;
+
+  _st_paint_timing_begin (&timing);
 
   st_widget_paint_background (ST_WIDGET (actor), paint_context);
 
@@ -289,6 +292,8 @@ st_scroll_view_paint (ClutterActor        *actor,
     clutter_actor_paint (priv->hscroll, paint_context);
   if (priv->vscrollbar_visible)
     clutter_actor_paint (priv->vscroll, paint_context);
+
+  _st_paint_timing_end (ST_WIDGET (actor), &timing);
 }
 
 static void
@@ -160,6 +160,50 @@ on_gtk_icon_theme_changed (GtkIconTheme   *icon_theme,
   g_signal_emit (self, signals[ICON_THEME_CHANGED], 0);
 }
 
+static void
+report_memory (guint    *n_objects,
+               guint64  *n_bytes,
+               gpointer  user_data)
+{
+  StTextureCache *self = user_data;
+  GHashTableIter iter;
+  gpointer value;
+
+  *n_objects = 0;
+  *n_bytes = 0;
+
+  if (self->priv->keyed_cache == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, self->priv->keyed_cache);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      CoglTexture *texture = NULL;
+
+      /* Besides images, st_texture_cache_load() stores plain textures */
+      if (cogl_is_texture (value))
+        texture = value;
+      else if (CLUTTER_IS_IMAGE (value))
+        texture = clutter_image_get_texture (value);
+
+      if (texture != NULL)
+        *n_bytes += (guint64) cogl_texture_get_width (texture) *
+                    cogl_texture_get_height (texture) * 4;
+      (*n_objects)++;
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->keyed_surface_cache);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      cairo_surface_t *surface = value;
+
+      if (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE)
+        *n_bytes += (guint64) cairo_image_surface_get_stride (surface) *
+                    cairo_image_surface_get_height (surface);
+      (*n_objects)++;
+    }
+}
+
 static void
 st_texture_cache_init (StTextureCache *self)
 {
@@ -190,6 +234,9 @@ st_texture_cache_init (StTextureCache *self)
                                                      g_object_unref, g_object_unref);
 
   on_icon_theme_changed (settings, NULL, self);
+
+  /* The cache is a singleton that is never freed */
+  st_profiler_add_memory_reporter ("textureCache", report_memory, self);
 }
 
 static void
@@ -536,6 +583,8 @@ pixbuf_to_st_content_image (GdkPixbuf *pixbuf,
       height *= paint_scale;
     }
 
+  _st_profiler_count (ST_PROFILER_COUNTER_TEXTURE_UPLOADS);
+
   image = st_image_content_new_with_preferred_size (width, height);
   clutter_image_set_data (CLUTTER_IMAGE (image),
                           gdk_pixbuf_get_pixels (pixbuf),
@@ -741,6 +790,8 @@ st_texture_cache_reset_texture (StTextureCachePropertyBind *bind,
       else
         g_object_ref (image);
 
+      _st_profiler_count (ST_PROFILER_COUNTER_TEXTURE_UPLOADS);
+
       clutter_image_set_data (CLUTTER_IMAGE (image),
                               cairo_image_surface_get_data (surface),
                               cairo_image_surface_get_format (surface) == CAIRO_FORMAT_ARGB32 ?
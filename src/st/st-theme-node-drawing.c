@@ -1034,6 +1034,8 @@ st_theme_node_prerender_background (StThemeNode *node,
   int texture_width;
   int texture_height;
 
+  _st_profiler_count (ST_PROFILER_COUNTER_PRERENDERS);
+
   border_image = st_theme_node_get_border_image (node);
 
   shadow_spec = st_theme_node_get_background_image_shadow (node);
@@ -1347,6 +1349,9 @@ st_theme_node_prerender_background (StThemeNode *node,
       g_error_free (error);
     }
 
+  if (texture != NULL)
+    _st_profiler_account_texture (texture, ST_TEXTURE_ACCOUNT_PAINT_STATES, 4);
+
   cairo_destroy (cr);
   cairo_surface_destroy (surface);
   g_free (data);
@@ -2292,6 +2297,8 @@ st_theme_node_prerender_shadow (StThemeNodePaintState *state)
 
   ctx = clutter_backend_get_cogl_context (clutter_get_default_backend ());
 
+  _st_profiler_count (ST_PROFILER_COUNTER_PRERENDERS);
+
   /* Render offscreen */
   fb_width = ceilf (state->box_shadow_width * state->resource_scale);
   fb_height = ceilf (state->box_shadow_height * state->resource_scale);
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "st-profiler.h"
 #include "st-settings.h"
 #include "st-theme-private.h"
 #include "st-theme-context.h"
@@ -42,9 +43,25 @@ static const ClutterColor DEFAULT_ERROR_COLOR = { 0xcc, 0x00, 0x00, 0xff };
 
 G_DEFINE_TYPE (StThemeNode, st_theme_node, G_TYPE_OBJECT)
 
+/* For memory accounting */
+static guint n_theme_nodes = 0;
+
+static void
+report_theme_node_memory (guint    *n_objects,
+                          guint64  *n_bytes,
+                          gpointer  user_data)
+{
+  /* Only the nodes themselves; their strings and cached properties
+   * are small in comparison */
+  *n_objects = n_theme_nodes;
+  *n_bytes = (guint64) n_theme_nodes * sizeof (StThemeNode);
+}
+
 static void
 st_theme_node_init (StThemeNode *node)
 {
+  n_theme_nodes++;
+
   node->transition_duration = -1;
 
   st_theme_node_paint_state_init (&node->cached_state);
@@ -57,6 +74,8 @@ st_theme_node_class_init (StThemeNodeClass *klass)
 
   object_class->dispose = st_theme_node_dispose;
   object_class->finalize = st_theme_node_finalize;
+
+  st_profiler_add_memory_reporter ("themeNodes", report_theme_node_memory, NULL);
 }
 
 static void
@@ -141,6 +160,8 @@ st_theme_node_finalize (GObject *object)
   cogl_clear_object (&node->border_slices_pipeline);
   cogl_clear_object (&node->color_pipeline);
 
+  n_theme_nodes--;
+
   G_OBJECT_CLASS (st_theme_node_parent_class)->finalize (object);
 }
 
@@ -360,6 +360,9 @@ st_viewport_paint (ClutterActor        *actor,
   ClutterActorBox content_box;
   ClutterActor *child;
   CoglFramebuffer *fb = clutter_paint_context_get_framebuffer (paint_context);
+  StPaintTiming timing;
+
+  _st_paint_timing_begin (&timing);
 
   get_border_paint_offsets (viewport, &x, &y);
   if (x != 0 || y != 0)
@@ -374,7 +377,7 @@ st_viewport_paint (ClutterActor        *actor,
     cogl_framebuffer_pop_matrix (fb);
 
   if (clutter_actor_get_n_children (actor) == 0)
-    return;
+    goto out;
 
   clutter_actor_get_allocation_box (actor, &allocation_box);
   st_theme_node_get_content_box (theme_node, &allocation_box, &content_box);
@@ -403,6 +406,9 @@ st_viewport_paint (ClutterActor        *actor,
 
   if (priv->hadjustment || priv->vadjustment)
     cogl_framebuffer_pop_clip (fb);
+
+out:
+  _st_paint_timing_end (ST_WIDGET (actor), &timing);
 }
 
 static void
@@ -306,6 +306,8 @@ st_widget_dispose (GObject *gobject)
 
   st_widget_remove_transition (actor);
 
+  _st_profiler_forget_widget (actor);
+
   g_clear_pointer (&priv->label_actor, g_object_unref);
 
   g_clear_signal_handler (&priv->texture_file_changed_id,
@@ -412,6 +414,7 @@ st_widget_paint_background (StWidget            *widget,
   ClutterActorBox allocation;
   float resource_scale;
   guint8 opacity;
+  gint64 node_start_time = 0;
 
   if (!st_widget_get_resource_scale (widget, &resource_scale))
     return;
@@ -423,6 +426,9 @@ st_widget_paint_background (StWidget            *widget,
 
   opacity = clutter_actor_get_paint_opacity (CLUTTER_ACTOR (widget));
 
+  if (G_UNLIKELY (_st_profiler_paint_profiling))
+    node_start_time = g_get_monotonic_time ();
+
   if (priv->transition_animation)
     st_theme_node_transition_paint (priv->transition_animation,
                                     framebuffer,
@@ -436,16 +442,26 @@ st_widget_paint_background (StWidget            *widget,
                          &allocation,
                          opacity,
                          resource_scale);
+
+  if (node_start_time != 0)
+    _st_profiler_add_node_time (widget,
+                                g_get_monotonic_time () - node_start_time);
 }
 
 static void
 st_widget_paint (ClutterActor        *actor,
                  ClutterPaintContext *paint_context)
 {
+  StPaintTiming timing;
+
+  _st_paint_timing_begin (&timing);
+
   st_widget_paint_background (ST_WIDGET (actor), paint_context);
 
   /* Chain up so we paint children. */
   CLUTTER_ACTOR_CLASS (st_widget_parent_class)->paint (actor, paint_context);
+
+  _st_paint_timing_end (ST_WIDGET (actor), &timing);
 }
 
 static void
@@ -1691,6 +1707,8 @@ st_widget_recompute_style (StWidget    *widget,
       return;
     }
 
+  _st_profiler_count (ST_PROFILER_COUNTER_STYLE_CHANGES);
+
   _st_theme_node_apply_margins (new_theme_node, CLUTTER_ACTOR (widget));
 
   if (old_theme_node)
@@ -0,0 +1,145 @@
+// -*- mode: js; js-indent-level: 4; indent-tabs-mode: nil -*-
+
+// Test cases for the statistics D-Bus service, run against a private bus
+
+const JsUnit = imports.jsUnit;
+const { Gio, GLib, Shell } = imports.gi;
+
+const StatisticsDBus = imports.ui.statisticsDBus;
+const { loadInterfaceXML } = imports.misc.fileUtils;
+
+const StatisticsProxy = Gio.DBusProxy.makeProxyWrapper(loadInterfaceXML('org.gnome.Shell.Statistics'));
+
+const TIMEOUT = 10; // seconds
+
+let testBus = new Gio.TestDBus({ flags: Gio.TestDBusFlags.NONE });
+testBus.up();
+
+function connect() {
+    return Gio.DBusConnection.new_for_address_sync(testBus.get_bus_address(),
+        Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+        Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+        null, null);
+}
+
+// The service and the client live in the same main loop, so they
+// need separate connections and the client must only use async calls
+let serviceConnection = connect();
+let clientConnection = connect();
+
+let perfLog = Shell.PerfLog.get_default();
+perfLog.define_statistic('test.counter', 'Counter for testing', 'i');
+
+let collections = 0;
+perfLog.add_statistics_callback(() => {
+    collections++;
+    perfLog.update_statistic_i('test.counter', collections);
+});
+
+// Only update on request, so serial numbers are predictable
+let service = new StatisticsDBus.StatisticsService(serviceConnection, 0);
+
+let loop = new GLib.MainLoop(null, false);
+let failure = null;
+let signalSerials = [];
+
+function step(func) {
+    return (...args) => {
+        try {
+            func(...args);
+        } catch (e) {
+            failure = e;
+            loop.quit();
+        }
+    };
+}
+
+function checkSnapshot([serial, timestamp, statistics], expectedSerial) {
+    JsUnit.assertEquals(expectedSerial, serial);
+    JsUnit.assertTrue(timestamp > 0);
+    JsUnit.assertTrue('test.counter' in statistics);
+    JsUnit.assertEquals(collections, statistics['test.counter'].unpack());
+}
+
+function testUpdateInterval(proxy) {
+    proxy.connect('g-properties-changed', step(() => {
+        // Raised to the minimum
+        JsUnit.assertEquals(StatisticsDBus.MIN_UPDATE_INTERVAL, proxy.UpdateInterval);
+
+        loop.quit();
+    }));
+
+    proxy.SetUpdateIntervalRemote(1, step((result, error) => {
+        if (error)
+            throw error;
+    }));
+}
+
+function testDescriptions(proxy) {
+    proxy.GetDescriptionsRemote(step(([descriptions], error) => {
+        if (error)
+            throw error;
+
+        JsUnit.assertEquals('Counter for testing', descriptions['test.counter']);
+
+        // The round trip guarantees the signal has been dispatched
+        JsUnit.assertEquals(1, signalSerials.length);
+        JsUnit.assertEquals(2, signalSerials[0]);
+
+        testUpdateInterval(proxy);
+    }));
+}
+
+function testRefresh(proxy) {
+    proxy.GetSnapshotRemote(true, step((result, error) => {
+        if (error)
+            throw error;
+
+        checkSnapshot(result, 2);
+        testDescriptions(proxy);
+    }));
+}
+
+function testCachedSnapshot(proxy) {
+    proxy.GetSnapshotRemote(false, step((result, error) => {
+        if (error)
+            throw error;
+
+        // Taken when the service was created
+        checkSnapshot(result, 1);
+        testRefresh(proxy);
+    }));
+}
+
+let proxy = new StatisticsProxy(clientConnection,
+                                serviceConnection.get_unique_name(),
+                                '/org/gnome/Shell/Statistics',
+                                step((p, error) => {
+                                    if (error)
+                                        throw error;
+
+                                    JsUnit.assertEquals(StatisticsDBus.SNAPSHOT_VERSION,
+                                                        p.Version);
+                                    JsUnit.assertEquals(0, p.UpdateInterval);
+
+                                    testCachedSnapshot(p);
+                                }));
+proxy.connectSignal('SnapshotUpdated', (p, sender, [serial]) => {
+    signalSerials.push(serial);
+});
+
+GLib.timeout_add_seconds(GLib.PRIORITY_DEFAULT, TIMEOUT, () => {
+    failure = new Error('Timed out waiting for the statistics service');
+    loop.quit();
+    return GLib.SOURCE_REMOVE;
+});
+
+loop.run();
+
+service.destroy();
+clientConnection.close_sync(null);
+serviceConnection.close_sync(null);
+testBus.down();
+
+if (failure)
+    throw failure;